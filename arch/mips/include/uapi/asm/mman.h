@@ -84,6 +84,8 @@
 					   overrides the coredump filter bits */
 #define MADV_DODUMP	17		/* Clear the MADV_NODUMP flag */
 
+#define MADV_COLLAPSE	25		/* Collapse into hugepages soon */
+
 /* compatibility flags */
 #define MAP_FILE	0
 
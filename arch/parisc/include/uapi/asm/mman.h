@@ -65,6 +65,7 @@
 #define MADV_DONTDUMP   69		/* Explicity exclude from the core dump,
 					   overrides the coredump filter bits */
 #define MADV_DODUMP	70		/* Clear the MADV_NODUMP flag */
+#define MADV_COLLAPSE	71		/* Collapse into hugepages soon */
 
 /* compatibility flags */
 #define MAP_FILE	0
@@ -1155,6 +1155,19 @@ __do_page_fault(struct pt_regs *regs, unsigned long error_code,
 	if (error_code & PF_WRITE)
 		flags |= FAULT_FLAG_WRITE;
 
+	/*
+	 * Try to fill a user space pte without taking mmap_sem first; if
+	 * that cannot be done safely, fall back to the locked path below,
+	 * which also takes care of any error.
+	 */
+	if ((error_code & (PF_USER | PF_PROT)) == PF_USER) {
+		fault = handle_speculative_fault(mm, address, flags);
+		if (fault != VM_FAULT_RETRY) {
+			major |= fault & VM_FAULT_MAJOR;
+			goto done;
+		}
+	}
+
 	/*
 	 * When running in the kernel we expect faults to occur only to
 	 * addresses in user space.  All other faults represent errors in
@@ -1264,6 +1277,7 @@ good_area:
 		return;
 	}
 
+done:
 	/*
 	 * Major/minor page fault accounting. If any of the events
 	 * returned VM_FAULT_MAJOR, we account it as a major fault.
@@ -21,6 +21,7 @@
 #include <linux/sched/sysctl.h>
 #include <linux/delay.h>
 #include <linux/crash_dump.h>
+#include <linux/hrtimer.h>
 
 #include <trace/events/block.h>
 
@@ -193,6 +194,7 @@ static void blk_mq_rq_ctx_init(struct request_queue *q, struct blk_mq_ctx *ctx,
 	rq->rq_disk = NULL;
 	rq->part = NULL;
 	rq->start_time = jiffies;
+	rq->issue_time_ns = 0;
 #ifdef CONFIG_BLK_CGROUP
 	rq->rl = NULL;
 	set_start_time_ns(rq);
@@ -320,10 +322,28 @@ void blk_mq_free_request(struct request *rq)
 }
 EXPORT_SYMBOL_GPL(blk_mq_free_request);
 
+/*
+ * Keep a running average of how long polled requests take, for the hybrid
+ * polling sleep.  Unlocked: a lost update only skews the average a bit.
+ */
+static void blk_mq_poll_stats_add(struct request *rq)
+{
+	struct request_queue *q = rq->q;
+	u64 sample = ktime_get_ns() - rq->issue_time_ns;
+	u64 mean = READ_ONCE(q->poll_mean_ns);
+
+	if (mean)
+		sample = (mean * 7 + sample) >> 3;
+	WRITE_ONCE(q->poll_mean_ns, sample);
+}
+
 inline void __blk_mq_end_request(struct request *rq, int error)
 {
 	blk_account_io_done(rq);
 
+	if ((rq->cmd_flags & REQ_HIPRI) && rq->issue_time_ns)
+		blk_mq_poll_stats_add(rq);
+
 	if (rq->end_io) {
 		rq->end_io(rq, error);
 	} else {
@@ -416,6 +436,9 @@ void blk_mq_start_request(struct request *rq)
 
 	trace_block_rq_issue(q, rq);
 
+	if (rq->cmd_flags & REQ_HIPRI)
+		rq->issue_time_ns = ktime_get_ns();
+
 	rq->resid_len = blk_rq_bytes(rq);
 	if (unlikely(blk_bidi_rq(rq)))
 		rq->next_rq->resid_len = blk_rq_bytes(rq->next_rq);
@@ -450,6 +473,97 @@ void blk_mq_start_request(struct request *rq)
 }
 EXPORT_SYMBOL(blk_mq_start_request);
 
+/*
+ * Hybrid polling: rather than burning the CPU for the whole time the device
+ * takes, sleep for part of it first and only spin for the tail.  The sleep
+ * ends @delay nsecs after @issue_ns, so once it has been slept through
+ * further calls for the same I/O go straight to polling.
+ */
+static bool blk_mq_poll_hybrid_sleep(struct request_queue *q, u64 issue_ns)
+{
+	struct hrtimer_sleeper hs;
+	u64 delay, now;
+
+	if (q->poll_nsec == -1 || !issue_ns)
+		return false;
+	if (q->poll_nsec > 0)
+		delay = q->poll_nsec;
+	else
+		delay = READ_ONCE(q->poll_mean_ns) / 2;
+
+	now = ktime_get_ns();
+	if (now - issue_ns >= delay)
+		return false;
+
+	hrtimer_init_on_stack(&hs.timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	hrtimer_set_expires(&hs.timer, ns_to_ktime(delay - (now - issue_ns)));
+	hrtimer_init_sleeper(&hs, current);
+
+	/*
+	 * The caller has set its task state before checking for completion,
+	 * so a completion that raced with us has already made it runnable.
+	 */
+	hrtimer_start_expires(&hs.timer, HRTIMER_MODE_REL);
+	if (hs.task && current->state != TASK_RUNNING)
+		io_schedule();
+	hrtimer_cancel(&hs.timer);
+	destroy_hrtimer_on_stack(&hs.timer);
+
+	__set_current_state(TASK_RUNNING);
+	return true;
+}
+
+/**
+ * blk_poll - poll a queue for completions instead of waiting for the IRQ
+ * @q:		the queue the I/O was submitted to
+ * @issue_ns:	ktime_get_ns() at submission for a hybrid sleep, or 0
+ *
+ * Description:
+ *	Meant for callers that have set their task state and would otherwise
+ *	io_schedule() until a completion wakes them.  Spins on the ->poll()
+ *	hook of the hardware queue this CPU submits to until a completion is
+ *	found, the task is woken or a signal or reschedule is pending.
+ *	Returns true if the caller should recheck for completion, false if
+ *	the queue cannot be polled and the caller should sleep as usual.
+ **/
+bool blk_poll(struct request_queue *q, u64 issue_ns)
+{
+	struct blk_mq_hw_ctx *hctx;
+	long state;
+
+	if (!q->mq_ops || !q->mq_ops->poll || !blk_queue_poll(q))
+		return false;
+
+	if (blk_mq_poll_hybrid_sleep(q, issue_ns))
+		return true;
+
+	hctx = q->mq_ops->map_queue(q, raw_smp_processor_id());
+	hctx->poll_invoked++;
+
+	state = current->state;
+	while (!need_resched()) {
+		int ret = q->mq_ops->poll(hctx);
+
+		if (ret > 0) {
+			hctx->poll_success++;
+			set_current_state(TASK_RUNNING);
+			return true;
+		}
+
+		if (signal_pending_state(state, current))
+			set_current_state(TASK_RUNNING);
+
+		if (current->state == TASK_RUNNING)
+			return true;
+		if (ret < 0)
+			break;
+		cpu_relax();
+	}
+
+	return false;
+}
+EXPORT_SYMBOL_GPL(blk_poll);
+
 static void __blk_mq_requeue_request(struct request *rq)
 {
 	struct request_queue *q = rq->q;
@@ -2013,6 +2127,10 @@ struct request_queue *blk_mq_init_allocated_queue(struct blk_mq_tag_set *set,
 	if (!(set->flags & BLK_MQ_F_SG_MERGE))
 		q->queue_flags |= 1 << QUEUE_FLAG_NO_SG_MERGE;
 
+	if (set->ops->poll)
+		q->queue_flags |= 1 << QUEUE_FLAG_POLL;
+	q->poll_nsec = -1;
+
 	q->sg_reserved_size = INT_MAX;
 
 	INIT_WORK(&q->requeue_work, blk_mq_requeue_work);
@@ -17,6 +17,7 @@ struct nullb_cmd {
 	struct bio *bio;
 	unsigned int tag;
 	struct nullb_queue *nq;
+	ktime_t deadline;
 };
 
 struct nullb_queue {
@@ -265,6 +266,7 @@ static void null_cmd_end_timer(struct nullb_cmd *cmd)
 	struct completion_queue *cq = &per_cpu(completion_queues, get_cpu());
 
 	cmd->ll_list.next = NULL;
+	cmd->deadline = ktime_add_ns(ktime_get(), completion_nsec);
 	if (llist_add(&cmd->ll_list, &cq->list)) {
 		ktime_t kt = ktime_set(0, completion_nsec);
 
@@ -399,11 +401,54 @@ static int null_init_hctx(struct blk_mq_hw_ctx *hctx, void *data,
 	return 0;
 }
 
+/*
+ * Complete the commands on this CPU's timer list whose completion time has
+ * come, without waiting for the timer.  The timer stays armed for whatever
+ * is put back.  Its callback only drains the list of the CPU it runs on,
+ * in hard interrupt context, so it cannot run under us with interrupts
+ * disabled here, whichever CPU the timer ends up on.
+ */
+static int null_poll(struct blk_mq_hw_ctx *hctx)
+{
+	struct completion_queue *cq;
+	struct llist_node *entry;
+	struct nullb_cmd *cmd;
+	unsigned long flags;
+	ktime_t now;
+	int found = 0;
+
+	if (irqmode != NULL_IRQ_TIMER)
+		return 0;
+
+	local_irq_save(flags);
+	cq = this_cpu_ptr(&completion_queues);
+	entry = llist_del_all(&cq->list);
+	if (entry) {
+		now = ktime_get();
+		entry = llist_reverse_order(entry);
+		do {
+			cmd = container_of(entry, struct nullb_cmd, ll_list);
+			entry = entry->next;
+			if (ktime_compare(cmd->deadline, now) <= 0) {
+				end_cmd(cmd);
+				found++;
+			} else {
+				cmd->ll_list.next = NULL;
+				llist_add(&cmd->ll_list, &cq->list);
+			}
+		} while (entry);
+	}
+	local_irq_restore(flags);
+
+	return found;
+}
+
 static struct blk_mq_ops null_mq_ops = {
 	.queue_rq       = null_queue_rq,
 	.map_queue      = blk_mq_map_queue,
 	.init_hctx	= null_init_hctx,
 	.complete	= null_softirq_done_fn,
+	.poll		= null_poll,
 };
 
 static void null_del_dev(struct nullb *nullb)
@@ -994,6 +994,26 @@ static irqreturn_t nvme_irq(int irq, void *data)
 	return result;
 }
 
+/*
+ * Reap completions for blk_poll().  cqe_seen is left set so that the
+ * interrupt which raced with us is not reported as spurious.
+ */
+static int nvme_poll(struct blk_mq_hw_ctx *hctx)
+{
+	struct nvme_queue *nvmeq = hctx->driver_data;
+	struct nvme_completion cqe = nvmeq->cqes[nvmeq->cq_head];
+	int found;
+
+	if ((le16_to_cpu(cqe.status) & 1) != nvmeq->cq_phase)
+		return 0;
+
+	spin_lock_irq(&nvmeq->q_lock);
+	found = nvme_process_cq(nvmeq);
+	spin_unlock_irq(&nvmeq->q_lock);
+
+	return found;
+}
+
 static irqreturn_t nvme_irq_check(int irq, void *data)
 {
 	struct nvme_queue *nvmeq = data;
@@ -1630,6 +1650,7 @@ static struct blk_mq_ops nvme_mq_ops = {
 	.init_hctx	= nvme_init_hctx,
 	.init_request	= nvme_init_request,
 	.timeout	= nvme_timeout,
+	.poll		= nvme_poll,
 };
 
 static void nvme_dev_remove_admin(struct nvme_dev *dev)
@@ -0,0 +1,143 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ */
+
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/zlib.h>
+
+#include "zcomp_deflate.h"
+
+/*
+ * Raw deflate (no zlib header) with a window just large enough for one
+ * page, which keeps the workspace of each stream reasonably small.
+ */
+#define DEFLATE_LEVEL		Z_DEFAULT_COMPRESSION
+#define DEFLATE_WINBITS		(PAGE_SHIFT > 15 ? 15 : PAGE_SHIFT)
+#define DEFLATE_MEMLEVEL	8
+
+struct deflate_ctx {
+	struct z_stream_s comp;
+	struct z_stream_s decomp;
+};
+
+static void deflate_destroy(void *private)
+{
+	struct deflate_ctx *ctx = private;
+
+	if (ctx->comp.workspace) {
+		zlib_deflateEnd(&ctx->comp);
+		vfree(ctx->comp.workspace);
+	}
+	if (ctx->decomp.workspace) {
+		zlib_inflateEnd(&ctx->decomp);
+		vfree(ctx->decomp.workspace);
+	}
+	kfree(ctx);
+}
+
+static void *deflate_create(void)
+{
+	struct deflate_ctx *ctx;
+
+	ctx = kzalloc(sizeof(*ctx), GFP_KERNEL);
+	if (!ctx)
+		return NULL;
+
+	ctx->comp.workspace = vzalloc(zlib_deflate_workspacesize(
+				-DEFLATE_WINBITS, DEFLATE_MEMLEVEL));
+	if (!ctx->comp.workspace)
+		goto fail;
+	if (zlib_deflateInit2(&ctx->comp, DEFLATE_LEVEL, Z_DEFLATED,
+			-DEFLATE_WINBITS, DEFLATE_MEMLEVEL,
+			Z_DEFAULT_STRATEGY) != Z_OK) {
+		vfree(ctx->comp.workspace);
+		ctx->comp.workspace = NULL;
+		goto fail;
+	}
+
+	ctx->decomp.workspace = vzalloc(zlib_inflate_workspacesize());
+	if (!ctx->decomp.workspace)
+		goto fail;
+	if (zlib_inflateInit2(&ctx->decomp, -DEFLATE_WINBITS) != Z_OK) {
+		vfree(ctx->decomp.workspace);
+		ctx->decomp.workspace = NULL;
+		goto fail;
+	}
+	return ctx;
+
+fail:
+	deflate_destroy(ctx);
+	return NULL;
+}
+
+static int deflate_compress(const unsigned char *src, unsigned char *dst,
+		size_t *dst_len, void *private)
+{
+	struct deflate_ctx *ctx = private;
+	struct z_stream_s *stream = &ctx->comp;
+	int ret;
+
+	ret = zlib_deflateReset(stream);
+	if (ret != Z_OK)
+		return -EINVAL;
+
+	stream->next_in = src;
+	stream->avail_in = PAGE_SIZE;
+	stream->next_out = dst;
+	/* zcomp_strm buffer is 2 pages long */
+	stream->avail_out = 2 * PAGE_SIZE;
+
+	ret = zlib_deflate(stream, Z_FINISH);
+	if (ret != Z_STREAM_END)
+		return -EINVAL;
+
+	*dst_len = stream->total_out;
+	return 0;
+}
+
+static int deflate_decompress(const unsigned char *src, size_t src_len,
+		unsigned char *dst, void *private)
+{
+	struct deflate_ctx *ctx = private;
+	struct z_stream_s *stream = &ctx->decomp;
+	int ret;
+
+	ret = zlib_inflateReset(stream);
+	if (ret != Z_OK)
+		return -EINVAL;
+
+	stream->next_in = src;
+	stream->avail_in = src_len;
+	stream->next_out = dst;
+	stream->avail_out = PAGE_SIZE;
+
+	ret = zlib_inflate(stream, Z_SYNC_FLUSH);
+	/*
+	 * Raw inflate may want to look at one byte past the end of the
+	 * input before it reports the end of the stream.
+	 */
+	if (ret == Z_OK && !stream->avail_in && stream->avail_out) {
+		u8 zerostuff = 0;
+
+		stream->next_in = &zerostuff;
+		stream->avail_in = 1;
+		ret = zlib_inflate(stream, Z_FINISH);
+	}
+	if (ret != Z_STREAM_END || stream->total_out != PAGE_SIZE)
+		return -EINVAL;
+
+	return 0;
+}
+
+struct zcomp_backend zcomp_deflate = {
+	.compress = deflate_compress,
+	.decompress = deflate_decompress,
+	.create = deflate_create,
+	.destroy = deflate_destroy,
+	.name = "deflate",
+};
@@ -0,0 +1,215 @@
+/*
+ * Deduplication of identical compressed pages in zram
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ */
+
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/jhash.h>
+
+#include "zram_drv.h"
+
+/* One bucket per this many pages of the disk, within the bounds below */
+#define ZRAM_HASH_SHIFT		10
+#define ZRAM_HASH_SIZE_MIN	(1 << 4)
+#define ZRAM_HASH_SIZE_MAX	(1 << 16)
+
+u32 zram_dedup_checksum(const unsigned char *mem, unsigned int len)
+{
+	return jhash(mem, len, 0);
+}
+
+static struct zram_hash *zram_dedup_bucket(struct zram_meta *meta,
+		u32 checksum)
+{
+	return &meta->hash[checksum % meta->hash_size];
+}
+
+/* Leftmost object of the bucket with the checksum, or NULL */
+static struct zram_dedup_entry *zram_dedup_first(struct zram_hash *hash,
+		u32 checksum)
+{
+	struct rb_node *rb_node = hash->rb_root.rb_node;
+	struct zram_dedup_entry *entry, *first = NULL;
+
+	while (rb_node) {
+		entry = rb_entry(rb_node, struct zram_dedup_entry, rb_node);
+		if (checksum < entry->checksum) {
+			rb_node = rb_node->rb_left;
+		} else if (checksum > entry->checksum) {
+			rb_node = rb_node->rb_right;
+		} else {
+			first = entry;
+			rb_node = rb_node->rb_left;
+		}
+	}
+	return first;
+}
+
+static bool zram_dedup_match(struct zram *zram, struct zram_dedup_entry *entry,
+		const unsigned char *mem, unsigned int len)
+{
+	struct zs_pool *pool = zram->meta->mem_pool;
+	unsigned char *cmem;
+	bool match;
+
+	if (entry->len != len)
+		return false;
+
+	cmem = zs_map_object(pool, entry->handle, ZS_MM_RO);
+	match = !memcmp(cmem, mem, len);
+	zs_unmap_object(pool, entry->handle);
+	return match;
+}
+
+/*
+ * Look for an object with the same compressed data as mem, and take a
+ * reference on it if there is one.
+ */
+struct zram_dedup_entry *zram_dedup_find(struct zram *zram,
+		const unsigned char *mem, unsigned int len, u32 checksum)
+{
+	struct zram_hash *hash = zram_dedup_bucket(zram->meta, checksum);
+	struct zram_dedup_entry *entry;
+	struct rb_node *rb_node;
+
+	spin_lock(&hash->lock);
+	entry = zram_dedup_first(hash, checksum);
+	while (entry) {
+		if (zram_dedup_match(zram, entry, mem, len)) {
+			entry->refcount++;
+			spin_unlock(&hash->lock);
+			return entry;
+		}
+
+		rb_node = rb_next(&entry->rb_node);
+		if (!rb_node)
+			break;
+		entry = rb_entry(rb_node, struct zram_dedup_entry, rb_node);
+		if (entry->checksum != checksum)
+			break;
+	}
+	spin_unlock(&hash->lock);
+
+	return NULL;
+}
+
+/*
+ * Make the object at handle available to later pages with the same
+ * data, with a reference for the page it was allocated for.  Returns
+ * NULL if that cannot be done: the page just keeps the handle then.
+ */
+struct zram_dedup_entry *zram_dedup_insert(struct zram *zram,
+		unsigned long handle, unsigned int len, u32 checksum)
+{
+	struct zram_hash *hash = zram_dedup_bucket(zram->meta, checksum);
+	struct zram_dedup_entry *entry, *parent;
+	struct rb_node **rb_node, *rb_parent = NULL;
+
+	entry = kmalloc(sizeof(*entry), GFP_NOIO | __GFP_NOWARN);
+	if (!entry)
+		return NULL;
+
+	entry->checksum = checksum;
+	entry->len = len;
+	entry->refcount = 1;
+	entry->handle = handle;
+
+	spin_lock(&hash->lock);
+	rb_node = &hash->rb_root.rb_node;
+	while (*rb_node) {
+		rb_parent = *rb_node;
+		parent = rb_entry(rb_parent, struct zram_dedup_entry, rb_node);
+		if (checksum < parent->checksum)
+			rb_node = &rb_parent->rb_left;
+		else
+			rb_node = &rb_parent->rb_right;
+	}
+	rb_link_node(&entry->rb_node, rb_parent, rb_node);
+	rb_insert_color(&entry->rb_node, &hash->rb_root);
+	spin_unlock(&hash->lock);
+
+	return entry;
+}
+
+/*
+ * Drop the reference of a page on the object, freeing it with the last
+ * one.  Only the last page still accounts for the compressed size, the
+ * others for the size saved by deduplication.
+ */
+void zram_dedup_put(struct zram *zram, struct zram_dedup_entry *entry)
+{
+	struct zram_hash *hash = zram_dedup_bucket(zram->meta, entry->checksum);
+	unsigned long refcount;
+
+	spin_lock(&hash->lock);
+	refcount = --entry->refcount;
+	if (!refcount)
+		rb_erase(&entry->rb_node, &hash->rb_root);
+	spin_unlock(&hash->lock);
+
+	if (refcount) {
+		atomic64_sub(entry->len, &zram->stats.dup_data_size);
+		return;
+	}
+
+	atomic64_sub(entry->len, &zram->stats.compr_data_size);
+	zs_free(zram->meta->mem_pool, entry->handle);
+	kfree(entry);
+}
+
+int zram_dedup_init(struct zram *zram, struct zram_meta *meta,
+		size_t num_pages)
+{
+	size_t i;
+
+	meta->hash = NULL;
+	meta->hash_size = 0;
+	if (!zram->use_dedup)
+		return 0;
+
+	meta->hash_size = clamp_t(size_t, num_pages >> ZRAM_HASH_SHIFT,
+				  ZRAM_HASH_SIZE_MIN, ZRAM_HASH_SIZE_MAX);
+	meta->hash = vzalloc(meta->hash_size * sizeof(struct zram_hash));
+	if (!meta->hash) {
+		pr_err("Error allocating zram entry hash\n");
+		meta->hash_size = 0;
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < meta->hash_size; i++) {
+		spin_lock_init(&meta->hash[i].lock);
+		meta->hash[i].rb_root = RB_ROOT;
+	}
+	return 0;
+}
+
+/* Free the objects still shared, before the pool goes away. */
+void zram_dedup_fini(struct zram_meta *meta)
+{
+	struct zram_dedup_entry *entry;
+	struct rb_node *rb_node;
+	size_t i;
+
+	if (!meta->hash)
+		return;
+
+	for (i = 0; i < meta->hash_size; i++) {
+		while ((rb_node = rb_first(&meta->hash[i].rb_root))) {
+			entry = rb_entry(rb_node, struct zram_dedup_entry,
+					 rb_node);
+			rb_erase(rb_node, &meta->hash[i].rb_root);
+			zs_free(meta->mem_pool, entry->handle);
+			kfree(entry);
+		}
+		cond_resched();
+	}
+
+	vfree(meta->hash);
+	meta->hash = NULL;
+}
@@ -0,0 +1,68 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ */
+
+#ifndef _ZRAM_DEDUP_H_
+#define _ZRAM_DEDUP_H_
+
+#include <linux/rbtree.h>
+#include <linux/spinlock.h>
+
+struct zram;
+struct zram_meta;
+
+/*
+ * A compressed object shared by all the pages that compressed to the
+ * same data.  The table entries of those pages point to it, flagged
+ * ZRAM_DEDUP, and it is freed with the last of them.
+ */
+struct zram_dedup_entry {
+	struct rb_node rb_node;
+	u32 checksum;
+	unsigned int len;
+	unsigned long refcount;	/* protected by the lock of its bucket */
+	unsigned long handle;
+};
+
+/* A bucket of the hash of compressed objects, a tree by checksum */
+struct zram_hash {
+	spinlock_t lock;
+	struct rb_root rb_root;
+};
+
+#ifdef CONFIG_ZRAM_DEDUP
+u32 zram_dedup_checksum(const unsigned char *mem, unsigned int len);
+struct zram_dedup_entry *zram_dedup_find(struct zram *zram,
+		const unsigned char *mem, unsigned int len, u32 checksum);
+struct zram_dedup_entry *zram_dedup_insert(struct zram *zram,
+		unsigned long handle, unsigned int len, u32 checksum);
+void zram_dedup_put(struct zram *zram, struct zram_dedup_entry *entry);
+
+int zram_dedup_init(struct zram *zram, struct zram_meta *meta,
+		size_t num_pages);
+void zram_dedup_fini(struct zram_meta *meta);
+#else
+static inline u32 zram_dedup_checksum(const unsigned char *mem,
+		unsigned int len) { return 0; }
+static inline struct zram_dedup_entry *zram_dedup_find(struct zram *zram,
+		const unsigned char *mem, unsigned int len, u32 checksum)
+{
+	return NULL;
+}
+static inline struct zram_dedup_entry *zram_dedup_insert(struct zram *zram,
+		unsigned long handle, unsigned int len, u32 checksum)
+{
+	return NULL;
+}
+static inline void zram_dedup_put(struct zram *zram,
+		struct zram_dedup_entry *entry) {}
+
+static inline int zram_dedup_init(struct zram *zram, struct zram_meta *meta,
+		size_t num_pages) { return 0; }
+static inline void zram_dedup_fini(struct zram_meta *meta) {}
+#endif
+
+#endif /* _ZRAM_DEDUP_H_ */
@@ -69,6 +69,15 @@ static inline bool init_done(struct zram *zram)
 	return zram->disksize;
 }
 
+static inline bool zram_dedup_enabled(struct zram_meta *meta)
+{
+#ifdef CONFIG_ZRAM_DEDUP
+	return meta->hash;
+#else
+	return false;
+#endif
+}
+
 static inline struct zram *dev_to_zram(struct device *dev)
 {
 	return (struct zram *)dev_to_disk(dev)->private_data;
@@ -157,31 +166,46 @@ static inline void update_used_max(struct zram *zram,
 	} while (old_max != cur_max);
 }
 
-static int page_zero_filled(void *ptr)
+/* Is the page filled with a single repeated word?  Returns it in element. */
+static int page_same_filled(void *ptr, unsigned long *element)
 {
 	unsigned int pos;
 	unsigned long *page;
 
 	page = (unsigned long *)ptr;
 
-	for (pos = 0; pos != PAGE_SIZE / sizeof(*page); pos++) {
-		if (page[pos])
+	for (pos = 1; pos < PAGE_SIZE / sizeof(*page); pos++) {
+		if (page[pos] != page[0])
 			return 0;
 	}
 
+	*element = page[0];
 	return 1;
 }
 
-static void handle_zero_page(struct bio_vec *bvec)
+static void zram_fill_page(void *ptr, unsigned long len,
+			   unsigned long element)
+{
+	unsigned long *page = ptr;
+	unsigned long pos;
+
+	if (!element) {
+		memset(ptr, 0, len);
+		return;
+	}
+
+	for (pos = 0; pos < len / sizeof(*page); pos++)
+		page[pos] = element;
+}
+
+static void handle_same_page(struct bio_vec *bvec, unsigned long element)
 {
 	struct page *page = bvec->bv_page;
 	void *user_mem;
 
 	user_mem = kmap_atomic(page);
-	if (is_partial_io(bvec))
-		memset(user_mem + bvec->bv_offset, 0, bvec->bv_len);
-	else
-		clear_page(user_mem);
+	/* partial I/O is sector aligned, so the words line up */
+	zram_fill_page(user_mem + bvec->bv_offset, bvec->bv_len, element);
 	kunmap_atomic(user_mem);
 
 	flush_dcache_page(page);
@@ -307,21 +331,14 @@ static ssize_t mem_used_max_store(struct device *dev,
 static ssize_t max_comp_streams_show(struct device *dev,
 		struct device_attribute *attr, char *buf)
 {
-	int val;
-	struct zram *zram = dev_to_zram(dev);
-
-	down_read(&zram->init_lock);
-	val = zram->max_comp_streams;
-	up_read(&zram->init_lock);
-
-	return scnprintf(buf, PAGE_SIZE, "%d\n", val);
+	/* every online cpu has a compression stream of its own */
+	return scnprintf(buf, PAGE_SIZE, "%d\n", num_online_cpus());
 }
 
 static ssize_t max_comp_streams_store(struct device *dev,
 		struct device_attribute *attr, const char *buf, size_t len)
 {
 	int num;
-	struct zram *zram = dev_to_zram(dev);
 	int ret;
 
 	ret = kstrtoint(buf, 0, &num);
@@ -330,20 +347,11 @@ static ssize_t max_comp_streams_store(struct device *dev,
 	if (num < 1)
 		return -EINVAL;
 
-	down_write(&zram->init_lock);
-	if (init_done(zram)) {
-		if (!zcomp_set_max_streams(zram->comp, num)) {
-			pr_info("Cannot change max compression streams\n");
-			ret = -EINVAL;
-			goto out;
-		}
-	}
-
-	zram->max_comp_streams = num;
-	ret = len;
-out:
-	up_write(&zram->init_lock);
-	return ret;
+	/*
+	 * Kept for compatibility only: the number of streams follows the
+	 * number of online cpus and cannot be limited any more.
+	 */
+	return len;
 }
 
 static ssize_t comp_algorithm_show(struct device *dev,
@@ -440,14 +448,15 @@ static ssize_t mm_stat_show(struct device *dev,
 	max_used = atomic_long_read(&zram->stats.max_used_pages);
 
 	ret = scnprintf(buf, PAGE_SIZE,
-			"%8llu %8llu %8llu %8lu %8ld %8llu %8llu\n",
+			"%8llu %8llu %8llu %8lu %8ld %8llu %8llu %8llu\n",
 			orig_size << PAGE_SHIFT,
 			(u64)atomic64_read(&zram->stats.compr_data_size),
 			mem_used << PAGE_SHIFT,
 			zram->limit_pages << PAGE_SHIFT,
 			max_used << PAGE_SHIFT,
-			(u64)atomic64_read(&zram->stats.zero_pages),
-			(u64)atomic64_read(&zram->stats.num_migrated));
+			(u64)atomic64_read(&zram->stats.same_pages),
+			(u64)atomic64_read(&zram->stats.num_migrated),
+			(u64)atomic64_read(&zram->stats.dup_data_size));
 	up_read(&zram->init_lock);
 
 	return ret;
@@ -461,9 +470,448 @@ ZRAM_ATTR_RO(failed_reads);
 ZRAM_ATTR_RO(failed_writes);
 ZRAM_ATTR_RO(invalid_io);
 ZRAM_ATTR_RO(notify_free);
-ZRAM_ATTR_RO(zero_pages);
 ZRAM_ATTR_RO(compr_data_size);
 
+/* zero filled pages are now counted with all the same filled ones */
+static ssize_t zero_pages_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	deprecated_attr_warn("zero_pages");
+	return scnprintf(buf, PAGE_SIZE, "%llu\n",
+		(u64)atomic64_read(&zram->stats.same_pages));
+}
+static DEVICE_ATTR_RO(zero_pages);
+
+static void zram_free_page(struct zram *zram, size_t index);
+static int zram_decompress_page(struct zram *zram, char *mem, u32 index,
+				unsigned long *blk_idx);
+
+#ifdef CONFIG_ZRAM_WRITEBACK
+static void reset_bdev(struct zram *zram)
+{
+	struct block_device *bdev;
+
+	if (!zram->backing_dev)
+		return;
+
+	bdev = zram->bdev;
+	filp_close(zram->backing_dev, NULL);
+	zram->backing_dev = NULL;
+	zram->bdev = NULL;
+	blkdev_put(bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL);
+
+	vfree(zram->bitmap);
+	zram->bitmap = NULL;
+	zram->nr_pages = 0;
+}
+
+static ssize_t backing_dev_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+	struct file *file;
+	ssize_t ret;
+	char *p;
+
+	down_read(&zram->init_lock);
+	file = zram->backing_dev;
+	if (!file) {
+		up_read(&zram->init_lock);
+		return scnprintf(buf, PAGE_SIZE, "none\n");
+	}
+
+	p = d_path(&file->f_path, buf, PAGE_SIZE - 1);
+	if (IS_ERR(p)) {
+		ret = PTR_ERR(p);
+		goto out;
+	}
+
+	ret = strlen(p);
+	memmove(buf, p, ret);
+	buf[ret++] = '\n';
+out:
+	up_read(&zram->init_lock);
+	return ret;
+}
+
+static ssize_t backing_dev_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	struct zram *zram = dev_to_zram(dev);
+	struct file *backing_dev = NULL;
+	struct block_device *bdev = NULL;
+	unsigned long nr_pages, *bitmap = NULL;
+	struct inode *inode;
+	char *file_name;
+	size_t sz;
+	int err;
+
+	file_name = kmalloc(PATH_MAX, GFP_KERNEL);
+	if (!file_name)
+		return -ENOMEM;
+
+	down_write(&zram->init_lock);
+	if (init_done(zram)) {
+		pr_info("Can't setup backing device for initialized device\n");
+		err = -EBUSY;
+		goto out;
+	}
+
+	strlcpy(file_name, buf, PATH_MAX);
+	/* ignore trailing newline */
+	sz = strlen(file_name);
+	if (sz > 0 && file_name[sz - 1] == '\n')
+		file_name[sz - 1] = 0x00;
+
+	backing_dev = filp_open(file_name, O_RDWR | O_LARGEFILE, 0);
+	if (IS_ERR(backing_dev)) {
+		err = PTR_ERR(backing_dev);
+		backing_dev = NULL;
+		goto out;
+	}
+
+	/* Only block devices are supported for now */
+	inode = backing_dev->f_mapping->host;
+	if (!S_ISBLK(inode->i_mode)) {
+		err = -ENOTBLK;
+		goto out;
+	}
+
+	bdev = bdgrab(I_BDEV(inode));
+	err = blkdev_get(bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL, zram);
+	if (err < 0) {
+		bdev = NULL;
+		goto out;
+	}
+
+	nr_pages = i_size_read(inode) >> PAGE_SHIFT;
+	if (nr_pages < 2) {
+		err = -EINVAL;
+		goto out;
+	}
+	bitmap = vzalloc(BITS_TO_LONGS(nr_pages) * sizeof(long));
+	if (!bitmap) {
+		err = -ENOMEM;
+		goto out;
+	}
+
+	reset_bdev(zram);
+	zram->backing_dev = backing_dev;
+	zram->bdev = bdev;
+	zram->bitmap = bitmap;
+	zram->nr_pages = nr_pages;
+	up_write(&zram->init_lock);
+
+	pr_info("setup backing device %s\n", file_name);
+	kfree(file_name);
+	return len;
+
+out:
+	if (bdev)
+		blkdev_put(bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL);
+	if (backing_dev)
+		filp_close(backing_dev, NULL);
+	up_write(&zram->init_lock);
+	kfree(file_name);
+	return err;
+}
+
+/*
+ * Block 0 of the backing device is never used, so that a handle of 0
+ * still means nothing is stored.  Returns 0 when the device is full.
+ */
+static unsigned long alloc_block_bdev(struct zram *zram)
+{
+	unsigned long blk_idx = 1;
+retry:
+	blk_idx = find_next_zero_bit(zram->bitmap, zram->nr_pages, blk_idx);
+	if (blk_idx == zram->nr_pages)
+		return 0;
+
+	if (test_and_set_bit(blk_idx, zram->bitmap))
+		goto retry;
+
+	atomic64_inc(&zram->stats.bd_count);
+	return blk_idx;
+}
+
+static void free_block_bdev(struct zram *zram, unsigned long blk_idx)
+{
+	int was_set;
+
+	was_set = test_and_clear_bit(blk_idx, zram->bitmap);
+	WARN_ON_ONCE(!was_set);
+	atomic64_dec(&zram->stats.bd_count);
+}
+
+/* Synchronous I/O of a whole page from or to the backing device. */
+static int zram_bdev_rw(struct zram *zram, struct page *page,
+			unsigned long blk_idx, int rw)
+{
+	struct bio *bio;
+	int ret;
+
+	bio = bio_alloc(GFP_NOIO, 1);
+	if (!bio)
+		return -ENOMEM;
+
+	bio->bi_iter.bi_sector = blk_idx << SECTORS_PER_PAGE_SHIFT;
+	bio->bi_bdev = zram->bdev;
+	if (!bio_add_page(bio, page, PAGE_SIZE, 0)) {
+		bio_put(bio);
+		return -EIO;
+	}
+
+	ret = submit_bio_wait(rw, bio);
+	bio_put(bio);
+	return ret;
+}
+
+static int read_from_bdev(struct zram *zram, struct page *page,
+			  unsigned long blk_idx)
+{
+	int ret;
+
+	ret = zram_bdev_rw(zram, page, blk_idx, READ);
+	if (!ret)
+		atomic64_inc(&zram->stats.bd_reads);
+	return ret;
+}
+
+/* Record an access to the page: it is not idle any more. */
+static void zram_accessed(struct zram_meta *meta, u32 index)
+{
+	zram_clear_flag(meta, index, ZRAM_IDLE);
+	meta->table[index].ac_time = jiffies;
+}
+
+/*
+ * "all" marks every page stored in memory idle, a number of seconds
+ * only those that have not been accessed for that long.  Any access
+ * clears the mark again, and "idle" writeback takes the pages that are
+ * still marked.
+ */
+static ssize_t idle_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	struct zram *zram = dev_to_zram(dev);
+	struct zram_meta *meta;
+	unsigned long nr_pages, index, age = 0;
+	bool all = sysfs_streq(buf, "all");
+
+	if (!all) {
+		if (kstrtoul(buf, 10, &age) || !age ||
+		    age > MAX_JIFFY_OFFSET / HZ)
+			return -EINVAL;
+		age *= HZ;
+	}
+
+	down_read(&zram->init_lock);
+	if (!init_done(zram)) {
+		up_read(&zram->init_lock);
+		return -EINVAL;
+	}
+
+	meta = zram->meta;
+	nr_pages = zram->disksize >> PAGE_SHIFT;
+	for (index = 0; index < nr_pages; index++) {
+		bit_spin_lock(ZRAM_ACCESS, &meta->table[index].value);
+		if (meta->table[index].handle &&
+		    !zram_test_flag(meta, index, ZRAM_WB) &&
+		    !zram_test_flag(meta, index, ZRAM_SAME) &&
+		    (all || time_after_eq(jiffies,
+				meta->table[index].ac_time + age)))
+			zram_set_flag(meta, index, ZRAM_IDLE);
+		bit_spin_unlock(ZRAM_ACCESS, &meta->table[index].value);
+		cond_resched();
+	}
+	up_read(&zram->init_lock);
+
+	return len;
+}
+
+/*
+ * Write pages stored in memory to the backing device and free their
+ * memory: "huge" for the pages that did not compress, "idle" for those
+ * marked idle, "huge_idle" for the pages that are both.
+ */
+static ssize_t writeback_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	struct zram *zram = dev_to_zram(dev);
+	struct zram_meta *meta;
+	unsigned long nr_pages, index, blk_idx = 0, unused;
+	bool huge, idle;
+	struct page *page;
+	ssize_t ret = len;
+	int err;
+
+	if (sysfs_streq(buf, "huge")) {
+		huge = true;
+		idle = false;
+	} else if (sysfs_streq(buf, "idle")) {
+		huge = false;
+		idle = true;
+	} else if (sysfs_streq(buf, "huge_idle")) {
+		huge = true;
+		idle = true;
+	} else {
+		return -EINVAL;
+	}
+
+	down_read(&zram->init_lock);
+	if (!init_done(zram) || !zram->backing_dev) {
+		ret = -EINVAL;
+		goto out_unlock;
+	}
+
+	page = alloc_page(GFP_KERNEL);
+	if (!page) {
+		ret = -ENOMEM;
+		goto out_unlock;
+	}
+
+	meta = zram->meta;
+	nr_pages = zram->disksize >> PAGE_SHIFT;
+	for (index = 0; index < nr_pages; index++) {
+		cond_resched();
+
+		if (!blk_idx) {
+			blk_idx = alloc_block_bdev(zram);
+			if (!blk_idx) {
+				ret = -ENOSPC;
+				break;
+			}
+		}
+
+		bit_spin_lock(ZRAM_ACCESS, &meta->table[index].value);
+		if (!meta->table[index].handle ||
+		    zram_test_flag(meta, index, ZRAM_SAME) ||
+		    zram_test_flag(meta, index, ZRAM_WB) ||
+		    zram_test_flag(meta, index, ZRAM_UNDER_WB) ||
+		    (huge && !zram_test_flag(meta, index, ZRAM_HUGE)) ||
+		    (idle && !zram_test_flag(meta, index, ZRAM_IDLE))) {
+			bit_spin_unlock(ZRAM_ACCESS, &meta->table[index].value);
+			continue;
+		}
+		/* A write or free of the page meanwhile clears the flag. */
+		zram_set_flag(meta, index, ZRAM_UNDER_WB);
+		bit_spin_unlock(ZRAM_ACCESS, &meta->table[index].value);
+
+		err = zram_decompress_page(zram, page_address(page), index,
+					   &unused);
+		if (!err)
+			err = zram_bdev_rw(zram, page, blk_idx, WRITE);
+		if (err) {
+			bit_spin_lock(ZRAM_ACCESS, &meta->table[index].value);
+			zram_clear_flag(meta, index, ZRAM_UNDER_WB);
+			bit_spin_unlock(ZRAM_ACCESS, &meta->table[index].value);
+			ret = err;
+			break;
+		}
+
+		/*
+		 * Keep the copy in memory if the page was rewritten or
+		 * freed while it was being written back, or accessed when
+		 * only idle pages are asked for.
+		 */
+		bit_spin_lock(ZRAM_ACCESS, &meta->table[index].value);
+		if (!zram_test_flag(meta, index, ZRAM_UNDER_WB) ||
+		    (idle && !zram_test_flag(meta, index, ZRAM_IDLE))) {
+			zram_clear_flag(meta, index, ZRAM_UNDER_WB);
+			bit_spin_unlock(ZRAM_ACCESS, &meta->table[index].value);
+			continue;
+		}
+
+		zram_free_page(zram, index);
+		zram_set_flag(meta, index, ZRAM_WB);
+		meta->table[index].handle = blk_idx;
+		zram_accessed(meta, index);
+		bit_spin_unlock(ZRAM_ACCESS, &meta->table[index].value);
+
+		atomic64_inc(&zram->stats.bd_writes);
+		blk_idx = 0;
+	}
+
+	if (blk_idx)
+		free_block_bdev(zram, blk_idx);
+	__free_page(page);
+out_unlock:
+	up_read(&zram->init_lock);
+	return ret;
+}
+
+static ssize_t bd_stat_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+	ssize_t ret;
+
+	down_read(&zram->init_lock);
+	ret = scnprintf(buf, PAGE_SIZE,
+			"%8llu %8llu %8llu\n",
+			(u64)atomic64_read(&zram->stats.bd_count) << PAGE_SHIFT,
+			(u64)atomic64_read(&zram->stats.bd_reads) << PAGE_SHIFT,
+			(u64)atomic64_read(&zram->stats.bd_writes) << PAGE_SHIFT);
+	up_read(&zram->init_lock);
+
+	return ret;
+}
+
+static DEVICE_ATTR_RW(backing_dev);
+static DEVICE_ATTR_WO(idle);
+static DEVICE_ATTR_WO(writeback);
+static DEVICE_ATTR_RO(bd_stat);
+#else
+static inline void reset_bdev(struct zram *zram) {}
+static inline void free_block_bdev(struct zram *zram,
+				   unsigned long blk_idx) {}
+static inline int read_from_bdev(struct zram *zram, struct page *page,
+				 unsigned long blk_idx)
+{
+	return -EIO;
+}
+static inline void zram_accessed(struct zram_meta *meta, u32 index) {}
+#endif
+
+#ifdef CONFIG_ZRAM_DEDUP
+static ssize_t use_dedup_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	bool val;
+	struct zram *zram = dev_to_zram(dev);
+
+	down_read(&zram->init_lock);
+	val = zram->use_dedup;
+	up_read(&zram->init_lock);
+
+	return scnprintf(buf, PAGE_SIZE, "%d\n", (int)val);
+}
+
+static ssize_t use_dedup_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	bool val;
+	struct zram *zram = dev_to_zram(dev);
+
+	if (strtobool(buf, &val))
+		return -EINVAL;
+
+	down_write(&zram->init_lock);
+	if (init_done(zram)) {
+		up_write(&zram->init_lock);
+		pr_info("Can't change dedup usage for initialized device\n");
+		return -EBUSY;
+	}
+	zram->use_dedup = val;
+	up_write(&zram->init_lock);
+	return len;
+}
+static DEVICE_ATTR_RW(use_dedup);
+#endif
+
 static inline bool zram_meta_get(struct zram *zram)
 {
 	if (atomic_inc_not_zero(&zram->refcount))
@@ -485,12 +933,20 @@ static void zram_meta_free(struct zram_meta *meta, u64 disksize)
 	for (index = 0; index < num_pages; index++) {
 		unsigned long handle = meta->table[index].handle;
 
-		if (!handle)
+		/*
+		 * The handle of a page on the backing device is its block,
+		 * that of a same filled page its element.  Shared objects
+		 * are freed with the dedup hash.
+		 */
+		if (!handle || zram_test_flag(meta, index, ZRAM_WB) ||
+		    zram_test_flag(meta, index, ZRAM_SAME) ||
+		    zram_test_flag(meta, index, ZRAM_DEDUP))
 			continue;
 
 		zs_free(meta->mem_pool, handle);
 	}
 
+	zram_dedup_fini(meta);
 	zs_destroy_pool(meta->mem_pool);
 	vfree(meta->table);
 	kfree(meta);
@@ -500,7 +956,7 @@ static struct zram_meta *zram_meta_alloc(int device_id, u64 disksize)
 {
 	size_t num_pages;
 	char pool_name[8];
-	struct zram_meta *meta = kmalloc(sizeof(*meta), GFP_KERNEL);
+	struct zram_meta *meta = kzalloc(sizeof(*meta), GFP_KERNEL);
 
 	if (!meta)
 		return NULL;
@@ -513,7 +969,7 @@ static struct zram_meta *zram_meta_alloc(int device_id, u64 disksize)
 	}
 
 	snprintf(pool_name, sizeof(pool_name), "zram%d", device_id);
-	meta->mem_pool = zs_create_pool(pool_name, GFP_NOIO | __GFP_HIGHMEM);
+	meta->mem_pool = zs_create_pool(pool_name);
 	if (!meta->mem_pool) {
 		pr_err("Error creating memory pool\n");
 		goto out_error;
@@ -537,29 +993,52 @@ static void zram_free_page(struct zram *zram, size_t index)
 	struct zram_meta *meta = zram->meta;
 	unsigned long handle = meta->table[index].handle;
 
-	if (unlikely(!handle)) {
-		/*
-		 * No memory is allocated for zero filled pages.
-		 * Simply clear zero page flag.
-		 */
-		if (zram_test_flag(meta, index, ZRAM_ZERO)) {
-			zram_clear_flag(meta, index, ZRAM_ZERO);
-			atomic64_dec(&zram->stats.zero_pages);
-		}
+	zram_clear_flag(meta, index, ZRAM_HUGE);
+	zram_clear_flag(meta, index, ZRAM_IDLE);
+	zram_clear_flag(meta, index, ZRAM_UNDER_WB);
+
+	if (zram_test_flag(meta, index, ZRAM_WB)) {
+		zram_clear_flag(meta, index, ZRAM_WB);
+		free_block_bdev(zram, handle);
+		meta->table[index].handle = 0;
+		return;
+	}
+
+	/*
+	 * No memory is allocated for same element filled pages.
+	 * Simply clear same page flag.
+	 */
+	if (zram_test_flag(meta, index, ZRAM_SAME)) {
+		zram_clear_flag(meta, index, ZRAM_SAME);
+		meta->table[index].element = 0;
+		atomic64_dec(&zram->stats.same_pages);
 		return;
 	}
 
-	zs_free(meta->mem_pool, handle);
+	if (unlikely(!handle))
+		return;
 
-	atomic64_sub(zram_get_obj_size(meta, index),
-			&zram->stats.compr_data_size);
+	if (zram_test_flag(meta, index, ZRAM_DEDUP)) {
+		zram_clear_flag(meta, index, ZRAM_DEDUP);
+		zram_dedup_put(zram, (struct zram_dedup_entry *)handle);
+	} else {
+		zs_free(meta->mem_pool, handle);
+		atomic64_sub(zram_get_obj_size(meta, index),
+				&zram->stats.compr_data_size);
+	}
 	atomic64_dec(&zram->stats.pages_stored);
 
 	meta->table[index].handle = 0;
 	zram_set_obj_size(meta, index, 0);
 }
 
-static int zram_decompress_page(struct zram *zram, char *mem, u32 index)
+/*
+ * Returns 1 without touching mem if the page is on the backing device,
+ * with its block in blk_idx: reading it back sleeps, which the caller
+ * may not be able to do here.
+ */
+static int zram_decompress_page(struct zram *zram, char *mem, u32 index,
+				unsigned long *blk_idx)
 {
 	int ret = 0;
 	unsigned char *cmem;
@@ -571,17 +1050,39 @@ static int zram_decompress_page(struct zram *zram, char *mem, u32 index)
 	handle = meta->table[index].handle;
 	size = zram_get_obj_size(meta, index);
 
-	if (!handle || zram_test_flag(meta, index, ZRAM_ZERO)) {
+	if (zram_test_flag(meta, index, ZRAM_SAME)) {
+		unsigned long element = meta->table[index].element;
+
+		bit_spin_unlock(ZRAM_ACCESS, &meta->table[index].value);
+		zram_fill_page(mem, PAGE_SIZE, element);
+		return 0;
+	}
+
+	if (!handle) {
 		bit_spin_unlock(ZRAM_ACCESS, &meta->table[index].value);
 		clear_page(mem);
 		return 0;
 	}
 
+	if (zram_test_flag(meta, index, ZRAM_WB)) {
+		*blk_idx = handle;
+		bit_spin_unlock(ZRAM_ACCESS, &meta->table[index].value);
+		return 1;
+	}
+
+	/* the entry holds a reference, which the table lock keeps */
+	if (zram_test_flag(meta, index, ZRAM_DEDUP))
+		handle = ((struct zram_dedup_entry *)handle)->handle;
+
 	cmem = zs_map_object(meta->mem_pool, handle, ZS_MM_RO);
-	if (size == PAGE_SIZE)
+	if (size == PAGE_SIZE) {
 		copy_page(mem, cmem);
-	else
-		ret = zcomp_decompress(zram->comp, cmem, size, mem);
+	} else {
+		struct zcomp_strm *zstrm = zcomp_strm_find(zram->comp);
+
+		ret = zcomp_decompress(zram->comp, zstrm, cmem, size, mem);
+		zcomp_strm_release(zram->comp, zstrm);
+	}
 	zs_unmap_object(meta->mem_pool, handle);
 	bit_spin_unlock(ZRAM_ACCESS, &meta->table[index].value);
 
@@ -594,6 +1095,24 @@ static int zram_decompress_page(struct zram *zram, char *mem, u32 index)
 	return 0;
 }
 
+/* Read a page from the backing device into mem, through a bounce page. */
+static int read_from_bdev_mem(struct zram *zram, char *mem,
+			      unsigned long blk_idx)
+{
+	struct page *page;
+	int ret;
+
+	page = alloc_page(GFP_NOIO);
+	if (!page)
+		return -ENOMEM;
+
+	ret = read_from_bdev(zram, page, blk_idx);
+	if (!ret)
+		copy_page(mem, page_address(page));
+	__free_page(page);
+	return ret;
+}
+
 static int zram_bvec_read(struct zram *zram, struct bio_vec *bvec,
 			  u32 index, int offset)
 {
@@ -601,15 +1120,23 @@ static int zram_bvec_read(struct zram *zram, struct bio_vec *bvec,
 	struct page *page;
 	unsigned char *user_mem, *uncmem = NULL;
 	struct zram_meta *meta = zram->meta;
+	unsigned long blk_idx;
 	page = bvec->bv_page;
 
 	bit_spin_lock(ZRAM_ACCESS, &meta->table[index].value);
-	if (unlikely(!meta->table[index].handle) ||
-			zram_test_flag(meta, index, ZRAM_ZERO)) {
+	if (zram_test_flag(meta, index, ZRAM_SAME)) {
+		unsigned long element = meta->table[index].element;
+
+		bit_spin_unlock(ZRAM_ACCESS, &meta->table[index].value);
+		handle_same_page(bvec, element);
+		return 0;
+	}
+	if (unlikely(!meta->table[index].handle)) {
 		bit_spin_unlock(ZRAM_ACCESS, &meta->table[index].value);
-		handle_zero_page(bvec);
+		handle_same_page(bvec, 0);
 		return 0;
 	}
+	zram_accessed(meta, index);
 	bit_spin_unlock(ZRAM_ACCESS, &meta->table[index].value);
 
 	if (is_partial_io(bvec))
@@ -626,7 +1153,16 @@ static int zram_bvec_read(struct zram *zram, struct bio_vec *bvec,
 		goto out_cleanup;
 	}
 
-	ret = zram_decompress_page(zram, uncmem, index);
+	ret = zram_decompress_page(zram, uncmem, index, &blk_idx);
+	if (ret == 1) {
+		/* Written back: read it without the page mapped atomically */
+		kunmap_atomic(user_mem);
+		if (is_partial_io(bvec))
+			ret = read_from_bdev_mem(zram, uncmem, blk_idx);
+		else
+			ret = read_from_bdev(zram, page, blk_idx);
+		user_mem = kmap_atomic(page);
+	}
 	/* Should NEVER happen. Return bio error if it does. */
 	if (unlikely(ret))
 		goto out_cleanup;
@@ -649,12 +1185,17 @@ static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 {
 	int ret = 0;
 	size_t clen;
-	unsigned long handle;
+	size_t alloced_clen = 0;
+	unsigned long handle = 0;
 	struct page *page;
 	unsigned char *user_mem, *cmem, *src, *uncmem = NULL;
 	struct zram_meta *meta = zram->meta;
 	struct zcomp_strm *zstrm = NULL;
 	unsigned long alloced_pages;
+	unsigned long blk_idx;
+	unsigned long element;
+	struct zram_dedup_entry *dedup = NULL;
+	u32 checksum = 0;
 
 	page = bvec->bv_page;
 	if (is_partial_io(bvec)) {
@@ -667,12 +1208,14 @@ static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 			ret = -ENOMEM;
 			goto out;
 		}
-		ret = zram_decompress_page(zram, uncmem, index);
+		ret = zram_decompress_page(zram, uncmem, index, &blk_idx);
+		if (ret == 1)
+			ret = read_from_bdev_mem(zram, uncmem, blk_idx);
 		if (ret)
 			goto out;
 	}
 
-	zstrm = zcomp_strm_find(zram->comp);
+compress_again:
 	user_mem = kmap_atomic(page);
 
 	if (is_partial_io(bvec)) {
@@ -684,20 +1227,24 @@ static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 		uncmem = user_mem;
 	}
 
-	if (page_zero_filled(uncmem)) {
+	if (page_same_filled(uncmem, &element)) {
 		if (user_mem)
 			kunmap_atomic(user_mem);
+		if (handle)
+			zs_free(meta->mem_pool, handle);
 		/* Free memory associated with this sector now. */
 		bit_spin_lock(ZRAM_ACCESS, &meta->table[index].value);
 		zram_free_page(zram, index);
-		zram_set_flag(meta, index, ZRAM_ZERO);
+		zram_set_flag(meta, index, ZRAM_SAME);
+		meta->table[index].element = element;
 		bit_spin_unlock(ZRAM_ACCESS, &meta->table[index].value);
 
-		atomic64_inc(&zram->stats.zero_pages);
+		atomic64_inc(&zram->stats.same_pages);
 		ret = 0;
 		goto out;
 	}
 
+	zstrm = zcomp_strm_find(zram->comp);
 	ret = zcomp_compress(zram->comp, zstrm, uncmem, &clen);
 	if (!is_partial_io(bvec)) {
 		kunmap_atomic(user_mem);
@@ -707,6 +1254,8 @@ static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 
 	if (unlikely(ret)) {
 		pr_err("Compression failed! err=%d\n", ret);
+		if (handle)
+			zs_free(meta->mem_pool, handle);
 		goto out;
 	}
 	src = zstrm->buffer;
@@ -716,8 +1265,60 @@ static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 			src = uncmem;
 	}
 
-	handle = zs_malloc(meta->mem_pool, clen);
+	/*
+	 * A page that compressed to the same data as one already stored
+	 * just takes a reference on its object.
+	 */
+	if (zram_dedup_enabled(meta) && clen != PAGE_SIZE) {
+		checksum = zram_dedup_checksum(src, clen);
+		dedup = zram_dedup_find(zram, src, clen, checksum);
+		if (dedup) {
+			zcomp_strm_release(zram->comp, zstrm);
+			zstrm = NULL;
+			if (handle)
+				zs_free(meta->mem_pool, handle);
+
+			bit_spin_lock(ZRAM_ACCESS, &meta->table[index].value);
+			zram_free_page(zram, index);
+			meta->table[index].handle = (unsigned long)dedup;
+			zram_set_flag(meta, index, ZRAM_DEDUP);
+			zram_set_obj_size(meta, index, clen);
+			zram_accessed(meta, index);
+			bit_spin_unlock(ZRAM_ACCESS, &meta->table[index].value);
+
+			atomic64_add(clen, &zram->stats.dup_data_size);
+			atomic64_inc(&zram->stats.pages_stored);
+			ret = 0;
+			goto out;
+		}
+	}
+
+	/* The page compressed differently the second time around. */
+	if (handle && clen != alloced_clen) {
+		zs_free(meta->mem_pool, handle);
+		handle = 0;
+	}
+
+	/*
+	 * The stream is per cpu and held with preemption disabled, so the
+	 * object is allocated without direct reclaim first.  If that fails,
+	 * the stream is given up for an allocation that may sleep, and the
+	 * page compressed again: its buffer may have been reused meanwhile.
+	 */
+	if (!handle)
+		handle = zs_malloc(meta->mem_pool, clen,
+				GFP_NOWAIT | __GFP_NOWARN | __GFP_HIGHMEM);
 	if (!handle) {
+		zcomp_strm_release(zram->comp, zstrm);
+		zstrm = NULL;
+
+		handle = zs_malloc(meta->mem_pool, clen,
+				GFP_NOIO | __GFP_HIGHMEM);
+		if (handle) {
+			alloced_clen = clen;
+			goto compress_again;
+		}
+
 		pr_info("Error allocating memory for compressed page: %u, size=%zu\n",
 			index, clen);
 		ret = -ENOMEM;
@@ -747,6 +1348,9 @@ static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 	zstrm = NULL;
 	zs_unmap_object(meta->mem_pool, handle);
 
+	if (zram_dedup_enabled(meta) && clen != PAGE_SIZE)
+		dedup = zram_dedup_insert(zram, handle, clen, checksum);
+
 	/*
 	 * Free memory associated with this sector
 	 * before overwriting unused sectors.
@@ -754,8 +1358,16 @@ static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 	bit_spin_lock(ZRAM_ACCESS, &meta->table[index].value);
 	zram_free_page(zram, index);
 
-	meta->table[index].handle = handle;
+	if (dedup) {
+		meta->table[index].handle = (unsigned long)dedup;
+		zram_set_flag(meta, index, ZRAM_DEDUP);
+	} else {
+		meta->table[index].handle = handle;
+	}
 	zram_set_obj_size(meta, index, clen);
+	if (clen == PAGE_SIZE)
+		zram_set_flag(meta, index, ZRAM_HUGE);
+	zram_accessed(meta, index);
 	bit_spin_unlock(ZRAM_ACCESS, &meta->table[index].value);
 
 	/* Update stats */
@@ -984,6 +1596,7 @@ static void zram_reset_device(struct zram *zram)
 	zram->limit_pages = 0;
 
 	if (!init_done(zram)) {
+		reset_bdev(zram);
 		up_write(&zram->init_lock);
 		return;
 	}
@@ -1006,10 +1619,11 @@ static void zram_reset_device(struct zram *zram)
 	/* Reset stats */
 	memset(&zram->stats, 0, sizeof(zram->stats));
 	zram->disksize = 0;
-	zram->max_comp_streams = 1;
 
 	set_capacity(zram->disk, 0);
 	part_stat_set_all(&zram->disk->part0, 0);
+	/* blocks on the backing device go with its bitmap */
+	reset_bdev(zram);
 
 	up_write(&zram->init_lock);
 	/* I/O operation under all of CPU are done so let's free */
@@ -1035,7 +1649,11 @@ static ssize_t disksize_store(struct device *dev,
 	if (!meta)
 		return -ENOMEM;
 
-	comp = zcomp_create(zram->compressor, zram->max_comp_streams);
+	err = zram_dedup_init(zram, meta, disksize >> PAGE_SHIFT);
+	if (err)
+		goto out_free_meta;
+
+	comp = zcomp_create(zram->compressor);
 	if (IS_ERR(comp)) {
 		pr_info("Cannot initialise %s compressing backend\n",
 				zram->compressor);
@@ -1174,6 +1792,15 @@ static struct attribute *zram_disk_attrs[] = {
 	&dev_attr_comp_algorithm.attr,
 	&dev_attr_io_stat.attr,
 	&dev_attr_mm_stat.attr,
+#ifdef CONFIG_ZRAM_WRITEBACK
+	&dev_attr_backing_dev.attr,
+	&dev_attr_idle.attr,
+	&dev_attr_writeback.attr,
+	&dev_attr_bd_stat.attr,
+#endif
+#ifdef CONFIG_ZRAM_DEDUP
+	&dev_attr_use_dedup.attr,
+#endif
 	NULL,
 };
 
@@ -1269,7 +1896,6 @@ static int zram_add(void)
 	}
 	strlcpy(zram->compressor, default_compressor, sizeof(zram->compressor));
 	zram->meta = NULL;
-	zram->max_comp_streams = 1;
 
 	pr_info("Added device: %s\n", zram->disk->disk_name);
 	return device_id;
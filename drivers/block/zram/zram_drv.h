@@ -19,6 +19,7 @@
 #include <linux/zsmalloc.h>
 
 #include "zcomp.h"
+#include "zram_dedup.h"
 
 /*-- Configurable parameters */
 
@@ -59,9 +60,14 @@ static const size_t max_zpage_size = PAGE_SIZE / 4 * 3;
 
 /* Flags for zram pages (table[page_no].value) */
 enum zram_pageflags {
-	/* Page consists entirely of zeros */
-	ZRAM_ZERO = ZRAM_FLAG_SHIFT,
+	/* Page consists of a single repeated word, kept in element */
+	ZRAM_SAME = ZRAM_FLAG_SHIFT,
 	ZRAM_ACCESS,	/* page is now accessed */
+	ZRAM_HUGE,	/* page is stored uncompressed */
+	ZRAM_IDLE,	/* page not accessed since marked idle */
+	ZRAM_UNDER_WB,	/* page is being written to the backing device */
+	ZRAM_WB,	/* page is on the backing device, handle is its block */
+	ZRAM_DEDUP,	/* handle is a shared struct zram_dedup_entry */
 
 	__NR_ZRAM_PAGEFLAGS,
 };
@@ -70,8 +76,14 @@ enum zram_pageflags {
 
 /* Allocated for each disk page */
 struct zram_table_entry {
-	unsigned long handle;
+	union {
+		unsigned long handle;
+		unsigned long element;
+	};
 	unsigned long value;
+#ifdef CONFIG_ZRAM_WRITEBACK
+	unsigned long ac_time;	/* jiffies of the last access */
+#endif
 };
 
 struct zram_stats {
@@ -83,14 +95,24 @@ struct zram_stats {
 	atomic64_t failed_writes;	/* can happen when memory is too low */
 	atomic64_t invalid_io;	/* non-page-aligned I/O requests */
 	atomic64_t notify_free;	/* no. of swap slot free notifications */
-	atomic64_t zero_pages;		/* no. of zero filled pages */
+	atomic64_t same_pages;		/* no. of same element filled pages */
 	atomic64_t pages_stored;	/* no. of pages currently stored */
 	atomic_long_t max_used_pages;	/* no. of maximum pages stored */
+	atomic64_t dup_data_size;	/* compressed size saved by dedup */
+#ifdef CONFIG_ZRAM_WRITEBACK
+	atomic64_t bd_count;		/* no. of pages on the backing device */
+	atomic64_t bd_reads;		/* no. of pages read back from it */
+	atomic64_t bd_writes;		/* no. of pages written back to it */
+#endif
 };
 
 struct zram_meta {
 	struct zram_table_entry *table;
 	struct zs_pool *mem_pool;
+#ifdef CONFIG_ZRAM_DEDUP
+	struct zram_hash *hash;
+	size_t hash_size;
+#endif
 };
 
 struct zram {
@@ -103,7 +125,6 @@ struct zram {
 	 * the number of pages zram can consume for storing compressed data
 	 */
 	unsigned long limit_pages;
-	int max_comp_streams;
 
 	struct zram_stats stats;
 	atomic_t refcount; /* refcount for zram_meta */
@@ -119,5 +140,18 @@ struct zram {
 	 * zram is claimed so open request will be failed
 	 */
 	bool claim; /* Protected by bdev->bd_mutex */
+#ifdef CONFIG_ZRAM_DEDUP
+	bool use_dedup;	/* set before the disk size, like comp_algorithm */
+#endif
+#ifdef CONFIG_ZRAM_WRITEBACK
+	/*
+	 * Block device pages are written back to, set up before the disk
+	 * size and torn down on reset.  bitmap tracks its used blocks.
+	 */
+	struct file *backing_dev;
+	struct block_device *bdev;
+	unsigned long *bitmap;
+	unsigned long nr_pages;
+#endif
 };
 #endif
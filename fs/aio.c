@@ -40,6 +40,10 @@
 #include <linux/ramfs.h>
 #include <linux/percpu-refcount.h>
 #include <linux/mount.h>
+#include <linux/cred.h>
+#include <linux/hugetlb.h>
+#include <linux/sizes.h>
+#include <linux/vmalloc.h>
 
 #include <asm/kmap_types.h>
 #include <asm/uaccess.h>
@@ -67,6 +71,30 @@ struct aio_ring {
 
 #define AIO_RING_PAGES	8
 
+/* Largest submission ring io_setup2() hands out */
+#define AIO_SQ_MAX_ENTRIES	4096
+/* Number of iocbs copied out of the submission ring at a time */
+#define AIO_SQ_BATCH		8
+
+/* Limits of io_ring_register(IORING_REGISTER_BUFFERS) */
+#define AIO_MAX_FIXED_BUFS	1024
+#define AIO_MAX_FIXED_BUF_SIZE	SZ_1G
+
+/* A user buffer pinned by io_ring_register(IORING_REGISTER_BUFFERS) */
+struct aio_mapped_ubuf {
+	unsigned long		ubuf;
+	size_t			len;
+	struct bio_vec		*bvec;
+	unsigned		nr_bvecs;
+};
+
+struct aio_buf_table {
+	struct user_struct	*user;		/* charged for the pinned pages */
+	unsigned long		nr_pages;
+	unsigned		nr;
+	struct aio_mapped_ubuf	bufs[];
+};
+
 struct kioctx_table {
 	struct rcu_head	rcu;
 	unsigned	nr;
@@ -109,6 +137,29 @@ struct kioctx {
 	/* Size of ringbuffer, in units of struct io_event */
 	unsigned		nr_events;
 
+	/* IOCTX_FLAG_* passed to io_setup2() */
+	unsigned		flags;
+
+	/*
+	 * Submission ring of IOCTX_FLAG_SCQRING contexts, which lives in the
+	 * ring file right after the event ring.  sq_entries and sq_head are
+	 * trusted copies of what userspace sees in struct aio_sq_ring.
+	 */
+	unsigned		sq_offset;
+	unsigned		sq_entries;
+	unsigned		sq_head;
+	unsigned		sq_dropped;
+	struct mutex		sq_lock;	/* serializes submitters */
+
+	/* Set once by io_ring_register(), freed with the context */
+	struct aio_buf_table	*user_bufs;
+
+	/*
+	 * Queue IOCTX_FLAG_IOPOLL contexts poll for completions, set by the
+	 * first direct I/O submitted and held until the context is freed.
+	 */
+	struct request_queue	*poll_queue;
+
 	unsigned long		mmap_base;
 	unsigned long		mmap_size;
 
@@ -197,6 +248,9 @@ unsigned long aio_max_nr = 0x10000; /* system wide maximum number of aio request
 static struct kmem_cache	*kiocb_cachep;
 static struct kmem_cache	*kioctx_cachep;
 
+/* Runs the requests IOCTX_FLAG_SCQRING contexts must not block on */
+static struct workqueue_struct	*aio_wq;
+
 static struct vfsmount *aio_mnt;
 
 static const struct file_operations aio_ring_fops;
@@ -260,6 +314,10 @@ static int __init aio_setup(void)
 	kiocb_cachep = KMEM_CACHE(aio_kiocb, SLAB_HWCACHE_ALIGN|SLAB_PANIC);
 	kioctx_cachep = KMEM_CACHE(kioctx,SLAB_HWCACHE_ALIGN|SLAB_PANIC);
 
+	aio_wq = alloc_workqueue("aio", WQ_UNBOUND, 0);
+	if (!aio_wq)
+		panic("Failed to create aio workqueue.");
+
 	pr_debug("sizeof(struct page) = %zu\n", sizeof(struct page));
 
 	return 0;
@@ -424,13 +482,36 @@ static const struct address_space_operations aio_ctx_aops = {
 #endif
 };
 
+/*
+ * The iocbs of the submission ring follow its index array.  Aligning them
+ * to their size keeps both from straddling a page.
+ */
+static unsigned aio_sq_iocbs_offset(unsigned entries)
+{
+	return ALIGN(sizeof(struct aio_sq_ring) + entries * sizeof(__u32),
+		     sizeof(struct iocb));
+}
+
+/* aio_ring_kmap
+ *	Maps the ring file page holding byte @offset of the ring and returns
+ *	a pointer to that byte.  Must be called with ctx->ring_lock or
+ *	ctx->completion_lock held to keep the page from being migrated, and
+ *	undone with kunmap_atomic().
+ */
+static void *aio_ring_kmap(struct kioctx *ctx, unsigned long offset)
+{
+	void *page = kmap_atomic(ctx->ring_pages[offset >> PAGE_SHIFT]);
+
+	return page + (offset & ~PAGE_MASK);
+}
+
 static int aio_setup_ring(struct kioctx *ctx)
 {
 	struct aio_ring *ring;
 	unsigned nr_events = ctx->max_reqs;
 	struct mm_struct *mm = current->mm;
 	unsigned long size, unused;
-	int nr_pages;
+	int nr_pages, ev_pages;
 	int i;
 	struct file *file;
 
@@ -440,10 +521,17 @@ static int aio_setup_ring(struct kioctx *ctx)
 	size = sizeof(struct aio_ring);
 	size += sizeof(struct io_event) * nr_events;
 
-	nr_pages = PFN_UP(size);
+	nr_pages = ev_pages = PFN_UP(size);
 	if (nr_pages < 0)
 		return -EINVAL;
 
+	if (ctx->flags & IOCTX_FLAG_SCQRING) {
+		ctx->sq_offset = nr_pages << PAGE_SHIFT;
+		size = aio_sq_iocbs_offset(ctx->sq_entries);
+		size += sizeof(struct iocb) * ctx->sq_entries;
+		nr_pages += PFN_UP(size);
+	}
+
 	file = aio_private_file(ctx, nr_pages);
 	if (IS_ERR(file)) {
 		ctx->aio_ring_file = NULL;
@@ -451,7 +539,7 @@ static int aio_setup_ring(struct kioctx *ctx)
 	}
 
 	ctx->aio_ring_file = file;
-	nr_events = (PAGE_SIZE * nr_pages - sizeof(struct aio_ring))
+	nr_events = (PAGE_SIZE * ev_pages - sizeof(struct aio_ring))
 			/ sizeof(struct io_event);
 
 	ctx->ring_pages = ctx->internal_pages;
@@ -514,6 +602,15 @@ static int aio_setup_ring(struct kioctx *ctx)
 	kunmap_atomic(ring);
 	flush_dcache_page(ctx->ring_pages[0]);
 
+	if (ctx->flags & IOCTX_FLAG_SCQRING) {
+		struct aio_sq_ring *sq = aio_ring_kmap(ctx, ctx->sq_offset);
+
+		sq->nr = ctx->sq_entries;
+		sq->iocbs_offset = aio_sq_iocbs_offset(ctx->sq_entries);
+		kunmap_atomic(sq);
+		flush_dcache_page(ctx->ring_pages[ev_pages]);
+	}
+
 	return 0;
 }
 
@@ -559,12 +656,37 @@ static int kiocb_cancel(struct aio_kiocb *kiocb)
 	return cancel(&kiocb->common);
 }
 
+static void aio_free_buf_table(struct aio_buf_table *table)
+{
+	unsigned i, j;
+
+	for (i = 0; i < table->nr; i++) {
+		struct aio_mapped_ubuf *imu = &table->bufs[i];
+
+		for (j = 0; j < imu->nr_bvecs; j++)
+			put_page(imu->bvec[j].bv_page);
+		kvfree(imu->bvec);
+	}
+
+	if (table->user) {
+		atomic_long_sub(table->nr_pages, &table->user->locked_vm);
+		free_uid(table->user);
+	}
+	kfree(table);
+}
+
 static void free_ioctx(struct work_struct *work)
 {
 	struct kioctx *ctx = container_of(work, struct kioctx, free_work);
 
 	pr_debug("freeing %p\n", ctx);
 
+	if (ctx->user_bufs)
+		aio_free_buf_table(ctx->user_bufs);
+#ifdef CONFIG_BLOCK
+	if (ctx->poll_queue)
+		blk_put_queue(ctx->poll_queue);
+#endif
 	aio_free_ring(ctx);
 	free_percpu(ctx->cpu);
 	percpu_ref_exit(&ctx->reqs);
@@ -678,12 +800,17 @@ static void aio_nr_sub(unsigned nr)
 /* ioctx_alloc
  *	Allocates and initializes an ioctx.  Returns an ERR_PTR if it failed.
  */
-static struct kioctx *ioctx_alloc(unsigned nr_events)
+static struct kioctx *ioctx_alloc(unsigned nr_events, unsigned flags)
 {
 	struct mm_struct *mm = current->mm;
 	struct kioctx *ctx;
+	unsigned sq_entries;
 	int err = -ENOMEM;
 
+	/* The submission ring is sized after what userspace asked for */
+	sq_entries = roundup_pow_of_two(min_t(unsigned, max(nr_events, 1U),
+					      AIO_SQ_MAX_ENTRIES));
+
 	/*
 	 * We keep track of the number of available ringbuffer slots, to prevent
 	 * overflow (reqs_available), and we also use percpu counters for this.
@@ -710,10 +837,14 @@ static struct kioctx *ioctx_alloc(unsigned nr_events)
 		return ERR_PTR(-ENOMEM);
 
 	ctx->max_reqs = nr_events;
+	ctx->flags = flags;
+	if (flags & IOCTX_FLAG_SCQRING)
+		ctx->sq_entries = sq_entries;
 
 	spin_lock_init(&ctx->ctx_lock);
 	spin_lock_init(&ctx->completion_lock);
 	mutex_init(&ctx->ring_lock);
+	mutex_init(&ctx->sq_lock);
 	/* Protect against page migration throughout kiotx setup by keeping
 	 * the ring_lock mutex held until setup is complete. */
 	mutex_lock(&ctx->ring_lock);
@@ -1291,20 +1422,9 @@ static long read_events(struct kioctx *ctx, long min_nr, long nr,
 	return ret;
 }
 
-/* sys_io_setup:
- *	Create an aio_context capable of receiving at least nr_events.
- *	ctxp must not point to an aio_context that already exists, and
- *	must be initialized to 0 prior to the call.  On successful
- *	creation of the aio_context, *ctxp is filled in with the resulting 
- *	handle.  May fail with -EINVAL if *ctxp is not initialized,
- *	if the specified nr_events exceeds internal limits.  May fail 
- *	with -EAGAIN if the specified nr_events exceeds the user's limit 
- *	of available events.  May fail with -ENOMEM if insufficient kernel
- *	resources are available.  May fail with -EFAULT if an invalid
- *	pointer is passed for ctxp.  Will fail with -ENOSYS if not
- *	implemented.
- */
-SYSCALL_DEFINE2(io_setup, unsigned, nr_events, aio_context_t __user *, ctxp)
+static long do_io_setup(unsigned nr_events, unsigned flags,
+			struct aio_ring_params __user *params,
+			aio_context_t __user *ctxp)
 {
 	struct kioctx *ioctx = NULL;
 	unsigned long ctx;
@@ -1321,10 +1441,26 @@ SYSCALL_DEFINE2(io_setup, unsigned, nr_events, aio_context_t __user *, ctxp)
 		goto out;
 	}
 
-	ioctx = ioctx_alloc(nr_events);
+	ioctx = ioctx_alloc(nr_events, flags);
 	ret = PTR_ERR(ioctx);
 	if (!IS_ERR(ioctx)) {
-		ret = put_user(ioctx->user_id, ctxp);
+		ret = 0;
+		if (params) {
+			struct aio_ring_params p = {
+				.sq_offset	= ioctx->sq_offset,
+				.sq_entries	= ioctx->sq_entries,
+				.cq_head	= offsetof(struct aio_ring, head),
+				.cq_tail	= offsetof(struct aio_ring, tail),
+				.cq_events	= offsetof(struct aio_ring,
+							   io_events),
+				.cq_entries	= ioctx->nr_events,
+			};
+
+			if (copy_to_user(params, &p, sizeof(p)))
+				ret = -EFAULT;
+		}
+		if (!ret)
+			ret = put_user(ioctx->user_id, ctxp);
 		if (ret)
 			kill_ioctx(current->mm, ioctx, NULL);
 		percpu_ref_put(&ioctx->users);
@@ -1334,6 +1470,42 @@ out:
 	return ret;
 }
 
+/* sys_io_setup:
+ *	Create an aio_context capable of receiving at least nr_events.
+ *	ctxp must not point to an aio_context that already exists, and
+ *	must be initialized to 0 prior to the call.  On successful
+ *	creation of the aio_context, *ctxp is filled in with the resulting 
+ *	handle.  May fail with -EINVAL if *ctxp is not initialized,
+ *	if the specified nr_events exceeds internal limits.  May fail 
+ *	with -EAGAIN if the specified nr_events exceeds the user's limit 
+ *	of available events.  May fail with -ENOMEM if insufficient kernel
+ *	resources are available.  May fail with -EFAULT if an invalid
+ *	pointer is passed for ctxp.  Will fail with -ENOSYS if not
+ *	implemented.
+ */
+SYSCALL_DEFINE2(io_setup, unsigned, nr_events, aio_context_t __user *, ctxp)
+{
+	return do_io_setup(nr_events, 0, NULL, ctxp);
+}
+
+/* sys_io_setup2:
+ *	Like io_setup(), with IOCTX_FLAG_* flags.  If params is not NULL,
+ *	the layout of the rings mapped at *ctxp is reported there.  May fail
+ *	with -EINVAL if unknown flags are passed, or if IOCTX_FLAG_IOPOLL is
+ *	passed without IOCTX_FLAG_SCQRING.
+ */
+SYSCALL_DEFINE4(io_setup2, u32, nr_events, u32, flags,
+		struct aio_ring_params __user *, params,
+		aio_context_t __user *, ctxp)
+{
+	if (flags & ~(IOCTX_FLAG_SCQRING | IOCTX_FLAG_IOPOLL))
+		return -EINVAL;
+	if ((flags & IOCTX_FLAG_IOPOLL) && !(flags & IOCTX_FLAG_SCQRING))
+		return -EINVAL;
+
+	return do_io_setup(nr_events, flags, params, ctxp);
+}
+
 /* sys_io_destroy:
  *	Destroy the aio_context specified.  May cancel any outstanding 
  *	AIOs and block on completion.  Will fail with -ENOSYS if not
@@ -1387,14 +1559,60 @@ static int aio_setup_vectored_rw(int rw, char __user *buf, size_t len,
 				len, UIO_FASTIOV, iovec, iter);
 }
 
+/*
+ * aio_import_fixed:
+ *	Sets up @iter over the part of a registered buffer an
+ *	IOCB_CMD_PREAD_FIXED or IOCB_CMD_PWRITE_FIXED iocb refers to.  The
+ *	pages were pinned at registration, so this costs no page table walk.
+ */
+static int aio_import_fixed(struct kiocb *req, int rw, struct iocb *iocb,
+			    struct iov_iter *iter)
+{
+	struct aio_kiocb *aiocb = container_of(req, struct aio_kiocb, common);
+	struct aio_buf_table *table;
+	struct aio_mapped_ubuf *imu;
+	unsigned long buf = iocb->aio_buf;
+	size_t len = iocb->aio_nbytes;
+	size_t offset;
+	unsigned seg = 0;
+
+	table = lockless_dereference(aiocb->ki_ctx->user_bufs);
+	if (unlikely(!table || iocb->aio_buf_index >= table->nr))
+		return -EFAULT;
+
+	imu = &table->bufs[iocb->aio_buf_index];
+	if (unlikely(buf + len < buf || buf < imu->ubuf ||
+		     buf + len > imu->ubuf + imu->len))
+		return -EFAULT;
+
+	/*
+	 * Only the first bvec may start inside its page, all the others
+	 * cover a whole page, so the one @buf falls in is found directly
+	 * rather than by iov_iter_advance() walking up to it.
+	 */
+	offset = buf - imu->ubuf;
+	if (offset >= imu->bvec[0].bv_len) {
+		offset -= imu->bvec[0].bv_len;
+		seg = 1 + (offset >> PAGE_SHIFT);
+		offset &= ~PAGE_MASK;
+	}
+
+	iov_iter_bvec(iter, ITER_BVEC | rw, imu->bvec + seg,
+		      imu->nr_bvecs - seg, len);
+	iter->iov_offset = offset;
+	return 0;
+}
+
 /*
  * aio_run_iocb:
  *	Performs the initial checks and io submission.
  */
-static ssize_t aio_run_iocb(struct kiocb *req, unsigned opcode,
-			    char __user *buf, size_t len, bool compat)
+static ssize_t aio_run_iocb(struct kiocb *req, struct iocb *iocb, bool compat)
 {
 	struct file *file = req->ki_filp;
+	unsigned opcode = iocb->aio_lio_opcode;
+	char __user *buf = (char __user *)(unsigned long)iocb->aio_buf;
+	size_t len = iocb->aio_nbytes;
 	ssize_t ret;
 	int rw;
 	fmode_t mode;
@@ -1405,6 +1623,7 @@ static ssize_t aio_run_iocb(struct kiocb *req, unsigned opcode,
 	switch (opcode) {
 	case IOCB_CMD_PREAD:
 	case IOCB_CMD_PREADV:
+	case IOCB_CMD_PREAD_FIXED:
 		mode	= FMODE_READ;
 		rw	= READ;
 		iter_op	= file->f_op->read_iter;
@@ -1412,6 +1631,7 @@ static ssize_t aio_run_iocb(struct kiocb *req, unsigned opcode,
 
 	case IOCB_CMD_PWRITE:
 	case IOCB_CMD_PWRITEV:
+	case IOCB_CMD_PWRITE_FIXED:
 		mode	= FMODE_WRITE;
 		rw	= WRITE;
 		iter_op	= file->f_op->write_iter;
@@ -1426,7 +1646,11 @@ rw_common:
 		if (opcode == IOCB_CMD_PREADV || opcode == IOCB_CMD_PWRITEV)
 			ret = aio_setup_vectored_rw(rw, buf, len,
 						&iovec, compat, &iter);
-		else {
+		else if (opcode == IOCB_CMD_PREAD_FIXED ||
+			 opcode == IOCB_CMD_PWRITE_FIXED) {
+			ret = aio_import_fixed(req, rw, iocb, &iter);
+			iovec = NULL;
+		} else {
 			ret = import_single_range(rw, buf, len, iovec, &iter);
 			iovec = NULL;
 		}
@@ -1484,6 +1708,121 @@ rw_common:
 	return 0;
 }
 
+/*
+ * A request of an IOCTX_FLAG_SCQRING context that would block the
+ * submitter, run from aio_wq on behalf of the submitting task.
+ */
+struct aio_offload {
+	struct work_struct	work;
+	struct aio_kiocb	*req;
+	struct mm_struct	*mm;
+	const struct cred	*creds;
+	struct iocb		iocb;
+	bool			compat;
+};
+
+/*
+ * Flags direct I/O on an IOCTX_FLAG_IOPOLL context for polled completion,
+ * and remembers the queue to poll.  A polled context is expected to drive
+ * a single device: I/O to others still completes, just by interrupt.
+ */
+static void aio_iopoll_prep(struct kioctx *ctx, struct aio_kiocb *req)
+{
+#ifdef CONFIG_BLOCK
+	struct inode *inode = req->common.ki_filp->f_mapping->host;
+	struct block_device *bdev;
+	struct request_queue *q;
+
+	req->common.ki_flags |= IOCB_HIPRI;
+	if (ctx->poll_queue)
+		return;
+
+	bdev = S_ISBLK(inode->i_mode) ? I_BDEV(inode) : inode->i_sb->s_bdev;
+	if (!bdev)
+		return;
+	q = bdev_get_queue(bdev);
+	if (blk_get_queue(q) && cmpxchg(&ctx->poll_queue, NULL, q))
+		blk_put_queue(q);
+#endif
+}
+
+/*
+ * Buffered reads and writes are only asynchronous as far as they do not
+ * miss the page cache, and most filesystems have no ->aio_fsync(): hand
+ * those to a worker thread rather than blocking the submitter.
+ */
+static bool aio_need_offload(struct aio_kiocb *req, unsigned opcode)
+{
+	switch (opcode) {
+	case IOCB_CMD_PREAD:
+	case IOCB_CMD_PREADV:
+	case IOCB_CMD_PREAD_FIXED:
+	case IOCB_CMD_PWRITE:
+	case IOCB_CMD_PWRITEV:
+	case IOCB_CMD_PWRITE_FIXED:
+		return !(req->common.ki_flags & IOCB_DIRECT);
+	case IOCB_CMD_FSYNC:
+	case IOCB_CMD_FDSYNC:
+		return true;
+	}
+	return false;
+}
+
+static void aio_offload_work(struct work_struct *work)
+{
+	struct aio_offload *ao = container_of(work, struct aio_offload, work);
+	struct kiocb *req = &ao->req->common;
+	const struct cred *old_cred;
+	mm_segment_t old_fs;
+	ssize_t ret;
+
+	old_cred = override_creds(ao->creds);
+	old_fs = get_fs();
+	set_fs(USER_DS);
+	use_mm(ao->mm);
+
+	switch (ao->iocb.aio_lio_opcode) {
+	case IOCB_CMD_FSYNC:
+	case IOCB_CMD_FDSYNC:
+		ret = vfs_fsync(req->ki_filp,
+				ao->iocb.aio_lio_opcode == IOCB_CMD_FDSYNC);
+		aio_complete(req, ret, 0);
+		break;
+	default:
+		ret = aio_run_iocb(req, &ao->iocb, ao->compat);
+		if (ret)
+			aio_complete(req, ret, 0);
+		break;
+	}
+
+	unuse_mm(ao->mm);
+	set_fs(old_fs);
+	mmput(ao->mm);
+	revert_creds(old_cred);
+	put_cred(ao->creds);
+	kfree(ao);
+}
+
+static int aio_offload_iocb(struct aio_kiocb *req, struct iocb *iocb,
+			    bool compat)
+{
+	struct aio_offload *ao;
+
+	ao = kmalloc(sizeof(*ao), GFP_KERNEL);
+	if (unlikely(!ao))
+		return -ENOMEM;
+
+	INIT_WORK(&ao->work, aio_offload_work);
+	ao->req = req;
+	ao->mm = current->mm;
+	atomic_inc(&ao->mm->mm_users);
+	ao->creds = get_current_cred();
+	ao->iocb = *iocb;
+	ao->compat = compat;
+	queue_work(aio_wq, &ao->work);
+	return 0;
+}
+
 static int io_submit_one(struct kioctx *ctx, struct iocb __user *user_iocb,
 			 struct iocb *iocb, bool compat)
 {
@@ -1491,7 +1830,10 @@ static int io_submit_one(struct kioctx *ctx, struct iocb __user *user_iocb,
 	ssize_t ret;
 
 	/* enforce forwards compatibility on users */
-	if (unlikely(iocb->aio_reserved1 || iocb->aio_reserved2)) {
+	if (unlikely(iocb->aio_reserved1 ||
+		     (iocb->aio_reserved2 &&
+		      iocb->aio_lio_opcode != IOCB_CMD_PREAD_FIXED &&
+		      iocb->aio_lio_opcode != IOCB_CMD_PWRITE_FIXED))) {
 		pr_debug("EINVAL: reserve field set\n");
 		return -EINVAL;
 	}
@@ -1536,19 +1878,18 @@ static int io_submit_one(struct kioctx *ctx, struct iocb __user *user_iocb,
 		req->common.ki_flags |= IOCB_EVENTFD;
 	}
 
-	ret = put_user(KIOCB_KEY, &user_iocb->aio_key);
-	if (unlikely(ret)) {
-		pr_debug("EFAULT: aio_key\n");
-		goto out_put_req;
-	}
-
 	req->ki_user_iocb = user_iocb;
 	req->ki_user_data = iocb->aio_data;
 
-	ret = aio_run_iocb(&req->common, iocb->aio_lio_opcode,
-			   (char __user *)(unsigned long)iocb->aio_buf,
-			   iocb->aio_nbytes,
-			   compat);
+	if ((ctx->flags & IOCTX_FLAG_IOPOLL) &&
+	    (req->common.ki_flags & IOCB_DIRECT))
+		aio_iopoll_prep(ctx, req);
+
+	if ((ctx->flags & IOCTX_FLAG_SCQRING) &&
+	    aio_need_offload(req, iocb->aio_lio_opcode))
+		ret = aio_offload_iocb(req, iocb, compat);
+	else
+		ret = aio_run_iocb(&req->common, iocb, compat);
 	if (ret)
 		goto out_put_req;
 
@@ -1603,6 +1944,12 @@ long do_io_submit(aio_context_t ctx_id, long nr,
 			break;
 		}
 
+		if (unlikely(put_user(KIOCB_KEY, &user_iocb->aio_key))) {
+			pr_debug("EFAULT: aio_key\n");
+			ret = -EFAULT;
+			break;
+		}
+
 		ret = io_submit_one(ctx, user_iocb, &tmp, compat);
 		if (ret)
 			break;
@@ -1631,6 +1978,487 @@ SYSCALL_DEFINE3(io_submit, aio_context_t, ctx_id, long, nr,
 	return do_io_submit(ctx_id, nr, iocbpp, 0);
 }
 
+/* aio_sq_fetch
+ *	Copies up to @nr iocbs queued in the submission ring, starting from
+ *	ctx->sq_head, and stores the aio_key of each in the shared ring.  On
+ *	return @heads[i] is the ring position following @iocbs[i], and @headp
+ *	is the position following everything that was looked at.  Returns the
+ *	number of iocbs copied, or -EINVAL if userspace moved the tail out of
+ *	the ring.
+ */
+static int aio_sq_fetch(struct kioctx *ctx, struct iocb *iocbs,
+			struct iocb __user **user_iocbs, unsigned *heads,
+			unsigned nr, unsigned *headp)
+{
+	unsigned long array = ctx->sq_offset +
+			      offsetof(struct aio_sq_ring, array);
+	unsigned long base = ctx->sq_offset +
+			     aio_sq_iocbs_offset(ctx->sq_entries);
+	unsigned mask = ctx->sq_entries - 1;
+	unsigned head = ctx->sq_head, tail;
+	struct aio_sq_ring *sq;
+	int i = 0;
+
+	/* Access to ->ring_pages here is protected by ctx->ring_lock. */
+	mutex_lock(&ctx->ring_lock);
+	sq = aio_ring_kmap(ctx, ctx->sq_offset);
+	tail = READ_ONCE(sq->tail);
+	kunmap_atomic(sq);
+
+	/* Read the entries only after the tail that published them. */
+	smp_rmb();
+
+	if (unlikely(tail - head > ctx->sq_entries)) {
+		i = -EINVAL;
+		goto out;
+	}
+
+	while (head != tail && i < nr) {
+		unsigned long pos;
+		struct iocb *iocb;
+		__u32 *entry, idx;
+
+		entry = aio_ring_kmap(ctx, array + (head & mask) * sizeof(idx));
+		idx = READ_ONCE(*entry);
+		kunmap_atomic(entry);
+		head++;
+
+		/* Skipped, and counted as dropped once committed. */
+		if (unlikely(idx >= ctx->sq_entries))
+			continue;
+
+		pos = base + idx * sizeof(struct iocb);
+		iocb = aio_ring_kmap(ctx, pos);
+		iocbs[i] = *iocb;
+		iocb->aio_key = KIOCB_KEY;
+		kunmap_atomic(iocb);
+		flush_dcache_page(ctx->ring_pages[pos >> PAGE_SHIFT]);
+
+		user_iocbs[i] = (struct iocb __user *)(ctx->mmap_base + pos);
+		heads[i++] = head;
+	}
+out:
+	mutex_unlock(&ctx->ring_lock);
+	*headp = head;
+	return i;
+}
+
+/* aio_sq_commit
+ *	Hands the submission ring entries up to @head back to userspace.
+ */
+static void aio_sq_commit(struct kioctx *ctx, unsigned head)
+{
+	struct aio_sq_ring *sq;
+
+	mutex_lock(&ctx->ring_lock);
+	sq = aio_ring_kmap(ctx, ctx->sq_offset);
+	sq->dropped = ctx->sq_dropped;
+	/* Make sure the entries are consumed before they can be reused. */
+	smp_mb();
+	sq->head = head;
+	kunmap_atomic(sq);
+	flush_dcache_page(ctx->ring_pages[ctx->sq_offset >> PAGE_SHIFT]);
+	mutex_unlock(&ctx->ring_lock);
+
+	ctx->sq_head = head;
+}
+
+/* aio_sq_fail
+ *	Posts the error of an iocb from the submission ring that could not
+ *	be submitted as its completion event, since there is no way to tell
+ *	userspace which entry failed otherwise.
+ */
+static int aio_sq_fail(struct kioctx *ctx, struct iocb __user *user_iocb,
+		       struct iocb *iocb, long res)
+{
+	struct aio_kiocb *req;
+
+	req = aio_get_req(ctx);
+	if (unlikely(!req))
+		return -EAGAIN;
+
+	req->common.ki_complete = aio_complete;
+	req->ki_user_iocb = user_iocb;
+	req->ki_user_data = iocb->aio_data;
+	aio_complete(&req->common, res, 0);
+	return 0;
+}
+
+/* aio_sq_submit
+ *	Submits up to @to_submit iocbs from the submission ring.  Returns the
+ *	number of entries consumed, or an error if none was.  An entry is
+ *	only left in the ring when the completion ring has no room for its
+ *	event, in which case -EAGAIN tells userspace to reap some first.
+ */
+static long aio_sq_submit(struct kioctx *ctx, unsigned to_submit)
+{
+	struct iocb iocbs[AIO_SQ_BATCH];
+	struct iocb __user *user_iocbs[AIO_SQ_BATCH];
+	unsigned heads[AIO_SQ_BATCH];
+	struct blk_plug plug;
+	long submitted = 0;
+	int ret = 0;
+
+	mutex_lock(&ctx->sq_lock);
+	blk_start_plug(&plug);
+
+	while (submitted < to_submit) {
+		unsigned want = min_t(unsigned, to_submit - submitted,
+				      AIO_SQ_BATCH);
+		unsigned head;
+		int i, nr;
+
+		nr = aio_sq_fetch(ctx, iocbs, user_iocbs, heads, want, &head);
+		if (nr < 0) {
+			ret = nr;
+			break;
+		}
+
+		for (i = 0; i < nr; i++) {
+			ret = io_submit_one(ctx, user_iocbs[i], &iocbs[i],
+					    false);
+			if (ret && ret != -EAGAIN)
+				ret = aio_sq_fail(ctx, user_iocbs[i],
+						  &iocbs[i], ret);
+			if (ret) {
+				head = heads[i] - 1;
+				break;
+			}
+			submitted++;
+		}
+
+		if (head != ctx->sq_head) {
+			/*
+			 * What the first i iocbs do not account for was
+			 * invalid.  Count it only now, as entries past a
+			 * rewound head are fetched again.
+			 */
+			ctx->sq_dropped += head - ctx->sq_head - i;
+			aio_sq_commit(ctx, head);
+		}
+		if (ret || nr < want)
+			break;
+	}
+
+	blk_finish_plug(&plug);
+	mutex_unlock(&ctx->sq_lock);
+
+	return submitted ? submitted : ret;
+}
+
+/* aio_ring_events
+ *	Returns the number of events userspace has not reaped yet.
+ */
+static unsigned aio_ring_events(struct kioctx *ctx)
+{
+	struct aio_ring *ring;
+	unsigned head, tail;
+
+	spin_lock_irq(&ctx->completion_lock);
+	ring = kmap_atomic(ctx->ring_pages[0]);
+	head = ring->head;
+	kunmap_atomic(ring);
+	tail = ctx->tail;
+	spin_unlock_irq(&ctx->completion_lock);
+
+	/* Clamp head since userland can write to it. */
+	head %= ctx->nr_events;
+	if (head <= tail)
+		return tail - head;
+	return ctx->nr_events - (head - tail);
+}
+
+static int aio_ring_wait(struct kioctx *ctx, unsigned min_nr)
+{
+	int ret = 0;
+
+	if (ctx->flags & IOCTX_FLAG_IOPOLL) {
+		struct request_queue *q = READ_ONCE(ctx->poll_queue);
+		u64 issue_ns = ktime_get_ns();
+		DEFINE_WAIT(wait);
+
+		/*
+		 * Spinning here saves the sleep and wakeup round trip, which
+		 * dominates the latency of fast devices.  Where the device
+		 * can be polled, reap its completions ourselves rather than
+		 * waiting for the interrupt to do it; blk_poll() wants to be
+		 * woken by aio_complete() in case it decides to sleep first.
+		 */
+		while (aio_ring_events(ctx) < min_nr &&
+		       !atomic_read(&ctx->dead)) {
+			if (signal_pending(current)) {
+				ret = -EINTR;
+				break;
+			}
+			if (q) {
+				prepare_to_wait(&ctx->wait, &wait,
+						TASK_INTERRUPTIBLE);
+				if (aio_ring_events(ctx) < min_nr)
+					blk_poll(q, issue_ns);
+				finish_wait(&ctx->wait, &wait);
+			} else {
+				cpu_relax();
+			}
+			cond_resched();
+		}
+	} else if (wait_event_interruptible(ctx->wait,
+			aio_ring_events(ctx) >= min_nr ||
+			atomic_read(&ctx->dead))) {
+		ret = -EINTR;
+	}
+
+	if (unlikely(atomic_read(&ctx->dead)))
+		ret = -EINVAL;
+	return ret;
+}
+
+static void *aio_kvmalloc(size_t size)
+{
+	void *p = kmalloc(size, GFP_KERNEL | __GFP_NOWARN);
+
+	if (!p)
+		p = vmalloc(size);
+	return p;
+}
+
+/* Charges @nr_pages pinned pages to @user, up to RLIMIT_MEMLOCK. */
+static int aio_account_mem(struct user_struct *user, unsigned long nr_pages)
+{
+	unsigned long limit = rlimit(RLIMIT_MEMLOCK) >> PAGE_SHIFT;
+	unsigned long cur, new;
+
+	do {
+		cur = atomic_long_read(&user->locked_vm);
+		new = cur + nr_pages;
+		if (new > limit)
+			return -ENOMEM;
+	} while (atomic_long_cmpxchg(&user->locked_vm, cur, new) != cur);
+
+	return 0;
+}
+
+/*
+ * Pins the user buffer @iov into @imu.  File backed memory is refused:
+ * a long term pin would keep the filesystem from writing back or
+ * truncating the pages.
+ */
+static int aio_map_ubuf(struct aio_mapped_ubuf *imu, struct iovec *iov,
+			struct page **pages, struct vm_area_struct **vmas,
+			int nr_pages)
+{
+	unsigned long ubuf = (unsigned long)iov->iov_base;
+	size_t off, size = iov->iov_len;
+	int i, pret, ret = 0;
+
+	imu->bvec = aio_kvmalloc(nr_pages * sizeof(struct bio_vec));
+	if (!imu->bvec)
+		return -ENOMEM;
+
+	down_read(&current->mm->mmap_sem);
+	pret = get_user_pages(current, current->mm, ubuf, nr_pages, 1, 0,
+			      pages, vmas);
+	if (pret == nr_pages) {
+		for (i = 0; i < nr_pages; i++) {
+			struct file *file = vmas[i]->vm_file;
+
+			if (file && !is_file_hugepages(file)) {
+				ret = -EOPNOTSUPP;
+				break;
+			}
+		}
+	} else {
+		ret = pret < 0 ? pret : -EFAULT;
+	}
+	up_read(&current->mm->mmap_sem);
+
+	if (ret) {
+		for (i = 0; i < pret; i++)
+			put_page(pages[i]);
+		kvfree(imu->bvec);
+		imu->bvec = NULL;
+		return ret;
+	}
+
+	off = ubuf & ~PAGE_MASK;
+	for (i = 0; i < nr_pages; i++) {
+		size_t vec_len = min_t(size_t, size, PAGE_SIZE - off);
+
+		imu->bvec[i].bv_page = pages[i];
+		imu->bvec[i].bv_len = vec_len;
+		imu->bvec[i].bv_offset = off;
+		off = 0;
+		size -= vec_len;
+	}
+	imu->ubuf = ubuf;
+	imu->len = iov->iov_len;
+	imu->nr_bvecs = nr_pages;
+	return 0;
+}
+
+static int aio_register_buffers(struct kioctx *ctx, void __user *arg,
+				unsigned nr_args)
+{
+	struct iovec __user *uiov = arg;
+	struct vm_area_struct **vmas = NULL;
+	struct page **pages = NULL;
+	struct aio_buf_table *table;
+	int i, max_pages = 0;
+	int ret = 0;
+
+	if (!nr_args || nr_args > AIO_MAX_FIXED_BUFS)
+		return -EINVAL;
+	if (ctx->user_bufs)
+		return -EBUSY;
+
+	table = kzalloc(sizeof(*table) + nr_args * sizeof(table->bufs[0]),
+			GFP_KERNEL);
+	if (!table)
+		return -ENOMEM;
+	if (!capable(CAP_IPC_LOCK))
+		table->user = get_uid(current_user());
+
+	for (i = 0; i < nr_args; i++) {
+		unsigned long start, end;
+		struct iovec iov;
+		int nr_pages;
+
+		if (copy_from_user(&iov, &uiov[i], sizeof(iov))) {
+			ret = -EFAULT;
+			break;
+		}
+		if (!iov.iov_base || !iov.iov_len ||
+		    iov.iov_len > AIO_MAX_FIXED_BUF_SIZE) {
+			ret = -EINVAL;
+			break;
+		}
+
+		start = (unsigned long)iov.iov_base >> PAGE_SHIFT;
+		end = ((unsigned long)iov.iov_base + iov.iov_len +
+		       PAGE_SIZE - 1) >> PAGE_SHIFT;
+		nr_pages = end - start;
+
+		if (table->user) {
+			ret = aio_account_mem(table->user, nr_pages);
+			if (ret)
+				break;
+			table->nr_pages += nr_pages;
+		}
+
+		if (nr_pages > max_pages) {
+			kvfree(pages);
+			kvfree(vmas);
+			pages = aio_kvmalloc(nr_pages * sizeof(*pages));
+			vmas = aio_kvmalloc(nr_pages * sizeof(*vmas));
+			if (!pages || !vmas) {
+				ret = -ENOMEM;
+				break;
+			}
+			max_pages = nr_pages;
+		}
+
+		ret = aio_map_ubuf(&table->bufs[i], &iov, pages, vmas,
+				   nr_pages);
+		if (ret)
+			break;
+		table->nr++;
+	}
+
+	kvfree(pages);
+	kvfree(vmas);
+
+	/* Requests find the table without locking, publish it only once. */
+	if (!ret && cmpxchg(&ctx->user_bufs, NULL, table))
+		ret = -EBUSY;
+	if (ret)
+		aio_free_buf_table(table);
+	return ret;
+}
+
+/* sys_io_ring_register:
+ *	Registers resources with an aio context.  IORING_REGISTER_BUFFERS
+ *	pins the nr_args user buffers described by the iovec array at arg;
+ *	IOCB_CMD_PREAD_FIXED and IOCB_CMD_PWRITE_FIXED iocbs then refer to
+ *	them by index, without pinning pages for every request.  Buffers stay
+ *	registered until the context is destroyed.  May fail with -EBUSY if
+ *	buffers were already registered, -ENOMEM if pinning them would
+ *	exceed RLIMIT_MEMLOCK, -EOPNOTSUPP if a buffer is file backed, and
+ *	-EINVAL if ctx_id or opcode is invalid or nr_args is out of range.
+ */
+SYSCALL_DEFINE4(io_ring_register, aio_context_t, ctx_id, u32, opcode,
+		void __user *, arg, u32, nr_args)
+{
+	struct kioctx *ctx;
+	long ret;
+
+	ctx = lookup_ioctx(ctx_id);
+	if (unlikely(!ctx)) {
+		pr_debug("EINVAL: invalid context id\n");
+		return -EINVAL;
+	}
+
+	switch (opcode) {
+	case IORING_REGISTER_BUFFERS:
+		ret = aio_register_buffers(ctx, arg, nr_args);
+		break;
+	default:
+		ret = -EINVAL;
+		break;
+	}
+
+	percpu_ref_put(&ctx->users);
+	return ret;
+}
+
+/* sys_io_ring_enter:
+ *	Submits up to to_submit iocbs from the submission ring of an
+ *	IOCTX_FLAG_SCQRING context if IORING_FLAG_SUBMIT is set, then waits
+ *	for at least min_complete events to be in the completion ring if
+ *	IORING_FLAG_GETEVENTS is set.  Events are reaped by userspace from
+ *	the mapped ring directly.  Returns the number of submission ring
+ *	entries consumed.  May fail with -EINVAL if ctx_id is invalid or not
+ *	an IOCTX_FLAG_SCQRING context, or if unknown flags are passed.  May
+ *	fail with -EAGAIN if the completion ring is too full to submit
+ *	anything, and with -EINTR if a signal arrived while waiting.
+ */
+SYSCALL_DEFINE4(io_ring_enter, aio_context_t, ctx_id, u32, to_submit,
+		u32, min_complete, u32, flags)
+{
+	struct kioctx *ctx;
+	long ret = 0;
+
+	if (unlikely(flags & ~(IORING_FLAG_SUBMIT | IORING_FLAG_GETEVENTS)))
+		return -EINVAL;
+
+	ctx = lookup_ioctx(ctx_id);
+	if (unlikely(!ctx)) {
+		pr_debug("EINVAL: invalid context id\n");
+		return -EINVAL;
+	}
+
+	if (unlikely(!(ctx->flags & IOCTX_FLAG_SCQRING))) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	if (flags & IORING_FLAG_SUBMIT) {
+		ret = aio_sq_submit(ctx, to_submit);
+		if (ret < 0)
+			goto out;
+	}
+
+	if (flags & IORING_FLAG_GETEVENTS) {
+		int err;
+
+		min_complete = min(min_complete, ctx->nr_events - 1);
+		err = aio_ring_wait(ctx, min_complete);
+		if (err && !ret)
+			ret = err;
+	}
+out:
+	percpu_ref_put(&ctx->users);
+	return ret;
+}
+
 /* lookup_kiocb
  *	Finds a given iocb for cancellation.
  */
@@ -42,6 +42,8 @@
 #include <linux/seq_file.h>
 #include <linux/compat.h>
 #include <linux/rculist.h>
+#include <linux/vmalloc.h>
+#include <linux/log2.h>
 
 /*
  * LOCKING:
@@ -92,13 +94,23 @@
  */
 
 /* Epoll private bits inside the event mask */
-#define EP_PRIVATE_BITS (EPOLLWAKEUP | EPOLLONESHOT | EPOLLET)
+#define EP_PRIVATE_BITS (EPOLLWAKEUP | EPOLLONESHOT | EPOLLET | EPOLLEXCLUSIVE)
+
+/* Events allowed together with EPOLLEXCLUSIVE */
+#define EPOLLEXCLUSIVE_OK_BITS (POLLIN | POLLOUT | POLLERR | POLLHUP | \
+				EPOLLWAKEUP | EPOLLET | EPOLLEXCLUSIVE)
 
 /* Maximum number of nesting allowed inside epoll sets */
 #define EP_MAX_NESTS 4
 
 #define EP_MAX_EVENTS (INT_MAX / sizeof(struct epoll_event))
 
+/* Number of epoll_ctl_batch() commands applied per "ep->mtx" hold */
+#define EP_CTL_BATCH_CHUNK (PAGE_SIZE / sizeof(struct epoll_ctl_cmd))
+
+/* Maximum number of items of an EPOLL_USERPOLL instance */
+#define EP_USERPOLL_MAX_ITEMS (1 << 16)
+
 #define EP_UNACTIVE_PTR ((void *) -1L)
 
 #define EP_ITEM_COST (sizeof(struct epitem) + sizeof(struct eppoll_entry))
@@ -156,6 +168,9 @@ struct epitem {
 	/* Number of active wait queue attached to poll operations */
 	int nwait;
 
+	/* Index of the shared item when the container is EPOLL_USERPOLL */
+	int uidx;
+
 	/* List containing poll wait queues */
 	struct list_head pwqlist;
 
@@ -219,6 +234,20 @@ struct eventpoll {
 	/* used to optimize loop detection check */
 	int visited;
 	struct list_head visited_list_link;
+
+	/*
+	 * Memory shared with userspace by EPOLL_USERPOLL instances, NULL
+	 * otherwise. The items bitmap is protected by "mtx", the ring tail
+	 * by "lock". The sizes are kept here as userspace can write to the
+	 * header.
+	 */
+	struct epoll_uheader *uheader;
+	struct epoll_uitem *uitems;
+	u32 *uring;
+	unsigned long *uitems_bm;
+	unsigned int uitems_max;
+	u32 uring_mask;
+	u32 uring_tail;
 };
 
 /* Wait structure used by the poll hooks */
@@ -366,6 +395,18 @@ static void ep_nested_calls_init(struct nested_calls *ncalls)
 	spin_lock_init(&ncalls->lock);
 }
 
+static inline bool ep_userpoll(struct eventpoll *ep)
+{
+	return ep->uheader != NULL;
+}
+
+/* Tells if the shared ring holds entries userspace has not reaped yet */
+static inline bool ep_uring_pending(struct eventpoll *ep)
+{
+	return ep_userpoll(ep) &&
+		READ_ONCE(ep->uring_tail) != READ_ONCE(ep->uheader->head);
+}
+
 /**
  * ep_events_available - Checks if ready events might be available.
  *
@@ -376,7 +417,8 @@ static void ep_nested_calls_init(struct nested_calls *ncalls)
  */
 static inline int ep_events_available(struct eventpoll *ep)
 {
-	return !list_empty(&ep->rdllist) || ep->ovflist != EP_UNACTIVE_PTR;
+	return !list_empty(&ep->rdllist) || ep->ovflist != EP_UNACTIVE_PTR ||
+		ep_uring_pending(ep);
 }
 
 /**
@@ -576,6 +618,116 @@ static inline void ep_pm_stay_awake_rcu(struct epitem *epi)
 	rcu_read_unlock();
 }
 
+/*
+ * Grabs a free shared item for @epi and fills it with the registered
+ * events and data. Must be called with "mtx" held.
+ */
+static int ep_uitem_alloc(struct eventpoll *ep, struct epitem *epi)
+{
+	struct epoll_uitem *uitem;
+	unsigned int idx;
+
+	idx = find_first_zero_bit(ep->uitems_bm, ep->uitems_max);
+	if (idx >= ep->uitems_max)
+		return -ENOSPC;
+	__set_bit(idx, ep->uitems_bm);
+
+	uitem = &ep->uitems[idx];
+	WRITE_ONCE(uitem->ready_events, 0);
+	WRITE_ONCE(uitem->events, epi->event.events);
+	WRITE_ONCE(uitem->data, epi->event.data);
+	epi->uidx = idx;
+
+	return 0;
+}
+
+/*
+ * Releases the shared item of @epi. The poll callbacks must have been
+ * unregistered already. The index may still sit in the ring, but with
+ * zero ready events it is skipped by userspace. Must be called with
+ * "mtx" held.
+ */
+static void ep_uitem_free(struct eventpoll *ep, struct epitem *epi)
+{
+	struct epoll_uitem *uitem = &ep->uitems[epi->uidx];
+
+	xchg(&uitem->ready_events, 0);
+	WRITE_ONCE(uitem->events, 0);
+	WRITE_ONCE(uitem->data, 0);
+	__clear_bit(epi->uidx, ep->uitems_bm);
+}
+
+/*
+ * Publishes the registered events of @epi found in @pollflags in its shared
+ * item, and pushes its index to the ring unless it is there already.
+ * Returns false if the ring is full, in which case the caller falls back to
+ * the ready list. Must be called with "ep->lock" held, which serializes the
+ * producers.
+ */
+static bool ep_uitem_publish(struct eventpoll *ep, struct epitem *epi,
+			     unsigned int pollflags)
+{
+	struct epoll_uheader *uheader = ep->uheader;
+	struct epoll_uitem *uitem = &ep->uitems[epi->uidx];
+	unsigned int events = epi->event.events;
+	u32 old, new, head, tail;
+
+	/*
+	 * Disable EPOLLONESHOT items before userspace can see the event, so
+	 * that the EPOLL_CTL_MOD re-arming them cannot be overwritten.
+	 */
+	if (events & EPOLLONESHOT)
+		epi->event.events &= EP_PRIVATE_BITS;
+
+	pollflags &= events & ~EP_PRIVATE_BITS;
+	do {
+		old = READ_ONCE(uitem->ready_events);
+		new = old | pollflags;
+	} while (cmpxchg(&uitem->ready_events, old, new) != old);
+
+	/* Already in the ring, userspace will see the new bits */
+	if (old)
+		return true;
+
+	tail = ep->uring_tail;
+	head = smp_load_acquire(&uheader->head);
+	if (unlikely(tail - head > ep->uring_mask)) {
+		/*
+		 * The ring is sized for twice the number of items, so only
+		 * stale indexes of removed items can fill it. Take the bits
+		 * back, unless userspace consumed them through a stale index.
+		 */
+		if (cmpxchg(&uitem->ready_events, new, 0) != new)
+			return true;
+		epi->event.events = events;
+		return false;
+	}
+
+	ep->uring[tail & ep->uring_mask] = epi->uidx;
+	WRITE_ONCE(ep->uring_tail, tail + 1);
+	smp_store_release(&uheader->tail, tail + 1);
+
+	return true;
+}
+
+/*
+ * Queues a ready item, either into the shared ring of an EPOLL_USERPOLL
+ * instance or into the ready list. Returns false if the item was queued
+ * already. Must be called with "ep->lock" held.
+ */
+static bool ep_queue_ready(struct eventpoll *ep, struct epitem *epi,
+			   unsigned int revents)
+{
+	if (ep_userpoll(ep) && ep_uitem_publish(ep, epi, revents))
+		return true;
+	if (ep_is_linked(&epi->rdllink))
+		return false;
+
+	list_add_tail(&epi->rdllink, &ep->rdllist);
+	ep_pm_stay_awake(epi);
+	return true;
+}
+
 /**
  * ep_scan_ready_list - Scans the ready list in a way that makes possible for
  *                      the scan code, to call f_op->poll(). Also allows for
@@ -716,6 +868,9 @@ static int ep_remove(struct eventpoll *ep, struct epitem *epi)
 		list_del_init(&epi->rdllink);
 	spin_unlock_irqrestore(&ep->lock, flags);
 
+	if (ep_userpoll(ep))
+		ep_uitem_free(ep, epi);
+
 	wakeup_source_unregister(ep_wakeup_source(epi));
 	/*
 	 * At this point it is safe to free the eventpoll item. Use the union
@@ -780,6 +935,8 @@ static void ep_free(struct eventpoll *ep)
 	mutex_destroy(&ep->mtx);
 	free_uid(ep->user);
 	wakeup_source_unregister(ep->ws);
+	kfree(ep->uitems_bm);
+	vfree(ep->uheader);
 	kfree(ep);
 }
 
@@ -857,6 +1014,9 @@ static unsigned int ep_eventpoll_poll(struct file *file, poll_table *wait)
 	/* Insert inside our poll wait queue */
 	poll_wait(file, &ep->poll_wait, wait);
 
+	if (ep_uring_pending(ep))
+		return POLLIN | POLLRDNORM;
+
 	/*
 	 * Proceed to find out if wanted events are really available inside
 	 * the ready list. This need to be done under ep_call_nested()
@@ -889,6 +1049,16 @@ static void ep_show_fdinfo(struct seq_file *m, struct file *f)
 }
 #endif
 
+static int ep_eventpoll_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct eventpoll *ep = file->private_data;
+
+	if (!ep_userpoll(ep))
+		return -ENODEV;
+
+	return remap_vmalloc_range(vma, ep->uheader, vma->vm_pgoff);
+}
+
 /* File callbacks that implement the eventpoll file behaviour */
 static const struct file_operations eventpoll_fops = {
 #ifdef CONFIG_PROC_FS
@@ -896,6 +1066,7 @@ static const struct file_operations eventpoll_fops = {
 #endif
 	.release	= ep_eventpoll_release,
 	.poll		= ep_eventpoll_poll,
+	.mmap		= ep_eventpoll_mmap,
 	.llseek		= noop_llseek,
 };
 
@@ -962,6 +1133,50 @@ free_uid:
 	return error;
 }
 
+/*
+ * Allocates the memory shared with userspace by an EPOLL_USERPOLL instance
+ * able to hold @max_items files. The index ring has room for twice as many
+ * entries, so that an item can be queued again while userspace is still
+ * reaping its previous entry.
+ */
+static int ep_userpoll_alloc(struct eventpoll *ep, unsigned int max_items)
+{
+	struct epoll_uheader *uheader;
+	unsigned int items_offset, ring_offset, ring_size, len;
+
+	ring_size = roundup_pow_of_two(2 * max_items);
+	items_offset = ALIGN(sizeof(*uheader), L1_CACHE_BYTES);
+	ring_offset = items_offset + max_items * sizeof(struct epoll_uitem);
+	len = PAGE_ALIGN(ring_offset + ring_size * sizeof(u32));
+
+	ep->uitems_bm = kcalloc(BITS_TO_LONGS(max_items), sizeof(long),
+				GFP_KERNEL);
+	if (!ep->uitems_bm)
+		return -ENOMEM;
+
+	uheader = vmalloc_user(len);
+	if (!uheader) {
+		kfree(ep->uitems_bm);
+		ep->uitems_bm = NULL;
+		return -ENOMEM;
+	}
+
+	uheader->magic = EPOLL_USERPOLL_HEADER_MAGIC;
+	uheader->header_length = len;
+	uheader->max_items = max_items;
+	uheader->ring_mask = ring_size - 1;
+	uheader->items_offset = items_offset;
+	uheader->ring_offset = ring_offset;
+
+	ep->uitems = (void *)uheader + items_offset;
+	ep->uring = (void *)uheader + ring_offset;
+	ep->uitems_max = max_items;
+	ep->uring_mask = ring_size - 1;
+	ep->uheader = uheader;
+
+	return 0;
+}
+
 /*
  * Search the file inside the eventpoll tree. The RB tree operations
  * are protected by the "mtx" mutex, and ep_find() must be called with
@@ -998,7 +1213,7 @@ static struct epitem *ep_find(struct eventpoll *ep, struct file *file, int fd)
  */
 static int ep_poll_callback(wait_queue_t *wait, unsigned mode, int sync, void *key)
 {
-	int pwake = 0;
+	int pwake = 0, ewake = 0;
 	unsigned long flags;
 	struct epitem *epi = ep_item_from_wait(wait);
 	struct eventpoll *ep = epi->ep;
@@ -1034,6 +1249,15 @@ static int ep_poll_callback(wait_queue_t *wait, unsigned mode, int sync, void *k
 	if (key && !((unsigned long) key & epi->event.events))
 		goto out_unlock;
 
+	/*
+	 * EPOLL_USERPOLL instances publish the event straight into the ring
+	 * shared with userspace. Without a "key" we cannot tell which events
+	 * fired, so report all the registered ones.
+	 */
+	if (ep_userpoll(ep) &&
+	    ep_uitem_publish(ep, epi, key ? (unsigned long) key : ~0U))
+		goto wakeup;
+
 	/*
 	 * If we are transferring events to userspace, we can hold no locks
 	 * (because we're accessing user memory, and because of linux f_op->poll()
@@ -1062,12 +1286,15 @@ static int ep_poll_callback(wait_queue_t *wait, unsigned mode, int sync, void *k
 		ep_pm_stay_awake_rcu(epi);
 	}
 
+wakeup:
 	/*
 	 * Wake up ( if active ) both the eventpoll wait list and the ->poll()
 	 * wait list.
 	 */
-	if (waitqueue_active(&ep->wq))
+	if (waitqueue_active(&ep->wq)) {
+		ewake = 1;
 		wake_up_locked(&ep->wq);
+	}
 	if (waitqueue_active(&ep->poll_wait))
 		pwake++;
 
@@ -1078,6 +1305,15 @@ out_unlock:
 	if (pwake)
 		ep_poll_safewake(&ep->poll_wait);
 
+	/*
+	 * EPOLLEXCLUSIVE items are queued as exclusive waiters, so the waker
+	 * stops at the first one returning non-zero. Only claim the wakeup
+	 * if a task was waiting on this epoll instance, otherwise let it go
+	 * on to the next one.
+	 */
+	if (epi->event.events & EPOLLEXCLUSIVE)
+		return ewake;
+
 	return 1;
 }
 
@@ -1095,7 +1331,10 @@ static void ep_ptable_queue_proc(struct file *file, wait_queue_head_t *whead,
 		init_waitqueue_func_entry(&pwq->wait, ep_poll_callback);
 		pwq->whead = whead;
 		pwq->base = epi;
-		add_wait_queue(whead, &pwq->wait);
+		if (epi->event.events & EPOLLEXCLUSIVE)
+			add_wait_queue_exclusive(whead, &pwq->wait);
+		else
+			add_wait_queue(whead, &pwq->wait);
 		list_add_tail(&pwq->llink, &epi->pwqlist);
 		epi->nwait++;
 	} else {
@@ -1292,6 +1531,11 @@ static int ep_insert(struct eventpoll *ep, struct epoll_event *event,
 	} else {
 		RCU_INIT_POINTER(epi->ws, NULL);
 	}
+	if (ep_userpoll(ep)) {
+		error = ep_uitem_alloc(ep, epi);
+		if (error)
+			goto error_uitem_alloc;
+	}
 
 	/* Initialize the poll table using the queue callback */
 	epq.epi = epi;
@@ -1335,10 +1579,8 @@ static int ep_insert(struct eventpoll *ep, struct epoll_event *event,
 	spin_lock_irqsave(&ep->lock, flags);
 
 	/* If the file is already "ready" we drop it inside the ready list */
-	if ((revents & event->events) && !ep_is_linked(&epi->rdllink)) {
-		list_add_tail(&epi->rdllink, &ep->rdllist);
-		ep_pm_stay_awake(epi);
-
+	if ((revents & event->events) &&
+	    ep_queue_ready(ep, epi, revents & event->events)) {
 		/* Notify waiting tasks that events are available */
 		if (waitqueue_active(&ep->wq))
 			wake_up_locked(&ep->wq);
@@ -1377,6 +1619,10 @@ error_unregister:
 		list_del_init(&epi->rdllink);
 	spin_unlock_irqrestore(&ep->lock, flags);
 
+	if (ep_userpoll(ep))
+		ep_uitem_free(ep, epi);
+
+error_uitem_alloc:
 	wakeup_source_unregister(ep_wakeup_source(epi));
 
 error_create_wakeup_source:
@@ -1410,6 +1656,10 @@ static int ep_modify(struct eventpoll *ep, struct epitem *epi, struct epoll_even
 	} else if (ep_has_wakeup_source(epi)) {
 		ep_destroy_wakeup_source(epi);
 	}
+	if (ep_userpoll(ep)) {
+		WRITE_ONCE(ep->uitems[epi->uidx].events, event->events);
+		WRITE_ONCE(ep->uitems[epi->uidx].data, event->data);
+	}
 
 	/*
 	 * The following barrier has two effects:
@@ -1443,10 +1693,7 @@ static int ep_modify(struct eventpoll *ep, struct epitem *epi, struct epoll_even
 	 */
 	if (revents & event->events) {
 		spin_lock_irq(&ep->lock);
-		if (!ep_is_linked(&epi->rdllink)) {
-			list_add_tail(&epi->rdllink, &ep->rdllist);
-			ep_pm_stay_awake(epi);
-
+		if (ep_queue_ready(ep, epi, revents & event->events)) {
 			/* Notify waiting tasks that events are available */
 			if (waitqueue_active(&ep->wq))
 				wake_up_locked(&ep->wq);
@@ -1652,10 +1899,12 @@ check_events:
 	/*
 	 * Try to transfer events to user space. In case we get 0 events and
 	 * there's still timeout left over, we go trying again in search of
-	 * more luck.
+	 * more luck. Entries of the shared ring of an EPOLL_USERPOLL instance
+	 * are not copied: return 0 and let userspace reap them.
 	 */
 	if (!res && eavail &&
-	    !(res = ep_send_events(ep, events, maxevents)) && !timed_out)
+	    !(res = ep_send_events(ep, events, maxevents)) && !timed_out &&
+	    !ep_uring_pending(ep))
 		goto fetch_events;
 
 	return res;
@@ -1759,25 +2008,26 @@ static void clear_tfile_check_list(void)
 }
 
 /*
- * Open an eventpoll file descriptor.
+ * Open an eventpoll file descriptor. @size is the number of items of an
+ * EPOLL_USERPOLL instance.
  */
-SYSCALL_DEFINE1(epoll_create1, int, flags)
+static int do_epoll_create(int flags, int size)
 {
 	int error, fd;
 	struct eventpoll *ep = NULL;
 	struct file *file;
 
-	/* Check the EPOLL_* constant for consistency.  */
-	BUILD_BUG_ON(EPOLL_CLOEXEC != O_CLOEXEC);
-
-	if (flags & ~EPOLL_CLOEXEC)
-		return -EINVAL;
 	/*
 	 * Create the internal data structure ("struct eventpoll").
 	 */
 	error = ep_alloc(&ep);
 	if (error < 0)
 		return error;
+	if (flags & EPOLL_USERPOLL) {
+		error = ep_userpoll_alloc(ep, size);
+		if (error)
+			goto out_free_ep;
+	}
 	/*
 	 * Creates all the items needed to setup an eventpoll file. That is,
 	 * a file structure and a free file descriptor.
@@ -1804,68 +2054,178 @@ out_free_ep:
 	return error;
 }
 
-SYSCALL_DEFINE1(epoll_create, int, size)
+SYSCALL_DEFINE1(epoll_create1, int, flags)
 {
-	if (size <= 0)
+	/* Check the EPOLL_* constant for consistency.  */
+	BUILD_BUG_ON(EPOLL_CLOEXEC != O_CLOEXEC);
+
+	if (flags & ~EPOLL_CLOEXEC)
 		return -EINVAL;
 
-	return sys_epoll_create1(0);
+	return do_epoll_create(flags, 0);
 }
 
 /*
- * The following function implements the controller interface for
- * the eventpoll file that enables the insertion/removal/change of
- * file descriptors inside the interest set.
+ * Same as epoll_create1(), with EPOLL_USERPOLL to share the ready events
+ * with userspace through a ring of @size items that the caller maps with
+ * mmap(2). Without EPOLL_USERPOLL, @size must be zero.
  */
-SYSCALL_DEFINE4(epoll_ctl, int, epfd, int, op, int, fd,
-		struct epoll_event __user *, event)
+SYSCALL_DEFINE2(epoll_create2, int, flags, int, size)
 {
-	int error;
-	int full_check = 0;
-	struct fd f, tf;
-	struct eventpoll *ep;
-	struct epitem *epi;
-	struct epoll_event epds;
-	struct eventpoll *tep = NULL;
+	BUILD_BUG_ON(EPOLL_USERPOLL & EPOLL_CLOEXEC);
 
-	error = -EFAULT;
-	if (ep_op_has_event(op) &&
-	    copy_from_user(&epds, event, sizeof(struct epoll_event)))
-		goto error_return;
+	if (flags & ~(EPOLL_CLOEXEC | EPOLL_USERPOLL))
+		return -EINVAL;
+	if (flags & EPOLL_USERPOLL) {
+		if (size <= 0 || size > EP_USERPOLL_MAX_ITEMS)
+			return -EINVAL;
+	} else if (size) {
+		return -EINVAL;
+	}
 
-	error = -EBADF;
-	f = fdget(epfd);
-	if (!f.file)
-		goto error_return;
+	return do_epoll_create(flags, size);
+}
 
-	/* Get the "struct file *" for the target file */
-	tf = fdget(fd);
-	if (!tf.file)
-		goto error_fput;
+SYSCALL_DEFINE1(epoll_create, int, size)
+{
+	if (size <= 0)
+		return -EINVAL;
 
-	/* The target file descriptor must support poll */
-	error = -EPERM;
-	if (!tf.file->f_op->poll)
-		goto error_tgt_fput;
+	return sys_epoll_create1(0);
+}
 
-	/* Check if EPOLLWAKEUP is allowed */
-	if (ep_op_has_event(op))
-		ep_take_care_of_epollwakeup(&epds);
+/*
+ * Checks shared by epoll_ctl() and epoll_ctl_batch() on the eventpoll file
+ * and the target file.
+ */
+static int ep_ctl_check_target(struct file *file, struct file *tfile)
+{
+	/* The target file descriptor must support poll */
+	if (!tfile->f_op->poll)
+		return -EPERM;
 
 	/*
 	 * We have to check that the file structure underneath the file descriptor
 	 * the user passed to us _is_ an eventpoll file. And also we do not permit
 	 * adding an epoll file descriptor inside itself.
 	 */
+	if (file == tfile || !is_file_epoll(file))
+		return -EINVAL;
+
+	return 0;
+}
+
+/*
+ * Checks the event mask of an EPOLL_CTL_ADD or EPOLL_CTL_MOD operation.
+ */
+static int ep_ctl_check_event(struct eventpoll *ep, int op, struct file *tfile,
+			      struct epoll_event *epds)
+{
+	/*
+	 * Events published in the shared ring are not polled again, so an
+	 * EPOLL_USERPOLL instance only supports edge-triggered items, and it
+	 * has no ready list walk to keep the system awake for EPOLLWAKEUP.
+	 */
+	if (ep_userpoll(ep) &&
+	    (epds->events & (EPOLLET | EPOLLWAKEUP)) != EPOLLET)
+		return -EINVAL;
+
+	/*
+	 * EPOLLEXCLUSIVE can only be set on add, and only for the events a
+	 * wakeup of a single waiter makes sense for. Exclusive items cannot
+	 * be modified later, nor point to nested epoll files.
+	 */
+	if (epds->events & EPOLLEXCLUSIVE) {
+		if (op == EPOLL_CTL_MOD)
+			return -EINVAL;
+		if (is_file_epoll(tfile) ||
+		    (epds->events & ~EPOLLEXCLUSIVE_OK_BITS))
+			return -EINVAL;
+	}
+
+	return 0;
+}
+
+/*
+ * Applies a single control operation to the interest set. Must be called
+ * with "ep->mtx" held (and "epmutex" too, if @full_check is set).
+ */
+static int ep_ctl_locked(struct eventpoll *ep, int op, struct file *tfile,
+			 int fd, struct epoll_event *epds, int full_check)
+{
+	struct epitem *epi;
+	int error;
+
+	/*
+	 * Try to lookup the file inside our RB tree, Since we grabbed "mtx"
+	 * above, we can be sure to be able to use the item looked up by
+	 * ep_find() till we release the mutex.
+	 */
+	epi = ep_find(ep, tfile, fd);
+
+	error = ep_op_has_event(op) ? ep_ctl_check_event(ep, op, tfile, epds) : 0;
+	if (error) {
+		if (full_check)
+			clear_tfile_check_list();
+		return error;
+	}
+
 	error = -EINVAL;
-	if (f.file == tf.file || !is_file_epoll(f.file))
-		goto error_tgt_fput;
+	switch (op) {
+	case EPOLL_CTL_ADD:
+		if (!epi) {
+			epds->events |= POLLERR | POLLHUP;
+			error = ep_insert(ep, epds, tfile, fd, full_check);
+		} else
+			error = -EEXIST;
+		if (full_check)
+			clear_tfile_check_list();
+		break;
+	case EPOLL_CTL_DEL:
+		if (epi)
+			error = ep_remove(ep, epi);
+		else
+			error = -ENOENT;
+		break;
+	case EPOLL_CTL_MOD:
+		if (epi) {
+			if (!(epi->event.events & EPOLLEXCLUSIVE)) {
+				epds->events |= POLLERR | POLLHUP;
+				error = ep_modify(ep, epi, epds);
+			}
+		} else
+			error = -ENOENT;
+		break;
+	}
+	return error;
+}
+
+/*
+ * Applies one epoll_ctl() operation to the epoll file @file, on the target
+ * file @tfile that was found under the descriptor @fd. The callers hold
+ * their own references to both files.
+ */
+static int do_epoll_ctl_file(struct file *file, int op, struct file *tfile,
+			     int fd, struct epoll_event *epds)
+{
+	int error;
+	int full_check = 0;
+	struct eventpoll *ep;
+	struct eventpoll *tep = NULL;
+
+	error = ep_ctl_check_target(file, tfile);
+	if (error)
+		return error;
+
+	/* Check if EPOLLWAKEUP is allowed */
+	if (ep_op_has_event(op))
+		ep_take_care_of_epollwakeup(epds);
 
 	/*
 	 * At this point it is safe to assume that the "private_data" contains
 	 * our own data structure.
 	 */
-	ep = f.file->private_data;
+	ep = file->private_data;
 
 	/*
 	 * When we insert an epoll file descriptor, inside another epoll file
@@ -1884,68 +2244,58 @@ SYSCALL_DEFINE4(epoll_ctl, int, epfd, int, op, int, fd,
 	 */
 	mutex_lock_nested(&ep->mtx, 0);
 	if (op == EPOLL_CTL_ADD) {
-		if (!list_empty(&f.file->f_ep_links) ||
-						is_file_epoll(tf.file)) {
+		if (!list_empty(&file->f_ep_links) ||
+						is_file_epoll(tfile)) {
 			full_check = 1;
 			mutex_unlock(&ep->mtx);
 			mutex_lock(&epmutex);
-			if (is_file_epoll(tf.file)) {
+			if (is_file_epoll(tfile)) {
 				error = -ELOOP;
-				if (ep_loop_check(ep, tf.file) != 0) {
+				if (ep_loop_check(ep, tfile) != 0) {
 					clear_tfile_check_list();
-					goto error_tgt_fput;
+					goto error_unlock;
 				}
 			} else
-				list_add(&tf.file->f_tfile_llink,
+				list_add(&tfile->f_tfile_llink,
 							&tfile_check_list);
 			mutex_lock_nested(&ep->mtx, 0);
-			if (is_file_epoll(tf.file)) {
-				tep = tf.file->private_data;
+			if (is_file_epoll(tfile)) {
+				tep = tfile->private_data;
 				mutex_lock_nested(&tep->mtx, 1);
 			}
 		}
 	}
 
-	/*
-	 * Try to lookup the file inside our RB tree, Since we grabbed "mtx"
-	 * above, we can be sure to be able to use the item looked up by
-	 * ep_find() till we release the mutex.
-	 */
-	epi = ep_find(ep, tf.file, fd);
+	error = ep_ctl_locked(ep, op, tfile, fd, epds, full_check);
 
-	error = -EINVAL;
-	switch (op) {
-	case EPOLL_CTL_ADD:
-		if (!epi) {
-			epds.events |= POLLERR | POLLHUP;
-			error = ep_insert(ep, &epds, tf.file, fd, full_check);
-		} else
-			error = -EEXIST;
-		if (full_check)
-			clear_tfile_check_list();
-		break;
-	case EPOLL_CTL_DEL:
-		if (epi)
-			error = ep_remove(ep, epi);
-		else
-			error = -ENOENT;
-		break;
-	case EPOLL_CTL_MOD:
-		if (epi) {
-			epds.events |= POLLERR | POLLHUP;
-			error = ep_modify(ep, epi, &epds);
-		} else
-			error = -ENOENT;
-		break;
-	}
 	if (tep != NULL)
 		mutex_unlock(&tep->mtx);
 	mutex_unlock(&ep->mtx);
 
-error_tgt_fput:
+error_unlock:
 	if (full_check)
 		mutex_unlock(&epmutex);
 
+	return error;
+}
+
+static int do_epoll_ctl(int epfd, int op, int fd, struct epoll_event *epds)
+{
+	int error;
+	struct fd f, tf;
+
+	error = -EBADF;
+	f = fdget(epfd);
+	if (!f.file)
+		goto error_return;
+
+	/* Get the "struct file *" for the target file */
+	tf = fdget(fd);
+	if (!tf.file)
+		goto error_fput;
+
+	error = do_epoll_ctl_file(f.file, op, tf.file, fd, epds);
+
 	fdput(tf);
 error_fput:
 	fdput(f);
@@ -1954,6 +2304,137 @@ error_return:
 	return error;
 }
 
+/*
+ * The following function implements the controller interface for
+ * the eventpoll file that enables the insertion/removal/change of
+ * file descriptors inside the interest set.
+ */
+SYSCALL_DEFINE4(epoll_ctl, int, epfd, int, op, int, fd,
+		struct epoll_event __user *, event)
+{
+	struct epoll_event epds;
+
+	if (ep_op_has_event(op) &&
+	    copy_from_user(&epds, event, sizeof(struct epoll_event)))
+		return -EFAULT;
+
+	return do_epoll_ctl(epfd, op, fd, &epds);
+}
+
+/*
+ * Runs one command of an epoll_ctl_batch() chunk. Called with "ep->mtx"
+ * held, which may be dropped and re-acquired for the rare additions that
+ * need the full loop and path check under "epmutex".
+ */
+static int ep_ctl_batch_one(struct file *file, struct eventpoll *ep,
+			    struct epoll_ctl_cmd *cmd)
+{
+	struct epoll_event epds;
+	struct fd tf;
+	int error;
+
+	if (cmd->flags)
+		return -EINVAL;
+
+	epds.events = cmd->events;
+	epds.data = cmd->data;
+
+	tf = fdget(cmd->fd);
+	if (!tf.file)
+		return -EBADF;
+
+	if (cmd->op == EPOLL_CTL_ADD &&
+	    (!list_empty(&file->f_ep_links) || is_file_epoll(tf.file))) {
+		/*
+		 * Stay on the epoll file the batch holds a reference to:
+		 * the descriptor may be closed and reused once "ep->mtx"
+		 * is dropped.
+		 */
+		mutex_unlock(&ep->mtx);
+		error = do_epoll_ctl_file(file, cmd->op, tf.file, cmd->fd,
+					  &epds);
+		fdput(tf);
+		mutex_lock_nested(&ep->mtx, 0);
+		return error;
+	}
+
+	error = ep_ctl_check_target(file, tf.file);
+	if (!error) {
+		if (ep_op_has_event(cmd->op))
+			ep_take_care_of_epollwakeup(&epds);
+		error = ep_ctl_locked(ep, cmd->op, tf.file, cmd->fd, &epds, 0);
+	}
+	fdput(tf);
+
+	return error;
+}
+
+/*
+ * Batched version of epoll_ctl(). The commands are copied in chunks of
+ * EP_CTL_BATCH_CHUNK entries and every chunk is applied with a single
+ * acquisition of "ep->mtx". The result of each command is stored in its
+ * "result" field. Returns the number of commands processed, which is
+ * less than @ncmds only if the command array could not be accessed.
+ */
+SYSCALL_DEFINE4(epoll_ctl_batch, int, epfd, int, flags, int, ncmds,
+		struct epoll_ctl_cmd __user *, cmds)
+{
+	struct epoll_ctl_cmd *kcmds;
+	struct eventpoll *ep;
+	struct fd f;
+	int done = 0, error;
+	int i, n;
+
+	if (flags || ncmds < 0)
+		return -EINVAL;
+	if (!ncmds)
+		return 0;
+
+	f = fdget(epfd);
+	if (!f.file)
+		return -EBADF;
+
+	error = -EINVAL;
+	if (!is_file_epoll(f.file))
+		goto error_fput;
+	ep = f.file->private_data;
+
+	error = -ENOMEM;
+	kcmds = kmalloc(EP_CTL_BATCH_CHUNK * sizeof(*kcmds), GFP_KERNEL);
+	if (!kcmds)
+		goto error_fput;
+
+	while (done < ncmds) {
+		n = min_t(int, ncmds - done, EP_CTL_BATCH_CHUNK);
+		if (copy_from_user(kcmds, cmds + done, n * sizeof(*kcmds)))
+			break;
+
+		mutex_lock_nested(&ep->mtx, 0);
+		for (i = 0; i < n; i++)
+			kcmds[i].result = ep_ctl_batch_one(f.file, ep,
+							   &kcmds[i]);
+		mutex_unlock(&ep->mtx);
+
+		/*
+		 * The commands have been applied already, so report them as
+		 * processed even if a result cannot be stored.
+		 */
+		for (i = 0; i < n; i++)
+			if (put_user(kcmds[i].result, &cmds[done + i].result))
+				break;
+		done += n;
+		if (i < n || fatal_signal_pending(current))
+			break;
+		cond_resched();
+	}
+	kfree(kcmds);
+
+	error = done ? done : -EFAULT;
+error_fput:
+	fdput(f);
+	return error;
+}
+
 /*
  * Implement the event wait interface for the eventpoll file. It is the kernel
  * part of the user space epoll_wait(2).
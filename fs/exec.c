@@ -1590,6 +1590,7 @@ static int do_execveat_common(int fd, struct filename *filename,
 	current->in_execve = 0;
 	acct_update_integrals(current);
 	task_numa_free(current);
+	rseq_execve(current);
 	free_bprm(bprm);
 	kfree(pathbuf);
 	putname(filename);
@@ -227,6 +227,9 @@ static const struct vm_operations_struct ext4_dax_vm_ops = {
 static const struct vm_operations_struct ext4_file_vm_ops = {
 	.fault		= filemap_fault,
 	.map_pages	= filemap_map_pages,
+#ifdef CONFIG_TRANSPARENT_HUGE_PAGECACHE
+	.pmd_fault	= filemap_pmd_fault,
+#endif
 	.page_mkwrite   = ext4_page_mkwrite,
 };
 
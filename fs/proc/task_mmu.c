@@ -69,6 +69,18 @@ void task_mem(struct seq_file *m, struct mm_struct *mm)
 		ptes >> 10,
 		pmds >> 10,
 		swap << (PAGE_SHIFT-10));
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	seq_printf(m,
+		"THP_collapsed:\t%lu\n"
+		"THP_collapse_requests:\t%lu\n"
+		"THP_collapse_wait_avg:\t%llu us\n"
+		"THP_collapse_wait_max:\t%llu us\n",
+		mm->thp_collapse.collapsed,
+		mm->thp_collapse.requests,
+		div64_u64(mm->thp_collapse.wait_ns,
+			  max(mm->thp_collapse.requests, 1UL)) / NSEC_PER_USEC,
+		div_u64(mm->thp_collapse.max_wait_ns, NSEC_PER_USEC));
+#endif
 }
 
 unsigned long task_vsize(struct mm_struct *mm)
@@ -515,7 +527,9 @@ static void smaps_pmd_entry(pmd_t *pmd, unsigned long addr,
 	page = follow_trans_huge_pmd(vma, addr, pmd, FOLL_DUMP);
 	if (IS_ERR_OR_NULL(page))
 		return;
-	mss->anonymous_thp += HPAGE_PMD_SIZE;
+	/* page cache can be mapped by huge pmds too */
+	if (PageAnon(page))
+		mss->anonymous_thp += HPAGE_PMD_SIZE;
 	smaps_account(mss, page, HPAGE_PMD_SIZE,
 			pmd_young(*pmd), pmd_dirty(*pmd));
 }
@@ -57,6 +57,9 @@ struct blk_mq_hw_ctx {
 
 	atomic_t		nr_active;
 
+	unsigned long		poll_invoked;
+	unsigned long		poll_success;
+
 	struct blk_mq_cpu_notifier	cpu_notifier;
 	struct kobject		kobj;
 };
@@ -93,6 +96,7 @@ typedef int (init_request_fn)(void *, struct request *, unsigned int,
 		unsigned int, unsigned int);
 typedef void (exit_request_fn)(void *, struct request *, unsigned int,
 		unsigned int);
+typedef int (poll_fn)(struct blk_mq_hw_ctx *);
 
 typedef void (busy_iter_fn)(struct blk_mq_hw_ctx *, struct request *, void *,
 		bool);
@@ -135,6 +139,13 @@ struct blk_mq_ops {
 	 */
 	init_request_fn		*init_request;
 	exit_request_fn		*exit_request;
+
+	/*
+	 * Called to reap completions from a hardware queue without waiting
+	 * for its interrupt.  Returns > 0 if requests were completed, 0 if
+	 * none were ready and < 0 if polling is not possible right now.
+	 */
+	poll_fn			*poll;
 };
 
 enum {
@@ -55,6 +55,9 @@ union futex_key {
 #ifdef CONFIG_FUTEX
 extern void exit_robust_list(struct task_struct *curr);
 extern void exit_pi_state_list(struct task_struct *curr);
+extern void futex_mm_release(struct mm_struct *mm);
+extern int futex_hash_prctl(unsigned long arg2, unsigned long arg3,
+			    unsigned long arg4);
 #ifdef CONFIG_HAVE_FUTEX_CMPXCHG
 #define futex_cmpxchg_enabled 1
 #else
@@ -67,5 +70,13 @@ static inline void exit_robust_list(struct task_struct *curr)
 static inline void exit_pi_state_list(struct task_struct *curr)
 {
 }
+static inline void futex_mm_release(struct mm_struct *mm)
+{
+}
+static inline int futex_hash_prctl(unsigned long arg2, unsigned long arg3,
+				   unsigned long arg4)
+{
+	return -EINVAL;
+}
 #endif
 #endif
@@ -318,6 +318,30 @@ static inline struct page *alloc_pages_exact_node(int nid, gfp_t gfp_mask,
 	return __alloc_pages(gfp_mask, order, node_zonelist(nid, gfp_mask));
 }
 
+unsigned long __alloc_pages_bulk(gfp_t gfp_mask, struct zonelist *zonelist,
+				 nodemask_t *nodemask, unsigned long nr_pages,
+				 struct list_head *page_list,
+				 struct page **page_array);
+
+/* Bulk allocate order-0 pages on the local node, see __alloc_pages_bulk() */
+static inline unsigned long
+alloc_pages_bulk_list(gfp_t gfp_mask, unsigned long nr_pages,
+		      struct list_head *list)
+{
+	return __alloc_pages_bulk(gfp_mask,
+				  node_zonelist(numa_mem_id(), gfp_mask), NULL,
+				  nr_pages, list, NULL);
+}
+
+static inline unsigned long
+alloc_pages_bulk_array(gfp_t gfp_mask, unsigned long nr_pages,
+		       struct page **page_array)
+{
+	return __alloc_pages_bulk(gfp_mask,
+				  node_zonelist(numa_mem_id(), gfp_mask), NULL,
+				  nr_pages, NULL, page_array);
+}
+
 #ifdef CONFIG_NUMA
 extern struct page *alloc_pages_current(gfp_t gfp_mask, unsigned order);
 
@@ -381,6 +405,7 @@ extern void free_kmem_pages(unsigned long addr, unsigned int order);
 
 void page_alloc_init(void);
 void drain_zone_pages(struct zone *zone, struct per_cpu_pages *pcp);
+bool decay_pcp_high(struct zone *zone, struct per_cpu_pages *pcp);
 void drain_all_pages(struct zone *zone);
 void drain_local_pages(struct zone *zone);
 
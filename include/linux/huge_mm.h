@@ -33,6 +33,30 @@ extern int move_huge_pmd(struct vm_area_struct *vma,
 extern int change_huge_pmd(struct vm_area_struct *vma, pmd_t *pmd,
 			unsigned long addr, pgprot_t newprot,
 			int prot_numa);
+#ifdef CONFIG_TRANSPARENT_HUGE_PAGECACHE
+extern int do_set_huge_pmd(struct vm_area_struct *vma, unsigned long haddr,
+			   pmd_t *pmd, struct page *page);
+extern pmd_t *page_check_address_file_pmd(struct page *page,
+					  struct mm_struct *mm,
+					  unsigned long address,
+					  spinlock_t **ptl);
+extern void split_huge_file_pmd(struct page *page,
+				struct vm_area_struct *vma,
+				unsigned long address);
+#else
+static inline pmd_t *page_check_address_file_pmd(struct page *page,
+						 struct mm_struct *mm,
+						 unsigned long address,
+						 spinlock_t **ptl)
+{
+	return NULL;
+}
+static inline void split_huge_file_pmd(struct page *page,
+				       struct vm_area_struct *vma,
+				       unsigned long address)
+{
+}
+#endif
 
 enum transparent_hugepage_flag {
 	TRANSPARENT_HUGEPAGE_FLAG,
@@ -122,6 +146,9 @@ extern void split_huge_page_pmd_mm(struct mm_struct *mm, unsigned long address,
 #endif
 extern int hugepage_madvise(struct vm_area_struct *vma,
 			    unsigned long *vm_flags, int advice);
+extern int madvise_collapse(struct vm_area_struct *vma,
+			    struct vm_area_struct **prev,
+			    unsigned long start, unsigned long end);
 extern void __vma_adjust_trans_huge(struct vm_area_struct *vma,
 				    unsigned long start,
 				    unsigned long end,
@@ -143,7 +170,8 @@ static inline void vma_adjust_trans_huge(struct vm_area_struct *vma,
 					 unsigned long end,
 					 long adjust_next)
 {
-	if (!vma->anon_vma || vma->vm_ops)
+	/* anonymous THP, or page cache mapped by ->pmd_fault */
+	if (vma->vm_ops ? !vma->vm_ops->pmd_fault : !vma->anon_vma)
 		return;
 	__vma_adjust_trans_huge(vma, start, end, adjust_next);
 }
@@ -195,6 +223,13 @@ static inline int hugepage_madvise(struct vm_area_struct *vma,
 	BUG();
 	return 0;
 }
+static inline int madvise_collapse(struct vm_area_struct *vma,
+				   struct vm_area_struct **prev,
+				   unsigned long start, unsigned long end)
+{
+	BUG();
+	return 0;
+}
 static inline void vma_adjust_trans_huge(struct vm_area_struct *vma,
 					 unsigned long start,
 					 unsigned long end,
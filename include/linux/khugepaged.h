@@ -8,6 +8,7 @@ extern int __khugepaged_enter(struct mm_struct *mm);
 extern void __khugepaged_exit(struct mm_struct *mm);
 extern int khugepaged_enter_vma_merge(struct vm_area_struct *vma,
 				      unsigned long vm_flags);
+extern int khugepaged_collapse_mm(struct mm_struct *mm);
 
 #define khugepaged_enabled()					       \
 	(transparent_hugepage_flags &				       \
@@ -65,6 +66,10 @@ static inline int khugepaged_enter_vma_merge(struct vm_area_struct *vma,
 {
 	return 0;
 }
+static inline int khugepaged_collapse_mm(struct mm_struct *mm)
+{
+	return -EINVAL;
+}
 #endif /* CONFIG_TRANSPARENT_HUGEPAGE */
 
 #endif /* _LINUX_KHUGEPAGED_H */
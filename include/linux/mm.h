@@ -247,6 +247,9 @@ struct vm_operations_struct {
 	void (*close)(struct vm_area_struct * area);
 	int (*fault)(struct vm_area_struct *vma, struct vm_fault *vmf);
 	void (*map_pages)(struct vm_area_struct *vma, struct vm_fault *vmf);
+	/* map a whole huge page aligned range with one pmd, if possible */
+	int (*pmd_fault)(struct vm_area_struct *vma, unsigned long address,
+			 pmd_t *pmd, unsigned int flags);
 
 	/* notification that a previously read-only page is about to become
 	 * writable, if an error is returned it will cause a SIGBUS */
@@ -1173,6 +1176,46 @@ static inline int fixup_user_fault(struct task_struct *tsk,
 }
 #endif
 
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+/*
+ * Changes to what the speculative fault path reads from a vma (its bounds,
+ * flags and page protection) or to the page tables it covers are bracketed
+ * by vm_write_begin() and vm_write_end(), with mmap_sem held for writing,
+ * or for reading with the whole vma write locked in mm->mmap_range.
+ * A vma taken off the tree is left odd for good.
+ */
+static inline void vm_write_begin(struct vm_area_struct *vma)
+{
+	raw_write_seqcount_begin(&vma->vm_sequence);
+}
+
+static inline void vm_write_end(struct vm_area_struct *vma)
+{
+	raw_write_seqcount_end(&vma->vm_sequence);
+}
+
+extern struct vm_area_struct *get_vma(struct mm_struct *mm,
+				      unsigned long addr);
+extern void put_vma(struct vm_area_struct *vma);
+extern int handle_speculative_fault(struct mm_struct *mm,
+				    unsigned long address, unsigned int flags);
+#else
+static inline void vm_write_begin(struct vm_area_struct *vma)
+{
+}
+
+static inline void vm_write_end(struct vm_area_struct *vma)
+{
+}
+
+static inline int handle_speculative_fault(struct mm_struct *mm,
+					   unsigned long address,
+					   unsigned int flags)
+{
+	return VM_FAULT_RETRY;
+}
+#endif
+
 extern int access_process_vm(struct task_struct *tsk, unsigned long addr, void *buf, int len, int write);
 extern int access_remote_vm(struct mm_struct *mm, unsigned long addr,
 		void *buf, int len, int write);
@@ -1916,6 +1959,8 @@ extern void truncate_inode_pages_final(struct address_space *);
 /* generic vm_area_ops exported for stackable file systems */
 extern int filemap_fault(struct vm_area_struct *, struct vm_fault *);
 extern void filemap_map_pages(struct vm_area_struct *vma, struct vm_fault *vmf);
+extern int filemap_pmd_fault(struct vm_area_struct *vma, unsigned long address,
+			     pmd_t *pmd, unsigned int flags);
 extern int filemap_page_mkwrite(struct vm_area_struct *vma, struct vm_fault *vmf);
 
 /* mm/page-writeback.c */
@@ -100,4 +100,74 @@ static __always_inline enum lru_list page_lru(struct page *page)
 	return lru;
 }
 
+/*
+ * The lruvec of an LRU page can change under us until its lru_lock is
+ * held: a page is only moved to another memcg with the lock of the
+ * lruvec it is leaving held.  So look it up, lock it, and try again if
+ * the page was moved in the meantime.  The lruvec of a memcg is freed
+ * after an RCU grace period, which keeps a stale one around long enough
+ * for us to take and drop its lock.
+ */
+static inline struct lruvec *lock_page_lruvec_irq(struct page *page)
+{
+	struct zone *zone = page_zone(page);
+	struct lruvec *lruvec;
+
+	rcu_read_lock();
+	for (;;) {
+		lruvec = mem_cgroup_page_lruvec(page, zone);
+		spin_lock_irq(&lruvec->lru_lock);
+		if (likely(lruvec == mem_cgroup_page_lruvec(page, zone)))
+			break;
+		spin_unlock_irq(&lruvec->lru_lock);
+	}
+	rcu_read_unlock();
+	return lruvec;
+}
+
+static inline struct lruvec *lock_page_lruvec_irqsave(struct page *page,
+						      unsigned long *flags)
+{
+	struct zone *zone = page_zone(page);
+	struct lruvec *lruvec;
+
+	rcu_read_lock();
+	for (;;) {
+		lruvec = mem_cgroup_page_lruvec(page, zone);
+		spin_lock_irqsave(&lruvec->lru_lock, *flags);
+		if (likely(lruvec == mem_cgroup_page_lruvec(page, zone)))
+			break;
+		spin_unlock_irqrestore(&lruvec->lru_lock, *flags);
+	}
+	rcu_read_unlock();
+	return lruvec;
+}
+
+/*
+ * For walking a batch of pages: keep @locked if @page belongs to it,
+ * otherwise drop it (if any) and lock the lruvec of @page instead.
+ */
+static inline struct lruvec *relock_page_lruvec_irq(struct page *page,
+						    struct lruvec *locked)
+{
+	if (locked) {
+		if (mem_cgroup_page_lruvec(page, page_zone(page)) == locked)
+			return locked;
+		spin_unlock_irq(&locked->lru_lock);
+	}
+	return lock_page_lruvec_irq(page);
+}
+
+static inline struct lruvec *relock_page_lruvec_irqsave(struct page *page,
+						struct lruvec *locked,
+						unsigned long *flags)
+{
+	if (locked) {
+		if (mem_cgroup_page_lruvec(page, page_zone(page)) == locked)
+			return locked;
+		spin_unlock_irqrestore(&locked->lru_lock, *flags);
+	}
+	return lock_page_lruvec_irqsave(page, flags);
+}
+
 #endif
@@ -8,6 +8,8 @@
 #include <linux/spinlock.h>
 #include <linux/rbtree.h>
 #include <linux/rwsem.h>
+#include <linux/range_lock.h>
+#include <linux/seqlock.h>
 #include <linux/completion.h>
 #include <linux/cpumask.h>
 #include <linux/uprobes.h>
@@ -21,6 +23,7 @@
 #define AT_VECTOR_SIZE (2*(AT_VECTOR_SIZE_ARCH + AT_VECTOR_SIZE_BASE + 1))
 
 struct address_space;
+struct futex_private_hash;
 struct mem_cgroup;
 
 #define USE_SPLIT_PTE_PTLOCKS	(NR_CPUS >= CONFIG_SPLIT_PTLOCK_CPUS)
@@ -125,7 +128,7 @@ struct page {
 	/* Third double word block */
 	union {
 		struct list_head lru;	/* Pageout list, eg. active_list
-					 * protected by zone->lru_lock !
+					 * protected by lruvec->lru_lock !
 					 * Can be used as a generic list
 					 * by the page owner.
 					 */
@@ -331,6 +334,10 @@ struct vm_area_struct {
 #ifdef CONFIG_NUMA
 	struct mempolicy *vm_policy;	/* NUMA policy for the VMA */
 #endif
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+	seqcount_t vm_sequence;		/* see vm_write_begin() */
+	atomic_t vm_ref_count;		/* see get_vma() */
+#endif
 };
 
 struct core_thread {
@@ -364,10 +371,23 @@ struct mm_rss_stat {
 	atomic_long_t count[NR_MM_COUNTERS];
 };
 
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+/* What khugepaged did for an mm, shown in /proc/<pid>/status */
+struct thp_collapse_stat {
+	unsigned long collapsed;	/* huge pages collapsed */
+	unsigned long requests;		/* MADV_COLLAPSE/PR_THP_COLLAPSE served */
+	u64 wait_ns;			/* total time they took */
+	u64 max_wait_ns;		/* longest time one took */
+};
+#endif
+
 struct kioctx_table;
 struct mm_struct {
 	struct vm_area_struct *mmap;		/* list of VMAs */
 	struct rb_root mm_rb;
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+	rwlock_t mm_rb_lock;			/* mm_rb for speculative faults */
+#endif
 	u32 vmacache_seqnum;                   /* per-thread vmacache */
 #ifdef CONFIG_MMU
 	unsigned long (*get_unmapped_area) (struct file *filp,
@@ -389,6 +409,18 @@ struct mm_struct {
 
 	spinlock_t page_table_lock;		/* Protects page tables and some counters */
 	struct rw_semaphore mmap_sem;
+	/*
+	 * Lets mmap_sem readers change the flags, protection and page
+	 * tables of whole vmas: they write lock the range of the vmas, and
+	 * page faults read lock the page they fault on while any range is
+	 * write locked.  Otherwise faults are only counted, per cpu, and a
+	 * new writer waits for them.  Anything changing the vma tree still
+	 * takes mmap_sem for writing.
+	 */
+	struct range_lock_tree mmap_range;
+	atomic_t mmap_range_writers;
+	int __percpu *mmap_range_faults;
+	wait_queue_head_t mmap_range_wait;
 
 	struct list_head mmlist;		/* List of maybe swapped mm's.	These are globally strung
 						 * together off init_mm.mmlist, and are protected
@@ -427,6 +459,13 @@ struct mm_struct {
 
 	unsigned long flags; /* Must use atomic bitops to access the bits */
 
+#ifdef CONFIG_MEMBARRIER
+	atomic_t membarrier_state;	/* MEMBARRIER_STATE_* flags */
+#endif
+#ifdef CONFIG_FUTEX
+	struct futex_private_hash *futex_hash;	/* private futex buckets */
+	unsigned long futex_hash_slots;		/* PR_FUTEX_HASH setting */
+#endif
 	struct core_state *core_state; /* coredumping support */
 #ifdef CONFIG_AIO
 	spinlock_t			ioctx_lock;
@@ -454,6 +493,9 @@ struct mm_struct {
 #if defined(CONFIG_TRANSPARENT_HUGEPAGE) && !USE_SPLIT_PMD_PTLOCKS
 	pgtable_t pmd_huge_pte; /* protected by page_table_lock */
 #endif
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	struct thp_collapse_stat thp_collapse;
+#endif
 #ifdef CONFIG_CPUMASK_OFFSTACK
 	struct cpumask cpumask_allocation;
 #endif
@@ -473,11 +515,19 @@ struct mm_struct {
 #endif
 #if defined(CONFIG_NUMA_BALANCING) || defined(CONFIG_COMPACTION)
 	/*
-	 * An operation with batched TLB flushing is going on. Anything that
-	 * can move process memory needs to flush the TLB when moving a
-	 * PROT_NONE or PROT_NUMA mapped page.
+	 * Number of operations with batched TLB flushing going on. Anything
+	 * that can move process memory needs to flush the TLB when moving a
+	 * PROT_NONE or PROT_NUMA mapped page.  More than one can be running
+	 * since mprotect() no longer always holds mmap_sem for writing.
+	 */
+	atomic_t tlb_flush_pending;
+#endif
+#ifdef CONFIG_ARCH_WANT_BATCHED_UNMAP_TLB_FLUSH
+	/*
+	 * Reclaim may have cleared ptes of this mm without flushing the
+	 * TLB yet: see flush_tlb_batched_pending().
 	 */
-	bool tlb_flush_pending;
+	bool tlb_flush_batched;
 #endif
 	struct uprobes_state uprobes_state;
 #ifdef CONFIG_X86_INTEL_MPX
@@ -510,11 +560,15 @@ static inline cpumask_t *mm_cpumask(struct mm_struct *mm)
 static inline bool mm_tlb_flush_pending(struct mm_struct *mm)
 {
 	barrier();
-	return mm->tlb_flush_pending;
+	return atomic_read(&mm->tlb_flush_pending) > 0;
 }
-static inline void set_tlb_flush_pending(struct mm_struct *mm)
+static inline void init_tlb_flush_pending(struct mm_struct *mm)
 {
-	mm->tlb_flush_pending = true;
+	atomic_set(&mm->tlb_flush_pending, 0);
+}
+static inline void inc_tlb_flush_pending(struct mm_struct *mm)
+{
+	atomic_inc(&mm->tlb_flush_pending);
 
 	/*
 	 * Guarantee that the tlb_flush_pending store does not leak into the
@@ -522,21 +576,24 @@ static inline void set_tlb_flush_pending(struct mm_struct *mm)
 	 */
 	smp_mb__before_spinlock();
 }
-/* Clearing is done after a TLB flush, which also provides a barrier. */
-static inline void clear_tlb_flush_pending(struct mm_struct *mm)
+/* Decrementing is done after a TLB flush, which also provides a barrier. */
+static inline void dec_tlb_flush_pending(struct mm_struct *mm)
 {
 	barrier();
-	mm->tlb_flush_pending = false;
+	atomic_dec(&mm->tlb_flush_pending);
 }
 #else
 static inline bool mm_tlb_flush_pending(struct mm_struct *mm)
 {
 	return false;
 }
-static inline void set_tlb_flush_pending(struct mm_struct *mm)
+static inline void init_tlb_flush_pending(struct mm_struct *mm)
+{
+}
+static inline void inc_tlb_flush_pending(struct mm_struct *mm)
 {
 }
-static inline void clear_tlb_flush_pending(struct mm_struct *mm)
+static inline void dec_tlb_flush_pending(struct mm_struct *mm)
 {
 }
 #endif
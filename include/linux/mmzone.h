@@ -97,10 +97,10 @@ struct free_area {
 struct pglist_data;
 
 /*
- * zone->lock and zone->lru_lock are two of the hottest locks in the kernel.
- * So add a wild amount of padding here to ensure that they fall into separate
- * cachelines.  There are very few zone structures in the machine, so space
- * consumption is not a concern here.
+ * zone->lock and the lru_lock of zone->lruvec are two of the hottest locks in
+ * the kernel.  So add a wild amount of padding here to ensure that they fall
+ * into separate cachelines.  There are very few zone structures in the
+ * machine, so space consumption is not a concern here.
  */
 #if defined(CONFIG_SMP)
 struct zone_padding {
@@ -213,7 +213,14 @@ struct zone_reclaim_stat {
 	unsigned long		recent_scanned[2];
 };
 
+/*
+ * The LRU lists of pages of one zone charged to one memcg, or of the whole
+ * zone when memcg is disabled.  lru_lock protects the lists and the
+ * reclaim statistics; see lock_page_lruvec_irq() for finding the lruvec a
+ * page is on and taking its lock.
+ */
 struct lruvec {
+	spinlock_t lru_lock;
 	struct list_head lists[NR_LRU_LISTS];
 	struct zone_reclaim_stat reclaim_stat;
 #ifdef CONFIG_MEMCG
@@ -249,13 +256,33 @@ enum zone_watermarks {
 #define low_wmark_pages(z) (z->watermark[WMARK_LOW])
 #define high_wmark_pages(z) (z->watermark[WMARK_HIGH])
 
+/*
+ * The pcp-lists hold pages up to PAGE_ALLOC_COSTLY_ORDER, one list per
+ * order and migrate type.
+ */
+#define NR_PCP_LISTS (MIGRATE_PCPTYPES * (PAGE_ALLOC_COSTLY_ORDER + 1))
+
+/*
+ * high moves between high_min and high_max with the demand on the lists:
+ * it grows each time they run dry and have to be refilled from the buddy
+ * lists, and decays back every vmstat interval.  Only CPUs of the zone's
+ * own node get a high_max above high_min.
+ */
 struct per_cpu_pages {
 	int count;		/* number of pages in the list */
 	int high;		/* high watermark, emptying needed */
 	int batch;		/* chunk size for buddy add/remove */
+	int high_min;		/* range high adapts within */
+	int high_max;
+	u8 alloc_factor;	/* batch scaling for refills */
+	u8 free_factor;		/* batch scaling for frees over high */
+
+	unsigned long alloc_hit;	/* allocations served from the lists */
+	unsigned long alloc_miss;	/* allocations that refilled them */
+	unsigned long free_drain;	/* frees that took count over high */
 
-	/* Lists of pages, one per migrate type stored on the pcp-lists */
-	struct list_head lists[MIGRATE_PCPTYPES];
+	/* Lists of pages, one per migrate type and order on the pcp-lists */
+	struct list_head lists[NR_PCP_LISTS];
 };
 
 struct per_cpu_pageset {
@@ -488,7 +515,6 @@ struct zone {
 	/* Write-intensive fields used by page reclaim */
 
 	/* Fields commonly accessed by the page reclaim scanner */
-	spinlock_t		lru_lock;
 	struct lruvec		lruvec;
 
 	/* Evictions & activations on the inactive file list */
@@ -2460,6 +2460,8 @@ struct softnet_data {
 	unsigned int		time_squeeze;
 	unsigned int		cpu_collision;
 	unsigned int		received_rps;
+	unsigned int		skb_cache_hit;	/* NAPI skb heads from the cache */
+	unsigned int		skb_cache_miss;	/* and from the slab */
 #ifdef CONFIG_RPS
 	struct softnet_data	*rps_ipi_list;
 #endif
@@ -0,0 +1,67 @@
+/*
+ * Range reader/writer locks
+ *
+ * A range lock covers [start, last] of some address space.  Holders of
+ * overlapping ranges exclude each other unless both are readers; holders
+ * of disjoint ranges never do.  Waiters are served in arrival order, so a
+ * reader must not take a range overlapping one it already holds: a writer
+ * queued in between would deadlock them both.
+ *
+ * The struct range_lock describes one acquisition and usually lives on the
+ * stack of the task taking it.
+ */
+#ifndef _LINUX_RANGE_LOCK_H
+#define _LINUX_RANGE_LOCK_H
+
+#include <linux/rbtree.h>
+#include <linux/spinlock.h>
+#include <linux/types.h>
+
+struct task_struct;
+
+struct range_lock_tree {
+	struct rb_root root;
+	spinlock_t lock;
+	unsigned long seqnum;	/* arrival order of the next range */
+};
+
+struct range_lock {
+	struct rb_node rb;
+	unsigned long start;	/* First location in range */
+	unsigned long last;	/* Last location in range */
+	unsigned long __subtree_last;
+	struct task_struct *tsk;
+	unsigned long blocking_ranges;	/* conflicting ranges taken earlier */
+	unsigned long seqnum;
+	bool reader;
+};
+
+#define RANGE_LOCK_FULL		(~0UL)
+
+#define RANGE_LOCK_TREE_INIT(name)				\
+	{ .root = RB_ROOT, .lock = __SPIN_LOCK_UNLOCKED(name.lock) }
+
+static inline void range_lock_tree_init(struct range_lock_tree *tree)
+{
+	tree->root = RB_ROOT;
+	spin_lock_init(&tree->lock);
+	tree->seqnum = 0;
+}
+
+static inline void range_lock_init(struct range_lock *lock,
+				   unsigned long start, unsigned long last)
+{
+	lock->start = start;
+	lock->last = last;
+}
+
+extern void range_read_lock(struct range_lock_tree *tree,
+			    struct range_lock *lock);
+extern void range_read_unlock(struct range_lock_tree *tree,
+			      struct range_lock *lock);
+extern void range_write_lock(struct range_lock_tree *tree,
+			     struct range_lock *lock);
+extern void range_write_unlock(struct range_lock_tree *tree,
+			       struct range_lock *lock);
+
+#endif /* _LINUX_RANGE_LOCK_H */
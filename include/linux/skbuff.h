@@ -2206,6 +2206,11 @@ static inline struct sk_buff *napi_alloc_skb(struct napi_struct *napi,
 {
 	return __napi_alloc_skb(napi, length, GFP_ATOMIC);
 }
+void napi_consume_skb(struct sk_buff *skb, int budget);
+
+void __kfree_skb_defer(struct sk_buff *skb);
+void napi_skb_free_stolen_head(struct sk_buff *skb);
+void napi_skb_cache_drain(unsigned int cpu);
 
 /**
  * __dev_alloc_pages - allocate page for network Rx
@@ -11,7 +11,9 @@
 #ifndef _LINUX_SYSCALLS_H
 #define _LINUX_SYSCALLS_H
 
+struct aio_ring_params;
 struct epoll_event;
+struct epoll_ctl_cmd;
 struct iattr;
 struct inode;
 struct iocb;
@@ -36,6 +38,7 @@ struct old_utsname;
 struct pollfd;
 struct rlimit;
 struct rlimit64;
+struct rseq;
 struct rusage;
 struct sched_param;
 struct sched_attr;
@@ -507,6 +510,13 @@ asmlinkage long sys_io_submit(aio_context_t, long,
 				struct iocb __user * __user *);
 asmlinkage long sys_io_cancel(aio_context_t ctx_id, struct iocb __user *iocb,
 			      struct io_event __user *result);
+asmlinkage long sys_io_setup2(u32 nr_events, u32 flags,
+			      struct aio_ring_params __user *params,
+			      aio_context_t __user *ctx);
+asmlinkage long sys_io_ring_enter(aio_context_t ctx_id, u32 to_submit,
+				  u32 min_complete, u32 flags);
+asmlinkage long sys_io_ring_register(aio_context_t ctx_id, u32 opcode,
+				     void __user *arg, u32 nr_args);
 asmlinkage long sys_sendfile(int out_fd, int in_fd,
 			     off_t __user *offset, size_t count);
 asmlinkage long sys_sendfile64(int out_fd, int in_fd,
@@ -626,8 +636,11 @@ asmlinkage long sys_select(int n, fd_set __user *inp, fd_set __user *outp,
 asmlinkage long sys_old_select(struct sel_arg_struct __user *arg);
 asmlinkage long sys_epoll_create(int size);
 asmlinkage long sys_epoll_create1(int flags);
+asmlinkage long sys_epoll_create2(int flags, int size);
 asmlinkage long sys_epoll_ctl(int epfd, int op, int fd,
 				struct epoll_event __user *event);
+asmlinkage long sys_epoll_ctl_batch(int epfd, int flags, int ncmds,
+				struct epoll_ctl_cmd __user *cmds);
 asmlinkage long sys_epoll_wait(int epfd, struct epoll_event __user *events,
 				int maxevents, int timeout);
 asmlinkage long sys_epoll_pwait(int epfd, struct epoll_event __user *events,
@@ -885,5 +898,7 @@ asmlinkage long sys_execveat(int dfd, const char __user *filename,
 			const char __user *const __user *envp, int flags);
 
 asmlinkage long sys_membarrier(int cmd, int flags);
+asmlinkage long sys_rseq(struct rseq __user *rseq, u32 rseq_len,
+			 int flags, u32 sig);
 
 #endif
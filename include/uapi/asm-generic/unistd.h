@@ -711,9 +711,21 @@ __SYSCALL(__NR_bpf, sys_bpf)
 __SC_COMP(__NR_execveat, sys_execveat, compat_sys_execveat)
 #define __NR_membarrier 282
 __SYSCALL(__NR_membarrier, sys_membarrier)
+#define __NR_rseq 283
+__SYSCALL(__NR_rseq, sys_rseq)
+#define __NR_epoll_ctl_batch 284
+__SYSCALL(__NR_epoll_ctl_batch, sys_epoll_ctl_batch)
+#define __NR_epoll_create2 285
+__SYSCALL(__NR_epoll_create2, sys_epoll_create2)
+#define __NR_io_setup2 286
+__SYSCALL(__NR_io_setup2, sys_io_setup2)
+#define __NR_io_ring_enter 287
+__SYSCALL(__NR_io_ring_enter, sys_io_ring_enter)
+#define __NR_io_ring_register 288
+__SYSCALL(__NR_io_ring_register, sys_io_ring_register)
 
 #undef __NR_syscalls
-#define __NR_syscalls 283
+#define __NR_syscalls 289
 
 /*
  * All syscalls below here should go away really,
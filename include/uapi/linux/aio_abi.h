@@ -44,6 +44,12 @@ enum {
 	IOCB_CMD_NOOP = 6,
 	IOCB_CMD_PREADV = 7,
 	IOCB_CMD_PWRITEV = 8,
+	/*
+	 * Like PREAD/PWRITE, on a buffer registered with io_ring_register():
+	 * aio_buf and aio_nbytes must lie within buffer aio_buf_index.
+	 */
+	IOCB_CMD_PREAD_FIXED = 9,
+	IOCB_CMD_PWRITE_FIXED = 10,
 };
 
 /*
@@ -54,6 +60,73 @@ enum {
  */
 #define IOCB_FLAG_RESFD		(1 << 0)
 
+/*
+ * Valid flags for io_setup2().
+ *
+ * IOCTX_FLAG_SCQRING - Submit iocbs through a ring shared with userspace
+ *                      (see "struct aio_sq_ring") and io_ring_enter()
+ *                      instead of io_submit().  Buffered reads and writes
+ *                      and fsync are handed to kernel worker threads so
+ *                      that submission never blocks on them.
+ * IOCTX_FLAG_IOPOLL  - io_ring_enter() busy-polls for completions instead
+ *                      of sleeping, reaping O_DIRECT completions from the
+ *                      device itself where its queue has io_poll enabled.
+ *                      Requires IOCTX_FLAG_SCQRING.
+ */
+#define IOCTX_FLAG_SCQRING	(1 << 0)
+#define IOCTX_FLAG_IOPOLL	(1 << 1)
+
+/*
+ * Valid flags for io_ring_enter().
+ *
+ * IORING_FLAG_SUBMIT    - Submit up to "to_submit" iocbs from the ring.
+ * IORING_FLAG_GETEVENTS - Wait until at least "min_complete" events are
+ *                         in the completion ring.
+ */
+#define IORING_FLAG_SUBMIT	(1 << 0)
+#define IORING_FLAG_GETEVENTS	(1 << 1)
+
+/*
+ * io_ring_register() opcodes.
+ *
+ * IORING_REGISTER_BUFFERS - Pin the buffers of an array of "nr_args"
+ *                           struct iovec for use by the _FIXED commands.
+ */
+#define IORING_REGISTER_BUFFERS	0
+
+/*
+ * Submission ring of an IOCTX_FLAG_SCQRING context, mapped "sq_offset"
+ * bytes after the aio_context_t returned by io_setup2().  Userspace fills
+ * in iocbs in the array found "iocbs_offset" bytes after the start of this
+ * structure, stores their indexes in array[tail & (nr - 1)] and then
+ * advances tail.  The kernel advances head as it consumes the entries.
+ * Entries holding an index >= nr are skipped and counted in "dropped".
+ *
+ * Completions are posted to the regular event ring at the start of the
+ * context; the "obj" field of an io_event is the address of the iocb
+ * within the mapped array.
+ */
+struct aio_sq_ring {
+	__u32	head;		/* written by the kernel */
+	__u32	tail;		/* written by userspace */
+	__u32	nr;		/* number of entries, a power of two */
+	__u32	dropped;	/* invalid entries skipped by the kernel */
+	__u32	iocbs_offset;	/* offset of the iocb array */
+	__u32	reserved[11];
+	__u32	array[0];
+}; /* 64 bytes + ring size */
+
+/* Filled in by io_setup2(), all offsets are from the aio_context_t. */
+struct aio_ring_params {
+	__u32	sq_offset;	/* struct aio_sq_ring */
+	__u32	sq_entries;
+	__u32	cq_head;	/* __u32 head, written by userspace */
+	__u32	cq_tail;	/* __u32 tail, written by the kernel */
+	__u32	cq_events;	/* struct io_event array */
+	__u32	cq_entries;
+	__u32	reserved[2];
+};
+
 /* read() from /dev/aio returns these structures. */
 struct io_event {
 	__u64		data;		/* the data field from the iocb */
@@ -92,7 +165,10 @@ struct iocb {
 	__s64	aio_offset;
 
 	/* extra parameters */
-	__u64	aio_reserved2;	/* TODO: use this for a (struct sigevent *) */
+	union {
+		__u64	aio_reserved2;	/* TODO: use this for a (struct sigevent *) */
+		__u64	aio_buf_index;	/* registered buffer of _FIXED commands */
+	};
 
 	/* flags for the "struct iocb" */
 	__u32	aio_flags;
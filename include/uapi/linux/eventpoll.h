@@ -21,11 +21,23 @@
 /* Flags for epoll_create1.  */
 #define EPOLL_CLOEXEC O_CLOEXEC
 
+/* Flags for epoll_create2, in addition to EPOLL_CLOEXEC */
+#define EPOLL_USERPOLL 1
+
 /* Valid opcodes to issue to sys_epoll_ctl() */
 #define EPOLL_CTL_ADD 1
 #define EPOLL_CTL_DEL 2
 #define EPOLL_CTL_MOD 3
 
+/*
+ * Set exclusive wakeup mode for the target file descriptor: when several
+ * epoll instances watch the same file with this flag, an event wakes up
+ * only one of the instances that have a task waiting in epoll_wait().
+ * Only allowed on EPOLL_CTL_ADD, together with POLLIN, POLLOUT, POLLERR,
+ * POLLHUP, EPOLLWAKEUP and EPOLLET.
+ */
+#define EPOLLEXCLUSIVE (1 << 28)
+
 /*
  * Request the handling of system wakeup events so as to prevent system suspends
  * from happening while those events are being processed.
@@ -61,6 +73,72 @@ struct epoll_event {
 	__u64 data;
 } EPOLL_PACKED;
 
+/*
+ * One command of sys_epoll_ctl_batch(). The layout is the same for 32-bit
+ * and 64-bit tasks.
+ */
+struct epoll_ctl_cmd {
+	/* Reserved flags for future extensions, must be 0. */
+	__s32 flags;
+	/* The same as the epoll_ctl() op parameter. */
+	__s32 op;
+	/* The same as the epoll_ctl() fd parameter. */
+	__s32 fd;
+	/* The same as the "events" field of struct epoll_event. */
+	__u32 events;
+	/* The same as the "data" field of struct epoll_event. */
+	__u64 data;
+	/* Set by the kernel to the return code of this command. */
+	__s32 result;
+	__u32 __reserved;
+};
+
+/*
+ * Layout of the memory mapped by mmap(2) on an epoll file created with
+ * EPOLL_USERPOLL. The mapping starts with struct epoll_uheader, followed
+ * by the item array at items_offset and the ring of item indexes at
+ * ring_offset.
+ *
+ * Every registered file owns one struct epoll_uitem. When the file becomes
+ * ready, the kernel ORs the ready events into ready_events and, if they
+ * were zero, stores the item index at ring[tail & ring_mask] and then
+ * increments tail. A single consumer reaps entries from head to tail by
+ * atomically exchanging ready_events with zero (an item whose ready_events
+ * is already zero is skipped) and then stores the new head. Only
+ * edge-triggered registrations are allowed on such an instance.
+ */
+#define EPOLL_USERPOLL_HEADER_MAGIC 0xeb01eb01
+
+struct epoll_uitem {
+	/* Ready events, set by the kernel and cleared by userspace. */
+	__u32 ready_events;
+	/* Registered events, read-only for userspace. */
+	__u32 events;
+	/* Registered data, read-only for userspace. */
+	__u64 data;
+};
+
+struct epoll_uheader {
+	__u32 magic;
+	/* Length of the whole mapping. */
+	__u32 header_length;
+	/* Number of entries of the item array. */
+	__u32 max_items;
+	/* Number of entries of the index ring, minus one. */
+	__u32 ring_mask;
+	__u32 items_offset;
+	__u32 ring_offset;
+	__u32 __reserved0[10];
+
+	/* Written by the kernel only. */
+	__u32 tail;
+	__u32 __reserved1[15];
+
+	/* Written by userspace only. */
+	__u32 head;
+	__u32 __reserved2[15];
+};
+
 #ifdef CONFIG_PM_SLEEP
 static inline void ep_take_care_of_epollwakeup(struct epoll_event *epev)
 {
@@ -20,6 +20,8 @@
 #define FUTEX_WAKE_BITSET	10
 #define FUTEX_WAIT_REQUEUE_PI	11
 #define FUTEX_CMP_REQUEUE_PI	12
+/* Op codes 13-30 are left for single-futex operations. */
+#define FUTEX_WAIT_MULTIPLE	31
 
 #define FUTEX_PRIVATE_FLAG	128
 #define FUTEX_CLOCK_REALTIME	256
@@ -40,6 +42,26 @@
 #define FUTEX_CMP_REQUEUE_PI_PRIVATE	(FUTEX_CMP_REQUEUE_PI | \
 					 FUTEX_PRIVATE_FLAG)
 
+/*
+ * Maximum number of futexes a single FUTEX_WAIT_MULTIPLE call can wait on.
+ */
+#define FUTEX_WAIT_MULTIPLE_MAX	128
+
+/*
+ * Per-futex entry of the FUTEX_WAIT_MULTIPLE vector: the caller sleeps
+ * until any of the futexes is woken, provided every @uaddr still
+ * contains its expected @val when the call starts. @flags accepts
+ * FUTEX_PRIVATE_FLAG, which applies to this entry only.
+ *
+ * NOTE: this structure is part of the syscall ABI, and must not be
+ * changed.
+ */
+struct futex_wait_block {
+	__u64 uaddr;
+	__u32 val;
+	__u32 flags;
+};
+
 /*
  * Support for robust futexes: the kernel cleans up held futexes at
  * thread exit time.
@@ -40,14 +40,39 @@
  *                          (non-running threads are de facto in such a
  *                          state). This covers threads from all processes
  *                          running on the system. This command returns 0.
+ * @MEMBARRIER_CMD_PRIVATE_EXPEDITED:
+ *                          Execute a memory barrier on each running
+ *                          thread belonging to the same process as the
+ *                          current thread. Upon return from system call,
+ *                          the caller thread is ensured that all its
+ *                          running threads siblings have passed through
+ *                          a state where all memory accesses to
+ *                          user-space addresses match program order
+ *                          between entry to and return from the system
+ *                          call (non-running threads are de facto in
+ *                          such a state). This only covers threads from
+ *                          the same process as the caller thread. This
+ *                          command returns 0 on success. The "expedited"
+ *                          commands complete faster than the non-expedited
+ *                          ones, they never block, but have the downside
+ *                          of causing extra overhead. A process needs to
+ *                          register its intent to use the private
+ *                          expedited command prior to using it, otherwise
+ *                          this command returns -EPERM.
+ * @MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED:
+ *                          Register the process intent to use
+ *                          MEMBARRIER_CMD_PRIVATE_EXPEDITED. Always
+ *                          returns 0.
  *
  * Command to be passed to the membarrier system call. The commands need to
  * be a single bit each, except for MEMBARRIER_CMD_QUERY which is assigned to
- * the value 0.
+ * the value 0. Bits 1 and 2 are reserved for global expedited commands.
  */
 enum membarrier_cmd {
 	MEMBARRIER_CMD_QUERY = 0,
 	MEMBARRIER_CMD_SHARED = (1 << 0),
+	MEMBARRIER_CMD_PRIVATE_EXPEDITED = (1 << 3),
+	MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED = (1 << 4),
 };
 
 #endif /* _UAPI_LINUX_MEMBARRIER_H */
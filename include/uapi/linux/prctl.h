@@ -190,4 +190,20 @@ struct prctl_mm_map {
 # define PR_FP_MODE_FR		(1 << 0)	/* 64b FP registers */
 # define PR_FP_MODE_FRE		(1 << 1)	/* 32b compatibility */
 
+/*
+ * Select the hash table used for PROCESS_PRIVATE futexes: the global one
+ * (0 slots), or a process-private one allocated on first use, either with
+ * a power of two number of slots or sized by thread count.
+ */
+#define PR_FUTEX_HASH			78
+# define PR_FUTEX_HASH_SET_SLOTS	1
+# define PR_FUTEX_HASH_GET_SLOTS	2
+# define PR_FUTEX_HASH_SLOTS_AUTO	(~0UL)
+
+/*
+ * Have khugepaged collapse all of the process' memory eligible for
+ * transparent huge pages before anything else it has to do.
+ */
+#define PR_THP_COLLAPSE			79
+
 #endif /* _LINUX_PRCTL_H */
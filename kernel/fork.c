@@ -569,6 +569,14 @@ static void mm_init_aio(struct mm_struct *mm)
 #endif
 }
 
+static void mm_init_futex(struct mm_struct *mm)
+{
+#ifdef CONFIG_FUTEX
+	/* The PR_FUTEX_HASH setting is inherited, the table is not. */
+	mm->futex_hash = NULL;
+#endif
+}
+
 static void mm_init_owner(struct mm_struct *mm, struct task_struct *p)
 {
 #ifdef CONFIG_MEMCG
@@ -580,10 +588,16 @@ static struct mm_struct *mm_init(struct mm_struct *mm, struct task_struct *p)
 {
 	mm->mmap = NULL;
 	mm->mm_rb = RB_ROOT;
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+	rwlock_init(&mm->mm_rb_lock);
+#endif
 	mm->vmacache_seqnum = 0;
 	atomic_set(&mm->mm_users, 1);
 	atomic_set(&mm->mm_count, 1);
 	init_rwsem(&mm->mmap_sem);
+	range_lock_tree_init(&mm->mmap_range);
+	atomic_set(&mm->mmap_range_writers, 0);
+	init_waitqueue_head(&mm->mmap_range_wait);
 	INIT_LIST_HEAD(&mm->mmlist);
 	mm->core_state = NULL;
 	atomic_long_set(&mm->nr_ptes, 0);
@@ -595,12 +609,16 @@ static struct mm_struct *mm_init(struct mm_struct *mm, struct task_struct *p)
 	spin_lock_init(&mm->page_table_lock);
 	mm_init_cpumask(mm);
 	mm_init_aio(mm);
+	mm_init_futex(mm);
 	mm_init_owner(mm, p);
 	mmu_notifier_mm_init(mm);
-	clear_tlb_flush_pending(mm);
+	init_tlb_flush_pending(mm);
 #if defined(CONFIG_TRANSPARENT_HUGEPAGE) && !USE_SPLIT_PMD_PTLOCKS
 	mm->pmd_huge_pte = NULL;
 #endif
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	memset(&mm->thp_collapse, 0, sizeof(mm->thp_collapse));
+#endif
 
 	if (current->mm) {
 		mm->flags = current->mm->flags & MMF_INIT_MASK;
@@ -610,6 +628,10 @@ static struct mm_struct *mm_init(struct mm_struct *mm, struct task_struct *p)
 		mm->def_flags = 0;
 	}
 
+	mm->mmap_range_faults = alloc_percpu(int);
+	if (!mm->mmap_range_faults)
+		goto fail_nofaults;
+
 	if (mm_alloc_pgd(mm))
 		goto fail_nopgd;
 
@@ -621,6 +643,8 @@ static struct mm_struct *mm_init(struct mm_struct *mm, struct task_struct *p)
 fail_nocontext:
 	mm_free_pgd(mm);
 fail_nopgd:
+	free_percpu(mm->mmap_range_faults);
+fail_nofaults:
 	free_mm(mm);
 	return NULL;
 }
@@ -676,6 +700,7 @@ void __mmdrop(struct mm_struct *mm)
 	destroy_context(mm);
 	mmu_notifier_mm_destroy(mm);
 	check_mm(mm);
+	free_percpu(mm->mmap_range_faults);
 	free_mm(mm);
 }
 EXPORT_SYMBOL_GPL(__mmdrop);
@@ -690,6 +715,7 @@ void mmput(struct mm_struct *mm)
 	if (atomic_dec_and_test(&mm->mm_users)) {
 		uprobe_clear_state(mm);
 		exit_aio(mm);
+		futex_mm_release(mm);
 		ksm_exit(mm);
 		khugepaged_exit(mm); /* must run before exit_mmap */
 		exit_mmap(mm);
@@ -1535,6 +1561,8 @@ static struct task_struct *copy_process(unsigned long clone_flags,
 	 */
 	copy_seccomp(p);
 
+	rseq_fork(p, clone_flags);
+
 	/*
 	 * Process group and session signals need to be delivered to just the
 	 * parent before the fork or both the parent and the child after the
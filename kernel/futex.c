@@ -63,7 +63,9 @@
 #include <linux/sched/rt.h>
 #include <linux/hugetlb.h>
 #include <linux/freezer.h>
-#include <linux/bootmem.h>
+#include <linux/vmalloc.h>
+#include <linux/prctl.h>
+#include <linux/log2.h>
 
 #include <asm/futex.h>
 
@@ -254,9 +256,29 @@ struct futex_hash_bucket {
 	struct plist_head chain;
 } ____cacheline_aligned_in_smp;
 
+/*
+ * The global hash is split into one table per possible node, each table
+ * allocated on its node. Keys are spread over the nodes by unused hash
+ * bits, so shared futexes interleave evenly instead of all landing on
+ * the node that happened to run futex_init().
+ */
 static unsigned long __read_mostly futex_hashsize;
+static unsigned int __read_mostly futex_hashshift;
+
+static struct futex_hash_bucket *futex_queues[MAX_NUMNODES] __read_mostly;
 
-static struct futex_hash_bucket *futex_queues;
+/*
+ * Process-private hash for PROCESS_PRIVATE futexes, see futex_hash_prctl().
+ * It is allocated on the node of the first thread that uses a private
+ * futex, so unrelated processes no longer contend on the same buckets.
+ */
+struct futex_private_hash {
+	unsigned long			hashmask;
+	struct futex_hash_bucket	queues[];
+};
+
+#define FUTEX_PRIVATE_HASH_MIN		16
+#define FUTEX_PRIVATE_HASH_MAX		8192
 
 static inline void futex_get_mm(union futex_key *key)
 {
@@ -303,15 +325,40 @@ static inline int hb_waiters_pending(struct futex_hash_bucket *hb)
 #endif
 }
 
+static inline struct futex_private_hash *
+futex_private_hash(union futex_key *key)
+{
+	if (key->both.offset & (FUT_OFF_INODE | FUT_OFF_MMSHARED))
+		return NULL;
+	return READ_ONCE(key->private.mm->futex_hash);
+}
+
 /*
  * We hash on the keys returned from get_futex_key (see below).
  */
 static struct futex_hash_bucket *hash_futex(union futex_key *key)
 {
+	struct futex_private_hash *fph = futex_private_hash(key);
 	u32 hash = jhash2((u32*)&key->both.word,
 			  (sizeof(key->both.word)+sizeof(key->both.ptr))/4,
 			  key->both.offset);
-	return &futex_queues[hash & (futex_hashsize - 1)];
+	int node;
+
+	if (fph)
+		return &fph->queues[hash & fph->hashmask];
+
+	/*
+	 * Use the hash bits above the bucket index to pick a node. This
+	 * is not perfectly uniform with sparse node masks, but it is fast
+	 * and never selects an impossible node.
+	 */
+	node = (hash >> futex_hashshift) % nr_node_ids;
+	if (!node_possible(node)) {
+		node = next_node(node, node_possible_map);
+		if (node >= MAX_NUMNODES)
+			node = first_node(node_possible_map);
+	}
+	return &futex_queues[node][hash & (futex_hashsize - 1)];
 }
 
 /*
@@ -376,6 +423,131 @@ static void drop_futex_key_refs(union futex_key *key)
 	}
 }
 
+static void futex_hash_buckets_init(struct futex_hash_bucket *queues,
+				    unsigned long size)
+{
+	unsigned long i;
+
+	for (i = 0; i < size; i++) {
+		atomic_set(&queues[i].waiters, 0);
+		plist_head_init(&queues[i].chain);
+		spin_lock_init(&queues[i].lock);
+	}
+}
+
+static void *futex_hash_alloc_node(size_t size, gfp_t gfp, int node)
+{
+	void *p = NULL;
+
+	if (size <= KMALLOC_MAX_SIZE)
+		p = kzalloc_node(size, gfp | __GFP_NOWARN, node);
+	if (!p && !(gfp & __GFP_NOFAIL))
+		p = vzalloc_node(size, node);
+	return p;
+}
+
+static unsigned long futex_private_hash_size(struct mm_struct *mm)
+{
+	unsigned long slots = mm->futex_hash_slots;
+
+	/*
+	 * The table is allocated on first use, usually before the process
+	 * has started its other threads, and can't grow once futexes may
+	 * be queued in it. Size it for the threads that can contend at
+	 * once: as many as there are CPUs the process may run on, or more
+	 * if it already has them.
+	 */
+	if (slots == PR_FUTEX_HASH_SLOTS_AUTO)
+		slots = 4 * roundup_pow_of_two(max_t(unsigned int,
+				current->signal->nr_threads,
+				cpumask_weight(tsk_cpus_allowed(current))));
+
+	return clamp_t(unsigned long, slots, FUTEX_PRIVATE_HASH_MIN,
+		       FUTEX_PRIVATE_HASH_MAX);
+}
+
+/*
+ * Allocate the process-private hash on first use of a private futex,
+ * once futex_hash_prctl() has requested one. Every thread of the mm
+ * must agree on the table, so this can't fail: if the requested size
+ * can't be had, fall back to the minimum size which is allocated with
+ * __GFP_NOFAIL.
+ */
+static noinline void futex_private_hash_alloc(struct mm_struct *mm)
+{
+	struct futex_private_hash *fph;
+	unsigned long size = futex_private_hash_size(mm);
+	int node = numa_node_id();
+
+	fph = futex_hash_alloc_node(sizeof(*fph) + size * sizeof(fph->queues[0]),
+				    GFP_KERNEL, node);
+	if (!fph) {
+		size = FUTEX_PRIVATE_HASH_MIN;
+		fph = futex_hash_alloc_node(sizeof(*fph) +
+					    size * sizeof(fph->queues[0]),
+					    GFP_KERNEL | __GFP_NOFAIL, node);
+	}
+
+	fph->hashmask = size - 1;
+	futex_hash_buckets_init(fph->queues, size);
+
+	/* Publish the initialized buckets; lost races free their copy. */
+	if (cmpxchg(&mm->futex_hash, NULL, fph))
+		kvfree(fph);
+}
+
+/*
+ * Called from mmput() once the last user of @mm is gone: no task can
+ * create a private futex key for @mm anymore.
+ */
+void futex_mm_release(struct mm_struct *mm)
+{
+	kvfree(mm->futex_hash);
+	mm->futex_hash = NULL;
+}
+
+/**
+ * futex_hash_prctl() - PR_FUTEX_HASH handler
+ * @arg2:	PR_FUTEX_HASH_SET_SLOTS or PR_FUTEX_HASH_GET_SLOTS
+ * @arg3:	for SET_SLOTS: 0 for the global hash, PR_FUTEX_HASH_SLOTS_AUTO
+ *		to size the private hash on first use by the number of
+ *		threads or allowed CPUs, or a power of two number of private
+ *		hash buckets
+ * @arg4:	must be 0
+ *
+ * PR_FUTEX_HASH_GET_SLOTS returns the number of private hash buckets, or 0
+ * while the global hash is in use.
+ *
+ * Changing the hash while futexes might be queued would lose wakeups, so
+ * the setting can only be changed while the caller is the sole user of
+ * its mm and no private hash has been allocated yet. It is inherited
+ * across fork() and reset by exec().
+ */
+int futex_hash_prctl(unsigned long arg2, unsigned long arg3,
+		     unsigned long arg4)
+{
+	struct mm_struct *mm = current->mm;
+	struct futex_private_hash *fph;
+
+	if (arg4)
+		return -EINVAL;
+
+	switch (arg2) {
+	case PR_FUTEX_HASH_SET_SLOTS:
+		if (arg3 && arg3 != PR_FUTEX_HASH_SLOTS_AUTO &&
+		    (!is_power_of_2(arg3) || arg3 > FUTEX_PRIVATE_HASH_MAX))
+			return -EINVAL;
+		if (atomic_read(&mm->mm_users) != 1 || mm->futex_hash)
+			return -EBUSY;
+		mm->futex_hash_slots = arg3;
+		return 0;
+	case PR_FUTEX_HASH_GET_SLOTS:
+		fph = READ_ONCE(mm->futex_hash);
+		return fph ? fph->hashmask + 1 : 0;
+	}
+	return -EINVAL;
+}
+
 /**
  * get_futex_key() - Get parameters which are the keys for a futex
  * @uaddr:	virtual address of the futex
@@ -421,6 +593,12 @@ get_futex_key(u32 __user *uaddr, int fshared, union futex_key *key, int rw)
 	 *        but access_ok() should be faster than find_vma()
 	 */
 	if (!fshared) {
+		/*
+		 * hash_futex() must see the process-private hash, if any,
+		 * for every private key of this mm.
+		 */
+		if (unlikely(mm->futex_hash_slots && !READ_ONCE(mm->futex_hash)))
+			futex_private_hash_alloc(mm);
 		key->private.mm = mm;
 		key->private.address = address;
 		get_futex_key_refs(key);  /* implies MB (B) */
@@ -2264,6 +2442,249 @@ static long futex_wait_restart(struct restart_block *restart)
 				restart->futex.val, tp, restart->futex.bitset);
 }
 
+/**
+ * unqueue_multiple() - Remove several futexes from their hash buckets
+ * @qs:		array of futex_q to unqueue
+ * @count:	number of entries in @qs
+ *
+ * Helper to unqueue a list of futexes. This can't fail.
+ *
+ * Return:
+ *  - >=0 - index of the last futex that was awoken;
+ *  - -1  - if no futex was awoken
+ */
+static int unqueue_multiple(struct futex_q *qs, int count)
+{
+	int ret = -1;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		if (!unqueue_me(&qs[i]))
+			ret = i;
+	}
+	return ret;
+}
+
+/**
+ * futex_wait_multiple_setup() - Prepare to wait and enqueue multiple futexes
+ * @wb:		the user supplied wait blocks
+ * @qs:		the futex_q array, one entry per wait block
+ * @count:	number of entries in @wb and @qs
+ * @woken:	index of the futex that was woken while setting up, if any
+ *
+ * The keys are resolved first, as get_futex_key() may sleep for shared
+ * futexes. Then the same ordering rules as futex_wait_setup() apply to
+ * each futex in turn: every futex_q is queued right after its value was
+ * checked under the hash bucket lock. The task state is set before the
+ * first futex is queued, so a wakeup on an already queued futex can't be
+ * missed while the remaining ones are being set up.
+ *
+ * Return:
+ *  -  1 - a futex was woken during setup, its index is stored in @woken;
+ *  -  0 - success, all futexes are queued and current is TASK_INTERRUPTIBLE;
+ *  - <0 - -EFAULT, -EWOULDBLOCK or a get_futex_key() error, nothing queued
+ */
+static int futex_wait_multiple_setup(struct futex_wait_block *wb,
+				     struct futex_q *qs, int count, int *woken)
+{
+	struct futex_hash_bucket *hb;
+	u32 __user *uaddr;
+	u32 uval;
+	int i, j, ret;
+
+retry:
+	for (i = 0; i < count; i++) {
+		unsigned int flags = 0;
+
+		if (!(wb[i].flags & FUTEX_PRIVATE_FLAG))
+			flags |= FLAGS_SHARED;
+		uaddr = (u32 __user *)(unsigned long)wb[i].uaddr;
+
+		ret = get_futex_key(uaddr, flags & FLAGS_SHARED, &qs[i].key,
+				    VERIFY_READ);
+		if (ret) {
+			while (--i >= 0)
+				put_futex_key(&qs[i].key);
+			return ret;
+		}
+	}
+
+	set_current_state(TASK_INTERRUPTIBLE);
+
+	for (i = 0; i < count; i++) {
+		uaddr = (u32 __user *)(unsigned long)wb[i].uaddr;
+
+		hb = queue_lock(&qs[i]);
+		ret = get_futex_value_locked(&uval, uaddr);
+		if (!ret && uval == wb[i].val) {
+			queue_me(&qs[i], hb);
+			continue;
+		}
+		queue_unlock(hb);
+
+		__set_current_state(TASK_RUNNING);
+
+		/*
+		 * Even if something went wrong, if we find out that a
+		 * futex was woken, we don't return error and return
+		 * this index to userspace. unqueue_multiple() drops the
+		 * key refs of the queued futexes, drop the others here.
+		 */
+		*woken = unqueue_multiple(qs, i);
+		for (j = i; j < count; j++)
+			put_futex_key(&qs[j].key);
+		if (*woken >= 0)
+			return 1;
+
+		if (ret) {
+			/*
+			 * The value could not be read atomically under
+			 * the hash bucket lock, fault it in and retry the
+			 * whole vector.
+			 */
+			if (get_user(uval, uaddr))
+				return -EFAULT;
+			goto retry;
+		}
+
+		return -EWOULDBLOCK;
+	}
+
+	return 0;
+}
+
+/**
+ * futex_sleep_multiple() - Check sleeping conditions and sleep
+ * @qs:		array of futex_q queued by futex_wait_multiple_setup()
+ * @count:	number of entries in @qs
+ * @timeout:	the prepared hrtimer_sleeper, or null for no timeout
+ *
+ * Sleep if and only if the timeout hasn't expired and no futex on the
+ * list has been woken up.
+ */
+static void futex_sleep_multiple(struct futex_q *qs, int count,
+				 struct hrtimer_sleeper *timeout)
+{
+	int i;
+
+	if (timeout && !timeout->task)
+		return;
+
+	for (i = 0; i < count; i++) {
+		if (!READ_ONCE(qs[i].lock_ptr))
+			return;
+	}
+
+	freezable_schedule();
+}
+
+/**
+ * futex_wait_multiple() - Wait on a vector of futexes, wake on any
+ * @uaddr:	userspace address of the struct futex_wait_block array
+ * @flags:	futex flags (FLAGS_CLOCKRT)
+ * @count:	number of entries in the array
+ * @abs_time:	absolute timeout, or NULL for none
+ *
+ * Return:
+ *  - >=0 - index of the futex that was woken;
+ *  - <0  - -EINVAL, -EFAULT, -ENOMEM, -EWOULDBLOCK, -ETIMEDOUT or
+ *	    -ERESTARTSYS
+ */
+static int futex_wait_multiple(u32 __user *uaddr, unsigned int flags,
+			       u32 count, ktime_t *abs_time)
+{
+	struct hrtimer_sleeper timeout, *to = NULL;
+	struct futex_wait_block *wb;
+	struct futex_q *qs;
+	int ret, woken = -1;
+	u32 i;
+
+	if (!count || count > FUTEX_WAIT_MULTIPLE_MAX)
+		return -EINVAL;
+
+	wb = kmalloc_array(count, sizeof(*wb), GFP_KERNEL);
+	if (!wb)
+		return -ENOMEM;
+
+	if (copy_from_user(wb, uaddr, count * sizeof(*wb))) {
+		ret = -EFAULT;
+		goto out_free_wb;
+	}
+
+	for (i = 0; i < count; i++) {
+		if (wb[i].flags & ~FUTEX_PRIVATE_FLAG) {
+			ret = -EINVAL;
+			goto out_free_wb;
+		}
+	}
+
+	qs = kmalloc_array(count, sizeof(*qs), GFP_KERNEL);
+	if (!qs) {
+		ret = -ENOMEM;
+		goto out_free_wb;
+	}
+	for (i = 0; i < count; i++)
+		qs[i] = futex_q_init;
+
+	if (abs_time) {
+		to = &timeout;
+
+		hrtimer_init_on_stack(&to->timer, (flags & FLAGS_CLOCKRT) ?
+				      CLOCK_REALTIME : CLOCK_MONOTONIC,
+				      HRTIMER_MODE_ABS);
+		hrtimer_init_sleeper(to, current);
+		hrtimer_set_expires_range_ns(&to->timer, *abs_time,
+					     current->timer_slack_ns);
+	}
+
+	for (;;) {
+		/*
+		 * On success, all futexes are queued, with their key
+		 * refs held, and current is TASK_INTERRUPTIBLE.
+		 */
+		ret = futex_wait_multiple_setup(wb, qs, count, &woken);
+		if (ret) {
+			if (ret > 0)
+				ret = woken;
+			break;
+		}
+
+		/* Arm the timer */
+		if (to)
+			hrtimer_start_expires(&to->timer, HRTIMER_MODE_ABS);
+
+		futex_sleep_multiple(qs, count, to);
+
+		__set_current_state(TASK_RUNNING);
+
+		/* unqueue_multiple() drops the key refs */
+		ret = unqueue_multiple(qs, count);
+		if (ret >= 0)
+			break;
+
+		ret = -ETIMEDOUT;
+		if (to && !to->task)
+			break;
+
+		/*
+		 * The timeout is absolute, so the call can be restarted
+		 * transparently. Otherwise this was a spurious wakeup.
+		 */
+		ret = -ERESTARTSYS;
+		if (signal_pending(current))
+			break;
+	}
+
+	if (to) {
+		hrtimer_cancel(&to->timer);
+		destroy_hrtimer_on_stack(&to->timer);
+	}
+	kfree(qs);
+out_free_wb:
+	kfree(wb);
+	return ret;
+}
+
 
 /*
  * Userspace tried a 0 -> TID atomic transition of the futex value
@@ -2947,7 +3368,8 @@ long do_futex(u32 __user *uaddr, int op, u32 val, ktime_t *timeout,
 
 	if (op & FUTEX_CLOCK_REALTIME) {
 		flags |= FLAGS_CLOCKRT;
-		if (cmd != FUTEX_WAIT_BITSET && cmd != FUTEX_WAIT_REQUEUE_PI)
+		if (cmd != FUTEX_WAIT_BITSET && cmd != FUTEX_WAIT_REQUEUE_PI &&
+		    cmd != FUTEX_WAIT_MULTIPLE)
 			return -ENOSYS;
 	}
 
@@ -2988,6 +3410,8 @@ long do_futex(u32 __user *uaddr, int op, u32 val, ktime_t *timeout,
 					     uaddr2);
 	case FUTEX_CMP_REQUEUE_PI:
 		return futex_requeue(uaddr, flags, uaddr2, val, val2, &val3, 1);
+	case FUTEX_WAIT_MULTIPLE:
+		return futex_wait_multiple(uaddr, flags, val, timeout);
 	}
 	return -ENOSYS;
 }
@@ -3004,7 +3428,8 @@ SYSCALL_DEFINE6(futex, u32 __user *, uaddr, int, op, u32, val,
 
 	if (utime && (cmd == FUTEX_WAIT || cmd == FUTEX_LOCK_PI ||
 		      cmd == FUTEX_WAIT_BITSET ||
-		      cmd == FUTEX_WAIT_REQUEUE_PI)) {
+		      cmd == FUTEX_WAIT_REQUEUE_PI ||
+		      cmd == FUTEX_WAIT_MULTIPLE)) {
 		if (copy_from_user(&ts, utime, sizeof(ts)) != 0)
 			return -EFAULT;
 		if (!timespec_valid(&ts))
@@ -3048,8 +3473,7 @@ static void __init futex_detect_cmpxchg(void)
 
 static int __init futex_init(void)
 {
-	unsigned int futex_shift;
-	unsigned long i;
+	int node;
 
 #if CONFIG_BASE_SMALL
 	futex_hashsize = 16;
@@ -3057,21 +3481,29 @@ static int __init futex_init(void)
 	futex_hashsize = roundup_pow_of_two(256 * num_possible_cpus());
 #endif
 
-	futex_queues = alloc_large_system_hash("futex", sizeof(*futex_queues),
-					       futex_hashsize, 0,
-					       futex_hashsize < 256 ? HASH_SMALL : 0,
-					       &futex_shift, NULL,
-					       futex_hashsize, futex_hashsize);
-	futex_hashsize = 1UL << futex_shift;
+	/* Each node gets its share of the buckets. */
+	futex_hashsize = roundup_pow_of_two(max_t(unsigned long, 16,
+				futex_hashsize / num_possible_nodes()));
+	futex_hashshift = ilog2(futex_hashsize);
 
 	futex_detect_cmpxchg();
 
-	for (i = 0; i < futex_hashsize; i++) {
-		atomic_set(&futex_queues[i].waiters, 0);
-		plist_head_init(&futex_queues[i].chain);
-		spin_lock_init(&futex_queues[i].lock);
+	for_each_node(node) {
+		struct futex_hash_bucket *table;
+		int nid = node_online(node) ? node : NUMA_NO_NODE;
+
+		table = futex_hash_alloc_node(futex_hashsize * sizeof(*table),
+					      GFP_KERNEL, nid);
+		if (!table)
+			panic("Failed to allocate futex hash table for node %d\n",
+			      node);
+		futex_hash_buckets_init(table, futex_hashsize);
+		futex_queues[node] = table;
 	}
 
+	pr_info("futex hash table entries: %lu per node (%d nodes)\n",
+		futex_hashsize, num_possible_nodes());
+
 	return 0;
 }
 __initcall(futex_init);
@@ -0,0 +1,126 @@
+/*
+ * kernel/locking/range_lock.c: range reader/writer locks
+ *
+ * The ranges currently held or waited for are kept in an interval tree.
+ * A new range counts the conflicting ranges already in the tree, inserts
+ * itself and sleeps until that count drops to zero; a range going away
+ * decrements the count of every conflicting range that arrived after it.
+ * Each waiter therefore only waits for the conflicting ranges that were
+ * there before it, which keeps the lock fair and free of starvation.
+ */
+
+#include <linux/export.h>
+#include <linux/interval_tree_generic.h>
+#include <linux/range_lock.h>
+#include <linux/sched.h>
+
+#define range_start(r)	((r)->start)
+#define range_last(r)	((r)->last)
+
+INTERVAL_TREE_DEFINE(struct range_lock, rb, unsigned long, __subtree_last,
+		     range_start, range_last, static, __range_tree)
+
+static inline bool range_conflict(struct range_lock *a, struct range_lock *b)
+{
+	return !a->reader || !b->reader;
+}
+
+static void __range_lock(struct range_lock_tree *tree,
+			 struct range_lock *lock, bool reader)
+{
+	struct range_lock *held;
+
+	might_sleep();
+
+	lock->reader = reader;
+	lock->tsk = current;
+	lock->blocking_ranges = 0;
+
+	spin_lock(&tree->lock);
+	lock->seqnum = tree->seqnum++;
+	for (held = __range_tree_iter_first(&tree->root, lock->start,
+					    lock->last);
+	     held;
+	     held = __range_tree_iter_next(held, lock->start, lock->last))
+		if (range_conflict(lock, held))
+			lock->blocking_ranges++;
+	__range_tree_insert(lock, &tree->root);
+	spin_unlock(&tree->lock);
+
+	if (!lock->blocking_ranges)
+		return;
+
+	for (;;) {
+		set_current_state(TASK_UNINTERRUPTIBLE);
+		/* Pairs with the release in __range_unlock() */
+		if (!smp_load_acquire(&lock->blocking_ranges))
+			break;
+		schedule();
+	}
+	__set_current_state(TASK_RUNNING);
+}
+
+static void __range_unlock(struct range_lock_tree *tree,
+			   struct range_lock *lock)
+{
+	struct range_lock *blocked;
+
+	spin_lock(&tree->lock);
+	__range_tree_remove(lock, &tree->root);
+	for (blocked = __range_tree_iter_first(&tree->root, lock->start,
+					       lock->last);
+	     blocked;
+	     blocked = __range_tree_iter_next(blocked, lock->start,
+					      lock->last)) {
+		/* Ranges that were there before us did not count us. */
+		if ((long)(blocked->seqnum - lock->seqnum) < 0)
+			continue;
+		if (!range_conflict(lock, blocked))
+			continue;
+		/*
+		 * Order everything done under the range before the waiter
+		 * can see its count reach zero.
+		 */
+		smp_store_release(&blocked->blocking_ranges,
+				  blocked->blocking_ranges - 1);
+		if (!blocked->blocking_ranges)
+			wake_up_process(blocked->tsk);
+	}
+	spin_unlock(&tree->lock);
+}
+
+/*
+ * lock a range for reading
+ */
+void range_read_lock(struct range_lock_tree *tree, struct range_lock *lock)
+{
+	__range_lock(tree, lock, true);
+}
+EXPORT_SYMBOL(range_read_lock);
+
+/*
+ * release a range locked for reading
+ */
+void range_read_unlock(struct range_lock_tree *tree, struct range_lock *lock)
+{
+	__range_unlock(tree, lock);
+}
+EXPORT_SYMBOL(range_read_unlock);
+
+/*
+ * lock a range for writing
+ */
+void range_write_lock(struct range_lock_tree *tree, struct range_lock *lock)
+{
+	__range_lock(tree, lock, false);
+}
+EXPORT_SYMBOL(range_write_lock);
+
+/*
+ * release a range locked for writing
+ */
+void range_write_unlock(struct range_lock_tree *tree, struct range_lock *lock)
+{
+	__range_unlock(tree, lock);
+}
+EXPORT_SYMBOL(range_write_unlock);
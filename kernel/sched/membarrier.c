@@ -0,0 +1,179 @@
+/*
+ * Copyright (C) 2010, 2015 Mathieu Desnoyers <mathieu.desnoyers@efficios.com>
+ *
+ * membarrier system call
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <linux/syscalls.h>
+#include <linux/membarrier.h>
+#include <linux/cpumask.h>
+#include <linux/slab.h>
+
+#include "sched.h"
+
+/*
+ * Bitmask made from a "or" of all commands within enum membarrier_cmd,
+ * except MEMBARRIER_CMD_QUERY.
+ */
+#define MEMBARRIER_CMD_BITMASK	\
+	(MEMBARRIER_CMD_SHARED | MEMBARRIER_CMD_PRIVATE_EXPEDITED |	\
+	 MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED)
+
+/* Flags kept in mm->membarrier_state. */
+#define MEMBARRIER_STATE_PRIVATE_EXPEDITED	(1U << 0)
+
+static void ipi_mb(void *info)
+{
+	smp_mb();	/* IPIs should be serializing but paranoid. */
+}
+
+/*
+ * Returns whether the task currently running on @cpu uses @mm. Taking
+ * the runqueue lock keeps rq->curr from being freed under us, and
+ * orders the read of rq->curr against the scheduler's update of it:
+ * a thread of @mm scheduled in after we release the lock observes
+ * every memory access the caller performed before its smp_mb(), and a
+ * thread of @mm scheduled out before we take the lock has completed
+ * all of its user-space memory accesses.
+ */
+static bool membarrier_cpu_runs_mm(int cpu, struct mm_struct *mm)
+{
+	struct rq *rq = cpu_rq(cpu);
+	bool ret;
+
+	raw_spin_lock_irq(&rq->lock);
+	ret = rq->curr->mm == mm;
+	raw_spin_unlock_irq(&rq->lock);
+
+	return ret;
+}
+
+static int membarrier_private_expedited(void)
+{
+	struct mm_struct *mm = current->mm;
+	cpumask_var_t tmpmask;
+	bool fallback = false;
+	int cpu;
+
+	if (!(atomic_read(&mm->membarrier_state) &
+	      MEMBARRIER_STATE_PRIVATE_EXPEDITED))
+		return -EPERM;
+
+	if (num_online_cpus() == 1)
+		return 0;
+
+	/*
+	 * Matches memory barriers around rq->curr modification in
+	 * the scheduler.
+	 */
+	smp_mb();	/* system call entry is not a mb. */
+
+	/*
+	 * Expedited membarrier commands guarantee that they won't
+	 * block, hence the GFP_NOWAIT allocation flag and fallback
+	 * to one IPI per targeted CPU.
+	 */
+	if (!zalloc_cpumask_var(&tmpmask, GFP_NOWAIT))
+		fallback = true;
+
+	get_online_cpus();
+	for_each_online_cpu(cpu) {
+		/*
+		 * Skipping the current CPU is OK even though we can be
+		 * migrated at any point. The current CPU, at the point
+		 * where we read raw_smp_processor_id(), is ensured to
+		 * be in program order with respect to the caller
+		 * thread. Therefore, we can skip this CPU from the
+		 * iteration.
+		 */
+		if (cpu == raw_smp_processor_id())
+			continue;
+		if (!membarrier_cpu_runs_mm(cpu, mm))
+			continue;
+		if (!fallback)
+			cpumask_set_cpu(cpu, tmpmask);
+		else
+			smp_call_function_single(cpu, ipi_mb, NULL, 1);
+	}
+	if (!fallback) {
+		preempt_disable();
+		smp_call_function_many(tmpmask, ipi_mb, NULL, 1);
+		preempt_enable();
+		free_cpumask_var(tmpmask);
+	}
+	put_online_cpus();
+
+	smp_mb();	/* exit from system call is not a mb. */
+	return 0;
+}
+
+static int membarrier_register_private_expedited(void)
+{
+	struct mm_struct *mm = current->mm;
+
+	/*
+	 * The state is inherited across fork() through dup_mm(), and
+	 * cleared on exec() since the new mm comes zeroed from
+	 * mm_alloc().
+	 */
+	atomic_or(MEMBARRIER_STATE_PRIVATE_EXPEDITED, &mm->membarrier_state);
+	return 0;
+}
+
+/**
+ * sys_membarrier - issue memory barriers on a set of threads
+ * @cmd:   Takes command values defined in enum membarrier_cmd.
+ * @flags: Currently needs to be 0. For future extensions.
+ *
+ * If this system call is not implemented, -ENOSYS is returned. If the
+ * command specified does not exist, or if the command argument is invalid,
+ * this system call returns -EINVAL. For a given command, with flags argument
+ * set to 0, this system call is guaranteed to always return the same value
+ * until reboot. MEMBARRIER_CMD_PRIVATE_EXPEDITED returns -EPERM unless the
+ * calling process previously issued
+ * MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED.
+ *
+ * All memory accesses performed in program order from each targeted thread
+ * is guaranteed to be ordered with respect to sys_membarrier(). If we use
+ * the semantic "barrier()" to represent a compiler barrier forcing memory
+ * accesses to be performed in program order across the barrier, and
+ * smp_mb() to represent explicit memory barriers forcing full memory
+ * ordering across the barrier, we have the following ordering table for
+ * each pair of barrier(), sys_membarrier() and smp_mb():
+ *
+ * The pair ordering is detailed as (O: ordered, X: not ordered):
+ *
+ *                        barrier()   smp_mb() sys_membarrier()
+ *        barrier()          X           X            O
+ *        smp_mb()           X           O            O
+ *        sys_membarrier()   O           O            O
+ */
+SYSCALL_DEFINE2(membarrier, int, cmd, int, flags)
+{
+	if (unlikely(flags))
+		return -EINVAL;
+	switch (cmd) {
+	case MEMBARRIER_CMD_QUERY:
+		return MEMBARRIER_CMD_BITMASK;
+	case MEMBARRIER_CMD_SHARED:
+		if (num_online_cpus() > 1)
+			synchronize_sched();
+		return 0;
+	case MEMBARRIER_CMD_PRIVATE_EXPEDITED:
+		return membarrier_private_expedited();
+	case MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED:
+		return membarrier_register_private_expedited();
+	default:
+		return -EINVAL;
+	}
+}
@@ -47,6 +47,8 @@
 #include <linux/kprobes.h>
 #include <linux/user_namespace.h>
 #include <linux/binfmts.h>
+#include <linux/futex.h>
+#include <linux/khugepaged.h>
 
 #include <linux/sched.h>
 #include <linux/rcupdate.h>
@@ -2267,6 +2269,14 @@ SYSCALL_DEFINE5(prctl, int, option, unsigned long, arg2, unsigned long, arg3,
 	case PR_GET_FP_MODE:
 		error = GET_FP_MODE(me);
 		break;
+	case PR_FUTEX_HASH:
+		error = futex_hash_prctl(arg2, arg3, arg4);
+		break;
+	case PR_THP_COLLAPSE:
+		if (arg2 || arg3 || arg4 || arg5)
+			return -EINVAL;
+		error = khugepaged_collapse_mm(me->mm);
+		break;
 	default:
 		error = -EINVAL;
 		break;
@@ -66,7 +66,9 @@ cond_syscall(sys_get_robust_list);
 cond_syscall(compat_sys_get_robust_list);
 cond_syscall(sys_epoll_create);
 cond_syscall(sys_epoll_create1);
+cond_syscall(sys_epoll_create2);
 cond_syscall(sys_epoll_ctl);
+cond_syscall(sys_epoll_ctl_batch);
 cond_syscall(sys_epoll_wait);
 cond_syscall(sys_epoll_pwait);
 cond_syscall(compat_sys_epoll_pwait);
@@ -149,6 +151,9 @@ cond_syscall(sys_io_destroy);
 cond_syscall(sys_io_submit);
 cond_syscall(sys_io_cancel);
 cond_syscall(sys_io_getevents);
+cond_syscall(sys_io_setup2);
+cond_syscall(sys_io_ring_enter);
+cond_syscall(sys_io_ring_register);
 cond_syscall(sys_sysfs);
 cond_syscall(sys_syslog);
 cond_syscall(sys_process_vm_readv);
@@ -246,3 +251,6 @@ cond_syscall(sys_execveat);
 
 /* membarrier */
 cond_syscall(sys_membarrier);
+
+/* restartable sequences */
+cond_syscall(sys_rseq);
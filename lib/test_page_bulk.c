@@ -0,0 +1,113 @@
+/*
+ * Benchmark of the bulk page allocator
+ *
+ * Allocates and frees BATCH order-0 pages at a time, LOOPS times, one page
+ * at a time with alloc_page() and __free_page(), and then with
+ * alloc_pages_bulk_array() and free_hot_cold_page_list(), and reports the
+ * cycles spent per page for both.
+ */
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/gfp.h>
+#include <linux/list.h>
+#include <linux/mm.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <asm/timex.h>
+
+#define LOOPS		1000
+
+static unsigned int batch = 64;
+module_param(batch, uint, 0444);
+MODULE_PARM_DESC(batch, "number of pages allocated at a time");
+
+static void free_page_array(struct page **pages, unsigned long nr)
+{
+	LIST_HEAD(list);
+	unsigned long i;
+
+	for (i = 0; i < nr; i++) {
+		if (put_page_testzero(pages[i]))
+			list_add(&pages[i]->lru, &list);
+		pages[i] = NULL;
+	}
+	free_hot_cold_page_list(&list, false);
+}
+
+static int __init test_page_bulk_init(void)
+{
+	struct page **pages;
+	cycles_t time1, time2;
+	unsigned long nr, total = 0;
+	unsigned int i, j;
+	int ret = -EAGAIN;
+
+	pages = kcalloc(batch, sizeof(*pages), GFP_KERNEL);
+	if (!pages)
+		return -ENOMEM;
+
+	time1 = get_cycles();
+	for (i = 0; i < LOOPS; i++) {
+		for (j = 0; j < batch; j++) {
+			pages[j] = alloc_page(GFP_KERNEL);
+			if (!pages[j])
+				break;
+		}
+		total += j;
+		while (j--) {
+			__free_page(pages[j]);
+			pages[j] = NULL;
+		}
+	}
+	time2 = get_cycles();
+	pr_info("alloc_page: %llu cycles/page\n",
+		(unsigned long long)div_u64(time2 - time1, total ? : 1));
+
+	total = 0;
+	time1 = get_cycles();
+	for (i = 0; i < LOOPS; i++) {
+		nr = alloc_pages_bulk_array(GFP_KERNEL, batch, pages);
+		total += nr;
+		free_page_array(pages, nr);
+	}
+	time2 = get_cycles();
+	pr_info("alloc_pages_bulk_array: %llu cycles/page, %lu%% of pages requested\n",
+		(unsigned long long)div_u64(time2 - time1, total ? : 1),
+		total * 100 / ((unsigned long)LOOPS * batch));
+
+	/* The list variant must hand out usable, distinct pages too. */
+	for (i = 0; i < LOOPS; i++) {
+		LIST_HEAD(list);
+		struct page *page, *next;
+
+		nr = alloc_pages_bulk_list(GFP_KERNEL, batch, &list);
+		j = 0;
+		list_for_each_entry_safe(page, next, &list, lru) {
+			list_del(&page->lru);
+			if (page_count(page) != 1) {
+				pr_err("page with count %d allocated\n",
+				       page_count(page));
+				ret = -EINVAL;
+			}
+			pages[j++] = page;
+		}
+		if (j != nr) {
+			pr_err("%lu pages reported, %u on the list\n", nr, j);
+			ret = -EINVAL;
+		}
+		free_page_array(pages, j);
+	}
+
+	kfree(pages);
+	return ret; /* Fail will directly unload the module */
+}
+
+static void __exit test_page_bulk_exit(void)
+{
+}
+
+module_init(test_page_bulk_init);
+module_exit(test_page_bulk_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Bulk page allocator benchmark");
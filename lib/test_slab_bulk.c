@@ -0,0 +1,123 @@
+/*
+ * Benchmark of the bulk slab allocation API
+ *
+ * For batches of 16 to 256 objects, allocates and frees a batch LOOPS
+ * times, one object at a time with kmem_cache_alloc() and
+ * kmem_cache_free(), and then with kmem_cache_alloc_bulk() and
+ * kmem_cache_free_bulk(), and reports the nanoseconds spent per object
+ * for both.
+ */
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/ktime.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+
+#define LOOPS		10000
+#define MAX_BATCH	256
+
+static unsigned int size = 256;
+module_param(size, uint, 0444);
+MODULE_PARM_DESC(size, "object size of the cache");
+
+static unsigned long long ns_per_obj(ktime_t start, unsigned long nr)
+{
+	return div_u64(ktime_to_ns(ktime_sub(ktime_get(), start)), nr ? : 1);
+}
+
+static int test_batch(struct kmem_cache *cache, void **objs,
+		      unsigned int batch)
+{
+	unsigned long long single, bulk;
+	unsigned int i, j;
+	ktime_t start;
+
+	start = ktime_get();
+	for (i = 0; i < LOOPS; i++) {
+		for (j = 0; j < batch; j++) {
+			objs[j] = kmem_cache_alloc(cache, GFP_KERNEL);
+			if (!objs[j])
+				break;
+		}
+		while (j--)
+			kmem_cache_free(cache, objs[j]);
+	}
+	single = ns_per_obj(start, (unsigned long)LOOPS * batch);
+
+	start = ktime_get();
+	for (i = 0; i < LOOPS; i++) {
+		if (!kmem_cache_alloc_bulk(cache, GFP_KERNEL, batch, objs))
+			return -ENOMEM;
+		kmem_cache_free_bulk(cache, batch, objs);
+	}
+	bulk = ns_per_obj(start, (unsigned long)LOOPS * batch);
+
+	pr_info("batch %3u: kmem_cache_alloc/free %llu ns/object, bulk %llu ns/object\n",
+		batch, single, bulk);
+
+	/* The objects must be usable, and distinct. */
+	if (!kmem_cache_alloc_bulk(cache, GFP_KERNEL | __GFP_ZERO, batch, objs))
+		return -ENOMEM;
+	for (j = 0; j < batch; j++) {
+		if (memchr_inv(objs[j], 0, size)) {
+			pr_err("object not zeroed\n");
+			goto err;
+		}
+		memset(objs[j], j + 1, size);
+	}
+	for (j = 0; j < batch; j++) {
+		if (memchr_inv(objs[j], j + 1, size)) {
+			pr_err("object allocated twice\n");
+			goto err;
+		}
+	}
+	kmem_cache_free_bulk(cache, batch, objs);
+	return 0;
+
+err:
+	kmem_cache_free_bulk(cache, batch, objs);
+	return -EINVAL;
+}
+
+static int __init test_slab_bulk_init(void)
+{
+	struct kmem_cache *cache;
+	unsigned int batch;
+	void **objs;
+	int ret = -EAGAIN;
+
+	if (!size)
+		return -EINVAL;
+
+	objs = kcalloc(MAX_BATCH, sizeof(*objs), GFP_KERNEL);
+	if (!objs)
+		return -ENOMEM;
+	cache = kmem_cache_create("test_slab_bulk", size, 0, 0, NULL);
+	if (!cache) {
+		kfree(objs);
+		return -ENOMEM;
+	}
+
+	for (batch = 16; batch <= MAX_BATCH; batch *= 2) {
+		int err = test_batch(cache, objs, batch);
+
+		if (err) {
+			ret = err;
+			break;
+		}
+	}
+
+	kmem_cache_destroy(cache);
+	kfree(objs);
+	return ret; /* Fail will directly unload the module */
+}
+
+static void __exit test_slab_bulk_exit(void)
+{
+}
+
+module_init(test_slab_bulk_init);
+module_exit(test_slab_bulk_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Bulk slab allocation benchmark");
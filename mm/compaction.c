@@ -328,6 +328,35 @@ static bool compact_trylock_irqsave(spinlock_t *lock, unsigned long *flags,
 	return true;
 }
 
+/*
+ * Like lock_page_lruvec_irqsave(), but with the compact_trylock_irqsave()
+ * rules for async compaction.  The lruvec is only returned through
+ * @lruvecp if its lock was taken.
+ */
+static bool compact_lock_page_lruvec(struct page *page, struct lruvec **lruvecp,
+				     unsigned long *flags,
+				     struct compact_control *cc)
+{
+	struct zone *zone = page_zone(page);
+	struct lruvec *lruvec;
+	bool locked;
+
+	rcu_read_lock();
+	for (;;) {
+		lruvec = mem_cgroup_page_lruvec(page, zone);
+		locked = compact_trylock_irqsave(&lruvec->lru_lock, flags, cc);
+		if (!locked)
+			break;
+		if (likely(lruvec == mem_cgroup_page_lruvec(page, zone))) {
+			*lruvecp = lruvec;
+			break;
+		}
+		spin_unlock_irqrestore(&lruvec->lru_lock, *flags);
+	}
+	rcu_read_unlock();
+	return locked;
+}
+
 /*
  * Compaction requires the taking of some coarse locks that are potentially
  * very heavily contended. The lock should be periodically unlocked to avoid
@@ -647,7 +676,7 @@ isolate_migratepages_block(struct compact_control *cc, unsigned long low_pfn,
 	struct zone *zone = cc->zone;
 	unsigned long nr_scanned = 0, nr_isolated = 0;
 	struct list_head *migratelist = &cc->migratepages;
-	struct lruvec *lruvec;
+	struct lruvec *lruvec = NULL;
 	unsigned long flags = 0;
 	bool locked = false;
 	struct page *page = NULL, *valid_page = NULL;
@@ -680,7 +709,7 @@ isolate_migratepages_block(struct compact_control *cc, unsigned long low_pfn,
 		 * if contended.
 		 */
 		if (!(low_pfn % SWAP_CLUSTER_MAX)
-		    && compact_unlock_should_abort(&zone->lru_lock, flags,
+		    && compact_unlock_should_abort(&lruvec->lru_lock, flags,
 								&locked, cc))
 			break;
 
@@ -756,24 +785,43 @@ isolate_migratepages_block(struct compact_control *cc, unsigned long low_pfn,
 		    page_count(page) > page_mapcount(page))
 			continue;
 
+		/*
+		 * The lock we hold, if any, may be that of another lruvec than
+		 * the page is on.  page->mem_cgroup only tells the lruvec of a
+		 * page that is PageLRU, and only keeps telling it under that
+		 * lruvec's lock; PageLRU is cleared before it is changed.
+		 * Not PageLRU under the lock of another lruvec means nothing,
+		 * so leave the page alone then.
+		 */
+		if (locked) {
+			if (!PageLRU(page))
+				continue;
+			smp_rmb();
+			if (mem_cgroup_page_lruvec(page, zone) != lruvec) {
+				spin_unlock_irqrestore(&lruvec->lru_lock, flags);
+				locked = false;
+			}
+		}
+
 		/* If we already hold the lock, we can skip some rechecking */
 		if (!locked) {
-			locked = compact_trylock_irqsave(&zone->lru_lock,
-								&flags, cc);
+			locked = compact_lock_page_lruvec(page, &lruvec,
+							  &flags, cc);
 			if (!locked)
 				break;
 
 			/* Recheck PageLRU and PageTransHuge under lock */
 			if (!PageLRU(page))
 				continue;
+			smp_rmb();
+			if (mem_cgroup_page_lruvec(page, zone) != lruvec)
+				continue;
 			if (PageTransHuge(page)) {
 				low_pfn += (1 << compound_order(page)) - 1;
 				continue;
 			}
 		}
 
-		lruvec = mem_cgroup_page_lruvec(page, zone);
-
 		/* Try isolate the page */
 		if (__isolate_lru_page(page, isolate_mode) != 0)
 			continue;
@@ -803,7 +851,7 @@ isolate_success:
 		low_pfn = end_pfn;
 
 	if (locked)
-		spin_unlock_irqrestore(&zone->lru_lock, flags);
+		spin_unlock_irqrestore(&lruvec->lru_lock, flags);
 
 	/*
 	 * Update the pageblock-skip information and cached scanner pfn,
@@ -94,8 +94,8 @@
  *    ->swap_lock		(try_to_unmap_one)
  *    ->private_lock		(try_to_unmap_one)
  *    ->tree_lock		(try_to_unmap_one)
- *    ->zone.lru_lock		(follow_page->mark_page_accessed)
- *    ->zone.lru_lock		(check_pte_range->isolate_lru_page)
+ *    ->lruvec.lru_lock		(follow_page->mark_page_accessed)
+ *    ->lruvec.lru_lock		(check_pte_range->isolate_lru_page)
  *    ->private_lock		(page_remove_rmap->set_page_dirty)
  *    ->tree_lock		(page_remove_rmap->set_page_dirty)
  *    bdi.wb->list_lock		(page_remove_rmap->set_page_dirty)
@@ -2082,6 +2082,110 @@ next:
 }
 EXPORT_SYMBOL(filemap_map_pages);
 
+#ifdef CONFIG_TRANSPARENT_HUGE_PAGECACHE
+/*
+ * Map the huge page aligned range of the file around @address with one
+ * pmd, if it is cached, or can be read, in HPAGE_PMD_NR physically
+ * contiguous and naturally aligned pages.  Only for read faults in
+ * mappings that cannot write to the file: dirtying and COW are tracked
+ * per page, so write faults split the pmd and go through the ptes.
+ */
+int filemap_pmd_fault(struct vm_area_struct *vma, unsigned long address,
+		      pmd_t *pmd, unsigned int flags)
+{
+	struct file *file = vma->vm_file;
+	struct address_space *mapping = file->f_mapping;
+	unsigned long haddr = address & HPAGE_PMD_MASK;
+	struct page **pages;
+	pgoff_t index, size;
+	int nr, locked = 0, major = 0, ret = VM_FAULT_FALLBACK;
+
+	if (flags & FAULT_FLAG_WRITE)
+		return VM_FAULT_FALLBACK;
+	if ((vma->vm_flags & (VM_SHARED | VM_MAYWRITE)) ==
+	    (VM_SHARED | VM_MAYWRITE))
+		return VM_FAULT_FALLBACK;
+	/* mlock works on the ptes */
+	if (vma->vm_flags & VM_LOCKED)
+		return VM_FAULT_FALLBACK;
+	if (haddr < vma->vm_start || haddr + HPAGE_PMD_SIZE > vma->vm_end)
+		return VM_FAULT_FALLBACK;
+	index = linear_page_index(vma, haddr);
+	if (index & (HPAGE_PMD_NR - 1))
+		return VM_FAULT_FALLBACK;
+	size = round_up(i_size_read(mapping->host), PAGE_CACHE_SIZE) >>
+		PAGE_CACHE_SHIFT;
+	if (index + HPAGE_PMD_NR > size)
+		return VM_FAULT_FALLBACK;
+
+	pages = kmalloc(HPAGE_PMD_NR * sizeof(*pages), GFP_KERNEL);
+	if (!pages)
+		return VM_FAULT_FALLBACK;
+
+	nr = find_get_pages_contig(mapping, index, HPAGE_PMD_NR, pages);
+	if (!nr) {
+		/* Only read the range in whole if none of it is cached */
+		if (find_get_pages(mapping, index, 1, pages)) {
+			bool cached = pages[0]->index < index + HPAGE_PMD_NR;
+
+			page_cache_release(pages[0]);
+			if (cached)
+				goto out;
+		}
+		if (page_cache_read_huge(mapping, file, index))
+			goto out;
+		count_vm_event(PGMAJFAULT);
+		mem_cgroup_count_vm_event(vma->vm_mm, PGMAJFAULT);
+		major = VM_FAULT_MAJOR;
+		nr = find_get_pages_contig(mapping, index, HPAGE_PMD_NR,
+					   pages);
+	}
+	if (nr < HPAGE_PMD_NR)
+		goto out_put;
+	if (page_to_pfn(pages[0]) & (HPAGE_PMD_NR - 1))
+		goto out_put;
+
+	for (; locked < HPAGE_PMD_NR; locked++) {
+		struct page *page = pages[locked];
+
+		if (page_to_pfn(page) != page_to_pfn(pages[0]) + locked)
+			goto out_unlock;
+		wait_on_page_locked(page);
+		if (!trylock_page(page))
+			goto out_unlock;
+		if (page->mapping != mapping || !PageUptodate(page) ||
+		    PageHWPoison(page)) {
+			unlock_page(page);
+			goto out_unlock;
+		}
+	}
+
+	/* Recheck against truncation now that the pages are locked */
+	size = round_up(i_size_read(mapping->host), PAGE_CACHE_SIZE) >>
+		PAGE_CACHE_SHIFT;
+	if (index + HPAGE_PMD_NR > size)
+		goto out_unlock;
+
+	ret = do_set_huge_pmd(vma, haddr, pmd, pages[0]);
+	if (!(ret & VM_FAULT_FALLBACK)) {
+		file->f_ra.mmap_miss = 0;
+		ret |= major;
+	}
+out_unlock:
+	while (locked--)
+		unlock_page(pages[locked]);
+out_put:
+	/* The pmd took over the page references if it was set up */
+	if (ret & VM_FAULT_FALLBACK)
+		while (nr--)
+			page_cache_release(pages[nr]);
+out:
+	kfree(pages);
+	return ret;
+}
+EXPORT_SYMBOL(filemap_pmd_fault);
+#endif
+
 int filemap_page_mkwrite(struct vm_area_struct *vma, struct vm_fault *vmf)
 {
 	struct page *page = vmf->page;
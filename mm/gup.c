@@ -187,7 +187,9 @@ struct page *follow_page_mask(struct vm_area_struct *vma,
 	if ((flags & FOLL_NUMA) && pmd_protnone(*pmd))
 		return no_page_table(vma, flags);
 	if (pmd_trans_huge(*pmd)) {
-		if (flags & FOLL_SPLIT) {
+		/* Page cache is mlocked one page at a time, through the ptes */
+		if ((flags & FOLL_SPLIT) ||
+		    (vma->vm_ops && (vma->vm_flags & VM_LOCKED))) {
 			split_huge_page_pmd(vma, address, pmd);
 			return follow_page_pte(vma, address, pmd, flags);
 		}
@@ -1081,6 +1083,9 @@ static int gup_huge_pmd(pmd_t orig, pmd_t *pmdp, unsigned long addr,
 
 	refs = 0;
 	head = pmd_page(orig);
+	/* page cache mapped by a huge pmd is left to the slow path */
+	if (!PageCompound(head))
+		return 0;
 	page = head + ((addr & ~PMD_MASK) >> PAGE_SHIFT);
 	tail = page;
 	do {
@@ -49,12 +49,24 @@ unsigned long transparent_hugepage_flags __read_mostly =
 
 /* default scan 8*512 pte (or vmas) every 30 second */
 static unsigned int khugepaged_pages_to_scan __read_mostly = HPAGE_PMD_NR*8;
-static unsigned int khugepaged_pages_collapsed;
+static atomic_t khugepaged_pages_collapsed;
 static unsigned int khugepaged_full_scans;
 static unsigned int khugepaged_scan_sleep_millisecs __read_mostly = 10000;
 /* during fragmentation poll the hugepage allocator once every minute */
 static unsigned int khugepaged_alloc_sleep_millisecs __read_mostly = 60000;
-static struct task_struct *khugepaged_thread __read_mostly;
+
+/*
+ * khugepaged can run as several threads, each scanning a different mm at
+ * any time.  Each thread has its own view of which nodes the pages of the
+ * pmd it is scanning come from.
+ */
+#define KHUGEPAGED_MAX_THREADS	32
+struct khugepaged_thread {
+	struct task_struct *task;
+	int node_load[MAX_NUMNODES];
+};
+static struct khugepaged_thread *khugepaged_threads[KHUGEPAGED_MAX_THREADS];
+static unsigned int khugepaged_nr_threads __read_mostly = 1;
 static DEFINE_MUTEX(khugepaged_mutex);
 static DEFINE_SPINLOCK(khugepaged_mm_lock);
 static DECLARE_WAIT_QUEUE_HEAD(khugepaged_wait);
@@ -65,7 +77,7 @@ static DECLARE_WAIT_QUEUE_HEAD(khugepaged_wait);
  */
 static unsigned int khugepaged_max_ptes_none __read_mostly = HPAGE_PMD_NR-1;
 
-static int khugepaged(void *none);
+static int khugepaged(void *data);
 static int khugepaged_slab_init(void);
 static void khugepaged_slab_exit(void);
 
@@ -77,30 +89,46 @@ static struct kmem_cache *mm_slot_cache __read_mostly;
 /**
  * struct mm_slot - hash lookup from mm to mm_slot
  * @hash: hash collision list
- * @mm_node: khugepaged scan list headed in khugepaged_scan.mm_head
+ * @mm_node: khugepaged scan list headed in khugepaged_scan.mm_head, or in
+ *	khugepaged_scan.req_head while a collapse request is pending
  * @mm: the mm that this information is valid for
+ * @address: the next address inside that to be scanned
+ * @scanning: a khugepaged thread is scanning this mm
+ * @req_start: start of the range still to collapse for a request
+ * @req_end: end of that range, equal to @req_start with no request pending
+ * @req_time: when the pending request was made, in ns
  */
 struct mm_slot {
 	struct hlist_node hash;
 	struct list_head mm_node;
 	struct mm_struct *mm;
+	unsigned long address;
+	bool scanning;
+	unsigned long req_start;
+	unsigned long req_end;
+	u64 req_time;
 };
 
 /**
- * struct khugepaged_scan - cursor for scanning
- * @mm_head: the head of the mm list to scan
- * @mm_slot: the current mm_slot we are scanning
- * @address: the next address inside that to be scanned
+ * struct khugepaged_scan - the mms to scan
+ * @mm_head: the head of the mm list to scan, in round-robin order
+ * @req_head: the mms with a collapse request pending, served first
+ * @nr_slots: the number of mms registered
+ * @nr_scanned: how many of them were scanned through since the last full scan
  *
- * There is only the one khugepaged_scan instance of this cursor structure.
+ * A thread takes the first mm_slot not being scanned, from @req_head if
+ * there is one, and puts it back to the tail of @mm_head once it scanned
+ * all of the mm.  All of it is protected by khugepaged_mm_lock.
  */
 struct khugepaged_scan {
 	struct list_head mm_head;
-	struct mm_slot *mm_slot;
-	unsigned long address;
+	struct list_head req_head;
+	unsigned int nr_slots;
+	unsigned int nr_scanned;
 };
 static struct khugepaged_scan khugepaged_scan = {
 	.mm_head = LIST_HEAD_INIT(khugepaged_scan.mm_head),
+	.req_head = LIST_HEAD_INIT(khugepaged_scan.req_head),
 };
 
 
@@ -142,27 +170,66 @@ static int set_recommended_min_free_kbytes(void)
 	return 0;
 }
 
+static int start_khugepaged_thread(unsigned int nr)
+{
+	struct khugepaged_thread *thread;
+
+	thread = kzalloc(sizeof(*thread), GFP_KERNEL);
+	if (!thread)
+		return -ENOMEM;
+
+	if (nr)
+		thread->task = kthread_run(khugepaged, thread,
+					   "khugepaged/%u", nr);
+	else
+		thread->task = kthread_run(khugepaged, thread, "khugepaged");
+	if (unlikely(IS_ERR(thread->task))) {
+		int err = PTR_ERR(thread->task);
+
+		pr_err("khugepaged: kthread_run(khugepaged) failed\n");
+		kfree(thread);
+		return err;
+	}
+
+	khugepaged_threads[nr] = thread;
+	return 0;
+}
+
+static void stop_khugepaged_thread(unsigned int nr)
+{
+	kthread_stop(khugepaged_threads[nr]->task);
+	kfree(khugepaged_threads[nr]);
+	khugepaged_threads[nr] = NULL;
+}
+
+/* Called with khugepaged_mutex held */
 static int start_stop_khugepaged(void)
 {
+	unsigned int nr_threads = 0;
+	unsigned int i;
 	int err = 0;
-	if (khugepaged_enabled()) {
-		if (!khugepaged_thread)
-			khugepaged_thread = kthread_run(khugepaged, NULL,
-							"khugepaged");
-		if (unlikely(IS_ERR(khugepaged_thread))) {
-			pr_err("khugepaged: kthread_run(khugepaged) failed\n");
-			err = PTR_ERR(khugepaged_thread);
-			khugepaged_thread = NULL;
+
+	if (khugepaged_enabled())
+		nr_threads = khugepaged_nr_threads;
+
+	for (i = nr_threads; i < KHUGEPAGED_MAX_THREADS; i++)
+		if (khugepaged_threads[i])
+			stop_khugepaged_thread(i);
+
+	for (i = 0; i < nr_threads; i++) {
+		if (khugepaged_threads[i])
+			continue;
+		err = start_khugepaged_thread(i);
+		if (err)
 			goto fail;
-		}
+	}
 
-		if (!list_empty(&khugepaged_scan.mm_head))
+	if (nr_threads) {
+		if (!list_empty(&khugepaged_scan.mm_head) ||
+		    !list_empty(&khugepaged_scan.req_head))
 			wake_up_interruptible(&khugepaged_wait);
 
 		set_recommended_min_free_kbytes();
-	} else if (khugepaged_thread) {
-		kthread_stop(khugepaged_thread);
-		khugepaged_thread = NULL;
 	}
 fail:
 	return err;
@@ -176,6 +243,16 @@ static inline bool is_huge_zero_pmd(pmd_t pmd)
 	return is_huge_zero_page(pmd_page(pmd));
 }
 
+/*
+ * A pmd set up by do_set_huge_pmd() maps HPAGE_PMD_NR small page cache
+ * pages, each mapped and referenced on its own, not a compound page.
+ */
+static inline bool is_file_huge_pmd(pmd_t pmd)
+{
+	return IS_ENABLED(CONFIG_TRANSPARENT_HUGE_PAGECACHE) &&
+		!is_huge_zero_pmd(pmd) && !PageAnon(pmd_page(pmd));
+}
+
 static struct page *get_huge_zero_page(void)
 {
 	struct page *zero_page;
@@ -492,7 +569,7 @@ static ssize_t pages_collapsed_show(struct kobject *kobj,
 				    struct kobj_attribute *attr,
 				    char *buf)
 {
-	return sprintf(buf, "%u\n", khugepaged_pages_collapsed);
+	return sprintf(buf, "%u\n", atomic_read(&khugepaged_pages_collapsed));
 }
 static struct kobj_attribute pages_collapsed_attr =
 	__ATTR_RO(pages_collapsed);
@@ -506,6 +583,33 @@ static ssize_t full_scans_show(struct kobject *kobj,
 static struct kobj_attribute full_scans_attr =
 	__ATTR_RO(full_scans);
 
+static ssize_t threads_show(struct kobject *kobj,
+			    struct kobj_attribute *attr,
+			    char *buf)
+{
+	return sprintf(buf, "%u\n", khugepaged_nr_threads);
+}
+static ssize_t threads_store(struct kobject *kobj,
+			     struct kobj_attribute *attr,
+			     const char *buf, size_t count)
+{
+	unsigned long nr_threads;
+	int err;
+
+	err = kstrtoul(buf, 10, &nr_threads);
+	if (err || !nr_threads || nr_threads > KHUGEPAGED_MAX_THREADS)
+		return -EINVAL;
+
+	mutex_lock(&khugepaged_mutex);
+	khugepaged_nr_threads = nr_threads;
+	err = start_stop_khugepaged();
+	mutex_unlock(&khugepaged_mutex);
+
+	return err ? err : count;
+}
+static struct kobj_attribute threads_attr =
+	__ATTR(threads, 0644, threads_show, threads_store);
+
 static ssize_t khugepaged_defrag_show(struct kobject *kobj,
 				      struct kobj_attribute *attr, char *buf)
 {
@@ -562,6 +666,7 @@ static struct attribute *khugepaged_attr[] = {
 	&pages_to_scan_attr.attr,
 	&pages_collapsed_attr.attr,
 	&full_scans_attr.attr,
+	&threads_attr.attr,
 	&scan_sleep_millisecs_attr.attr,
 	&alloc_sleep_millisecs_attr.attr,
 	NULL,
@@ -765,6 +870,45 @@ static int __do_huge_pmd_anonymous_page(struct mm_struct *mm,
 	return 0;
 }
 
+#ifdef CONFIG_TRANSPARENT_HUGE_PAGECACHE
+/*
+ * Map the HPAGE_PMD_NR locked, physically contiguous page cache pages
+ * starting at the naturally aligned @page with one read-only pmd.  The
+ * mapping takes over the caller's references to the pages if it is set
+ * up, which VM_FAULT_FALLBACK says it was not.
+ */
+int do_set_huge_pmd(struct vm_area_struct *vma, unsigned long haddr,
+		    pmd_t *pmd, struct page *page)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	pgtable_t pgtable;
+	spinlock_t *ptl;
+	int i;
+
+	pgtable = pte_alloc_one(mm, haddr);
+	if (unlikely(!pgtable))
+		return VM_FAULT_FALLBACK;
+
+	ptl = pmd_lock(mm, pmd);
+	if (unlikely(!pmd_none(*pmd))) {
+		spin_unlock(ptl);
+		pte_free(mm, pgtable);
+		return VM_FAULT_FALLBACK;
+	}
+	for (i = 0; i < HPAGE_PMD_NR; i++)
+		page_add_file_rmap(page + i);
+	pgtable_trans_huge_deposit(mm, pmd, pgtable);
+	set_pmd_at(mm, haddr, pmd, mk_huge_pmd(page, vma->vm_page_prot));
+	update_mmu_cache_pmd(vma, haddr, pmd);
+	add_mm_counter(mm, MM_FILEPAGES, HPAGE_PMD_NR);
+	atomic_long_inc(&mm->nr_ptes);
+	spin_unlock(ptl);
+
+	count_vm_event(THP_FILE_MAPPED);
+	return VM_FAULT_NOPAGE;
+}
+#endif
+
 static inline gfp_t alloc_hugepage_gfpmask(int defrag, gfp_t extra_gfp)
 {
 	return (GFP_TRANSHUGE & ~(defrag ? 0 : __GFP_WAIT)) | extra_gfp;
@@ -897,10 +1041,20 @@ int copy_huge_pmd(struct mm_struct *dst_mm, struct mm_struct *src_mm,
 		goto out;
 	}
 	src_page = pmd_page(pmd);
-	VM_BUG_ON_PAGE(!PageHead(src_page), src_page);
-	get_page(src_page);
-	page_dup_rmap(src_page);
-	add_mm_counter(dst_mm, MM_ANONPAGES, HPAGE_PMD_NR);
+	if (is_file_huge_pmd(pmd)) {
+		int i;
+
+		for (i = 0; i < HPAGE_PMD_NR; i++) {
+			get_page(src_page + i);
+			page_dup_rmap(src_page + i);
+		}
+		add_mm_counter(dst_mm, MM_FILEPAGES, HPAGE_PMD_NR);
+	} else {
+		VM_BUG_ON_PAGE(!PageHead(src_page), src_page);
+		get_page(src_page);
+		page_dup_rmap(src_page);
+		add_mm_counter(dst_mm, MM_ANONPAGES, HPAGE_PMD_NR);
+	}
 
 	pmdp_set_wrprotect(src_mm, addr, src_pmd);
 	pmd = pmd_mkold(pmd_wrprotect(pmd));
@@ -1222,6 +1376,13 @@ struct page *follow_trans_huge_pmd(struct vm_area_struct *vma,
 		goto out;
 
 	page = pmd_page(*pmd);
+	if (is_file_huge_pmd(*pmd)) {
+		/* VM_LOCKED ranges are split by follow_page_mask() */
+		page += (addr & ~HPAGE_PMD_MASK) >> PAGE_SHIFT;
+		if (flags & FOLL_GET)
+			get_page(page);
+		goto out;
+	}
 	VM_BUG_ON_PAGE(!PageHead(page), page);
 	if (flags & FOLL_TOUCH) {
 		pmd_t _pmd;
@@ -1408,6 +1569,20 @@ int zap_huge_pmd(struct mmu_gather *tlb, struct vm_area_struct *vma,
 			atomic_long_dec(&tlb->mm->nr_ptes);
 			spin_unlock(ptl);
 			put_huge_zero_page();
+		} else if (is_file_huge_pmd(orig_pmd)) {
+			int i;
+
+			page = pmd_page(orig_pmd);
+			add_mm_counter(tlb->mm, MM_FILEPAGES, -HPAGE_PMD_NR);
+			atomic_long_dec(&tlb->mm->nr_ptes);
+			spin_unlock(ptl);
+			for (i = 0; i < HPAGE_PMD_NR; i++) {
+				if (pmd_young(orig_pmd) &&
+				    likely(!(vma->vm_flags & VM_SEQ_READ)))
+					mark_page_accessed(page + i);
+				page_remove_rmap(page + i);
+				tlb_remove_page(tlb, page + i);
+			}
 		} else {
 			page = pmd_page(orig_pmd);
 			page_remove_rmap(page);
@@ -1499,7 +1674,8 @@ int change_huge_pmd(struct vm_area_struct *vma, pmd_t *pmd,
 		 * data is likely to be read-cached on the local CPU and
 		 * local/remote hits to the zero page are not interesting.
 		 */
-		if (prot_numa && is_huge_zero_pmd(*pmd)) {
+		if (prot_numa && (is_huge_zero_pmd(*pmd) ||
+				  is_file_huge_pmd(*pmd))) {
 			spin_unlock(ptl);
 			return ret;
 		}
@@ -1641,8 +1817,7 @@ static void __split_huge_page_refcount(struct page *page,
 	int tail_count = 0;
 
 	/* prevent PageLRU to go away from under us, and freeze lru stats */
-	spin_lock_irq(&zone->lru_lock);
-	lruvec = mem_cgroup_page_lruvec(page, zone);
+	lruvec = lock_page_lruvec_irq(page);
 
 	compound_lock(page);
 	/* complete memcg works before add pages to LRU */
@@ -1730,7 +1905,7 @@ static void __split_huge_page_refcount(struct page *page,
 
 	ClearPageCompound(page);
 	compound_unlock(page);
-	spin_unlock_irq(&zone->lru_lock);
+	spin_unlock_irq(&lruvec->lru_lock);
 
 	for (i = 1; i < HPAGE_PMD_NR; i++) {
 		struct page *page_tail = page + i;
@@ -1924,6 +2099,18 @@ out:
 
 #define VM_NO_THP (VM_SPECIAL | VM_HUGETLB | VM_SHARED | VM_MAYSHARE)
 
+/*
+ * Page cache mapped by ->pmd_fault is only ever mapped read-only, so it
+ * may be shared as long as the mapping can never be made writable.
+ */
+static unsigned long vma_no_thp(struct vm_area_struct *vma,
+				unsigned long vm_flags)
+{
+	if (vma->vm_ops && vma->vm_ops->pmd_fault && !(vm_flags & VM_MAYWRITE))
+		return VM_NO_THP & ~(VM_SHARED | VM_MAYSHARE);
+	return VM_NO_THP;
+}
+
 int hugepage_madvise(struct vm_area_struct *vma,
 		     unsigned long *vm_flags, int advice)
 {
@@ -1941,7 +2128,7 @@ int hugepage_madvise(struct vm_area_struct *vma,
 		/*
 		 * Be somewhat over-protective like KSM for now!
 		 */
-		if (*vm_flags & (VM_HUGEPAGE | VM_NO_THP))
+		if (*vm_flags & (VM_HUGEPAGE | vma_no_thp(vma, *vm_flags)))
 			return -EINVAL;
 		*vm_flags &= ~VM_NOHUGEPAGE;
 		*vm_flags |= VM_HUGEPAGE;
@@ -1957,7 +2144,7 @@ int hugepage_madvise(struct vm_area_struct *vma,
 		/*
 		 * Be somewhat over-protective like KSM for now!
 		 */
-		if (*vm_flags & (VM_NOHUGEPAGE | VM_NO_THP))
+		if (*vm_flags & (VM_NOHUGEPAGE | vma_no_thp(vma, *vm_flags)))
 			return -EINVAL;
 		*vm_flags &= ~VM_HUGEPAGE;
 		*vm_flags |= VM_NOHUGEPAGE;
@@ -2042,11 +2229,12 @@ int __khugepaged_enter(struct mm_struct *mm)
 	spin_lock(&khugepaged_mm_lock);
 	insert_to_mm_slots_hash(mm, mm_slot);
 	/*
-	 * Insert just behind the scanning cursor, to let the area settle
+	 * Insert behind the mms being scanned, to let the area settle
 	 * down a little.
 	 */
 	wakeup = list_empty(&khugepaged_scan.mm_head);
 	list_add_tail(&mm_slot->mm_node, &khugepaged_scan.mm_head);
+	khugepaged_scan.nr_slots++;
 	spin_unlock(&khugepaged_mm_lock);
 
 	atomic_inc(&mm->mm_count);
@@ -2084,9 +2272,10 @@ void __khugepaged_exit(struct mm_struct *mm)
 
 	spin_lock(&khugepaged_mm_lock);
 	mm_slot = get_mm_slot(mm);
-	if (mm_slot && khugepaged_scan.mm_slot != mm_slot) {
+	if (mm_slot && !mm_slot->scanning) {
 		hash_del(&mm_slot->hash);
 		list_del(&mm_slot->mm_node);
+		khugepaged_scan.nr_slots--;
 		free = 1;
 	}
 	spin_unlock(&khugepaged_mm_lock);
@@ -2109,6 +2298,100 @@ void __khugepaged_exit(struct mm_struct *mm)
 	}
 }
 
+/*
+ * Ask khugepaged to collapse the huge page aligned parts of [start, end)
+ * ahead of everything else it has to scan.  Requests for an mm still
+ * pending are merged into one covering both.
+ */
+static int khugepaged_request(struct mm_struct *mm, unsigned long start,
+			      unsigned long end)
+{
+	struct mm_slot *mm_slot;
+	int err;
+
+	start = (start + ~HPAGE_PMD_MASK) & HPAGE_PMD_MASK;
+	end &= HPAGE_PMD_MASK;
+	if (start >= end)
+		return 0;
+
+	if (!test_bit(MMF_VM_HUGEPAGE, &mm->flags)) {
+		err = __khugepaged_enter(mm);
+		if (err)
+			return err;
+	}
+
+	spin_lock(&khugepaged_mm_lock);
+	mm_slot = get_mm_slot(mm);
+	if (unlikely(!mm_slot)) {
+		/* not registered by __khugepaged_enter() for lack of memory */
+		spin_unlock(&khugepaged_mm_lock);
+		return -ENOMEM;
+	}
+	if (mm_slot->req_start < mm_slot->req_end) {
+		mm_slot->req_start = min(mm_slot->req_start, start);
+		mm_slot->req_end = max(mm_slot->req_end, end);
+	} else {
+		mm_slot->req_start = start;
+		mm_slot->req_end = end;
+		mm_slot->req_time = ktime_get_ns();
+		list_move_tail(&mm_slot->mm_node, &khugepaged_scan.req_head);
+	}
+	spin_unlock(&khugepaged_mm_lock);
+
+	wake_up_interruptible(&khugepaged_wait);
+	return 0;
+}
+
+/* Account a request done and put the mm back into the round-robin. */
+static void khugepaged_finish_request(struct mm_slot *mm_slot)
+{
+	struct thp_collapse_stat *stat = &mm_slot->mm->thp_collapse;
+	u64 wait = ktime_get_ns() - mm_slot->req_time;
+
+	VM_BUG_ON(NR_CPUS != 1 && !spin_is_locked(&khugepaged_mm_lock));
+
+	stat->requests++;
+	stat->wait_ns += wait;
+	if (wait > stat->max_wait_ns)
+		stat->max_wait_ns = wait;
+
+	mm_slot->req_start = mm_slot->req_end = 0;
+	list_move_tail(&mm_slot->mm_node, &khugepaged_scan.mm_head);
+}
+
+/*
+ * MADV_COLLAPSE: collapse the range in the background as soon as a
+ * khugepaged thread gets to it, instead of waiting for it to come around.
+ */
+int madvise_collapse(struct vm_area_struct *vma, struct vm_area_struct **prev,
+		     unsigned long start, unsigned long end)
+{
+	*prev = vma;
+
+	if (!khugepaged_enabled())
+		return -EINVAL;
+	if ((!(vma->vm_flags & VM_HUGEPAGE) && !khugepaged_always()) ||
+	    (vma->vm_flags & (VM_NOHUGEPAGE | VM_NO_THP)) || vma->vm_ops)
+		return -EINVAL;
+	/* Nothing faulted in yet, so nothing to collapse */
+	if (!vma->anon_vma)
+		return 0;
+
+	return khugepaged_request(vma->vm_mm, start, end);
+}
+
+/*
+ * PR_THP_COLLAPSE: the same for all of the memory of the mm that
+ * khugepaged would collapse.
+ */
+int khugepaged_collapse_mm(struct mm_struct *mm)
+{
+	if (!khugepaged_enabled())
+		return -EINVAL;
+
+	return khugepaged_request(mm, 0, TASK_SIZE);
+}
+
 static void release_pte_page(struct page *page)
 {
 	/* 0 stands for page_is_file_cache(page) == false */
@@ -2266,9 +2549,7 @@ static void khugepaged_alloc_sleep(void)
 			msecs_to_jiffies(khugepaged_alloc_sleep_millisecs));
 }
 
-static int khugepaged_node_load[MAX_NUMNODES];
-
-static bool khugepaged_scan_abort(int nid)
+static bool khugepaged_scan_abort(int *node_load, int nid)
 {
 	int i;
 
@@ -2280,11 +2561,11 @@ static bool khugepaged_scan_abort(int nid)
 		return false;
 
 	/* If there is a count for this node already, it must be acceptable */
-	if (khugepaged_node_load[nid])
+	if (node_load[nid])
 		return false;
 
 	for (i = 0; i < MAX_NUMNODES; i++) {
-		if (!khugepaged_node_load[i])
+		if (!node_load[i])
 			continue;
 		if (node_distance(nid, i) > RECLAIM_DISTANCE)
 			return true;
@@ -2293,15 +2574,15 @@ static bool khugepaged_scan_abort(int nid)
 }
 
 #ifdef CONFIG_NUMA
-static int khugepaged_find_target_node(void)
+static int khugepaged_find_target_node(int *node_load)
 {
 	static int last_khugepaged_target_node = NUMA_NO_NODE;
 	int nid, target_node = 0, max_value = 0;
 
 	/* find first node with max normal pages hit */
 	for (nid = 0; nid < MAX_NUMNODES; nid++)
-		if (khugepaged_node_load[nid] > max_value) {
-			max_value = khugepaged_node_load[nid];
+		if (node_load[nid] > max_value) {
+			max_value = node_load[nid];
 			target_node = nid;
 		}
 
@@ -2309,7 +2590,7 @@ static int khugepaged_find_target_node(void)
 	if (target_node <= last_khugepaged_target_node)
 		for (nid = last_khugepaged_target_node + 1; nid < MAX_NUMNODES;
 				nid++)
-			if (max_value == khugepaged_node_load[nid]) {
+			if (max_value == node_load[nid]) {
 				target_node = nid;
 				break;
 			}
@@ -2361,7 +2642,7 @@ khugepaged_alloc_page(struct page **hpage, gfp_t gfp, struct mm_struct *mm,
 	return *hpage;
 }
 #else
-static int khugepaged_find_target_node(void)
+static int khugepaged_find_target_node(int *node_load)
 {
 	return 0;
 }
@@ -2485,6 +2766,7 @@ static void collapse_huge_page(struct mm_struct *mm,
 		goto out;
 
 	anon_vma_lock_write(vma->anon_vma);
+	vm_write_begin(vma);
 
 	pte = pte_offset_map(pmd, address);
 	pte_ptl = pte_lockptr(mm, pmd);
@@ -2518,6 +2800,7 @@ static void collapse_huge_page(struct mm_struct *mm,
 		 */
 		pmd_populate(mm, pmd, pmd_pgtable(_pmd));
 		spin_unlock(pmd_ptl);
+		vm_write_end(vma);
 		anon_vma_unlock_write(vma->anon_vma);
 		goto out;
 	}
@@ -2552,10 +2835,12 @@ static void collapse_huge_page(struct mm_struct *mm,
 	set_pmd_at(mm, address, pmd, _pmd);
 	update_mmu_cache_pmd(vma, address, pmd);
 	spin_unlock(pmd_ptl);
+	vm_write_end(vma);
 
 	*hpage = NULL;
 
-	khugepaged_pages_collapsed++;
+	atomic_inc(&khugepaged_pages_collapsed);
+	mm->thp_collapse.collapsed++;
 out_up_write:
 	up_write(&mm->mmap_sem);
 	return;
@@ -2568,7 +2853,8 @@ out:
 static int khugepaged_scan_pmd(struct mm_struct *mm,
 			       struct vm_area_struct *vma,
 			       unsigned long address,
-			       struct page **hpage)
+			       struct page **hpage,
+			       int *node_load, bool requested)
 {
 	pmd_t *pmd;
 	pte_t *pte, *_pte;
@@ -2585,7 +2871,7 @@ static int khugepaged_scan_pmd(struct mm_struct *mm,
 	if (!pmd)
 		goto out;
 
-	memset(khugepaged_node_load, 0, sizeof(khugepaged_node_load));
+	memset(node_load, 0, sizeof(int) * MAX_NUMNODES);
 	pte = pte_offset_map_lock(mm, pmd, address, &ptl);
 	for (_address = address, _pte = pte; _pte < pte+HPAGE_PMD_NR;
 	     _pte++, _address += PAGE_SIZE) {
@@ -2606,14 +2892,14 @@ static int khugepaged_scan_pmd(struct mm_struct *mm,
 			goto out_unmap;
 		/*
 		 * Record which node the original page is from and save this
-		 * information to khugepaged_node_load[].
+		 * information to node_load[].
 		 * Khupaged will allocate hugepage from the node has the max
 		 * hit record.
 		 */
 		node = page_to_nid(page);
-		if (khugepaged_scan_abort(node))
+		if (khugepaged_scan_abort(node_load, node))
 			goto out_unmap;
-		khugepaged_node_load[node]++;
+		node_load[node]++;
 		VM_BUG_ON_PAGE(PageCompound(page), page);
 		if (!PageLRU(page) || PageLocked(page) || !PageAnon(page))
 			goto out_unmap;
@@ -2628,12 +2914,13 @@ static int khugepaged_scan_pmd(struct mm_struct *mm,
 		    mmu_notifier_test_young(vma->vm_mm, address))
 			referenced = true;
 	}
-	if (referenced && writable)
+	/* Asked for, so don't wait for the pages to be used again */
+	if ((referenced || requested) && writable)
 		ret = 1;
 out_unmap:
 	pte_unmap_unlock(pte, ptl);
 	if (ret) {
-		node = khugepaged_find_target_node();
+		node = khugepaged_find_target_node(node_load);
 		/* collapse_huge_page will return with the mmap_sem released */
 		collapse_huge_page(mm, address, hpage, vma, node);
 	}
@@ -2651,6 +2938,7 @@ static void collect_mm_slot(struct mm_slot *mm_slot)
 		/* free mm_slot */
 		hash_del(&mm_slot->hash);
 		list_del(&mm_slot->mm_node);
+		khugepaged_scan.nr_slots--;
 
 		/*
 		 * Not strictly needed because the mm exited already.
@@ -2664,35 +2952,63 @@ static void collect_mm_slot(struct mm_slot *mm_slot)
 	}
 }
 
-static unsigned int khugepaged_scan_mm_slot(unsigned int pages,
-					    struct page **hpage)
+/*
+ * Take the next mm to scan, an mm with a collapse request pending first.
+ * Called with khugepaged_mm_lock held.
+ */
+static struct mm_slot *khugepaged_get_mm_slot(void)
+{
+	struct mm_slot *mm_slot;
+
+	list_for_each_entry(mm_slot, &khugepaged_scan.req_head, mm_node)
+		if (!mm_slot->scanning)
+			goto found;
+	list_for_each_entry(mm_slot, &khugepaged_scan.mm_head, mm_node)
+		if (!mm_slot->scanning)
+			goto found;
+	return NULL;
+found:
+	mm_slot->scanning = true;
+	return mm_slot;
+}
+
+/*
+ * Scan up to @pages of the given mm, or of the range requested for it,
+ * from where the last scan of it stopped.  Returns the progress made, and
+ * sets *@done if that was the end of the mm or of the request.
+ */
+static unsigned int khugepaged_scan_mm_slot(struct mm_slot *mm_slot,
+					    unsigned int pages,
+					    struct page **hpage,
+					    int *node_load, bool *done)
 	__releases(&khugepaged_mm_lock)
 	__acquires(&khugepaged_mm_lock)
 {
-	struct mm_slot *mm_slot;
-	struct mm_struct *mm;
+	struct mm_struct *mm = mm_slot->mm;
 	struct vm_area_struct *vma;
+	unsigned long address, req_start, end;
+	bool requested;
 	int progress = 0;
 
 	VM_BUG_ON(!pages);
 	VM_BUG_ON(NR_CPUS != 1 && !spin_is_locked(&khugepaged_mm_lock));
 
-	if (khugepaged_scan.mm_slot)
-		mm_slot = khugepaged_scan.mm_slot;
-	else {
-		mm_slot = list_entry(khugepaged_scan.mm_head.next,
-				     struct mm_slot, mm_node);
-		khugepaged_scan.address = 0;
-		khugepaged_scan.mm_slot = mm_slot;
+	req_start = mm_slot->req_start;
+	requested = req_start < mm_slot->req_end;
+	if (requested) {
+		address = req_start;
+		end = mm_slot->req_end;
+	} else {
+		address = mm_slot->address;
+		end = TASK_SIZE;
 	}
 	spin_unlock(&khugepaged_mm_lock);
 
-	mm = mm_slot->mm;
 	down_read(&mm->mmap_sem);
 	if (unlikely(khugepaged_test_exit(mm)))
 		vma = NULL;
 	else
-		vma = find_vma(mm, khugepaged_scan.address);
+		vma = find_vma(mm, address);
 
 	progress++;
 	for (; vma; vma = vma->vm_next) {
@@ -2703,35 +3019,37 @@ static unsigned int khugepaged_scan_mm_slot(unsigned int pages,
 			progress++;
 			break;
 		}
+		if (vma->vm_start >= end) {
+			vma = NULL;
+			break;
+		}
 		if (!hugepage_vma_check(vma)) {
 skip:
 			progress++;
 			continue;
 		}
 		hstart = (vma->vm_start + ~HPAGE_PMD_MASK) & HPAGE_PMD_MASK;
-		hend = vma->vm_end & HPAGE_PMD_MASK;
+		hend = min(vma->vm_end & HPAGE_PMD_MASK, end);
 		if (hstart >= hend)
 			goto skip;
-		if (khugepaged_scan.address > hend)
+		if (address > hend)
 			goto skip;
-		if (khugepaged_scan.address < hstart)
-			khugepaged_scan.address = hstart;
-		VM_BUG_ON(khugepaged_scan.address & ~HPAGE_PMD_MASK);
+		if (address < hstart)
+			address = hstart;
+		VM_BUG_ON(address & ~HPAGE_PMD_MASK);
 
-		while (khugepaged_scan.address < hend) {
+		while (address < hend) {
 			int ret;
 			cond_resched();
 			if (unlikely(khugepaged_test_exit(mm)))
 				goto breakouterloop;
 
-			VM_BUG_ON(khugepaged_scan.address < hstart ||
-				  khugepaged_scan.address + HPAGE_PMD_SIZE >
-				  hend);
-			ret = khugepaged_scan_pmd(mm, vma,
-						  khugepaged_scan.address,
-						  hpage);
+			VM_BUG_ON(address < hstart ||
+				  address + HPAGE_PMD_SIZE > hend);
+			ret = khugepaged_scan_pmd(mm, vma, address, hpage,
+						  node_load, requested);
 			/* move to next address */
-			khugepaged_scan.address += HPAGE_PMD_SIZE;
+			address += HPAGE_PMD_SIZE;
 			progress += HPAGE_PMD_NR;
 			if (ret)
 				/* we released mmap_sem so break loop */
@@ -2745,55 +3063,89 @@ breakouterloop:
 breakouterloop_mmap_sem:
 
 	spin_lock(&khugepaged_mm_lock);
-	VM_BUG_ON(khugepaged_scan.mm_slot != mm_slot);
-	/*
-	 * Release the current mm_slot if this mm is about to die, or
-	 * if we scanned all vmas of this mm.
-	 */
-	if (khugepaged_test_exit(mm) || !vma) {
-		/*
-		 * Make sure that if mm_users is reaching zero while
-		 * khugepaged runs here, khugepaged_exit will find
-		 * mm_slot not pointing to the exiting mm.
-		 */
-		if (mm_slot->mm_node.next != &khugepaged_scan.mm_head) {
-			khugepaged_scan.mm_slot = list_entry(
-				mm_slot->mm_node.next,
-				struct mm_slot, mm_node);
-			khugepaged_scan.address = 0;
-		} else {
-			khugepaged_scan.mm_slot = NULL;
+	VM_BUG_ON(!mm_slot->scanning);
+	mm_slot->scanning = false;
+	*done = khugepaged_test_exit(mm) || !vma;
+
+	if (requested) {
+		/* Unless a new request moved the start, continue from here */
+		if (mm_slot->req_start == req_start)
+			mm_slot->req_start = *done ? mm_slot->req_end : address;
+		if (khugepaged_test_exit(mm) ||
+		    mm_slot->req_start >= mm_slot->req_end)
+			khugepaged_finish_request(mm_slot);
+		else
+			*done = false;
+	} else if (*done) {
+		mm_slot->address = 0;
+		if (++khugepaged_scan.nr_scanned >= khugepaged_scan.nr_slots) {
+			khugepaged_scan.nr_scanned = 0;
 			khugepaged_full_scans++;
 		}
-
-		collect_mm_slot(mm_slot);
+		/* Unless a request came in meanwhile, back to the end */
+		if (mm_slot->req_start >= mm_slot->req_end)
+			list_move_tail(&mm_slot->mm_node,
+				       &khugepaged_scan.mm_head);
+	} else {
+		mm_slot->address = address;
 	}
 
+	/*
+	 * Release the mm_slot if this mm is about to die.  It is no longer
+	 * marked scanning, so khugepaged_exit will not wait for us either.
+	 */
+	collect_mm_slot(mm_slot);
+
 	return progress;
 }
 
 static int khugepaged_has_work(void)
 {
-	return !list_empty(&khugepaged_scan.mm_head) &&
+	return (!list_empty(&khugepaged_scan.mm_head) ||
+		!list_empty(&khugepaged_scan.req_head)) &&
 		khugepaged_enabled();
 }
 
+/* Is there a request no other thread is serving already? */
+static bool khugepaged_has_request(void)
+{
+	struct mm_slot *mm_slot;
+	bool ret = false;
+
+	if (!khugepaged_enabled())
+		return false;
+
+	spin_lock(&khugepaged_mm_lock);
+	list_for_each_entry(mm_slot, &khugepaged_scan.req_head, mm_node) {
+		if (!mm_slot->scanning) {
+			ret = true;
+			break;
+		}
+	}
+	spin_unlock(&khugepaged_mm_lock);
+	return ret;
+}
+
 static int khugepaged_wait_event(void)
 {
 	return !list_empty(&khugepaged_scan.mm_head) ||
+		!list_empty(&khugepaged_scan.req_head) ||
 		kthread_should_stop();
 }
 
-static void khugepaged_do_scan(void)
+static void khugepaged_do_scan(struct khugepaged_thread *thread)
 {
 	struct page *hpage = NULL;
-	unsigned int progress = 0, pass_through_head = 0;
+	unsigned int progress = 0, nr_done = 0;
 	unsigned int pages = khugepaged_pages_to_scan;
 	bool wait = true;
 
 	barrier(); /* write khugepaged_pages_to_scan to local stack */
 
 	while (progress < pages) {
+		struct mm_slot *mm_slot;
+		bool done = false;
+
 		if (!khugepaged_prealloc_page(&hpage, &wait))
 			break;
 
@@ -2803,13 +3155,17 @@ static void khugepaged_do_scan(void)
 			break;
 
 		spin_lock(&khugepaged_mm_lock);
-		if (!khugepaged_scan.mm_slot)
-			pass_through_head++;
+		/* Don't go around more than once per wakeup */
 		if (khugepaged_has_work() &&
-		    pass_through_head < 2)
-			progress += khugepaged_scan_mm_slot(pages - progress,
-							    &hpage);
-		else
+		    nr_done <= khugepaged_scan.nr_slots &&
+		    (mm_slot = khugepaged_get_mm_slot())) {
+			progress += khugepaged_scan_mm_slot(mm_slot,
+							    pages - progress,
+							    &hpage,
+							    thread->node_load,
+							    &done);
+			nr_done += done;
+		} else
 			progress = pages;
 		spin_unlock(&khugepaged_mm_lock);
 	}
@@ -2820,12 +3176,17 @@ static void khugepaged_do_scan(void)
 
 static void khugepaged_wait_work(void)
 {
+	/* Requests don't wait for the scan interval */
+	if (khugepaged_has_request())
+		return;
+
 	if (khugepaged_has_work()) {
 		if (!khugepaged_scan_sleep_millisecs)
 			return;
 
 		wait_event_freezable_timeout(khugepaged_wait,
-					     kthread_should_stop(),
+					     kthread_should_stop() ||
+					     khugepaged_has_request(),
 			msecs_to_jiffies(khugepaged_scan_sleep_millisecs));
 		return;
 	}
@@ -2834,24 +3195,18 @@ static void khugepaged_wait_work(void)
 		wait_event_freezable(khugepaged_wait, khugepaged_wait_event());
 }
 
-static int khugepaged(void *none)
+static int khugepaged(void *data)
 {
-	struct mm_slot *mm_slot;
+	struct khugepaged_thread *thread = data;
 
 	set_freezable();
 	set_user_nice(current, MAX_NICE);
 
 	while (!kthread_should_stop()) {
-		khugepaged_do_scan();
+		khugepaged_do_scan(thread);
 		khugepaged_wait_work();
 	}
 
-	spin_lock(&khugepaged_mm_lock);
-	mm_slot = khugepaged_scan.mm_slot;
-	khugepaged_scan.mm_slot = NULL;
-	if (mm_slot)
-		collect_mm_slot(mm_slot);
-	spin_unlock(&khugepaged_mm_lock);
 	return 0;
 }
 
@@ -2883,6 +3238,40 @@ static void __split_huge_zero_page_pmd(struct vm_area_struct *vma,
 	put_huge_zero_page();
 }
 
+/*
+ * The small pages behind a huge pmd of page cache are mapped and
+ * referenced one by one already, so they just move to ptes.
+ */
+static void __split_huge_file_pmd(struct vm_area_struct *vma,
+		unsigned long haddr, pmd_t *pmd)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	struct page *page = pmd_page(*pmd);
+	bool young = pmd_young(*pmd);
+	pgtable_t pgtable;
+	pmd_t _pmd;
+	int i;
+
+	pmdp_huge_clear_flush_notify(vma, haddr, pmd);
+	/* leave pmd empty until pte is filled */
+
+	pgtable = pgtable_trans_huge_withdraw(mm, pmd);
+	pmd_populate(mm, &_pmd, pgtable);
+
+	for (i = 0; i < HPAGE_PMD_NR; i++, haddr += PAGE_SIZE) {
+		pte_t *pte, entry;
+		entry = mk_pte(page + i, vma->vm_page_prot);
+		if (young)
+			entry = pte_mkyoung(entry);
+		pte = pte_offset_map(&_pmd, haddr);
+		VM_BUG_ON(!pte_none(*pte));
+		set_pte_at(mm, haddr, pte, entry);
+		pte_unmap(pte);
+	}
+	smp_wmb(); /* make pte visible before pmd */
+	pmd_populate(mm, pmd, pgtable);
+}
+
 void __split_huge_page_pmd(struct vm_area_struct *vma, unsigned long address,
 		pmd_t *pmd)
 {
@@ -2911,6 +3300,12 @@ again:
 		mmu_notifier_invalidate_range_end(mm, mmun_start, mmun_end);
 		return;
 	}
+	if (is_file_huge_pmd(*pmd)) {
+		__split_huge_file_pmd(vma, haddr, pmd);
+		spin_unlock(ptl);
+		mmu_notifier_invalidate_range_end(mm, mmun_start, mmun_end);
+		return;
+	}
 	page = pmd_page(*pmd);
 	VM_BUG_ON_PAGE(!page_count(page), page);
 	get_page(page);
@@ -2940,6 +3335,57 @@ void split_huge_page_pmd_mm(struct mm_struct *mm, unsigned long address,
 	split_huge_page_pmd(vma, address, pmd);
 }
 
+#ifdef CONFIG_TRANSPARENT_HUGE_PAGECACHE
+/*
+ * Find the huge pmd of page cache that maps @page at @address in @mm, and
+ * return it with its lock held.  page_check_address() skips huge pmds, so
+ * rmap walks of page cache look for these first.
+ */
+pmd_t *page_check_address_file_pmd(struct page *page, struct mm_struct *mm,
+				   unsigned long address, spinlock_t **ptl)
+{
+	pgd_t *pgd;
+	pud_t *pud;
+	pmd_t *pmd;
+
+	pgd = pgd_offset(mm, address);
+	if (!pgd_present(*pgd))
+		return NULL;
+
+	pud = pud_offset(pgd, address);
+	if (!pud_present(*pud))
+		return NULL;
+
+	pmd = pmd_offset(pud, address);
+	if (!pmd_trans_huge(*pmd))
+		return NULL;
+
+	*ptl = pmd_lock(mm, pmd);
+	if (pmd_trans_huge(*pmd) && is_file_huge_pmd(*pmd) &&
+	    pmd_page(*pmd) + ((address & ~HPAGE_PMD_MASK) >> PAGE_SHIFT) == page)
+		return pmd;
+	spin_unlock(*ptl);
+	return NULL;
+}
+
+/*
+ * Split the huge pmd of page cache that maps @page at @address in @vma, if
+ * any, so that rmap walks can unmap the small page there.
+ */
+void split_huge_file_pmd(struct page *page, struct vm_area_struct *vma,
+			 unsigned long address)
+{
+	spinlock_t *ptl;
+	pmd_t *pmd;
+
+	pmd = page_check_address_file_pmd(page, vma->vm_mm, address, &ptl);
+	if (!pmd)
+		return;
+	spin_unlock(ptl);
+	split_huge_page_pmd(vma, address, pmd);
+}
+#endif
+
 static void split_huge_page_address(struct mm_struct *mm,
 				    unsigned long address)
 {
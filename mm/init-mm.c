@@ -4,6 +4,8 @@
 #include <linux/spinlock.h>
 #include <linux/list.h>
 #include <linux/cpumask.h>
+#include <linux/percpu.h>
+#include <linux/wait.h>
 
 #include <linux/atomic.h>
 #include <asm/pgtable.h>
@@ -13,12 +15,21 @@
 #define INIT_MM_CONTEXT(name)
 #endif
 
+static DEFINE_PER_CPU(int, init_mm_range_faults);
+
 struct mm_struct init_mm = {
 	.mm_rb		= RB_ROOT,
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+	.mm_rb_lock	= __RW_LOCK_UNLOCKED(init_mm.mm_rb_lock),
+#endif
 	.pgd		= swapper_pg_dir,
 	.mm_users	= ATOMIC_INIT(2),
 	.mm_count	= ATOMIC_INIT(1),
 	.mmap_sem	= __RWSEM_INITIALIZER(init_mm.mmap_sem),
+	.mmap_range	= RANGE_LOCK_TREE_INIT(init_mm.mmap_range),
+	.mmap_range_writers = ATOMIC_INIT(0),
+	.mmap_range_faults = &init_mm_range_faults,
+	.mmap_range_wait = __WAIT_QUEUE_HEAD_INITIALIZER(init_mm.mmap_range_wait),
 	.page_table_lock =  __SPIN_LOCK_UNLOCKED(init_mm.page_table_lock),
 	.mmlist		= LIST_HEAD_INIT(init_mm.mmlist),
 	INIT_MM_CONTEXT(init_mm)
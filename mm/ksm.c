@@ -90,6 +90,13 @@
  *
  * If the merge_across_nodes tunable is unset, then KSM maintains multiple
  * stable trees and multiple unstable trees: one of each for each NUMA node.
+ *
+ * Each of those trees is further split into KSM_TREE_SHARDS trees by the
+ * checksum of the page, and sorted by checksum before contents, so that a
+ * full memcmp is only done against pages whose checksum matches.  A shard
+ * of the trees is protected by its own mutex, which lets several ksmd
+ * threads, each scanning an mm_slot of its own, merge pages at the same
+ * time: see ksm_tree_shard().
  */
 
 /**
@@ -98,30 +105,59 @@
  * @mm_list: link into the mm_slots list, rooted in ksm_mm_head
  * @rmap_list: head for this mm_slot's singly-linked list of rmap_items
  * @mm: the mm that this information is valid for
+ * @scanning: claimed by a ksmd thread for this scan
  */
 struct mm_slot {
 	struct hlist_node link;
 	struct list_head mm_list;
 	struct rmap_item *rmap_list;
 	struct mm_struct *mm;
+	bool scanning;
 };
 
 /**
  * struct ksm_scan - cursor for scanning
- * @mm_slot: the current mm_slot we are scanning
+ * @mm_slot: the current mm_slot we are scanning, or NULL
  * @address: the next address inside that to be scanned
  * @rmap_list: link to the next rmap to be scanned in the rmap_list
- * @seqnr: count of completed full scans (needed when removing unstable node)
+ * @reset: value of ksm_scan_reset when mm_slot was claimed
  *
- * There is only the one ksm_scan instance of this cursor structure.
+ * Each ksmd thread has its own cursor, on an mm_slot claimed from
+ * ksm_mm_next, which no other thread scans until it is released.
  */
 struct ksm_scan {
 	struct mm_slot *mm_slot;
 	unsigned long address;
 	struct rmap_item **rmap_list;
-	unsigned long seqnr;
+	unsigned long reset;
+};
+
+/**
+ * struct ksm_thread - a ksmd thread
+ * @task: the thread
+ * @scan: its scanning cursor
+ * @pages_scanned: pages it has scanned so far
+ * @rate_start: jiffies when the current rate window started
+ * @rate_pages: pages scanned in the current rate window
+ * @pages_per_sec: pages per second scanned in the last rate window
+ */
+struct ksm_thread {
+	struct task_struct *task;
+	struct ksm_scan scan;
+	unsigned long pages_scanned;
+	unsigned long rate_start;
+	unsigned long rate_pages;
+	unsigned long pages_per_sec;
 };
 
+/**
+ * struct ksm_tree_shard - lock of a shard of the stable and unstable trees
+ * @lock: protects the trees of the shard and the rmap_items linked in them
+ */
+struct ksm_tree_shard {
+	struct mutex lock;
+} ____cacheline_aligned_in_smp;
+
 /**
  * struct stable_node - node of the stable rbtree
  * @node: rb node of this ksm page in the stable tree
@@ -129,6 +165,7 @@ struct ksm_scan {
  * @list: linked into migrate_nodes, pending placement in the proper node tree
  * @hlist: hlist head of rmap_items using this ksm page
  * @kpfn: page frame number of this ksm page (perhaps temporarily on wrong nid)
+ * @checksum: checksum of this ksm page, which picks its shard of the tree
  * @nid: NUMA node id of stable tree in which linked (may not match kpfn)
  */
 struct stable_node {
@@ -141,6 +178,7 @@ struct stable_node {
 	};
 	struct hlist_head hlist;
 	unsigned long kpfn;
+	unsigned int checksum;
 #ifdef CONFIG_NUMA
 	int nid;
 #endif
@@ -153,7 +191,8 @@ struct stable_node {
  * @nid: NUMA node id of unstable tree in which linked (may not match page)
  * @mm: the memory structure this rmap_item is pointing into
  * @address: the virtual address this rmap_item tracks (+ flags in low bits)
- * @oldchecksum: previous checksum of the page at that virtual address
+ * @oldchecksum: previous checksum of the page at that virtual address,
+ *	which picks the shard of the tree while it is linked in one
  * @node: rb node of this rmap_item in the unstable tree
  * @head: pointer to stable_node heading this list in the stable tree
  * @hlist: link into hlist of rmap_items hanging off that stable_node
@@ -168,7 +207,7 @@ struct rmap_item {
 	};
 	struct mm_struct *mm;
 	unsigned long address;		/* + low bits used for flags below */
-	unsigned int oldchecksum;	/* when unstable */
+	unsigned int oldchecksum;
 	union {
 		struct rb_node node;	/* when node of unstable tree */
 		struct {		/* when listed from stable tree */
@@ -182,14 +221,22 @@ struct rmap_item {
 #define UNSTABLE_FLAG	0x100	/* is a node of the unstable tree */
 #define STABLE_FLAG	0x200	/* is listed from the stable tree */
 
-/* The stable and unstable tree heads */
-static struct rb_root one_stable_tree[1] = { RB_ROOT };
-static struct rb_root one_unstable_tree[1] = { RB_ROOT };
+/* Number of shards each stable and unstable tree is split into */
+#define KSM_TREE_SHARDS	64
+
+/* The stable and unstable tree heads, KSM_TREE_SHARDS for each node */
+static struct rb_root one_stable_tree[KSM_TREE_SHARDS] = {
+	[0 ... KSM_TREE_SHARDS - 1] = RB_ROOT };
+static struct rb_root one_unstable_tree[KSM_TREE_SHARDS] = {
+	[0 ... KSM_TREE_SHARDS - 1] = RB_ROOT };
 static struct rb_root *root_stable_tree = one_stable_tree;
 static struct rb_root *root_unstable_tree = one_unstable_tree;
 
+static struct ksm_tree_shard ksm_tree_shards[KSM_TREE_SHARDS];
+
 /* Recently migrated nodes of stable tree, pending proper placement */
 static LIST_HEAD(migrate_nodes);
+static DEFINE_SPINLOCK(ksm_migrate_lock);
 
 #define MM_SLOTS_HASH_BITS 10
 static DEFINE_HASHTABLE(mm_slots_hash, MM_SLOTS_HASH_BITS);
@@ -197,27 +244,36 @@ static DEFINE_HASHTABLE(mm_slots_hash, MM_SLOTS_HASH_BITS);
 static struct mm_slot ksm_mm_head = {
 	.mm_list = LIST_HEAD_INIT(ksm_mm_head.mm_list),
 };
-static struct ksm_scan ksm_scan = {
-	.mm_slot = &ksm_mm_head,
-};
+
+/* The next mm_slot to be claimed for this scan, ksm_mm_head at its end */
+static struct mm_slot *ksm_mm_next = &ksm_mm_head;
+
+/* The number of mm_slots claimed by ksmd threads */
+static unsigned int ksm_nr_scanning;
+
+/* Count of completed full scans (needed when removing unstable node) */
+static unsigned long ksm_seqnr;
+
+/* Bumped to invalidate the cursors of all ksmd threads */
+static unsigned long ksm_scan_reset;
 
 static struct kmem_cache *rmap_item_cache;
 static struct kmem_cache *stable_node_cache;
 static struct kmem_cache *mm_slot_cache;
 
 /* The number of nodes in the stable tree */
-static unsigned long ksm_pages_shared;
+static atomic_long_t ksm_pages_shared;
 
 /* The number of page slots additionally sharing those nodes */
-static unsigned long ksm_pages_sharing;
+static atomic_long_t ksm_pages_sharing;
 
 /* The number of nodes in the unstable tree */
-static unsigned long ksm_pages_unshared;
+static atomic_long_t ksm_pages_unshared;
 
 /* The number of rmap_items in use: to calculate pages_volatile */
-static unsigned long ksm_rmap_items;
+static atomic_long_t ksm_rmap_items;
 
-/* Number of pages ksmd should scan in one batch */
+/* Number of pages each ksmd thread should scan in one batch */
 static unsigned int ksm_thread_pages_to_scan = 100;
 
 /* Milliseconds ksmd should sleep between batches */
@@ -239,8 +295,21 @@ static int ksm_nr_node_ids = 1;
 static unsigned long ksm_run = KSM_RUN_STOP;
 static void wait_while_offlining(void);
 
+/* The ksmd threads */
+#define KSM_MAX_THREADS	32
+static struct ksm_thread *ksm_threads[KSM_MAX_THREADS];
+static unsigned int ksm_nr_threads = 1;
+static DEFINE_MUTEX(ksm_threads_mutex);
+
+/* Pages scanned by ksmd threads which have been stopped */
+static unsigned long ksm_pages_scanned;
+
+/*
+ * ksmd threads hold ksm_thread_sem for read while scanning a batch;
+ * changing ksm_run or merge_across_nodes takes it for write.
+ */
 static DECLARE_WAIT_QUEUE_HEAD(ksm_thread_wait);
-static DEFINE_MUTEX(ksm_thread_mutex);
+static DECLARE_RWSEM(ksm_thread_sem);
 static DEFINE_SPINLOCK(ksm_mmlist_lock);
 
 #define KSM_KMEM_CACHE(__struct, __flags) kmem_cache_create("ksm_"#__struct,\
@@ -285,13 +354,13 @@ static inline struct rmap_item *alloc_rmap_item(void)
 
 	rmap_item = kmem_cache_zalloc(rmap_item_cache, GFP_KERNEL);
 	if (rmap_item)
-		ksm_rmap_items++;
+		atomic_long_inc(&ksm_rmap_items);
 	return rmap_item;
 }
 
 static inline void free_rmap_item(struct rmap_item *rmap_item)
 {
-	ksm_rmap_items--;
+	atomic_long_dec(&ksm_rmap_items);
 	rmap_item->mm = NULL;	/* debug safety */
 	kmem_cache_free(rmap_item_cache, rmap_item);
 }
@@ -492,25 +561,53 @@ static inline int get_kpfn_nid(unsigned long kpfn)
 	return ksm_merge_across_nodes ? 0 : NUMA(pfn_to_nid(kpfn));
 }
 
+/*
+ * Pages, stable nodes and rmap_items go into the shard of the trees picked
+ * by their checksum.  Anything linked into a shard's stable or unstable
+ * tree, or listed from a stable node in it, is only touched with the lock
+ * of that shard held; except when only one thread can be doing so, at the
+ * start of a scan, or with ksm_thread_sem held for write.
+ */
+static inline struct ksm_tree_shard *ksm_tree_shard(unsigned int checksum)
+{
+	return &ksm_tree_shards[checksum % KSM_TREE_SHARDS];
+}
+
+static inline struct rb_root *stable_tree_root(int nid, unsigned int checksum)
+{
+	return root_stable_tree + nid * KSM_TREE_SHARDS +
+		checksum % KSM_TREE_SHARDS;
+}
+
+static inline struct rb_root *unstable_tree_root(int nid,
+						 unsigned int checksum)
+{
+	return root_unstable_tree + nid * KSM_TREE_SHARDS +
+		checksum % KSM_TREE_SHARDS;
+}
+
 static void remove_node_from_stable_tree(struct stable_node *stable_node)
 {
 	struct rmap_item *rmap_item;
 
 	hlist_for_each_entry(rmap_item, &stable_node->hlist, hlist) {
 		if (rmap_item->hlist.next)
-			ksm_pages_sharing--;
+			atomic_long_dec(&ksm_pages_sharing);
 		else
-			ksm_pages_shared--;
+			atomic_long_dec(&ksm_pages_shared);
 		put_anon_vma(rmap_item->anon_vma);
 		rmap_item->address &= PAGE_MASK;
 		cond_resched();
 	}
 
-	if (stable_node->head == &migrate_nodes)
+	if (stable_node->head == &migrate_nodes) {
+		spin_lock(&ksm_migrate_lock);
 		list_del(&stable_node->list);
-	else
+		spin_unlock(&ksm_migrate_lock);
+	} else
 		rb_erase(&stable_node->node,
-			 root_stable_tree + NUMA(stable_node->nid));
+			 stable_tree_root(NUMA(stable_node->nid),
+					  stable_node->checksum));
 	free_stable_node(stable_node);
 }
 
@@ -609,8 +706,9 @@ stale:
 /*
  * Removing rmap_item from stable or unstable tree.
  * This function will clean the information from the stable/unstable tree.
+ * The caller holds the lock of the shard picked by rmap_item->oldchecksum.
  */
-static void remove_rmap_item_from_tree(struct rmap_item *rmap_item)
+static void __remove_rmap_item_from_tree(struct rmap_item *rmap_item)
 {
 	if (rmap_item->address & STABLE_FLAG) {
 		struct stable_node *stable_node;
@@ -626,9 +724,9 @@ static void remove_rmap_item_from_tree(struct rmap_item *rmap_item)
 		put_page(page);
 
 		if (stable_node->hlist.first)
-			ksm_pages_sharing--;
+			atomic_long_dec(&ksm_pages_sharing);
 		else
-			ksm_pages_shared--;
+			atomic_long_dec(&ksm_pages_shared);
 
 		put_anon_vma(rmap_item->anon_vma);
 		rmap_item->address &= PAGE_MASK;
@@ -642,27 +740,31 @@ static void remove_rmap_item_from_tree(struct rmap_item *rmap_item)
 		 * if this rmap_item was inserted by this scan, rather
 		 * than left over from before.
 		 */
-		age = (unsigned char)(ksm_scan.seqnr - rmap_item->address);
+		age = (unsigned char)(ksm_seqnr - rmap_item->address);
 		BUG_ON(age > 1);
 		if (!age)
 			rb_erase(&rmap_item->node,
-				 root_unstable_tree + NUMA(rmap_item->nid));
-		ksm_pages_unshared--;
+				 unstable_tree_root(NUMA(rmap_item->nid),
+						    rmap_item->oldchecksum));
+		atomic_long_dec(&ksm_pages_unshared);
 		rmap_item->address &= PAGE_MASK;
 	}
 out:
 	cond_resched();		/* we're called from many long loops */
 }
 
-static void remove_trailing_rmap_items(struct mm_slot *mm_slot,
-				       struct rmap_item **rmap_list)
+/*
+ * Another ksmd thread may be merging rmap_item as the tree_rmap_item of
+ * its own page, linking it into the stable tree: so the shard lock must
+ * be taken even if rmap_item does not look linked into a tree yet.
+ */
+static void remove_rmap_item_from_tree(struct rmap_item *rmap_item)
 {
-	while (*rmap_list) {
-		struct rmap_item *rmap_item = *rmap_list;
-		*rmap_list = rmap_item->rmap_list;
-		remove_rmap_item_from_tree(rmap_item);
-		free_rmap_item(rmap_item);
-	}
+	struct ksm_tree_shard *shard = ksm_tree_shard(rmap_item->oldchecksum);
+
+	mutex_lock(&shard->lock);
+	__remove_rmap_item_from_tree(rmap_item);
+	mutex_unlock(&shard->lock);
 }
 
 /*
@@ -741,16 +843,16 @@ static int remove_all_stable_nodes(void)
 {
 	struct stable_node *stable_node;
 	struct list_head *this, *next;
-	int nid;
+	int i;
 	int err = 0;
 
-	for (nid = 0; nid < ksm_nr_node_ids; nid++) {
-		while (root_stable_tree[nid].rb_node) {
-			stable_node = rb_entry(root_stable_tree[nid].rb_node,
+	for (i = 0; i < ksm_nr_node_ids * KSM_TREE_SHARDS; i++) {
+		while (root_stable_tree[i].rb_node) {
+			stable_node = rb_entry(root_stable_tree[i].rb_node,
 						struct stable_node, node);
 			if (remove_stable_node(stable_node)) {
 				err = -EBUSY;
-				break;	/* proceed to next nid */
+				break;	/* proceed to next tree */
 			}
 			cond_resched();
 		}
@@ -764,6 +866,35 @@ static int remove_all_stable_nodes(void)
 	return err;
 }
 
+/*
+ * Called with ksm_mmlist_lock and ksm_thread_sem for write held: the ksmd
+ * threads drop their cursors when they next see ksm_scan_reset changed.
+ */
+static void __ksm_reset_scan(void)
+{
+	struct mm_slot *mm_slot;
+
+	list_for_each_entry(mm_slot, &ksm_mm_head.mm_list, mm_list)
+		mm_slot->scanning = false;
+	ksm_nr_scanning = 0;
+	ksm_scan_reset++;
+}
+
+/*
+ * The ksmd threads cannot be holding a shard lock while ksm_thread_sem is
+ * held for write, so unlike them this may take it with mmap_sem held.
+ */
+static void remove_trailing_rmap_items(struct mm_slot *mm_slot,
+				       struct rmap_item **rmap_list)
+{
+	while (*rmap_list) {
+		struct rmap_item *rmap_item = *rmap_list;
+		*rmap_list = rmap_item->rmap_list;
+		remove_rmap_item_from_tree(rmap_item);
+		free_rmap_item(rmap_item);
+	}
+}
+
 static int unmerge_and_remove_all_rmap_items(void)
 {
 	struct mm_slot *mm_slot;
@@ -772,12 +903,13 @@ static int unmerge_and_remove_all_rmap_items(void)
 	int err = 0;
 
 	spin_lock(&ksm_mmlist_lock);
-	ksm_scan.mm_slot = list_entry(ksm_mm_head.mm_list.next,
+	__ksm_reset_scan();
+	ksm_mm_next = list_entry(ksm_mm_head.mm_list.next,
 						struct mm_slot, mm_list);
 	spin_unlock(&ksm_mmlist_lock);
 
-	for (mm_slot = ksm_scan.mm_slot;
-			mm_slot != &ksm_mm_head; mm_slot = ksm_scan.mm_slot) {
+	for (mm_slot = ksm_mm_next;
+			mm_slot != &ksm_mm_head; mm_slot = ksm_mm_next) {
 		mm = mm_slot->mm;
 		down_read(&mm->mmap_sem);
 		for (vma = mm->mmap; vma; vma = vma->vm_next) {
@@ -794,7 +926,7 @@ static int unmerge_and_remove_all_rmap_items(void)
 		remove_trailing_rmap_items(mm_slot, &mm_slot->rmap_list);
 
 		spin_lock(&ksm_mmlist_lock);
-		ksm_scan.mm_slot = list_entry(mm_slot->mm_list.next,
+		ksm_mm_next = list_entry(mm_slot->mm_list.next,
 						struct mm_slot, mm_list);
 		if (ksm_test_exit(mm)) {
 			hash_del(&mm_slot->link);
@@ -813,13 +945,13 @@ static int unmerge_and_remove_all_rmap_items(void)
 
 	/* Clean up stable nodes, but don't worry if some are still busy */
 	remove_all_stable_nodes();
-	ksm_scan.seqnr = 0;
+	ksm_seqnr = 0;
 	return 0;
 
 error:
 	up_read(&mm->mmap_sem);
 	spin_lock(&ksm_mmlist_lock);
-	ksm_scan.mm_slot = &ksm_mm_head;
+	ksm_mm_next = &ksm_mm_head;
 	spin_unlock(&ksm_mmlist_lock);
 	return err;
 }
@@ -1076,6 +1208,7 @@ out:
 /*
  * try_to_merge_with_ksm_page - like try_to_merge_two_pages,
  * but no new kernel page is allocated: kpage must already be a ksm page.
+ * The caller holds the lock of the shard rmap_item is in, if in any.
  *
  * This function returns 0 if the pages were merged, -EFAULT otherwise.
  */
@@ -1098,7 +1231,7 @@ static int try_to_merge_with_ksm_page(struct rmap_item *rmap_item,
 		goto out;
 
 	/* Unstable nid is in union with stable anon_vma: remove first */
-	remove_rmap_item_from_tree(rmap_item);
+	__remove_rmap_item_from_tree(rmap_item);
 
 	/* Must get reference to anon_vma while still holding mmap_sem */
 	rmap_item->anon_vma = vma->anon_vma;
@@ -1143,12 +1276,14 @@ static struct page *try_to_merge_two_pages(struct rmap_item *rmap_item,
  * stable_tree_search - search for page inside the stable tree
  *
  * This function checks if there is a page inside the stable tree
- * with identical content to the page that we are scanning right now.
+ * with identical content to the page that we are scanning right now,
+ * whose checksum is given.
  *
  * This function returns the stable tree node of identical content if found,
  * NULL otherwise.
  */
-static struct page *stable_tree_search(struct page *page)
+static struct page *stable_tree_search(struct page *page,
+				       unsigned int checksum)
 {
 	int nid;
 	struct rb_root *root;
@@ -1165,7 +1300,7 @@ static struct page *stable_tree_search(struct page *page)
 	}
 
 	nid = get_kpfn_nid(page_to_pfn(page));
-	root = root_stable_tree + nid;
+	root = stable_tree_root(nid, checksum);
 again:
 	new = &root->rb_node;
 	parent = NULL;
@@ -1176,6 +1311,15 @@ again:
 
 		cond_resched();
 		stable_node = rb_entry(*new, struct stable_node, node);
+		parent = *new;
+		if (checksum != stable_node->checksum) {
+			if (checksum < stable_node->checksum)
+				new = &parent->rb_left;
+			else
+				new = &parent->rb_right;
+			continue;
+		}
+
 		tree_page = get_ksm_page(stable_node, false);
 		if (!tree_page)
 			return NULL;
@@ -1183,7 +1327,6 @@ again:
 		ret = memcmp_pages(page, tree_page);
 		put_page(tree_page);
 
-		parent = *new;
 		if (ret < 0)
 			new = &parent->rb_left;
 		else if (ret > 0)
@@ -1219,7 +1362,9 @@ again:
 	if (!page_node)
 		return NULL;
 
+	spin_lock(&ksm_migrate_lock);
 	list_del(&page_node->list);
+	spin_unlock(&ksm_migrate_lock);
 	DO_NUMA(page_node->nid = nid);
 	rb_link_node(&page_node->node, parent, new);
 	rb_insert_color(&page_node->node, root);
@@ -1227,6 +1372,7 @@ again:
 	return page;
 
 replace:
+	spin_lock(&ksm_migrate_lock);
 	if (page_node) {
 		list_del(&page_node->list);
 		DO_NUMA(page_node->nid = nid);
@@ -1238,17 +1384,19 @@ replace:
 	}
 	stable_node->head = &migrate_nodes;
 	list_add(&stable_node->list, stable_node->head);
+	spin_unlock(&ksm_migrate_lock);
 	return page;
 }
 
 /*
  * stable_tree_insert - insert stable tree node pointing to new ksm page
- * into the stable tree.
+ * into the stable tree, by the given checksum of its contents.
  *
  * This function returns the stable tree node just allocated on success,
  * NULL otherwise.
  */
-static struct stable_node *stable_tree_insert(struct page *kpage)
+static struct stable_node *stable_tree_insert(struct page *kpage,
+					      unsigned int checksum)
 {
 	int nid;
 	unsigned long kpfn;
@@ -1259,7 +1407,7 @@ static struct stable_node *stable_tree_insert(struct page *kpage)
 
 	kpfn = page_to_pfn(kpage);
 	nid = get_kpfn_nid(kpfn);
-	root = root_stable_tree + nid;
+	root = stable_tree_root(nid, checksum);
 	new = &root->rb_node;
 
 	while (*new) {
@@ -1268,6 +1416,15 @@ static struct stable_node *stable_tree_insert(struct page *kpage)
 
 		cond_resched();
 		stable_node = rb_entry(*new, struct stable_node, node);
+		parent = *new;
+		if (checksum != stable_node->checksum) {
+			if (checksum < stable_node->checksum)
+				new = &parent->rb_left;
+			else
+				new = &parent->rb_right;
+			continue;
+		}
+
 		tree_page = get_ksm_page(stable_node, false);
 		if (!tree_page)
 			return NULL;
@@ -1275,7 +1432,6 @@ static struct stable_node *stable_tree_insert(struct page *kpage)
 		ret = memcmp_pages(kpage, tree_page);
 		put_page(tree_page);
 
-		parent = *new;
 		if (ret < 0)
 			new = &parent->rb_left;
 		else if (ret > 0)
@@ -1296,6 +1452,7 @@ static struct stable_node *stable_tree_insert(struct page *kpage)
 
 	INIT_HLIST_HEAD(&stable_node->hlist);
 	stable_node->kpfn = kpfn;
+	stable_node->checksum = checksum;
 	set_page_stable_node(kpage, stable_node);
 	DO_NUMA(stable_node->nid = nid);
 	rb_link_node(&stable_node->node, parent, new);
@@ -1309,8 +1466,9 @@ static struct stable_node *stable_tree_insert(struct page *kpage)
  * else insert rmap_item into the unstable tree.
  *
  * This function searches for a page in the unstable tree identical to the
- * page currently being scanned; and if no identical page is found in the
- * tree, we insert rmap_item as a new object into the unstable tree.
+ * page currently being scanned, whose checksum is rmap_item->oldchecksum;
+ * and if no identical page is found in the tree, we insert rmap_item as a
+ * new object into the unstable tree.
  *
  * This function returns pointer to rmap_item found to be identical
  * to the currently scanned page, NULL otherwise.
@@ -1329,7 +1487,7 @@ struct rmap_item *unstable_tree_search_insert(struct rmap_item *rmap_item,
 	int nid;
 
 	nid = get_kpfn_nid(page_to_pfn(page));
-	root = root_unstable_tree + nid;
+	root = unstable_tree_root(nid, rmap_item->oldchecksum);
 	new = &root->rb_node;
 
 	while (*new) {
@@ -1339,6 +1497,15 @@ struct rmap_item *unstable_tree_search_insert(struct rmap_item *rmap_item,
 
 		cond_resched();
 		tree_rmap_item = rb_entry(*new, struct rmap_item, node);
+		if (rmap_item->oldchecksum != tree_rmap_item->oldchecksum) {
+			parent = *new;
+			if (rmap_item->oldchecksum < tree_rmap_item->oldchecksum)
+				new = &parent->rb_left;
+			else
+				new = &parent->rb_right;
+			continue;
+		}
+
 		tree_page = get_mergeable_page(tree_rmap_item);
 		if (IS_ERR_OR_NULL(tree_page))
 			return NULL;
@@ -1376,12 +1543,12 @@ struct rmap_item *unstable_tree_search_insert(struct rmap_item *rmap_item,
 	}
 
 	rmap_item->address |= UNSTABLE_FLAG;
-	rmap_item->address |= (ksm_scan.seqnr & SEQNR_MASK);
+	rmap_item->address |= (ksm_seqnr & SEQNR_MASK);
 	DO_NUMA(rmap_item->nid = nid);
 	rb_link_node(&rmap_item->node, parent, new);
 	rb_insert_color(&rmap_item->node, root);
 
-	ksm_pages_unshared++;
+	atomic_long_inc(&ksm_pages_unshared);
 	return NULL;
 }
 
@@ -1398,9 +1565,9 @@ static void stable_tree_append(struct rmap_item *rmap_item,
 	hlist_add_head(&rmap_item->hlist, &stable_node->hlist);
 
 	if (rmap_item->hlist.next)
-		ksm_pages_sharing++;
+		atomic_long_inc(&ksm_pages_sharing);
 	else
-		ksm_pages_shared++;
+		atomic_long_inc(&ksm_pages_shared);
 }
 
 /*
@@ -1417,46 +1584,74 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 	struct rmap_item *tree_rmap_item;
 	struct page *tree_page = NULL;
 	struct stable_node *stable_node;
+	struct ksm_tree_shard *shard;
 	struct page *kpage;
 	unsigned int checksum;
+	bool merged;
 	int err;
 
+	/*
+	 * The checksum picks the shard of the trees to search, so take it
+	 * before locking anything; the contents of a ksm page cannot change,
+	 * so the checksum kept in its stable node will do.
+	 */
 	stable_node = page_stable_node(page);
+	if (stable_node)
+		checksum = stable_node->checksum;
+	else
+		checksum = calc_checksum(page);
+	shard = ksm_tree_shard(checksum);
+
+	/*
+	 * Unless it is already listed from this ksm page, rmap_item has to
+	 * come out of whatever tree it is in, and that may be another shard.
+	 */
+	if (ksm_tree_shard(rmap_item->oldchecksum) != shard)
+		remove_rmap_item_from_tree(rmap_item);
+
+	mutex_lock(&shard->lock);
+	merged = stable_node && (rmap_item->address & STABLE_FLAG) &&
+		 rmap_item->head == stable_node;
+
 	if (stable_node) {
 		if (stable_node->head != &migrate_nodes &&
 		    get_kpfn_nid(stable_node->kpfn) != NUMA(stable_node->nid)) {
 			rb_erase(&stable_node->node,
-				 root_stable_tree + NUMA(stable_node->nid));
+				 stable_tree_root(NUMA(stable_node->nid),
+						  checksum));
 			stable_node->head = &migrate_nodes;
+			spin_lock(&ksm_migrate_lock);
 			list_add(&stable_node->list, stable_node->head);
+			spin_unlock(&ksm_migrate_lock);
 		}
-		if (stable_node->head != &migrate_nodes &&
-		    rmap_item->head == stable_node)
-			return;
+		if (stable_node->head != &migrate_nodes && merged)
+			goto out;
 	}
 
 	/* We first start with searching the page inside the stable tree */
-	kpage = stable_tree_search(page);
-	if (kpage == page && rmap_item->head == stable_node) {
+	kpage = stable_tree_search(page, checksum);
+	if (kpage == page && merged) {
 		put_page(kpage);
-		return;
+		goto out;
 	}
 
-	remove_rmap_item_from_tree(rmap_item);
+	__remove_rmap_item_from_tree(rmap_item);
 
 	if (kpage) {
 		err = try_to_merge_with_ksm_page(rmap_item, page, kpage);
 		if (!err) {
 			/*
 			 * The page was successfully merged:
-			 * add its rmap_item to the stable tree.
+			 * add its rmap_item to the stable tree,
+			 * in the same shard as its stable node.
 			 */
+			rmap_item->oldchecksum = checksum;
 			lock_page(kpage);
 			stable_tree_append(rmap_item, page_stable_node(kpage));
 			unlock_page(kpage);
 		}
 		put_page(kpage);
-		return;
+		goto out;
 	}
 
 	/*
@@ -1465,10 +1660,9 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 	 * don't want to insert it in the unstable tree, and we don't want
 	 * to waste our time searching for something identical to it there.
 	 */
-	checksum = calc_checksum(page);
 	if (rmap_item->oldchecksum != checksum) {
 		rmap_item->oldchecksum = checksum;
-		return;
+		goto out;
 	}
 
 	tree_rmap_item =
@@ -1481,9 +1675,17 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 			/*
 			 * The pages were successfully merged: insert new
 			 * node in the stable tree and add both rmap_items.
+			 * They were only write protected after checksum was
+			 * taken: if their contents changed since, so that
+			 * the new checksum belongs to another shard, treat
+			 * it as a failure to insert.
 			 */
 			lock_page(kpage);
-			stable_node = stable_tree_insert(kpage);
+			checksum = calc_checksum(kpage);
+			stable_node = NULL;
+			if (ksm_tree_shard(checksum) == shard)
+				stable_node = stable_tree_insert(kpage,
+								 checksum);
 			if (stable_node) {
 				stable_tree_append(tree_rmap_item, stable_node);
 				stable_tree_append(rmap_item, stable_node);
@@ -1502,11 +1704,30 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 			}
 		}
 	}
+out:
+	mutex_unlock(&shard->lock);
+}
+
+/*
+ * Free a chain of rmap_items unlinked from an mm_slot's rmap_list.  This
+ * takes the shard locks, which are held while taking mmap_sem to merge:
+ * so the rmap_items are only unlinked under mmap_sem, and freed after.
+ */
+static void free_stale_rmap_items(struct rmap_item *rmap_item)
+{
+	struct rmap_item *next;
+
+	for (; rmap_item; rmap_item = next) {
+		next = rmap_item->rmap_list;
+		remove_rmap_item_from_tree(rmap_item);
+		free_rmap_item(rmap_item);
+	}
 }
 
 static struct rmap_item *get_next_rmap_item(struct mm_slot *mm_slot,
 					    struct rmap_item **rmap_list,
-					    unsigned long addr)
+					    unsigned long addr,
+					    struct rmap_item **stale)
 {
 	struct rmap_item *rmap_item;
 
@@ -1517,8 +1738,8 @@ static struct rmap_item *get_next_rmap_item(struct mm_slot *mm_slot,
 		if (rmap_item->address > addr)
 			break;
 		*rmap_list = rmap_item->rmap_list;
-		remove_rmap_item_from_tree(rmap_item);
-		free_rmap_item(rmap_item);
+		rmap_item->rmap_list = *stale;
+		*stale = rmap_item;
 	}
 
 	rmap_item = alloc_rmap_item();
@@ -1532,68 +1753,144 @@ static struct rmap_item *get_next_rmap_item(struct mm_slot *mm_slot,
 	return rmap_item;
 }
 
-static struct rmap_item *scan_get_next_rmap_item(struct page **page)
+/*
+ * Called at the start of each full scan, when no mm_slot is claimed by
+ * any ksmd thread, nor can be until it is done: so nothing else can be
+ * looking at the trees, and no shard lock is needed here.
+ */
+static void ksm_start_scan(void)
 {
-	struct mm_struct *mm;
-	struct mm_slot *slot;
-	struct vm_area_struct *vma;
-	struct rmap_item *rmap_item;
-	int nid;
+	int i;
 
-	if (list_empty(&ksm_mm_head.mm_list))
-		return NULL;
+	/*
+	 * A number of pages can hang around indefinitely on per-cpu
+	 * pagevecs, raised page count preventing write_protect_page
+	 * from merging them.  Though it doesn't really matter much,
+	 * it is puzzling to see some stuck in pages_volatile until
+	 * other activity jostles them out, and they also prevented
+	 * LTP's KSM test from succeeding deterministically; so drain
+	 * them here (here rather than on entry to ksm_do_scan(),
+	 * so we don't IPI too often when pages_to_scan is set low).
+	 */
+	lru_add_drain_all();
 
-	slot = ksm_scan.mm_slot;
-	if (slot == &ksm_mm_head) {
-		/*
-		 * A number of pages can hang around indefinitely on per-cpu
-		 * pagevecs, raised page count preventing write_protect_page
-		 * from merging them.  Though it doesn't really matter much,
-		 * it is puzzling to see some stuck in pages_volatile until
-		 * other activity jostles them out, and they also prevented
-		 * LTP's KSM test from succeeding deterministically; so drain
-		 * them here (here rather than on entry to ksm_do_scan(),
-		 * so we don't IPI too often when pages_to_scan is set low).
-		 */
-		lru_add_drain_all();
+	/*
+	 * Whereas stale stable_nodes on the stable_tree itself
+	 * get pruned in the regular course of stable_tree_search(),
+	 * those moved out to the migrate_nodes list can accumulate:
+	 * so prune them once before each full scan.
+	 */
+	if (!ksm_merge_across_nodes) {
+		struct stable_node *stable_node;
+		struct list_head *this, *next;
+		struct page *page;
 
-		/*
-		 * Whereas stale stable_nodes on the stable_tree itself
-		 * get pruned in the regular course of stable_tree_search(),
-		 * those moved out to the migrate_nodes list can accumulate:
-		 * so prune them once before each full scan.
-		 */
-		if (!ksm_merge_across_nodes) {
-			struct stable_node *stable_node;
-			struct list_head *this, *next;
-			struct page *page;
-
-			list_for_each_safe(this, next, &migrate_nodes) {
-				stable_node = list_entry(this,
-						struct stable_node, list);
-				page = get_ksm_page(stable_node, false);
-				if (page)
-					put_page(page);
-				cond_resched();
-			}
+		list_for_each_safe(this, next, &migrate_nodes) {
+			stable_node = list_entry(this,
+					struct stable_node, list);
+			page = get_ksm_page(stable_node, false);
+			if (page)
+				put_page(page);
+			cond_resched();
 		}
+	}
 
-		for (nid = 0; nid < ksm_nr_node_ids; nid++)
-			root_unstable_tree[nid] = RB_ROOT;
+	for (i = 0; i < ksm_nr_node_ids * KSM_TREE_SHARDS; i++)
+		root_unstable_tree[i] = RB_ROOT;
+}
 
-		spin_lock(&ksm_mmlist_lock);
-		slot = list_entry(slot->mm_list.next, struct mm_slot, mm_list);
-		ksm_scan.mm_slot = slot;
+/*
+ * Claim the next mm_slot of this full scan for a ksmd thread to scan,
+ * starting the next full scan if this one is complete.  Returns NULL if
+ * there is none left, or other threads are still scanning the last ones.
+ */
+static struct mm_slot *ksm_claim_mm_slot(void)
+{
+	struct mm_slot *slot;
+
+	spin_lock(&ksm_mmlist_lock);
+	if (ksm_mm_next == &ksm_mm_head) {
+		if (ksm_nr_scanning || list_empty(&ksm_mm_head.mm_list)) {
+			spin_unlock(&ksm_mmlist_lock);
+			return NULL;
+		}
+		/* Keep other threads out until the scan is started */
+		ksm_nr_scanning++;
 		spin_unlock(&ksm_mmlist_lock);
+
+		ksm_start_scan();
+
+		spin_lock(&ksm_mmlist_lock);
+		ksm_nr_scanning--;
 		/*
-		 * Although we tested list_empty() above, a racing __ksm_exit
-		 * of the last mm on the list may have removed it since then.
+		 * A racing __ksm_exit of the last mm on the list may have
+		 * removed it since then, leaving ksm_mm_head here again.
 		 */
-		if (slot == &ksm_mm_head)
-			return NULL;
+		ksm_mm_next = list_entry(ksm_mm_head.mm_list.next,
+					 struct mm_slot, mm_list);
+	}
+
+	slot = ksm_mm_next;
+	if (slot != &ksm_mm_head) {
+		ksm_mm_next = list_entry(slot->mm_list.next,
+					 struct mm_slot, mm_list);
+		slot->scanning = true;
+		ksm_nr_scanning++;
+	} else
+		slot = NULL;
+	spin_unlock(&ksm_mmlist_lock);
+	return slot;
+}
+
+/*
+ * Called with ksm_mmlist_lock held when a ksmd thread is done with the
+ * mm_slot it claimed: the full scan is complete when the last one is.
+ */
+static void __ksm_release_mm_slot(void)
+{
+	if (!--ksm_nr_scanning && ksm_mm_next == &ksm_mm_head)
+		ksm_seqnr++;
+}
+
+/* Drop the mm_slot left claimed by a ksmd thread which is stopping */
+static void ksm_drop_mm_slot(struct ksm_scan *scan)
+{
+	spin_lock(&ksm_mmlist_lock);
+	if (scan->mm_slot && scan->reset == ksm_scan_reset) {
+		scan->mm_slot->scanning = false;
+		__ksm_release_mm_slot();
+	}
+	scan->mm_slot = NULL;
+	spin_unlock(&ksm_mmlist_lock);
+}
+
+static struct rmap_item *scan_get_next_rmap_item(struct ksm_scan *scan,
+						 struct page **page)
+{
+	struct mm_struct *mm;
+	struct mm_slot *slot;
+	struct vm_area_struct *vma;
+	struct rmap_item *rmap_item;
+	struct rmap_item *stale = NULL;
+
+	if (list_empty(&ksm_mm_head.mm_list))
+		return NULL;
+
+	/* Unmerging everything forgets the cursors of all threads */
+	if (scan->mm_slot && scan->reset != ksm_scan_reset)
+		scan->mm_slot = NULL;
+
+	slot = scan->mm_slot;
+	if (!slot) {
 next_mm:
-		ksm_scan.address = 0;
-		ksm_scan.rmap_list = &slot->rmap_list;
+		stale = NULL;
+		slot = ksm_claim_mm_slot();
+		if (!slot)
+			return NULL;
+		scan->mm_slot = slot;
+		scan->reset = ksm_scan_reset;
+		scan->address = 0;
+		scan->rmap_list = &slot->rmap_list;
 	}
 
 	mm = slot->mm;
@@ -1601,60 +1898,71 @@ next_mm:
 	if (ksm_test_exit(mm))
 		vma = NULL;
 	else
-		vma = find_vma(mm, ksm_scan.address);
+		vma = find_vma(mm, scan->address);
 
 	for (; vma; vma = vma->vm_next) {
 		if (!(vma->vm_flags & VM_MERGEABLE))
 			continue;
-		if (ksm_scan.address < vma->vm_start)
-			ksm_scan.address = vma->vm_start;
+		if (scan->address < vma->vm_start)
+			scan->address = vma->vm_start;
 		if (!vma->anon_vma)
-			ksm_scan.address = vma->vm_end;
+			scan->address = vma->vm_end;
 
-		while (ksm_scan.address < vma->vm_end) {
+		while (scan->address < vma->vm_end) {
 			if (ksm_test_exit(mm))
 				break;
-			*page = follow_page(vma, ksm_scan.address, FOLL_GET);
+			*page = follow_page(vma, scan->address, FOLL_GET);
 			if (IS_ERR_OR_NULL(*page)) {
-				ksm_scan.address += PAGE_SIZE;
+				scan->address += PAGE_SIZE;
 				cond_resched();
 				continue;
 			}
 			if (PageAnon(*page) ||
 			    page_trans_compound_anon(*page)) {
-				flush_anon_page(vma, *page, ksm_scan.address);
+				flush_anon_page(vma, *page, scan->address);
 				flush_dcache_page(*page);
 				rmap_item = get_next_rmap_item(slot,
-					ksm_scan.rmap_list, ksm_scan.address);
+					scan->rmap_list, scan->address,
+					&stale);
 				if (rmap_item) {
-					ksm_scan.rmap_list =
+					scan->rmap_list =
 							&rmap_item->rmap_list;
-					ksm_scan.address += PAGE_SIZE;
+					scan->address += PAGE_SIZE;
 				} else
 					put_page(*page);
 				up_read(&mm->mmap_sem);
+				free_stale_rmap_items(stale);
 				return rmap_item;
 			}
 			put_page(*page);
-			ksm_scan.address += PAGE_SIZE;
+			scan->address += PAGE_SIZE;
 			cond_resched();
 		}
 	}
 
 	if (ksm_test_exit(mm)) {
-		ksm_scan.address = 0;
-		ksm_scan.rmap_list = &slot->rmap_list;
+		scan->address = 0;
+		scan->rmap_list = &slot->rmap_list;
 	}
 	/*
 	 * Nuke all the rmap_items that are above this current rmap:
 	 * because there were no VM_MERGEABLE vmas with such addresses.
+	 * They are freed once mmap_sem is dropped, but before the mm_slot
+	 * is released, so that the mm cannot go away while they are still
+	 * linked in a tree, and before this full scan can be completed.
 	 */
-	remove_trailing_rmap_items(slot, ksm_scan.rmap_list);
+	rmap_item = *scan->rmap_list;
+	*scan->rmap_list = NULL;
+	while (rmap_item) {
+		struct rmap_item *next = rmap_item->rmap_list;
+
+		rmap_item->rmap_list = stale;
+		stale = rmap_item;
+		rmap_item = next;
+	}
 
-	spin_lock(&ksm_mmlist_lock);
-	ksm_scan.mm_slot = list_entry(slot->mm_list.next,
-						struct mm_slot, mm_list);
-	if (ksm_scan.address == 0) {
+	scan->mm_slot = NULL;
+	if (scan->address == 0) {
 		/*
 		 * We've completed a full scan of all vmas, holding mmap_sem
 		 * throughout, and found no VM_MERGEABLE: so do the same as
@@ -1664,6 +1972,7 @@ next_mm:
 		 * or when all VM_MERGEABLE areas have been unmapped (and
 		 * mmap_sem then protects against race with MADV_MERGEABLE).
 		 */
+		spin_lock(&ksm_mmlist_lock);
 		hash_del(&slot->link);
 		list_del(&slot->mm_list);
 		spin_unlock(&ksm_mmlist_lock);
@@ -1671,38 +1980,67 @@ next_mm:
 		free_mm_slot(slot);
 		clear_bit(MMF_VM_MERGEABLE, &mm->flags);
 		up_read(&mm->mmap_sem);
+		free_stale_rmap_items(stale);
+
+		spin_lock(&ksm_mmlist_lock);
+		__ksm_release_mm_slot();
+		spin_unlock(&ksm_mmlist_lock);
 		mmdrop(mm);
 	} else {
-		spin_unlock(&ksm_mmlist_lock);
 		up_read(&mm->mmap_sem);
+		free_stale_rmap_items(stale);
+
+		spin_lock(&ksm_mmlist_lock);
+		slot->scanning = false;
+		__ksm_release_mm_slot();
+		spin_unlock(&ksm_mmlist_lock);
 	}
 
 	/* Repeat until we've completed scanning the whole list */
-	slot = ksm_scan.mm_slot;
-	if (slot != &ksm_mm_head)
+	if (READ_ONCE(ksm_mm_next) != &ksm_mm_head)
 		goto next_mm;
 
-	ksm_scan.seqnr++;
 	return NULL;
 }
 
+/*
+ * Account pages scanned by a ksmd thread, and its rate over the last
+ * window of at least a second.
+ */
+static void ksm_account_scan(struct ksm_thread *thread, unsigned long pages)
+{
+	unsigned long elapsed = jiffies - thread->rate_start;
+
+	thread->pages_scanned += pages;
+	thread->rate_pages += pages;
+	if (elapsed >= HZ) {
+		thread->pages_per_sec = thread->rate_pages * HZ / elapsed;
+		thread->rate_start = jiffies;
+		thread->rate_pages = 0;
+	}
+}
+
 /**
  * ksm_do_scan  - the ksm scanner main worker function.
+ * @thread - the ksmd thread scanning.
  * @scan_npages - number of pages we want to scan before we return.
  */
-static void ksm_do_scan(unsigned int scan_npages)
+static void ksm_do_scan(struct ksm_thread *thread, unsigned int scan_npages)
 {
 	struct rmap_item *rmap_item;
 	struct page *uninitialized_var(page);
+	unsigned long scanned = 0;
 
 	while (scan_npages-- && likely(!freezing(current))) {
 		cond_resched();
-		rmap_item = scan_get_next_rmap_item(&page);
+		rmap_item = scan_get_next_rmap_item(&thread->scan, &page);
 		if (!rmap_item)
-			return;
+			break;
 		cmp_and_merge_page(page, rmap_item);
 		put_page(page);
+		scanned++;
 	}
+	ksm_account_scan(thread, scanned);
 }
 
 static int ksmd_should_run(void)
@@ -1710,17 +2048,22 @@ static int ksmd_should_run(void)
 	return (ksm_run & KSM_RUN_MERGE) && !list_empty(&ksm_mm_head.mm_list);
 }
 
-static int ksm_scan_thread(void *nothing)
+static int ksm_scan_thread(void *data)
 {
+	struct ksm_thread *thread = data;
+
 	set_freezable();
 	set_user_nice(current, 5);
 
 	while (!kthread_should_stop()) {
-		mutex_lock(&ksm_thread_mutex);
-		wait_while_offlining();
-		if (ksmd_should_run())
-			ksm_do_scan(ksm_thread_pages_to_scan);
-		mutex_unlock(&ksm_thread_mutex);
+		/*
+		 * While memory is being offlined, just sleep and retry,
+		 * rather than wait with ksm_thread_sem held.
+		 */
+		down_read(&ksm_thread_sem);
+		if (ksmd_should_run() && !(ksm_run & KSM_RUN_OFFLINE))
+			ksm_do_scan(thread, ksm_thread_pages_to_scan);
+		up_read(&ksm_thread_sem);
 
 		try_to_freeze();
 
@@ -1728,13 +2071,53 @@ static int ksm_scan_thread(void *nothing)
 			schedule_timeout_interruptible(
 				msecs_to_jiffies(ksm_thread_sleep_millisecs));
 		} else {
+			thread->pages_per_sec = 0;
 			wait_event_freezable(ksm_thread_wait,
 				ksmd_should_run() || kthread_should_stop());
+			thread->rate_start = jiffies;
+			thread->rate_pages = 0;
 		}
 	}
+
+	down_read(&ksm_thread_sem);
+	ksm_drop_mm_slot(&thread->scan);
+	up_read(&ksm_thread_sem);
 	return 0;
 }
 
+static int start_ksm_thread(unsigned int nr)
+{
+	struct ksm_thread *thread;
+	struct task_struct *task;
+
+	thread = kzalloc(sizeof(*thread), GFP_KERNEL);
+	if (!thread)
+		return -ENOMEM;
+	thread->rate_start = jiffies;
+
+	if (nr)
+		task = kthread_run(ksm_scan_thread, thread, "ksmd/%u", nr);
+	else
+		task = kthread_run(ksm_scan_thread, thread, "ksmd");
+	if (IS_ERR(task)) {
+		kfree(thread);
+		return PTR_ERR(task);
+	}
+	thread->task = task;
+	ksm_threads[nr] = thread;
+	return 0;
+}
+
+static void stop_ksm_thread(unsigned int nr)
+{
+	struct ksm_thread *thread = ksm_threads[nr];
+
+	ksm_threads[nr] = NULL;
+	kthread_stop(thread->task);
+	ksm_pages_scanned += thread->pages_scanned;
+	kfree(thread);
+}
+
 int ksm_madvise(struct vm_area_struct *vma, unsigned long start,
 		unsigned long end, int advice, unsigned long *vm_flags)
 {
@@ -1809,7 +2192,7 @@ int __ksm_enter(struct mm_struct *mm)
 	if (ksm_run & KSM_RUN_UNMERGE)
 		list_add_tail(&mm_slot->mm_list, &ksm_mm_head.mm_list);
 	else
-		list_add_tail(&mm_slot->mm_list, &ksm_scan.mm_slot->mm_list);
+		list_add_tail(&mm_slot->mm_list, &ksm_mm_next->mm_list);
 	spin_unlock(&ksm_mmlist_lock);
 
 	set_bit(MMF_VM_MERGEABLE, &mm->flags);
@@ -1829,22 +2212,27 @@ void __ksm_exit(struct mm_struct *mm)
 	/*
 	 * This process is exiting: if it's straightforward (as is the
 	 * case when ksmd was never running), free mm_slot immediately.
-	 * But if it's at the cursor or has rmap_items linked to it, use
-	 * mmap_sem to synchronize with any break_cows before pagetables
-	 * are freed, and leave the mm_slot on the list for ksmd to free.
+	 * But if it's being scanned, at the cursor or has rmap_items
+	 * linked to it, use mmap_sem to synchronize with any break_cows
+	 * before pagetables are freed, and leave the mm_slot on the list
+	 * for ksmd to free: next to be claimed, unless the full scan is
+	 * over, in which case first in the next one.
 	 * Beware: ksm may already have noticed it exiting and freed the slot.
 	 */
 
 	spin_lock(&ksm_mmlist_lock);
 	mm_slot = get_mm_slot(mm);
-	if (mm_slot && ksm_scan.mm_slot != mm_slot) {
+	if (mm_slot && !mm_slot->scanning && ksm_mm_next != mm_slot) {
 		if (!mm_slot->rmap_list) {
 			hash_del(&mm_slot->link);
 			list_del(&mm_slot->mm_list);
 			easy_to_free = 1;
+		} else if (ksm_mm_next == &ksm_mm_head) {
+			list_move(&mm_slot->mm_list, &ksm_mm_head.mm_list);
 		} else {
-			list_move(&mm_slot->mm_list,
-				  &ksm_scan.mm_slot->mm_list);
+			list_move_tail(&mm_slot->mm_list,
+				       &ksm_mm_next->mm_list);
+			ksm_mm_next = mm_slot;
 		}
 	}
 	spin_unlock(&ksm_mmlist_lock);
@@ -1981,10 +2369,10 @@ void ksm_migrate_page(struct page *newpage, struct page *oldpage)
 static void wait_while_offlining(void)
 {
 	while (ksm_run & KSM_RUN_OFFLINE) {
-		mutex_unlock(&ksm_thread_mutex);
+		up_write(&ksm_thread_sem);
 		wait_on_bit(&ksm_run, ilog2(KSM_RUN_OFFLINE),
 			    TASK_UNINTERRUPTIBLE);
-		mutex_lock(&ksm_thread_mutex);
+		down_write(&ksm_thread_sem);
 	}
 }
 
@@ -1994,10 +2382,10 @@ static void ksm_check_stable_tree(unsigned long start_pfn,
 	struct stable_node *stable_node;
 	struct list_head *this, *next;
 	struct rb_node *node;
-	int nid;
+	int i;
 
-	for (nid = 0; nid < ksm_nr_node_ids; nid++) {
-		node = rb_first(root_stable_tree + nid);
+	for (i = 0; i < ksm_nr_node_ids * KSM_TREE_SHARDS; i++) {
+		node = rb_first(root_stable_tree + i);
 		while (node) {
 			stable_node = rb_entry(node, struct stable_node, node);
 			if (stable_node->kpfn >= start_pfn &&
@@ -2007,7 +2395,7 @@ static void ksm_check_stable_tree(unsigned long start_pfn,
 				 * which is why we keep kpfn instead of page*
 				 */
 				remove_node_from_stable_tree(stable_node);
-				node = rb_first(root_stable_tree + nid);
+				node = rb_first(root_stable_tree + i);
 			} else
 				node = rb_next(node);
 			cond_resched();
@@ -2034,11 +2422,11 @@ static int ksm_memory_callback(struct notifier_block *self,
 		 * and remove_all_stable_nodes() while memory is going offline:
 		 * it is unsafe for them to touch the stable tree at this time.
 		 * But unmerge_ksm_pages(), rmap lookups and other entry points
-		 * which do not need the ksm_thread_mutex are all safe.
+		 * which do not need the ksm_thread_sem are all safe.
 		 */
-		mutex_lock(&ksm_thread_mutex);
+		down_write(&ksm_thread_sem);
 		ksm_run |= KSM_RUN_OFFLINE;
-		mutex_unlock(&ksm_thread_mutex);
+		up_write(&ksm_thread_sem);
 		break;
 
 	case MEM_OFFLINE:
@@ -2054,9 +2442,9 @@ static int ksm_memory_callback(struct notifier_block *self,
 		/* fallthrough */
 
 	case MEM_CANCEL_OFFLINE:
-		mutex_lock(&ksm_thread_mutex);
+		down_write(&ksm_thread_sem);
 		ksm_run &= ~KSM_RUN_OFFLINE;
-		mutex_unlock(&ksm_thread_mutex);
+		up_write(&ksm_thread_sem);
 
 		smp_mb();	/* wake_up_bit advises this */
 		wake_up_bit(&ksm_run, ilog2(KSM_RUN_OFFLINE));
@@ -2152,7 +2540,7 @@ static ssize_t run_store(struct kobject *kobj, struct kobj_attribute *attr,
 	 * on the list for when ksmd may be set running again).
 	 */
 
-	mutex_lock(&ksm_thread_mutex);
+	down_write(&ksm_thread_sem);
 	wait_while_offlining();
 	if (ksm_run != flags) {
 		ksm_run = flags;
@@ -2166,7 +2554,7 @@ static ssize_t run_store(struct kobject *kobj, struct kobj_attribute *attr,
 			}
 		}
 	}
-	mutex_unlock(&ksm_thread_mutex);
+	up_write(&ksm_thread_sem);
 
 	if (flags & KSM_RUN_MERGE)
 		wake_up_interruptible(&ksm_thread_wait);
@@ -2195,10 +2583,11 @@ static ssize_t merge_across_nodes_store(struct kobject *kobj,
 	if (knob > 1)
 		return -EINVAL;
 
-	mutex_lock(&ksm_thread_mutex);
+	down_write(&ksm_thread_sem);
 	wait_while_offlining();
 	if (ksm_merge_across_nodes != knob) {
-		if (ksm_pages_shared || remove_all_stable_nodes())
+		if (atomic_long_read(&ksm_pages_shared) ||
+		    remove_all_stable_nodes())
 			err = -EBUSY;
 		else if (root_stable_tree == one_stable_tree) {
 			struct rb_root *buf;
@@ -2206,19 +2595,22 @@ static ssize_t merge_across_nodes_store(struct kobject *kobj,
 			 * This is the first time that we switch away from the
 			 * default of merging across nodes: must now allocate
 			 * a buffer to hold as many roots as may be needed.
-			 * Allocate stable and unstable together:
-			 * MAXSMP NODES_SHIFT 10 will use 16kB.
+			 * Allocate stable and unstable together, one root
+			 * per shard of each: 64 shards on a 64 node
+			 * machine will use 64kB.
 			 */
-			buf = kcalloc(nr_node_ids + nr_node_ids, sizeof(*buf),
-				      GFP_KERNEL);
+			buf = kcalloc(2 * nr_node_ids * KSM_TREE_SHARDS,
+				      sizeof(*buf), GFP_KERNEL);
 			/* Let us assume that RB_ROOT is NULL is zero */
 			if (!buf)
 				err = -ENOMEM;
 			else {
 				root_stable_tree = buf;
-				root_unstable_tree = buf + nr_node_ids;
+				root_unstable_tree = buf +
+					nr_node_ids * KSM_TREE_SHARDS;
 				/* Stable tree is empty but not the unstable */
-				root_unstable_tree[0] = one_unstable_tree[0];
+				memcpy(root_unstable_tree, one_unstable_tree,
+				       sizeof(one_unstable_tree));
 			}
 		}
 		if (!err) {
@@ -2226,7 +2618,7 @@ static ssize_t merge_across_nodes_store(struct kobject *kobj,
 			ksm_nr_node_ids = knob ? 1 : nr_node_ids;
 		}
 	}
-	mutex_unlock(&ksm_thread_mutex);
+	up_write(&ksm_thread_sem);
 
 	return err ? err : count;
 }
@@ -2236,21 +2628,21 @@ KSM_ATTR(merge_across_nodes);
 static ssize_t pages_shared_show(struct kobject *kobj,
 				 struct kobj_attribute *attr, char *buf)
 {
-	return sprintf(buf, "%lu\n", ksm_pages_shared);
+	return sprintf(buf, "%ld\n", atomic_long_read(&ksm_pages_shared));
 }
 KSM_ATTR_RO(pages_shared);
 
 static ssize_t pages_sharing_show(struct kobject *kobj,
 				  struct kobj_attribute *attr, char *buf)
 {
-	return sprintf(buf, "%lu\n", ksm_pages_sharing);
+	return sprintf(buf, "%ld\n", atomic_long_read(&ksm_pages_sharing));
 }
 KSM_ATTR_RO(pages_sharing);
 
 static ssize_t pages_unshared_show(struct kobject *kobj,
 				   struct kobj_attribute *attr, char *buf)
 {
-	return sprintf(buf, "%lu\n", ksm_pages_unshared);
+	return sprintf(buf, "%ld\n", atomic_long_read(&ksm_pages_unshared));
 }
 KSM_ATTR_RO(pages_unshared);
 
@@ -2259,8 +2651,10 @@ static ssize_t pages_volatile_show(struct kobject *kobj,
 {
 	long ksm_pages_volatile;
 
-	ksm_pages_volatile = ksm_rmap_items - ksm_pages_shared
-				- ksm_pages_sharing - ksm_pages_unshared;
+	ksm_pages_volatile = atomic_long_read(&ksm_rmap_items)
+				- atomic_long_read(&ksm_pages_shared)
+				- atomic_long_read(&ksm_pages_sharing)
+				- atomic_long_read(&ksm_pages_unshared);
 	/*
 	 * It was not worth any locking to calculate that statistic,
 	 * but it might therefore sometimes be negative: conceal that.
@@ -2274,10 +2668,75 @@ KSM_ATTR_RO(pages_volatile);
 static ssize_t full_scans_show(struct kobject *kobj,
 			       struct kobj_attribute *attr, char *buf)
 {
-	return sprintf(buf, "%lu\n", ksm_scan.seqnr);
+	return sprintf(buf, "%lu\n", ksm_seqnr);
 }
 KSM_ATTR_RO(full_scans);
 
+static ssize_t threads_show(struct kobject *kobj,
+			    struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", ksm_nr_threads);
+}
+
+static ssize_t threads_store(struct kobject *kobj,
+			     struct kobj_attribute *attr,
+			     const char *buf, size_t count)
+{
+	unsigned long nr;
+	int err;
+
+	err = kstrtoul(buf, 10, &nr);
+	if (err || !nr || nr > KSM_MAX_THREADS)
+		return -EINVAL;
+
+	mutex_lock(&ksm_threads_mutex);
+	while (ksm_nr_threads < nr) {
+		err = start_ksm_thread(ksm_nr_threads);
+		if (err)
+			break;
+		ksm_nr_threads++;
+	}
+	while (ksm_nr_threads > nr)
+		stop_ksm_thread(--ksm_nr_threads);
+	mutex_unlock(&ksm_threads_mutex);
+
+	return err ? err : count;
+}
+KSM_ATTR(threads);
+
+static ssize_t pages_scanned_show(struct kobject *kobj,
+				  struct kobj_attribute *attr, char *buf)
+{
+	unsigned long pages;
+	unsigned int i;
+
+	mutex_lock(&ksm_threads_mutex);
+	pages = ksm_pages_scanned;
+	for (i = 0; i < ksm_nr_threads; i++)
+		pages += ksm_threads[i]->pages_scanned;
+	mutex_unlock(&ksm_threads_mutex);
+
+	return sprintf(buf, "%lu\n", pages);
+}
+KSM_ATTR_RO(pages_scanned);
+
+static ssize_t thread_scan_rates_show(struct kobject *kobj,
+				      struct kobj_attribute *attr, char *buf)
+{
+	ssize_t len = 0;
+	unsigned int i;
+
+	mutex_lock(&ksm_threads_mutex);
+	for (i = 0; i < ksm_nr_threads; i++)
+		len += sprintf(buf + len, "%s%lu", i ? " " : "",
+			       ksm_threads[i]->pages_per_sec);
+	mutex_unlock(&ksm_threads_mutex);
+	len += sprintf(buf + len, "\n");
+
+	return len;
+}
+KSM_ATTR_RO(thread_scan_rates);
+
 static struct attribute *ksm_attrs[] = {
 	&sleep_millisecs_attr.attr,
 	&pages_to_scan_attr.attr,
@@ -2287,6 +2746,9 @@ static struct attribute *ksm_attrs[] = {
 	&pages_unshared_attr.attr,
 	&pages_volatile_attr.attr,
 	&full_scans_attr.attr,
+	&threads_attr.attr,
+	&pages_scanned_attr.attr,
+	&thread_scan_rates_attr.attr,
 #ifdef CONFIG_NUMA
 	&merge_across_nodes_attr.attr,
 #endif
@@ -2301,17 +2763,19 @@ static struct attribute_group ksm_attr_group = {
 
 static int __init ksm_init(void)
 {
-	struct task_struct *ksm_thread;
 	int err;
+	int i;
 
 	err = ksm_slab_init();
 	if (err)
 		goto out;
 
-	ksm_thread = kthread_run(ksm_scan_thread, NULL, "ksmd");
-	if (IS_ERR(ksm_thread)) {
+	for (i = 0; i < KSM_TREE_SHARDS; i++)
+		mutex_init(&ksm_tree_shards[i].lock);
+
+	err = start_ksm_thread(0);
+	if (err) {
 		pr_err("ksm: creating kthread failed\n");
-		err = PTR_ERR(ksm_thread);
 		goto out_free;
 	}
 
@@ -2319,7 +2783,7 @@ static int __init ksm_init(void)
 	err = sysfs_create_group(mm_kobj, &ksm_attr_group);
 	if (err) {
 		pr_err("ksm: register sysfs failed\n");
-		kthread_stop(ksm_thread);
+		stop_ksm_thread(0);
 		goto out_free;
 	}
 #else
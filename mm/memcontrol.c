@@ -1236,8 +1236,9 @@ out:
  * @zone: zone of the page
  *
  * This function is only safe when following the LRU page isolation
- * and putback protocol: the LRU lock must be held, and the page must
- * either be PageLRU() or the caller must have isolated/allocated it.
+ * and putback protocol: the lru_lock of the returned lruvec must be held,
+ * and the page must either be PageLRU() or the caller must have
+ * isolated/allocated it.  See lock_page_lruvec_irq() for taking it.
  */
 struct lruvec *mem_cgroup_page_lruvec(struct page *page, struct zone *zone)
 {
@@ -2389,40 +2390,42 @@ struct mem_cgroup *try_get_mem_cgroup_from_page(struct page *page)
 	return memcg;
 }
 
-static void lock_page_lru(struct page *page, int *isolated)
+static struct lruvec *lock_page_lru(struct page *page, int *isolated)
 {
-	struct zone *zone = page_zone(page);
+	struct lruvec *lruvec;
 
-	spin_lock_irq(&zone->lru_lock);
+	lruvec = lock_page_lruvec_irq(page);
 	if (PageLRU(page)) {
-		struct lruvec *lruvec;
-
-		lruvec = mem_cgroup_page_lruvec(page, zone);
 		ClearPageLRU(page);
 		del_page_from_lru_list(page, lruvec, page_lru(page));
 		*isolated = 1;
 	} else
 		*isolated = 0;
+	/*
+	 * Clear PageLRU before the caller changes page->mem_cgroup, for
+	 * the lockless lruvec lookup in isolate_migratepages_block().
+	 */
+	smp_wmb();
+	return lruvec;
 }
 
-static void unlock_page_lru(struct page *page, int isolated)
+static void unlock_page_lru(struct page *page, struct lruvec *lruvec,
+			    int isolated)
 {
-	struct zone *zone = page_zone(page);
-
 	if (isolated) {
-		struct lruvec *lruvec;
-
-		lruvec = mem_cgroup_page_lruvec(page, zone);
+		/* page->mem_cgroup changed, the page goes to its new lruvec */
+		lruvec = relock_page_lruvec_irq(page, lruvec);
 		VM_BUG_ON_PAGE(PageLRU(page), page);
 		SetPageLRU(page);
 		add_page_to_lru_list(page, lruvec, page_lru(page));
 	}
-	spin_unlock_irq(&zone->lru_lock);
+	spin_unlock_irq(&lruvec->lru_lock);
 }
 
 static void commit_charge(struct page *page, struct mem_cgroup *memcg,
 			  bool lrucare)
 {
+	struct lruvec *uninitialized_var(lruvec);
 	int isolated;
 
 	VM_BUG_ON_PAGE(page->mem_cgroup, page);
@@ -2432,7 +2435,7 @@ static void commit_charge(struct page *page, struct mem_cgroup *memcg,
 	 * may already be on some other mem_cgroup's LRU.  Take care of it.
 	 */
 	if (lrucare)
-		lock_page_lru(page, &isolated);
+		lruvec = lock_page_lru(page, &isolated);
 
 	/*
 	 * Nobody should be changing or seriously looking at
@@ -2451,7 +2454,7 @@ static void commit_charge(struct page *page, struct mem_cgroup *memcg,
 	page->mem_cgroup = memcg;
 
 	if (lrucare)
-		unlock_page_lru(page, isolated);
+		unlock_page_lru(page, lruvec, isolated);
 }
 
 #ifdef CONFIG_MEMCG_KMEM
@@ -2761,7 +2764,7 @@ struct mem_cgroup *__mem_cgroup_from_kmem(void *ptr)
 
 /*
  * Because tail pages are not marked as "used", set it. We're under
- * zone->lru_lock, 'splitting on pmd' and compound_lock.
+ * lruvec->lru_lock, 'splitting on pmd' and compound_lock.
  * charge/uncharge will be never happen and move_account() is done under
  * compound_lock(), so we don't have to take care of races.
  */
@@ -4994,6 +4997,9 @@ static enum mc_target_type get_mctgt_type_thp(struct vm_area_struct *vma,
 	enum mc_target_type ret = MC_TARGET_NONE;
 
 	page = pmd_page(pmd);
+	/* Page cache mapped by ->pmd_fault is made of small pages */
+	if (!PageAnon(page))
+		return ret;
 	VM_BUG_ON_PAGE(!page || !PageHead(page), page);
 	if (!(mc.flags & MOVE_ANON))
 		return ret;
@@ -5853,6 +5859,7 @@ void mem_cgroup_uncharge_list(struct list_head *page_list)
 void mem_cgroup_migrate(struct page *oldpage, struct page *newpage,
 			bool lrucare)
 {
+	struct lruvec *uninitialized_var(lruvec);
 	struct mem_cgroup *memcg;
 	int isolated;
 
@@ -5882,12 +5889,12 @@ void mem_cgroup_migrate(struct page *oldpage, struct page *newpage,
 		return;
 
 	if (lrucare)
-		lock_page_lru(oldpage, &isolated);
+		lruvec = lock_page_lru(oldpage, &isolated);
 
 	oldpage->mem_cgroup = NULL;
 
 	if (lrucare)
-		unlock_page_lru(oldpage, isolated);
+		unlock_page_lru(oldpage, lruvec, isolated);
 
 	commit_charge(newpage, memcg, lrucare);
 }
@@ -1086,6 +1086,7 @@ again:
 	init_rss_vec(rss);
 	start_pte = pte_offset_map_lock(mm, pmd, addr, &ptl);
 	pte = start_pte;
+	flush_tlb_batched_pending(mm);
 	arch_enter_lazy_mmu_mode();
 	do {
 		pte_t ptent = *pte;
@@ -1195,7 +1196,13 @@ static inline unsigned long zap_pmd_range(struct mmu_gather *tlb,
 		if (pmd_trans_huge(*pmd)) {
 			if (next - addr != HPAGE_PMD_SIZE) {
 #ifdef CONFIG_DEBUG_VM
-				if (!rwsem_is_locked(&tlb->mm->mmap_sem)) {
+				/*
+				 * Page cache mapped by ->pmd_fault is split
+				 * under the pmd lock alone, as truncation and
+				 * hole punching do without mmap_sem.
+				 */
+				if (!vma->vm_ops &&
+				    !rwsem_is_locked(&tlb->mm->mmap_sem)) {
 					pr_err("%s: mmap_sem is unlocked! addr=0x%lx end=0x%lx vma->vm_start=0x%lx vma->vm_end=0x%lx\n",
 						__func__, addr, end,
 						vma->vm_start,
@@ -3322,6 +3329,8 @@ static int __handle_mm_fault(struct mm_struct *mm, struct vm_area_struct *vma,
 		if (!vma->vm_ops)
 			ret = do_huge_pmd_anonymous_page(mm, vma, address,
 					pmd, flags);
+		else if (vma->vm_ops->pmd_fault)
+			ret = vma->vm_ops->pmd_fault(vma, address, pmd, flags);
 		if (!(ret & VM_FAULT_FALLBACK))
 			return ret;
 	} else {
@@ -3344,7 +3353,10 @@ static int __handle_mm_fault(struct mm_struct *mm, struct vm_area_struct *vma,
 				return do_huge_pmd_numa_page(mm, vma, address,
 							     orig_pmd, pmd);
 
-			if (dirty && !pmd_write(orig_pmd)) {
+			if (dirty && !pmd_write(orig_pmd) && vma->vm_ops) {
+				/* page cache is written through the ptes */
+				split_huge_page_pmd(vma, address, pmd);
+			} else if (dirty && !pmd_write(orig_pmd)) {
 				ret = do_huge_pmd_wp_page(mm, vma, address, pmd,
 							  orig_pmd);
 				if (!(ret & VM_FAULT_FALLBACK))
@@ -3379,6 +3391,74 @@ static int __handle_mm_fault(struct mm_struct *mm, struct vm_area_struct *vma,
 	return handle_pte_fault(mm, vma, address, pte, pmd, flags);
 }
 
+/*
+ * Page faults only read lock their page in mm->mmap_range while some
+ * range there is write locked, which is rare.  Otherwise they are counted
+ * in mm->mmap_range_faults, on whichever cpu they start and end, and
+ * mmap_range_write_lock() waits for that count to drop to zero after
+ * announcing itself in mm->mmap_range_writers: either the fault sees the
+ * writer and takes the range lock, or the writer sees the fault and waits
+ * for it.
+ */
+static bool fault_range_lock(struct mm_struct *mm, struct range_lock *range,
+			     unsigned long address)
+{
+	this_cpu_inc(*mm->mmap_range_faults);
+	smp_mb();	/* pairs with mmap_range_write_lock() */
+	if (likely(!atomic_read(&mm->mmap_range_writers)))
+		return false;
+
+	this_cpu_dec(*mm->mmap_range_faults);
+	smp_mb();
+	wake_up(&mm->mmap_range_wait);
+
+	range_lock_init(range, address & PAGE_MASK,
+			(address & PAGE_MASK) + PAGE_SIZE - 1);
+	range_read_lock(&mm->mmap_range, range);
+	return true;
+}
+
+static void fault_range_unlock(struct mm_struct *mm, struct range_lock *range,
+			       bool locked)
+{
+	if (locked) {
+		range_read_unlock(&mm->mmap_range, range);
+		return;
+	}
+
+	this_cpu_dec(*mm->mmap_range_faults);
+	smp_mb();	/* pairs with mmap_range_write_lock() */
+	if (unlikely(atomic_read(&mm->mmap_range_writers)))
+		wake_up(&mm->mmap_range_wait);
+}
+
+static bool mmap_range_faults_drained(struct mm_struct *mm)
+{
+	int cpu, sum = 0;
+
+	for_each_possible_cpu(cpu)
+		sum += per_cpu(*mm->mmap_range_faults, cpu);
+	return !sum;
+}
+
+/*
+ * Write lock @range of mm->mmap_range, against other ranges and against
+ * page faults, with mmap_sem held for reading.
+ */
+void mmap_range_write_lock(struct mm_struct *mm, struct range_lock *range)
+{
+	range_write_lock(&mm->mmap_range, range);
+	atomic_inc(&mm->mmap_range_writers);
+	smp_mb__after_atomic();	/* pairs with fault_range_lock() */
+	wait_event(mm->mmap_range_wait, mmap_range_faults_drained(mm));
+}
+
+void mmap_range_write_unlock(struct mm_struct *mm, struct range_lock *range)
+{
+	range_write_unlock(&mm->mmap_range, range);
+	atomic_dec(&mm->mmap_range_writers);
+}
+
 /*
  * By the time we get here, we already hold the mm semaphore
  *
@@ -3388,6 +3468,8 @@ static int __handle_mm_fault(struct mm_struct *mm, struct vm_area_struct *vma,
 int handle_mm_fault(struct mm_struct *mm, struct vm_area_struct *vma,
 		    unsigned long address, unsigned int flags)
 {
+	struct range_lock range;
+	bool locked;
 	int ret;
 
 	__set_current_state(TASK_RUNNING);
@@ -3405,7 +3487,13 @@ int handle_mm_fault(struct mm_struct *mm, struct vm_area_struct *vma,
 	if (flags & FAULT_FLAG_USER)
 		mem_cgroup_oom_enable();
 
+	/*
+	 * Keep mprotect() from changing the vma under us while it holds
+	 * mmap_sem only for reading; see mm->mmap_range.
+	 */
+	locked = fault_range_lock(mm, &range, address);
 	ret = __handle_mm_fault(mm, vma, address, flags);
+	fault_range_unlock(mm, &range, locked);
 
 	if (flags & FAULT_FLAG_USER) {
 		mem_cgroup_oom_disable();
@@ -3423,6 +3511,267 @@ int handle_mm_fault(struct mm_struct *mm, struct vm_area_struct *vma,
 }
 EXPORT_SYMBOL_GPL(handle_mm_fault);
 
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+/*
+ * Speculative page faults.
+ *
+ * A fault on an empty pte of an anonymous vma, or a read fault on an empty
+ * pte of a vma served by filemap_fault(), can be handled without mmap_sem.
+ * The vma is pinned by get_vma() and its vm_sequence sampled before any of
+ * its fields are looked at; everything that changes what such a fault
+ * depends on (vm_flags, vm_page_prot, the vma boundaries, the page tables
+ * underneath it) does so between vm_write_begin() and vm_write_end(), so
+ * an unchanged sequence once the pte lock is held means the vma we looked
+ * at still maps the address.  Anything else returns VM_FAULT_RETRY, and
+ * the caller takes mmap_sem and goes through handle_mm_fault().
+ *
+ * Page tables are walked with interrupts disabled: they are freed only
+ * after the vma has been detached and a TLB flush has been acknowledged
+ * by every CPU running the mm, this one included.
+ */
+
+/*
+ * Maps and locks the pte for @address if the vma has not changed since
+ * @seq was read.  @pmdval is the pmd as it was found during the walk;
+ * if the pmd no longer matches it, the page table it pointed to may be
+ * on its way out.
+ */
+static pte_t *spf_pte_map_lock(struct vm_area_struct *vma, unsigned int seq,
+			       pmd_t *pmd, pmd_t pmdval, unsigned long address,
+			       spinlock_t **ptlp)
+{
+	spinlock_t *ptl;
+	pte_t *pte;
+
+	local_irq_disable();
+	if (read_seqcount_retry(&vma->vm_sequence, seq) ||
+	    pmd_val(*pmd) != pmd_val(pmdval))
+		goto fail;
+
+	ptl = pte_lockptr(vma->vm_mm, &pmdval);
+	pte = pte_offset_map(&pmdval, address);
+	/*
+	 * Spinning here with interrupts off could deadlock against a CPU
+	 * that holds the lock and waits for us to ack a TLB flush.
+	 */
+	if (!spin_trylock(ptl)) {
+		pte_unmap(pte);
+		goto fail;
+	}
+	if (read_seqcount_retry(&vma->vm_sequence, seq)) {
+		pte_unmap_unlock(pte, ptl);
+		goto fail;
+	}
+	local_irq_enable();
+	*ptlp = ptl;
+	return pte;
+fail:
+	local_irq_enable();
+	return NULL;
+}
+
+static int spf_anonymous_page(struct mm_struct *mm,
+		struct vm_area_struct *vma, unsigned long address,
+		pmd_t *pmd, pmd_t pmdval, unsigned int seq, unsigned int flags)
+{
+	struct mem_cgroup *memcg;
+	struct page *page = NULL;
+	spinlock_t *ptl;
+	pte_t *pte, entry;
+	int ret = 0;
+
+	if (!(flags & FAULT_FLAG_WRITE) && !mm_forbids_zeropage(mm)) {
+		entry = pte_mkspecial(pfn_pte(my_zero_pfn(address),
+						vma->vm_page_prot));
+	} else {
+		/* anon_vma_prepare() needs mmap_sem. */
+		if (!vma->anon_vma)
+			return VM_FAULT_RETRY;
+		page = alloc_zeroed_user_highpage_movable(vma, address);
+		if (!page)
+			return VM_FAULT_RETRY;
+		if (mem_cgroup_try_charge(page, mm, GFP_KERNEL, &memcg)) {
+			page_cache_release(page);
+			return VM_FAULT_RETRY;
+		}
+		__SetPageUptodate(page);
+		entry = mk_pte(page, vma->vm_page_prot);
+		if (vma->vm_flags & VM_WRITE)
+			entry = pte_mkwrite(pte_mkdirty(entry));
+	}
+
+	pte = spf_pte_map_lock(vma, seq, pmd, pmdval, address, &ptl);
+	if (!pte) {
+		ret = VM_FAULT_RETRY;
+		goto release;
+	}
+	if (!pte_none(*pte)) {
+		pte_unmap_unlock(pte, ptl);
+		goto release;
+	}
+
+	if (page) {
+		inc_mm_counter_fast(mm, MM_ANONPAGES);
+		page_add_new_anon_rmap(page, vma, address);
+		mem_cgroup_commit_charge(page, memcg, false);
+		lru_cache_add_active_or_unevictable(page, vma);
+	}
+	set_pte_at(mm, address, pte, entry);
+
+	/* No need to invalidate - it was non-present before */
+	update_mmu_cache(vma, address, pte);
+	pte_unmap_unlock(pte, ptl);
+	return 0;
+
+release:
+	if (page) {
+		mem_cgroup_cancel_charge(page, memcg);
+		page_cache_release(page);
+	}
+	return ret;
+}
+
+/* do_read_fault(), with the pte lock taken through spf_pte_map_lock(). */
+static int spf_read_fault(struct vm_area_struct *vma, unsigned long address,
+		pmd_t *pmd, pmd_t pmdval, unsigned int seq, unsigned int flags)
+{
+	pgoff_t pgoff = linear_page_index(vma, address);
+	struct page *fault_page;
+	spinlock_t *ptl;
+	pte_t *pte;
+	int ret;
+
+	if (vma->vm_ops->map_pages && fault_around_bytes >> PAGE_SHIFT > 1) {
+		pte = spf_pte_map_lock(vma, seq, pmd, pmdval, address, &ptl);
+		if (!pte)
+			return VM_FAULT_RETRY;
+		do_fault_around(vma, address, pte, pgoff, flags);
+		if (!pte_none(*pte)) {
+			pte_unmap_unlock(pte, ptl);
+			return 0;
+		}
+		pte_unmap_unlock(pte, ptl);
+	}
+
+	ret = __do_fault(vma, address, pgoff, flags, NULL, &fault_page);
+	if (unlikely(ret & (VM_FAULT_ERROR | VM_FAULT_NOPAGE | VM_FAULT_RETRY)))
+		return ret;
+
+	pte = spf_pte_map_lock(vma, seq, pmd, pmdval, address, &ptl);
+	if (!pte) {
+		unlock_page(fault_page);
+		page_cache_release(fault_page);
+		return VM_FAULT_RETRY;
+	}
+	if (unlikely(!pte_none(*pte))) {
+		pte_unmap_unlock(pte, ptl);
+		unlock_page(fault_page);
+		page_cache_release(fault_page);
+		return ret;
+	}
+	do_set_pte(vma, address, fault_page, pte, false, false);
+	unlock_page(fault_page);
+	pte_unmap_unlock(pte, ptl);
+	return ret;
+}
+
+/*
+ * Tries to handle a user fault at @address without mmap_sem.  Returns
+ * VM_FAULT_RETRY if the fault has to go through handle_mm_fault() with
+ * mmap_sem held, which is also how errors are reported: the locked path
+ * redoes the fault and decides what to signal.
+ */
+int handle_speculative_fault(struct mm_struct *mm, unsigned long address,
+			     unsigned int flags)
+{
+	struct vm_area_struct *vma;
+	unsigned int seq;
+	pgd_t *pgd;
+	pud_t *pud;
+	pmd_t *pmd, pmdval;
+	pte_t *pte, entry;
+	int ret = VM_FAULT_RETRY;
+
+	/* There is no mmap_sem for ->fault() to drop. */
+	flags &= ~(FAULT_FLAG_ALLOW_RETRY | FAULT_FLAG_KILLABLE);
+
+	vma = get_vma(mm, address);
+	if (!vma)
+		return VM_FAULT_RETRY;
+
+	seq = raw_read_seqcount(&vma->vm_sequence);
+	if (seq & 1)
+		goto out_put;
+
+	if (address < vma->vm_start)
+		goto out_put;
+	if (vma->vm_flags & (VM_HUGETLB | VM_PFNMAP | VM_MIXEDMAP | VM_IO |
+			     VM_GROWSDOWN | VM_GROWSUP))
+		goto out_put;
+	/* The policy may be shared and changed under mmap_sem. */
+	if (vma_policy(vma))
+		goto out_put;
+	if (flags & FAULT_FLAG_WRITE) {
+		if (!(vma->vm_flags & VM_WRITE))
+			goto out_put;
+	} else if (!(vma->vm_flags & (VM_READ | VM_EXEC | VM_WRITE)))
+		goto out_put;
+	if (vma->vm_ops) {
+		if (vma->vm_ops->fault != filemap_fault ||
+		    (flags & FAULT_FLAG_WRITE))
+			goto out_put;
+	} else if (vma->vm_flags & VM_SHARED)
+		goto out_put;
+
+	local_irq_disable();
+	pgd = pgd_offset(mm, address);
+	if (pgd_none(*pgd) || unlikely(pgd_bad(*pgd)))
+		goto out_walk;
+	pud = pud_offset(pgd, address);
+	if (pud_none(*pud) || unlikely(pud_bad(*pud)))
+		goto out_walk;
+	pmd = pmd_offset(pud, address);
+	pmdval = pmd_read_atomic(pmd);
+	barrier();
+	if (pmd_none(pmdval) || pmd_trans_huge(pmdval) ||
+	    unlikely(pmd_bad(pmdval)))
+		goto out_walk;
+	pte = pte_offset_map(&pmdval, address);
+	entry = *pte;
+	barrier();
+	pte_unmap(pte);
+	local_irq_enable();
+
+	/* Swap, NUMA hinting and write protect faults take the slow path. */
+	if (!pte_none(entry))
+		goto out_put;
+
+	check_sync_rss_stat(current);
+
+	if (!vma->vm_ops)
+		ret = spf_anonymous_page(mm, vma, address, pmd, pmdval, seq,
+					 flags);
+	else
+		ret = spf_read_fault(vma, address, pmd, pmdval, seq, flags);
+
+	if (ret & (VM_FAULT_ERROR | VM_FAULT_RETRY)) {
+		ret = VM_FAULT_RETRY;
+		goto out_put;
+	}
+
+	count_vm_event(PGFAULT);
+	count_vm_event(SPECULATIVE_PGFAULT);
+	mem_cgroup_count_vm_event(mm, PGFAULT);
+	goto out_put;
+
+out_walk:
+	local_irq_enable();
+out_put:
+	put_vma(vma);
+	return ret;
+}
+#endif /* CONFIG_SPECULATIVE_PAGE_FAULT */
+
 #ifndef __PAGETABLE_PUD_FOLDED
 /*
  * Allocate page upper directory.
@@ -72,6 +72,7 @@ static unsigned long change_pte_range(struct vm_area_struct *vma, pmd_t *pmd,
 	if (!pte)
 		return 0;
 
+	flush_tlb_batched_pending(mm);
 	arch_enter_lazy_mmu_mode();
 	do {
 		oldpte = *pte;
@@ -223,7 +224,7 @@ static unsigned long change_protection_range(struct vm_area_struct *vma,
 	BUG_ON(addr >= end);
 	pgd = pgd_offset(mm, addr);
 	flush_cache_range(vma, addr, end);
-	set_tlb_flush_pending(mm);
+	inc_tlb_flush_pending(mm);
 	do {
 		next = pgd_addr_end(addr, end);
 		if (pgd_none_or_clear_bad(pgd))
@@ -235,7 +236,7 @@ static unsigned long change_protection_range(struct vm_area_struct *vma,
 	/* Only flush the TLB if we actually modified any entries: */
 	if (pages)
 		flush_tlb_range(vma, start, end);
-	clear_tlb_flush_pending(mm);
+	dec_tlb_flush_pending(mm);
 
 	return pages;
 }
@@ -254,6 +255,26 @@ unsigned long change_protection(struct vm_area_struct *vma, unsigned long start,
 	return pages;
 }
 
+/*
+ * vm_flags and vm_page_prot are protected by the mmap_sem held in write
+ * mode, or in read mode with the range of the whole vma write locked in
+ * mm->mmap_range.
+ */
+static void vma_change_protection(struct vm_area_struct *vma,
+		unsigned long start, unsigned long end, unsigned long newflags)
+{
+	int dirty_accountable;
+
+	vm_write_begin(vma);
+	vma->vm_flags = newflags;
+	dirty_accountable = vma_wants_writenotify(vma);
+	vma_set_page_prot(vma);
+
+	change_protection(vma, start, end, vma->vm_page_prot,
+			  dirty_accountable, 0);
+	vm_write_end(vma);
+}
+
 int
 mprotect_fixup(struct vm_area_struct *vma, struct vm_area_struct **pprev,
 	unsigned long start, unsigned long end, unsigned long newflags)
@@ -264,7 +285,6 @@ mprotect_fixup(struct vm_area_struct *vma, struct vm_area_struct **pprev,
 	unsigned long charged = 0;
 	pgoff_t pgoff;
 	int error;
-	int dirty_accountable = 0;
 
 	if (newflags == oldflags) {
 		*pprev = vma;
@@ -313,16 +333,7 @@ mprotect_fixup(struct vm_area_struct *vma, struct vm_area_struct **pprev,
 	}
 
 success:
-	/*
-	 * vm_flags and vm_page_prot are protected by the mmap_sem
-	 * held in write mode.
-	 */
-	vma->vm_flags = newflags;
-	dirty_accountable = vma_wants_writenotify(vma);
-	vma_set_page_prot(vma);
-
-	change_protection(vma, start, end, vma->vm_page_prot,
-			  dirty_accountable, 0);
+	vma_change_protection(vma, start, end, newflags);
 
 	/*
 	 * Private VM_LOCKED VMA becoming writable: trigger COW to avoid major
@@ -343,6 +354,94 @@ fail:
 	return error;
 }
 
+/*
+ * Can mprotect() give @vma @newflags without mmap_sem held for writing?
+ * Not if it has anything to report, would touch the commit charge or the
+ * mm-wide counters kept by vm_stat_account(), or would fault pages in.
+ */
+static bool mprotect_needs_mmap_write(struct vm_area_struct *vma,
+				      unsigned long newflags)
+{
+	unsigned long oldflags = vma->vm_flags;
+
+	/* newflags >> 4 shift VM_MAY% in place of VM_% */
+	if ((newflags & ~(newflags >> 4)) & (VM_READ | VM_WRITE | VM_EXEC))
+		return true;
+	if (newflags == oldflags)
+		return false;
+	if (is_vm_hugetlb_page(vma) || (oldflags & VM_LOCKED))
+		return true;
+	if ((newflags & VM_WRITE) &&
+	    !(oldflags & (VM_ACCOUNT|VM_WRITE|VM_SHARED|VM_NORESERVE)))
+		return true;
+	if (vma->vm_file &&
+	    ((oldflags & (VM_EXEC|VM_WRITE)) == VM_EXEC) !=
+	    ((newflags & (VM_EXEC|VM_WRITE)) == VM_EXEC))
+		return true;
+	return false;
+}
+
+/*
+ * When [start, end) is made of whole vmas, changing their protection
+ * neither splits nor merges anything, so the vma tree is left alone and
+ * mmap_sem held for reading is enough, with the range write locked
+ * against page faults and other mprotect() calls.  Neighbouring vmas that
+ * end up with the same flags are not merged here; their flags may be
+ * changing under us.
+ *
+ * Returns -EAGAIN, having changed nothing, when mprotect() has to go the
+ * mmap_sem write path, which is also where errors get reported.
+ */
+static int mprotect_whole_vmas(struct mm_struct *mm, unsigned long start,
+		unsigned long end, unsigned long vm_flags,
+		unsigned long prot, unsigned long reqprot)
+{
+	struct vm_area_struct *vma, *first;
+	struct range_lock range;
+	unsigned long newflags;
+	int error = -EAGAIN;
+
+	range_lock_init(&range, start, end - 1);
+	down_read(&mm->mmap_sem);
+	mmap_range_write_lock(mm, &range);
+
+	first = find_vma(mm, start);
+	if (!first || first->vm_start != start)
+		goto out;
+
+	/* Check them all first, so that nothing is left half done. */
+	for (vma = first; vma->vm_end < end; vma = vma->vm_next) {
+		if (!vma->vm_next || vma->vm_next->vm_start != vma->vm_end)
+			goto out;
+	}
+	if (vma->vm_end != end)
+		goto out;
+
+	for (vma = first; vma && vma->vm_start < end; vma = vma->vm_next) {
+		newflags = vm_flags;
+		newflags |= (vma->vm_flags & ~(VM_READ | VM_WRITE | VM_EXEC));
+		if (mprotect_needs_mmap_write(vma, newflags))
+			goto out;
+		if (security_file_mprotect(vma, reqprot, prot))
+			goto out;
+	}
+
+	for (vma = first; vma && vma->vm_start < end; vma = vma->vm_next) {
+		newflags = vm_flags;
+		newflags |= (vma->vm_flags & ~(VM_READ | VM_WRITE | VM_EXEC));
+		if (newflags == vma->vm_flags)
+			continue;
+		vma_change_protection(vma, vma->vm_start, vma->vm_end,
+				      newflags);
+		perf_event_mmap(vma);
+	}
+	error = 0;
+out:
+	mmap_range_write_unlock(mm, &range);
+	up_read(&mm->mmap_sem);
+	return error;
+}
+
 SYSCALL_DEFINE3(mprotect, unsigned long, start, size_t, len,
 		unsigned long, prot)
 {
@@ -374,6 +473,13 @@ SYSCALL_DEFINE3(mprotect, unsigned long, start, size_t, len,
 
 	vm_flags = calc_vm_prot_bits(prot);
 
+	if (!grows) {
+		error = mprotect_whole_vmas(current->mm, start, end, vm_flags,
+					    prot, reqprot);
+		if (error != -EAGAIN)
+			return error;
+	}
+
 	down_write(&current->mm->mmap_sem);
 
 	vma = find_vma(current->mm, start);
@@ -135,6 +135,7 @@ static void move_ptes(struct vm_area_struct *vma, pmd_t *old_pmd,
 	new_ptl = pte_lockptr(mm, new_pmd);
 	if (new_ptl != old_ptl)
 		spin_lock_nested(new_ptl, SINGLE_DEPTH_NESTING);
+	flush_tlb_batched_pending(mm);
 	arch_enter_lazy_mmu_mode();
 
 	for (; old_addr < old_end; old_pte++, old_addr += PAGE_SIZE,
@@ -193,9 +194,9 @@ unsigned long move_page_tables(struct vm_area_struct *vma,
 			break;
 		if (pmd_trans_huge(*old_pmd)) {
 			int err = 0;
-			if (extent == HPAGE_PMD_SIZE) {
-				VM_BUG_ON_VMA(vma->vm_file || !vma->anon_vma,
-					      vma);
+			/* page cache is moved as ptes */
+			if (extent == HPAGE_PMD_SIZE && !vma->vm_file) {
+				VM_BUG_ON_VMA(!vma->anon_vma, vma);
 				/* See comment in move_ptes() */
 				if (need_rmap_locks)
 					anon_vma_lock_write(vma->anon_vma);
@@ -273,6 +274,14 @@ static unsigned long move_vma(struct vm_area_struct *vma,
 	if (!new_vma)
 		return -ENOMEM;
 
+	/*
+	 * Keep speculative faults off both vmas while page table entries
+	 * move between them.  copy_vma() may have merged the source vma
+	 * into new_vma, in which case there is only one to mark.
+	 */
+	vm_write_begin(vma);
+	if (new_vma != vma)
+		vm_write_begin(new_vma);
 	moved_len = move_page_tables(vma, old_addr, new_vma, new_addr, old_len,
 				     need_rmap_locks);
 	if (moved_len < old_len) {
@@ -283,6 +292,9 @@ static unsigned long move_vma(struct vm_area_struct *vma,
 		 */
 		move_page_tables(new_vma, new_addr, vma, old_addr, moved_len,
 				 true);
+		if (new_vma != vma)
+			vm_write_end(new_vma);
+		vm_write_end(vma);
 		vma = new_vma;
 		old_len = new_len;
 		old_addr = new_addr;
@@ -293,9 +305,15 @@ static unsigned long move_vma(struct vm_area_struct *vma,
 			if (err < 0) {
 				move_page_tables(new_vma, new_addr, vma,
 						 old_addr, moved_len, true);
+				if (new_vma != vma)
+					vm_write_end(new_vma);
+				vm_write_end(vma);
 				return err;
 			}
 		}
+		if (new_vma != vma)
+			vm_write_end(new_vma);
+		vm_write_end(vma);
 		arch_remap(mm, old_addr, old_addr + old_len,
 			   new_addr, new_addr + new_len);
 	}
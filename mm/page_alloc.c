@@ -168,6 +168,8 @@ int pageblock_order __read_mostly;
 #endif
 
 static void __free_pages_ok(struct page *page, unsigned int order);
+static void free_hot_cold_page_commit(struct page *page, unsigned long pfn,
+				      unsigned int order, bool cold);
 
 /*
  * results with 256, 32 in the lowmem_reserve sysctl:
@@ -739,10 +741,30 @@ static inline int free_pages_check(struct page *page)
 	return 0;
 }
 
+/*
+ * The pcp-lists hold pages of the orders up to PAGE_ALLOC_COSTLY_ORDER,
+ * with a list per order and pcp migratetype.
+ */
+static inline unsigned int order_to_pindex(int migratetype, unsigned int order)
+{
+	return order * MIGRATE_PCPTYPES + migratetype;
+}
+
+static inline unsigned int pindex_to_order(unsigned int pindex)
+{
+	return pindex / MIGRATE_PCPTYPES;
+}
+
+static inline bool pcp_allowed_order(unsigned int order)
+{
+	return order <= PAGE_ALLOC_COSTLY_ORDER;
+}
+
 /*
  * Frees a number of pages from the PCP lists
- * Assumes all pages on list are in same zone, and of same order.
- * count is the number of pages to free.
+ * Assumes all pages on list are in same zone, and of the list's order.
+ * count is the number of pages to free, which may be exceeded by a
+ * fraction of a high order page.  pcp->count is updated as they go.
  *
  * If the zone was previously in an "all pages pinned" state then look to
  * see if this freeing clears that state.
@@ -753,9 +775,9 @@ static inline int free_pages_check(struct page *page)
 static void free_pcppages_bulk(struct zone *zone, int count,
 					struct per_cpu_pages *pcp)
 {
-	int migratetype = 0;
+	int pindex = 0;
 	int batch_free = 0;
-	int to_free = count;
+	int to_free = min(count, pcp->count);
 	unsigned long nr_scanned;
 
 	spin_lock(&zone->lock);
@@ -763,9 +785,10 @@ static void free_pcppages_bulk(struct zone *zone, int count,
 	if (nr_scanned)
 		__mod_zone_page_state(zone, NR_PAGES_SCANNED, -nr_scanned);
 
-	while (to_free) {
+	while (to_free > 0) {
 		struct page *page;
 		struct list_head *list;
+		unsigned int order;
 
 		/*
 		 * Remove pages from lists in a round-robin fashion. A
@@ -776,15 +799,16 @@ static void free_pcppages_bulk(struct zone *zone, int count,
 		 */
 		do {
 			batch_free++;
-			if (++migratetype == MIGRATE_PCPTYPES)
-				migratetype = 0;
-			list = &pcp->lists[migratetype];
+			if (++pindex == NR_PCP_LISTS)
+				pindex = 0;
+			list = &pcp->lists[pindex];
 		} while (list_empty(list));
 
 		/* This is the only non-empty list. Free them all. */
-		if (batch_free == MIGRATE_PCPTYPES)
+		if (batch_free == NR_PCP_LISTS)
 			batch_free = to_free;
 
+		order = pindex_to_order(pindex);
 		do {
 			int mt;	/* migratetype of the to-be-freed page */
 
@@ -796,9 +820,11 @@ static void free_pcppages_bulk(struct zone *zone, int count,
 				mt = get_pageblock_migratetype(page);
 
 			/* MIGRATE_MOVABLE list may include MIGRATE_RESERVEs */
-			__free_one_page(page, page_to_pfn(page), zone, 0, mt);
-			trace_mm_page_pcpu_drain(page, 0, mt);
-		} while (--to_free && --batch_free && !list_empty(list));
+			__free_one_page(page, page_to_pfn(page), zone, order, mt);
+			trace_mm_page_pcpu_drain(page, order, mt);
+			to_free -= 1 << order;
+			pcp->count -= 1 << order;
+		} while (to_free > 0 && --batch_free && !list_empty(list));
 	}
 	spin_unlock(&zone->lock);
 }
@@ -954,9 +980,13 @@ static void __free_pages_ok(struct page *page, unsigned int order)
 
 	migratetype = get_pfnblock_migratetype(page, pfn);
 	local_irq_save(flags);
-	__count_vm_events(PGFREE, 1 << order);
 	set_freepage_migratetype(page, migratetype);
-	free_one_page(page_zone(page), page, pfn, order, migratetype);
+	if (pcp_allowed_order(order)) {
+		free_hot_cold_page_commit(page, pfn, order, false);
+	} else {
+		__count_vm_events(PGFREE, 1 << order);
+		free_one_page(page_zone(page), page, pfn, order, migratetype);
+	}
 	local_irq_restore(flags);
 }
 
@@ -1720,13 +1750,40 @@ void drain_zone_pages(struct zone *zone, struct per_cpu_pages *pcp)
 	local_irq_save(flags);
 	batch = READ_ONCE(pcp->batch);
 	to_drain = min(pcp->count, batch);
+	if (to_drain > 0)
+		free_pcppages_bulk(zone, to_drain, pcp);
+	local_irq_restore(flags);
+}
+#endif
+
+/*
+ * Called from the vmstat counter updater to let the pcp-lists of this
+ * processor shrink back towards pcp->high_min once the demand that grew
+ * them is gone.  Returns true while there is more decaying to do.
+ */
+bool decay_pcp_high(struct zone *zone, struct per_cpu_pages *pcp)
+{
+	unsigned long flags;
+	int high, high_min, to_drain;
+	bool todo;
+
+	local_irq_save(flags);
+	high_min = READ_ONCE(pcp->high_min);
+	high = min(pcp->high, READ_ONCE(pcp->high_max));
+	high = max(high - (high >> 3), high_min);
+	pcp->high = high;
+	pcp->alloc_factor >>= 1;
+
+	todo = high > high_min;
+	to_drain = pcp->count - high;
 	if (to_drain > 0) {
 		free_pcppages_bulk(zone, to_drain, pcp);
-		pcp->count -= to_drain;
+		todo = true;
 	}
 	local_irq_restore(flags);
+
+	return todo;
 }
-#endif
 
 /*
  * Drain pcplists of the indicated processor and zone.
@@ -1745,10 +1802,8 @@ static void drain_pages_zone(unsigned int cpu, struct zone *zone)
 	pset = per_cpu_ptr(zone->pageset, cpu);
 
 	pcp = &pset->pcp;
-	if (pcp->count) {
+	if (pcp->count)
 		free_pcppages_bulk(zone, pcp->count, pcp);
-		pcp->count = 0;
-	}
 	local_irq_restore(flags);
 }
 
@@ -1875,25 +1930,45 @@ void mark_free_pages(struct zone *zone)
 }
 #endif /* CONFIG_PM */
 
+static bool free_hot_cold_page_prepare(struct page *page, unsigned long pfn)
+{
+	if (!free_pages_prepare(page, 0))
+		return false;
+
+	set_freepage_migratetype(page, get_pfnblock_migratetype(page, pfn));
+	return true;
+}
+
 /*
- * Free a 0-order page
- * cold == true ? free a cold page : free a hot page
+ * How many pages to give back to the buddy lists once the pcp-lists reach
+ * high: a batch, and more the longer frees keep outpacing allocations, but
+ * at least what is above high and never the last batch.
  */
-void free_hot_cold_page(struct page *page, bool cold)
+static int nr_pcp_free(struct per_cpu_pages *pcp, int high, int batch)
+{
+	int max_nr_free = max(high - batch, batch);
+	int nr = min(batch << pcp->free_factor, max_nr_free);
+
+	if (nr < max_nr_free)
+		pcp->free_factor++;
+	return max(nr, pcp->count - high);
+}
+
+/*
+ * Put a page prepared by free_hot_cold_page_prepare(), or by
+ * free_pages_prepare() for a small order, on the per-cpu list.
+ * Called with interrupts disabled.
+ */
+static void free_hot_cold_page_commit(struct page *page, unsigned long pfn,
+				      unsigned int order, bool cold)
 {
 	struct zone *zone = page_zone(page);
 	struct per_cpu_pages *pcp;
-	unsigned long flags;
-	unsigned long pfn = page_to_pfn(page);
-	int migratetype;
-
-	if (!free_pages_prepare(page, 0))
-		return;
+	struct list_head *list;
+	int migratetype, high;
 
-	migratetype = get_pfnblock_migratetype(page, pfn);
-	set_freepage_migratetype(page, migratetype);
-	local_irq_save(flags);
-	__count_vm_event(PGFREE);
+	migratetype = get_freepage_migratetype(page);
+	__count_vm_events(PGFREE, 1 << order);
 
 	/*
 	 * We only track unmovable, reclaimable and movable on pcp lists.
@@ -1904,40 +1979,80 @@ void free_hot_cold_page(struct page *page, bool cold)
 	 */
 	if (migratetype >= MIGRATE_PCPTYPES) {
 		if (unlikely(is_migrate_isolate(migratetype))) {
-			free_one_page(zone, page, pfn, 0, migratetype);
-			goto out;
+			free_one_page(zone, page, pfn, order, migratetype);
+			return;
 		}
 		migratetype = MIGRATE_MOVABLE;
 	}
 
 	pcp = &this_cpu_ptr(zone->pageset)->pcp;
+	list = &pcp->lists[order_to_pindex(migratetype, order)];
 	if (!cold)
-		list_add(&page->lru, &pcp->lists[migratetype]);
+		list_add(&page->lru, list);
 	else
-		list_add_tail(&page->lru, &pcp->lists[migratetype]);
-	pcp->count++;
-	if (pcp->count >= pcp->high) {
-		unsigned long batch = READ_ONCE(pcp->batch);
-		free_pcppages_bulk(zone, batch, pcp);
-		pcp->count -= batch;
+		list_add_tail(&page->lru, list);
+	pcp->count += 1 << order;
+	high = READ_ONCE(pcp->high);
+	if (pcp->count >= high) {
+		int batch = READ_ONCE(pcp->batch);
+
+		pcp->free_drain++;
+		/* Freeing is outpacing allocation, don't refill as eagerly */
+		pcp->alloc_factor >>= 1;
+		free_pcppages_bulk(zone, nr_pcp_free(pcp, high, batch), pcp);
 	}
+}
 
-out:
+/*
+ * Free a 0-order page
+ * cold == true ? free a cold page : free a hot page
+ */
+void free_hot_cold_page(struct page *page, bool cold)
+{
+	unsigned long flags;
+	unsigned long pfn = page_to_pfn(page);
+
+	if (!free_hot_cold_page_prepare(page, pfn))
+		return;
+
+	local_irq_save(flags);
+	free_hot_cold_page_commit(page, pfn, 0, cold);
 	local_irq_restore(flags);
 }
 
 /*
  * Free a list of 0-order pages
+ *
+ * The pages are prepared for freeing first, and then put on the per-cpu
+ * lists with interrupts disabled once per SWAP_CLUSTER_MAX pages rather
+ * than once per page.
  */
 void free_hot_cold_page_list(struct list_head *list, bool cold)
 {
 	struct page *page, *next;
+	unsigned long flags;
+	int batch = 0;
 
+	list_for_each_entry_safe(page, next, list, lru) {
+		if (!free_hot_cold_page_prepare(page, page_to_pfn(page)))
+			list_del(&page->lru);
+	}
+
+	local_irq_save(flags);
 	list_for_each_entry_safe(page, next, list, lru) {
 		trace_mm_page_free_batched(page, cold);
-		free_hot_cold_page(page, cold);
+		free_hot_cold_page_commit(page, page_to_pfn(page), 0, cold);
+
+		/* Don't keep interrupts disabled for the whole list. */
+		if (++batch == SWAP_CLUSTER_MAX) {
+			local_irq_restore(flags);
+			batch = 0;
+			local_irq_save(flags);
+		}
 	}
+	local_irq_restore(flags);
 }
+EXPORT_SYMBOL(free_hot_cold_page_list);
 
 /*
  * split_page takes a non-compound higher-order page, and splits it into
@@ -2039,7 +2154,39 @@ int split_free_page(struct page *page)
 }
 
 /*
- * Allocate a page from the given zone. Use pcplists for order-0 allocations.
+ * Refill a pcp-list of the given order that ran dry, with at least @min_nr
+ * pages if that many can be had.  Each refill lets the lists of an adaptive
+ * pcp hold a batch more, and refill a larger batch the next time, until
+ * frees start going over high or the vmstat interval decays it again.
+ * Called with interrupts disabled.
+ */
+static void pcp_refill(struct zone *zone, struct per_cpu_pages *pcp,
+		       struct list_head *list, unsigned int order,
+		       int migratetype, bool cold, int min_nr)
+{
+	int batch = READ_ONCE(pcp->batch);
+	int high_max = READ_ONCE(pcp->high_max);
+	int nr = batch;
+
+	pcp->alloc_miss++;
+	if (high_max > READ_ONCE(pcp->high_min)) {
+		int high = min(pcp->high + batch, high_max);
+		int max_nr = max(high - pcp->count - batch, batch);
+
+		pcp->high = high;
+		nr = min(batch << pcp->alloc_factor, max_nr);
+		if (nr < max_nr)
+			pcp->alloc_factor++;
+	}
+	nr = max(nr, min_nr);
+
+	pcp->count += rmqueue_bulk(zone, order, max(nr >> order, 1), list,
+				   migratetype, cold) << order;
+}
+
+/*
+ * Allocate a page from the given zone. Use pcplists for orders up to
+ * PAGE_ALLOC_COSTLY_ORDER.
  */
 static inline
 struct page *buffered_rmqueue(struct zone *preferred_zone,
@@ -2050,19 +2197,33 @@ struct page *buffered_rmqueue(struct zone *preferred_zone,
 	struct page *page;
 	bool cold = ((gfp_flags & __GFP_COLD) != 0);
 
-	if (likely(order == 0)) {
+	if (unlikely(gfp_flags & __GFP_NOFAIL)) {
+		/*
+		 * __GFP_NOFAIL is not to be used in new code.
+		 *
+		 * All __GFP_NOFAIL callers should be fixed so that they
+		 * properly detect and handle allocation failures.
+		 *
+		 * We most definitely don't want callers attempting to
+		 * allocate greater than order-1 page units with
+		 * __GFP_NOFAIL.
+		 */
+		WARN_ON_ONCE(order > 1);
+	}
+
+	if (likely(pcp_allowed_order(order))) {
 		struct per_cpu_pages *pcp;
 		struct list_head *list;
 
 		local_irq_save(flags);
 		pcp = &this_cpu_ptr(zone->pageset)->pcp;
-		list = &pcp->lists[migratetype];
+		list = &pcp->lists[order_to_pindex(migratetype, order)];
 		if (list_empty(list)) {
-			pcp->count += rmqueue_bulk(zone, 0,
-					pcp->batch, list,
-					migratetype, cold);
+			pcp_refill(zone, pcp, list, order, migratetype, cold, 0);
 			if (unlikely(list_empty(list)))
 				goto failed;
+		} else {
+			pcp->alloc_hit++;
 		}
 
 		if (cold)
@@ -2071,21 +2232,9 @@ struct page *buffered_rmqueue(struct zone *preferred_zone,
 			page = list_entry(list->next, struct page, lru);
 
 		list_del(&page->lru);
-		pcp->count--;
+		pcp->count -= 1 << order;
+		pcp->free_factor >>= 1;
 	} else {
-		if (unlikely(gfp_flags & __GFP_NOFAIL)) {
-			/*
-			 * __GFP_NOFAIL is not to be used in new code.
-			 *
-			 * All __GFP_NOFAIL callers should be fixed so that they
-			 * properly detect and handle allocation failures.
-			 *
-			 * We most definitely don't want callers attempting to
-			 * allocate greater than order-1 page units with
-			 * __GFP_NOFAIL.
-			 */
-			WARN_ON_ONCE(order > 1);
-		}
 		spin_lock_irqsave(&zone->lock, flags);
 		page = __rmqueue(zone, order, migratetype);
 		spin_unlock(&zone->lock);
@@ -3225,6 +3374,177 @@ out:
 }
 EXPORT_SYMBOL(__alloc_pages_nodemask);
 
+/*
+ * __alloc_pages_bulk - allocate a number of order-0 pages at once
+ * @gfp_mask: GFP flags for the allocation
+ * @zonelist: zonelist to allocate from
+ * @nodemask: nodes allowed, or NULL
+ * @nr_pages: the number of pages wanted on @page_list or in @page_array
+ * @page_list: list to add the pages to, or NULL
+ * @page_array: array to store the pages in, used if @page_list is NULL
+ *
+ * The pages are taken from the per-cpu lists of the first local zone that
+ * stays above its low watermark with all of them allocated, and those
+ * lists are topped up from the zone's free lists with one hold of
+ * zone->lock when they run short, so the per-page cost of the normal
+ * path is paid once per call.  If no zone qualifies, one page is
+ * allocated the normal way, with whatever reclaim @gfp_mask allows.
+ *
+ * Only the NULL entries of @page_array are filled in, so an array that
+ * was partially populated by an earlier call can be passed again.
+ *
+ * Returns the number of pages added to @page_list, or the number of
+ * populated entries of @page_array, which may be less than @nr_pages.
+ */
+unsigned long __alloc_pages_bulk(gfp_t gfp_mask, struct zonelist *zonelist,
+				 nodemask_t *nodemask, unsigned long nr_pages,
+				 struct list_head *page_list,
+				 struct page **page_array)
+{
+	enum zone_type high_zoneidx = gfp_zone(gfp_mask);
+	int migratetype = gfpflags_to_migratetype(gfp_mask);
+	int alloc_flags = ALLOC_WMARK_LOW | ALLOC_CPUSET;
+	bool cold = ((gfp_mask & __GFP_COLD) != 0);
+	unsigned long nr_populated = 0, nr_taken = 0, idx = 0;
+	struct zone *preferred_zone, *zone;
+	struct zoneref *preferred_zoneref, *z;
+	struct per_cpu_pages *pcp;
+	struct list_head *list;
+	struct page *page, *next;
+	unsigned long flags;
+	LIST_HEAD(pages);
+
+	if (page_array) {
+		unsigned long i;
+
+		for (i = 0; i < nr_pages; i++)
+			if (page_array[i])
+				nr_populated++;
+	}
+	if (nr_populated >= nr_pages)
+		return nr_populated;
+
+	gfp_mask &= gfp_allowed_mask;
+
+	/* Leave fault injection and empty zonelists to the single page path */
+	if (should_fail_alloc_page(gfp_mask, 0))
+		goto failed;
+
+	if (IS_ENABLED(CONFIG_CMA) && migratetype == MIGRATE_MOVABLE)
+		alloc_flags |= ALLOC_CMA;
+
+	preferred_zoneref = first_zones_zonelist(zonelist, high_zoneidx,
+				nodemask ? : &cpuset_current_mems_allowed,
+				&preferred_zone);
+	if (!preferred_zone)
+		goto failed;
+
+	/*
+	 * Like the ALLOC_FAIR pass of get_page_from_freelist(), stick to the
+	 * local zones that have not used up their fair share of allocations.
+	 * Anything else, including zones over their dirty limit, is for the
+	 * single page path to deal with.
+	 */
+	for_each_zone_zonelist_nodemask(zone, z, zonelist, high_zoneidx,
+								nodemask) {
+		unsigned long mark;
+
+		if (!zone_local(preferred_zone, zone)) {
+			zone = NULL;
+			break;
+		}
+		if (cpusets_enabled() && !cpuset_zone_allowed(zone, gfp_mask))
+			continue;
+		if (test_bit(ZONE_FAIR_DEPLETED, &zone->flags))
+			continue;
+		if ((gfp_mask & __GFP_WRITE) && !zone_dirty_ok(zone))
+			continue;
+
+		mark = low_wmark_pages(zone) + nr_pages - nr_populated;
+		if (zone_watermark_ok(zone, 0, mark,
+				      zonelist_zone_idx(preferred_zoneref),
+				      alloc_flags))
+			break;
+	}
+	if (!zone)
+		goto failed;
+
+	local_irq_save(flags);
+	pcp = &this_cpu_ptr(zone->pageset)->pcp;
+	list = &pcp->lists[order_to_pindex(migratetype, 0)];
+	while (nr_populated + nr_taken < nr_pages) {
+		if (list_empty(list)) {
+			unsigned long want = nr_pages - nr_populated - nr_taken;
+
+			pcp_refill(zone, pcp, list, 0, migratetype, cold,
+				   min_t(unsigned long, want, INT_MAX));
+			if (unlikely(list_empty(list)))
+				break;
+		} else {
+			pcp->alloc_hit++;
+		}
+
+		if (cold)
+			page = list_entry(list->prev, struct page, lru);
+		else
+			page = list_entry(list->next, struct page, lru);
+
+		list_move_tail(&page->lru, &pages);
+		pcp->count--;
+		pcp->free_factor >>= 1;
+		nr_taken++;
+		zone_statistics(preferred_zone, zone, gfp_mask);
+	}
+
+	__mod_zone_page_state(zone, NR_ALLOC_BATCH, -nr_taken);
+	if (atomic_long_read(&zone->vm_stat[NR_ALLOC_BATCH]) <= 0 &&
+	    !test_bit(ZONE_FAIR_DEPLETED, &zone->flags))
+		set_bit(ZONE_FAIR_DEPLETED, &zone->flags);
+
+	__count_zone_vm_events(PGALLOC, zone, nr_taken);
+	local_irq_restore(flags);
+
+	list_for_each_entry_safe(page, next, &pages, lru) {
+		VM_BUG_ON_PAGE(bad_range(zone, page), page);
+
+		list_del(&page->lru);
+		/* A bad page is left alone, like get_page_from_freelist() does */
+		if (prep_new_page(page, 0, gfp_mask, 0))
+			continue;
+		if (kmemcheck_enabled)
+			kmemcheck_pagealloc_alloc(page, 0, gfp_mask);
+		trace_mm_page_alloc(page, 0, gfp_mask, migratetype);
+
+		if (page_list) {
+			list_add_tail(&page->lru, page_list);
+		} else {
+			while (page_array[idx])
+				idx++;
+			page_array[idx] = page;
+		}
+		nr_populated++;
+	}
+
+	if (nr_taken)
+		return nr_populated;
+
+failed:
+	page = __alloc_pages_nodemask(gfp_mask, 0, zonelist, nodemask);
+	if (page) {
+		if (page_list) {
+			list_add_tail(&page->lru, page_list);
+		} else {
+			while (page_array[idx])
+				idx++;
+			page_array[idx] = page;
+		}
+		nr_populated++;
+	}
+
+	return nr_populated;
+}
+EXPORT_SYMBOL(__alloc_pages_bulk);
+
 /*
  * Common helper functions.
  */
@@ -4692,7 +5012,8 @@ static int zone_batchsize(struct zone *zone)
 
 /*
  * pcp->high and pcp->batch values are related and dependent on one another:
- * ->batch must never be higher then ->high.
+ * ->batch must never be higher then ->high.  ->high itself moves between
+ * ->high_min and ->high_max as the CPU owning the lists adapts it.
  * The following function updates them in a safe manner without read side
  * locking.
  *
@@ -4703,15 +5024,17 @@ static int zone_batchsize(struct zone *zone)
  * outside of boot time (or some other assurance that no concurrent updaters
  * exist).
  */
-static void pageset_update(struct per_cpu_pages *pcp, unsigned long high,
-		unsigned long batch)
+static void pageset_update(struct per_cpu_pages *pcp, unsigned long high_min,
+		unsigned long high_max, unsigned long batch)
 {
        /* start with a fail safe value for batch */
 	pcp->batch = 1;
 	smp_wmb();
 
        /* Update high, then batch, in order */
-	pcp->high = high;
+	pcp->high_min = high_min;
+	pcp->high_max = high_max;
+	pcp->high = high_min;
 	smp_wmb();
 
 	pcp->batch = batch;
@@ -4720,20 +5043,44 @@ static void pageset_update(struct per_cpu_pages *pcp, unsigned long high,
 /* a companion to pageset_set_high() */
 static void pageset_set_batch(struct per_cpu_pageset *p, unsigned long batch)
 {
-	pageset_update(&p->pcp, 6 * batch, max(1UL, 1 * batch));
+	pageset_update(&p->pcp, 6 * batch, 6 * batch, max(1UL, 1 * batch));
+}
+
+/*
+ * How far the lists of the given CPU may grow when it keeps allocating from
+ * the zone: its share of the zone's low watermark, as long as the zone is on
+ * its own node.  Lists of remote CPUs stay at the fixed size, so that pages
+ * do not pile up where they are expensive to use.
+ */
+static unsigned long zone_highsize(struct zone *zone, unsigned long batch,
+				   int cpu)
+{
+	unsigned long high = 6 * batch;
+	unsigned long share;
+	int nr_cpus;
+
+	if (!batch || cpu_to_node(cpu) != zone_to_nid(zone))
+		return high;
+
+	nr_cpus = cpumask_weight(cpumask_of_node(zone_to_nid(zone)));
+	if (!nr_cpus)
+		nr_cpus = num_online_cpus();
+	share = low_wmark_pages(zone) / nr_cpus;
+
+	return max(high, share);
 }
 
 static void pageset_init(struct per_cpu_pageset *p)
 {
 	struct per_cpu_pages *pcp;
-	int migratetype;
+	int pindex;
 
 	memset(p, 0, sizeof(*p));
 
 	pcp = &p->pcp;
 	pcp->count = 0;
-	for (migratetype = 0; migratetype < MIGRATE_PCPTYPES; migratetype++)
-		INIT_LIST_HEAD(&pcp->lists[migratetype]);
+	for (pindex = 0; pindex < NR_PCP_LISTS; pindex++)
+		INIT_LIST_HEAD(&pcp->lists[pindex]);
 }
 
 static void setup_pageset(struct per_cpu_pageset *p, unsigned long batch)
@@ -4744,7 +5091,7 @@ static void setup_pageset(struct per_cpu_pageset *p, unsigned long batch)
 
 /*
  * pageset_set_high() sets the high water mark for hot per_cpu_pagelist
- * to the value high for the pageset p.
+ * to the value high for the pageset p, which then no longer adapts.
  */
 static void pageset_set_high(struct per_cpu_pageset *p,
 				unsigned long high)
@@ -4753,18 +5100,24 @@ static void pageset_set_high(struct per_cpu_pageset *p,
 	if ((high / 4) > (PAGE_SHIFT * 8))
 		batch = PAGE_SHIFT * 8;
 
-	pageset_update(&p->pcp, high, batch);
+	pageset_update(&p->pcp, high, high, batch);
 }
 
 static void pageset_set_high_and_batch(struct zone *zone,
-				       struct per_cpu_pageset *pcp)
+				       struct per_cpu_pageset *pcp, int cpu)
 {
-	if (percpu_pagelist_fraction)
+	unsigned long batch;
+
+	if (percpu_pagelist_fraction) {
 		pageset_set_high(pcp,
 			(zone->managed_pages /
 				percpu_pagelist_fraction));
-	else
-		pageset_set_batch(pcp, zone_batchsize(zone));
+	} else {
+		batch = zone_batchsize(zone);
+		pageset_update(&pcp->pcp, 6 * batch,
+			       zone_highsize(zone, batch, cpu),
+			       max(1UL, batch));
+	}
 }
 
 static void __meminit zone_pageset_init(struct zone *zone, int cpu)
@@ -4772,7 +5125,27 @@ static void __meminit zone_pageset_init(struct zone *zone, int cpu)
 	struct per_cpu_pageset *pcp = per_cpu_ptr(zone->pageset, cpu);
 
 	pageset_init(pcp);
-	pageset_set_high_and_batch(zone, pcp);
+	pageset_set_high_and_batch(zone, pcp, cpu);
+}
+
+/*
+ * The watermarks the local high_max values derive from are only known
+ * after the pagesets are set up, and change with min_free_kbytes.
+ */
+static void __zone_pcp_update(void)
+{
+	struct zone *zone;
+	unsigned int cpu;
+
+	mutex_lock(&pcp_batch_high_lock);
+	for_each_populated_zone(zone) {
+		if (zone->pageset == &boot_pageset)
+			continue;
+		for_each_possible_cpu(cpu)
+			pageset_set_high_and_batch(zone,
+					per_cpu_ptr(zone->pageset, cpu), cpu);
+	}
+	mutex_unlock(&pcp_batch_high_lock);
 }
 
 static void __meminit setup_zone_pageset(struct zone *zone)
@@ -5347,7 +5720,6 @@ static void __paginginit free_area_init_core(struct pglist_data *pgdat,
 #endif
 		zone->name = zone_names[j];
 		spin_lock_init(&zone->lock);
-		spin_lock_init(&zone->lru_lock);
 		zone_seqlock_init(zone);
 		zone->zone_pgdat = pgdat;
 		zone_pcp_init(zone);
@@ -6178,6 +6550,7 @@ void setup_per_zone_wmarks(void)
 	mutex_lock(&zonelists_mutex);
 	__setup_per_zone_wmarks();
 	mutex_unlock(&zonelists_mutex);
+	__zone_pcp_update();
 }
 
 /*
@@ -6381,7 +6754,7 @@ int percpu_pagelist_fraction_sysctl_handler(struct ctl_table *table, int write,
 
 		for_each_possible_cpu(cpu)
 			pageset_set_high_and_batch(zone,
-					per_cpu_ptr(zone->pageset, cpu));
+					per_cpu_ptr(zone->pageset, cpu), cpu);
 	}
 out:
 	mutex_unlock(&pcp_batch_high_lock);
@@ -6907,7 +7280,7 @@ void __meminit zone_pcp_update(struct zone *zone)
 	mutex_lock(&pcp_batch_high_lock);
 	for_each_possible_cpu(cpu)
 		pageset_set_high_and_batch(zone,
-				per_cpu_ptr(zone->pageset, cpu));
+				per_cpu_ptr(zone->pageset, cpu), cpu);
 	mutex_unlock(&pcp_batch_high_lock);
 }
 #endif
@@ -203,6 +203,39 @@ out:
 	return ret;
 }
 
+#ifdef CONFIG_TRANSPARENT_HUGE_PAGECACHE
+/*
+ * Read the HPAGE_PMD_NR pages at the huge page aligned @offset, none of
+ * which may be cached yet, into one naturally aligned block of physically
+ * contiguous pages, for filemap_pmd_fault() to map with a single pmd.
+ * Once in the page cache the pages are managed one by one as usual.
+ *
+ * Returns -ENOMEM if no such block could be had without trying hard.
+ */
+int page_cache_read_huge(struct address_space *mapping, struct file *filp,
+			 pgoff_t offset)
+{
+	struct page *page;
+	LIST_HEAD(page_pool);
+	int i;
+
+	page = alloc_pages(mapping_gfp_mask(mapping) | __GFP_COLD |
+			   __GFP_NORETRY | __GFP_NOWARN, HPAGE_PMD_ORDER);
+	if (!page)
+		return -ENOMEM;
+	count_vm_event(THP_FILE_ALLOC);
+
+	split_page(page, HPAGE_PMD_ORDER);
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		page[i].index = offset + i;
+		list_add(&page[i].lru, &page_pool);
+	}
+	read_pages(mapping, filp, &page_pool, HPAGE_PMD_NR);
+	BUG_ON(!list_empty(&page_pool));
+	return 0;
+}
+#endif
+
 /*
  * Chunk the readahead into 2 megabyte units, so that we don't pin too much
  * memory at once.
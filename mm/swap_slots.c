@@ -0,0 +1,291 @@
+/*
+ * Per cpu caches of swap slots
+ *
+ * Each cpu keeps a batch of SWAP_SLOTS_CACHE_SIZE slots allocated from the
+ * swap areas with get_swap_pages(), so that get_swap_page() can hand them
+ * out without taking swap_avail_lock and the lock of a swap area for every
+ * page swapped out.  Slots whose last reference is dropped are collected
+ * per cpu by free_swap_slot() in the same way, and returned to their swap
+ * areas a batch at a time with swapcache_free_entries().  While in either
+ * cache, a slot is marked SWAP_HAS_CACHE in swap_map, without a page in
+ * swap cache.
+ *
+ * Slots held in the caches cannot be allocated by other cpus, so the
+ * caches are drained and bypassed once free swap space goes below
+ * THRESHOLD_DEACTIVATE_SWAP_SLOTS_CACHE slots per online cpu, and used
+ * again when it is back above THRESHOLD_ACTIVATE_SWAP_SLOTS_CACHE.  They
+ * are also drained and bypassed while swapoff looks for slots in use.
+ */
+
+#include <linux/swap_slots.h>
+#include <linux/cpu.h>
+#include <linux/cpumask.h>
+#include <linux/init.h>
+#include <linux/percpu.h>
+#include <linux/slab.h>
+
+static DEFINE_PER_CPU(struct swap_slots_cache, swp_slots);
+static bool swap_slot_cache_active;
+bool swap_slot_cache_enabled;
+static bool swap_slot_cache_initialized;
+static DEFINE_MUTEX(swap_slots_cache_mutex);
+/* Serialize swap slots cache enable/disable operations */
+static DEFINE_MUTEX(swap_slots_cache_enable_mutex);
+
+#define use_swap_slot_cache (swap_slot_cache_active && \
+		swap_slot_cache_enabled && swap_slot_cache_initialized)
+#define SLOTS_CACHE 0x1
+#define SLOTS_CACHE_RET 0x2
+
+static void drain_slots_cache_cpu(unsigned int cpu, unsigned int type)
+{
+	struct swap_slots_cache *cache = &per_cpu(swp_slots, cpu);
+
+	if ((type & SLOTS_CACHE) && cache->slots) {
+		mutex_lock(&cache->alloc_lock);
+		swapcache_free_entries(cache->slots + cache->cur, cache->nr);
+		cache->cur = 0;
+		cache->nr = 0;
+		mutex_unlock(&cache->alloc_lock);
+	}
+	if ((type & SLOTS_CACHE_RET) && cache->slots_ret) {
+		spin_lock(&cache->free_lock);
+		swapcache_free_entries(cache->slots_ret, cache->n_ret);
+		cache->n_ret = 0;
+		spin_unlock(&cache->free_lock);
+	}
+}
+
+static void __drain_swap_slots_cache(unsigned int type)
+{
+	unsigned int cpu;
+
+	/*
+	 * Offline cpus were drained when they went down, but may still be
+	 * going down, so all the possible ones are drained here.
+	 */
+	for_each_possible_cpu(cpu)
+		drain_slots_cache_cpu(cpu, type);
+}
+
+static void deactivate_swap_slots_cache(void)
+{
+	mutex_lock(&swap_slots_cache_mutex);
+	swap_slot_cache_active = false;
+	__drain_swap_slots_cache(SLOTS_CACHE | SLOTS_CACHE_RET);
+	mutex_unlock(&swap_slots_cache_mutex);
+}
+
+static void reactivate_swap_slots_cache(void)
+{
+	mutex_lock(&swap_slots_cache_mutex);
+	swap_slot_cache_active = true;
+	mutex_unlock(&swap_slots_cache_mutex);
+}
+
+/*
+ * Empty the caches and stop using them until
+ * reenable_swap_slots_cache_unlock().
+ */
+void disable_swap_slots_cache_lock(void)
+{
+	mutex_lock(&swap_slots_cache_enable_mutex);
+	swap_slot_cache_enabled = false;
+	if (swap_slot_cache_initialized)
+		__drain_swap_slots_cache(SLOTS_CACHE | SLOTS_CACHE_RET);
+}
+
+static void __reenable_swap_slots_cache(void)
+{
+	swap_slot_cache_enabled = has_usable_swap();
+}
+
+void reenable_swap_slots_cache_unlock(void)
+{
+	__reenable_swap_slots_cache();
+	mutex_unlock(&swap_slots_cache_enable_mutex);
+}
+
+static bool check_cache_active(void)
+{
+	long pages;
+
+	if (!swap_slot_cache_enabled || !swap_slot_cache_initialized)
+		return false;
+
+	pages = get_nr_swap_pages();
+	if (!swap_slot_cache_active) {
+		if (pages > num_online_cpus() *
+		    THRESHOLD_ACTIVATE_SWAP_SLOTS_CACHE)
+			reactivate_swap_slots_cache();
+		goto out;
+	}
+
+	/* if global pool of slot caches too low, deactivate cache */
+	if (pages < num_online_cpus() * THRESHOLD_DEACTIVATE_SWAP_SLOTS_CACHE)
+		deactivate_swap_slots_cache();
+out:
+	return swap_slot_cache_active;
+}
+
+static int alloc_swap_slot_cache(unsigned int cpu)
+{
+	struct swap_slots_cache *cache = &per_cpu(swp_slots, cpu);
+	swp_entry_t *slots, *slots_ret;
+
+	if (cache->slots)
+		return 0;
+
+	slots = kcalloc(SWAP_SLOTS_CACHE_SIZE, sizeof(swp_entry_t),
+			GFP_KERNEL);
+	slots_ret = kcalloc(SWAP_SLOTS_CACHE_SIZE, sizeof(swp_entry_t),
+			    GFP_KERNEL);
+	if (!slots || !slots_ret) {
+		kfree(slots);
+		kfree(slots_ret);
+		return -ENOMEM;
+	}
+
+	mutex_lock(&cache->alloc_lock);
+	cache->nr = 0;
+	cache->cur = 0;
+	cache->slots = slots;
+	mutex_unlock(&cache->alloc_lock);
+
+	spin_lock(&cache->free_lock);
+	cache->n_ret = 0;
+	cache->slots_ret = slots_ret;
+	spin_unlock(&cache->free_lock);
+	return 0;
+}
+
+/*
+ * Called after each successful swapon: set up the caches the first time,
+ * they are kept from then on.
+ */
+int enable_swap_slots_cache(void)
+{
+	unsigned int cpu;
+	int ret = 0;
+
+	mutex_lock(&swap_slots_cache_enable_mutex);
+	if (!swap_slot_cache_initialized) {
+		for_each_possible_cpu(cpu) {
+			ret = alloc_swap_slot_cache(cpu);
+			if (ret)
+				break;
+		}
+		if (!ret)
+			swap_slot_cache_initialized = true;
+	}
+	__reenable_swap_slots_cache();
+	mutex_unlock(&swap_slots_cache_enable_mutex);
+	return ret;
+}
+
+/* called with swap slot cache's alloc lock held */
+static int refill_swap_slots_cache(struct swap_slots_cache *cache)
+{
+	if (!use_swap_slot_cache || cache->nr)
+		return 0;
+
+	cache->cur = 0;
+	cache->nr = get_swap_pages(SWAP_SLOTS_CACHE_SIZE, cache->slots);
+
+	return cache->nr;
+}
+
+/*
+ * Release a slot whose last reference was dropped, and which is left
+ * marked SWAP_HAS_CACHE for it.  Called without the swap area locked.
+ */
+void free_swap_slot(swp_entry_t entry)
+{
+	struct swap_slots_cache *cache;
+
+	cache = raw_cpu_ptr(&swp_slots);
+	if (use_swap_slot_cache && cache->slots_ret) {
+		spin_lock(&cache->free_lock);
+		/* Swap slots cache may be deactivated before acquiring lock */
+		if (!use_swap_slot_cache) {
+			spin_unlock(&cache->free_lock);
+			goto direct_free;
+		}
+		if (cache->n_ret >= SWAP_SLOTS_CACHE_SIZE) {
+			/* Return the batch to the swap areas */
+			swapcache_free_entries(cache->slots_ret, cache->n_ret);
+			cache->n_ret = 0;
+		}
+		cache->slots_ret[cache->n_ret++] = entry;
+		spin_unlock(&cache->free_lock);
+	} else {
+direct_free:
+		swapcache_free_entries(&entry, 1);
+	}
+}
+
+swp_entry_t get_swap_page(void)
+{
+	swp_entry_t entry, *pentry;
+	struct swap_slots_cache *cache;
+
+	/*
+	 * Preemption is allowed here, because we may sleep in
+	 * refill_swap_slots_cache().  But it is safe, because accesses to
+	 * the per-CPU data structure are protected by the mutex
+	 * cache->alloc_lock.
+	 *
+	 * The alloc path here does not touch cache->slots_ret so
+	 * cache->free_lock is not taken.
+	 */
+	cache = raw_cpu_ptr(&swp_slots);
+
+	entry.val = 0;
+	if (check_cache_active()) {
+		mutex_lock(&cache->alloc_lock);
+		if (cache->slots) {
+repeat:
+			if (cache->nr) {
+				pentry = &cache->slots[cache->cur++];
+				entry = *pentry;
+				pentry->val = 0;
+				cache->nr--;
+			} else {
+				if (refill_swap_slots_cache(cache))
+					goto repeat;
+			}
+		}
+		mutex_unlock(&cache->alloc_lock);
+		if (entry.val)
+			return entry;
+	}
+
+	get_swap_pages(1, &entry);
+
+	return entry;
+}
+
+static int swap_slots_cpu_notify(struct notifier_block *self,
+				 unsigned long action, void *hcpu)
+{
+	int cpu = (unsigned long)hcpu;
+
+	if (action == CPU_DEAD || action == CPU_DEAD_FROZEN)
+		drain_slots_cache_cpu(cpu, SLOTS_CACHE | SLOTS_CACHE_RET);
+	return NOTIFY_OK;
+}
+
+static int __init swap_slots_init(void)
+{
+	unsigned int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct swap_slots_cache *cache = &per_cpu(swp_slots, cpu);
+
+		mutex_init(&cache->alloc_lock);
+		spin_lock_init(&cache->free_lock);
+	}
+	hotcpu_notifier(swap_slots_cpu_notify, 0);
+	return 0;
+}
+subsys_initcall(swap_slots_init);
@@ -11,6 +11,7 @@
 #include <linux/kernel_stat.h>
 #include <linux/swap.h>
 #include <linux/swapops.h>
+#include <linux/swap_slots.h>
 #include <linux/init.h>
 #include <linux/pagemap.h>
 #include <linux/backing-dev.h>
@@ -311,6 +312,17 @@ struct page *read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
 		if (found_page)
 			break;
 
+		/*
+		 * Just skip read ahead for unused swap slots: while in a swap
+		 * slots cache, a slot is marked SWAP_HAS_CACHE without a page
+		 * in swap cache, and swapcache_prepare() would keep failing
+		 * with -EEXIST for it.  The cache is disabled during swapoff,
+		 * where an unused slot marked SWAP_HAS_CACHE is only the race
+		 * with its page being added to swap cache, handled below.
+		 */
+		if (!__swp_swapcount(entry) && swap_slot_cache_enabled)
+			break;
+
 		/*
 		 * Get a new page to read into from swap.
 		 */
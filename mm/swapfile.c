@@ -33,7 +33,9 @@
 #include <linux/oom.h>
 #include <linux/frontswap.h>
 #include <linux/swapfile.h>
+#include <linux/swap_slots.h>
 #include <linux/export.h>
+#include <linux/sort.h>
 
 #include <asm/pgtable.h>
 #include <asm/tlbflush.h>
@@ -636,14 +638,47 @@ no_page:
 	return 0;
 }
 
-swp_entry_t get_swap_page(void)
+/*
+ * Allocate up to nr slots from si, taking si->lock once for the batch
+ * rather than once per slot.  Called with si->lock held.
+ */
+static int scan_swap_map_slots(struct swap_info_struct *si,
+			       unsigned char usage, int nr,
+			       swp_entry_t slots[])
+{
+	unsigned long offset;
+	int n_ret = 0;
+
+	while (n_ret < nr) {
+		offset = scan_swap_map(si, usage);
+		if (!offset)
+			break;
+		slots[n_ret++] = swp_entry(si->type, offset);
+	}
+	return n_ret;
+}
+
+/*
+ * Allocate up to n_goal swap slots for swap cache, at most SWAP_BATCH, from
+ * the highest priority swap areas that have free space, and return how
+ * many were allocated.
+ */
+int get_swap_pages(int n_goal, swp_entry_t swp_entries[])
 {
 	struct swap_info_struct *si, *next;
-	pgoff_t offset;
+	long avail_pgs;
+	int n_ret = 0;
 
-	if (atomic_long_read(&nr_swap_pages) <= 0)
+	avail_pgs = atomic_long_read(&nr_swap_pages);
+	if (avail_pgs <= 0)
 		goto noswap;
-	atomic_long_dec(&nr_swap_pages);
+
+	if (n_goal > SWAP_BATCH)
+		n_goal = SWAP_BATCH;
+	if (n_goal > avail_pgs)
+		n_goal = avail_pgs;
+
+	atomic_long_sub(n_goal, &nr_swap_pages);
 
 	spin_lock(&swap_avail_lock);
 
@@ -671,10 +706,11 @@ start_over:
 		}
 
 		/* This is called for allocating swap entry for cache */
-		offset = scan_swap_map(si, SWAP_HAS_CACHE);
+		n_ret = scan_swap_map_slots(si, SWAP_HAS_CACHE, n_goal,
+					    swp_entries);
 		spin_unlock(&si->lock);
-		if (offset)
-			return swp_entry(si->type, offset);
+		if (n_ret)
+			goto check_out;
 		pr_debug("scan_swap_map of si %d failed to find offset\n",
 		       si->type);
 		spin_lock(&swap_avail_lock);
@@ -695,9 +731,11 @@ nextsi:
 
 	spin_unlock(&swap_avail_lock);
 
-	atomic_long_inc(&nr_swap_pages);
+check_out:
+	if (n_ret < n_goal)
+		atomic_long_add(n_goal - n_ret, &nr_swap_pages);
 noswap:
-	return (swp_entry_t) {0};
+	return n_ret;
 }
 
 /* The only caller of this function is now suspend routine */
@@ -722,7 +760,21 @@ swp_entry_t get_swap_page_of_type(int type)
 	return (swp_entry_t) {0};
 }
 
-static struct swap_info_struct *swap_info_get(swp_entry_t entry)
+/*
+ * Is there any swap area to allocate from at all?
+ */
+bool has_usable_swap(void)
+{
+	bool ret = true;
+
+	spin_lock(&swap_lock);
+	if (plist_head_empty(&swap_active_head))
+		ret = false;
+	spin_unlock(&swap_lock);
+	return ret;
+}
+
+static struct swap_info_struct *_swap_info_get(swp_entry_t entry)
 {
 	struct swap_info_struct *p;
 	unsigned long offset, type;
@@ -740,7 +792,6 @@ static struct swap_info_struct *swap_info_get(swp_entry_t entry)
 		goto bad_offset;
 	if (!p->swap_map[offset])
 		goto bad_free;
-	spin_lock(&p->lock);
 	return p;
 
 bad_free:
@@ -758,8 +809,43 @@ out:
 	return NULL;
 }
 
-static unsigned char swap_entry_free(struct swap_info_struct *p,
-				     swp_entry_t entry, unsigned char usage)
+static struct swap_info_struct *swap_info_get(swp_entry_t entry)
+{
+	struct swap_info_struct *p;
+
+	p = _swap_info_get(entry);
+	if (p)
+		spin_lock(&p->lock);
+	return p;
+}
+
+/*
+ * Like swap_info_get(), but keeps q->lock if entry is on the same swap
+ * area as the previous one, q, and drops it otherwise.
+ */
+static struct swap_info_struct *swap_info_get_cont(swp_entry_t entry,
+					struct swap_info_struct *q)
+{
+	struct swap_info_struct *p;
+
+	p = _swap_info_get(entry);
+
+	if (p != q) {
+		if (q != NULL)
+			spin_unlock(&q->lock);
+		if (p != NULL)
+			spin_lock(&p->lock);
+	}
+	return p;
+}
+
+/*
+ * Drop a reference to the entry.  When the last one is gone, the slot is
+ * left marked SWAP_HAS_CACHE, as it is while cached for allocation, and
+ * the caller must hand it to free_swap_slot() once it dropped p->lock.
+ */
+static unsigned char __swap_entry_free(struct swap_info_struct *p,
+				       swp_entry_t entry, unsigned char usage)
 {
 	unsigned long offset = swp_offset(entry);
 	unsigned char count;
@@ -792,27 +878,10 @@ static unsigned char swap_entry_free(struct swap_info_struct *p,
 		mem_cgroup_uncharge_swap(entry);
 
 	usage = count | has_cache;
-	p->swap_map[offset] = usage;
+	p->swap_map[offset] = usage ? : SWAP_HAS_CACHE;
 
-	/* free if no reference */
+	/* The contents are gone, even if the slot is not free yet */
 	if (!usage) {
-		dec_cluster_info_page(p, p->cluster_info, offset);
-		if (offset < p->lowest_bit)
-			p->lowest_bit = offset;
-		if (offset > p->highest_bit) {
-			bool was_full = !p->highest_bit;
-			p->highest_bit = offset;
-			if (was_full && (p->flags & SWP_WRITEOK)) {
-				spin_lock(&swap_avail_lock);
-				WARN_ON(!plist_node_empty(&p->avail_list));
-				if (plist_node_empty(&p->avail_list))
-					plist_add(&p->avail_list,
-						  &swap_avail_head);
-				spin_unlock(&swap_avail_lock);
-			}
-		}
-		atomic_long_inc(&nr_swap_pages);
-		p->inuse_pages--;
 		frontswap_invalidate_page(p->type, offset);
 		if (p->flags & SWP_BLKDEV) {
 			struct gendisk *disk = p->bdev->bd_disk;
@@ -825,6 +894,35 @@ static unsigned char swap_entry_free(struct swap_info_struct *p,
 	return usage;
 }
 
+/*
+ * Return a slot that has no references left to its swap area, so that it
+ * can be allocated again.  Called with p->lock held.
+ */
+static void swap_entry_free(struct swap_info_struct *p, swp_entry_t entry)
+{
+	unsigned long offset = swp_offset(entry);
+
+	VM_BUG_ON(p->swap_map[offset] != SWAP_HAS_CACHE);
+	p->swap_map[offset] = 0;
+	dec_cluster_info_page(p, p->cluster_info, offset);
+	if (offset < p->lowest_bit)
+		p->lowest_bit = offset;
+	if (offset > p->highest_bit) {
+		bool was_full = !p->highest_bit;
+		p->highest_bit = offset;
+		if (was_full && (p->flags & SWP_WRITEOK)) {
+			spin_lock(&swap_avail_lock);
+			WARN_ON(!plist_node_empty(&p->avail_list));
+			if (plist_node_empty(&p->avail_list))
+				plist_add(&p->avail_list,
+					  &swap_avail_head);
+			spin_unlock(&swap_avail_lock);
+		}
+	}
+	atomic_long_inc(&nr_swap_pages);
+	p->inuse_pages--;
+}
+
 /*
  * Caller has made sure that the swap device corresponding to entry
  * is still around or has not been recycled.
@@ -832,11 +930,14 @@ static unsigned char swap_entry_free(struct swap_info_struct *p,
 void swap_free(swp_entry_t entry)
 {
 	struct swap_info_struct *p;
+	unsigned char usage;
 
 	p = swap_info_get(entry);
 	if (p) {
-		swap_entry_free(p, entry, 1);
+		usage = __swap_entry_free(p, entry, 1);
 		spin_unlock(&p->lock);
+		if (!usage)
+			free_swap_slot(entry);
 	}
 }
 
@@ -846,14 +947,76 @@ void swap_free(swp_entry_t entry)
 void swapcache_free(swp_entry_t entry)
 {
 	struct swap_info_struct *p;
+	unsigned char usage;
 
 	p = swap_info_get(entry);
 	if (p) {
-		swap_entry_free(p, entry, SWAP_HAS_CACHE);
+		usage = __swap_entry_free(p, entry, SWAP_HAS_CACHE);
 		spin_unlock(&p->lock);
+		if (!usage)
+			free_swap_slot(entry);
 	}
 }
 
+static int swp_entry_cmp(const void *ent1, const void *ent2)
+{
+	const swp_entry_t *e1 = ent1, *e2 = ent2;
+
+	return (int)swp_type(*e1) - (int)swp_type(*e2);
+}
+
+/*
+ * Return n slots, all of which free_swap_slot() was called on, to their
+ * swap areas, taking the lock of each area once for the slots in it.
+ */
+void swapcache_free_entries(swp_entry_t *entries, int n)
+{
+	struct swap_info_struct *p, *prev;
+	int i;
+
+	if (n <= 0)
+		return;
+
+	prev = NULL;
+	p = NULL;
+
+	/*
+	 * Sort swap entries by swap device, so each lock is only taken once.
+	 * nr_swapfiles isn't absolutely correct, but the overhead of sort() is
+	 * so low that it isn't necessary to optimize further.
+	 */
+	if (nr_swapfiles > 1)
+		sort(entries, n, sizeof(entries[0]), swp_entry_cmp, NULL);
+	for (i = 0; i < n; ++i) {
+		p = swap_info_get_cont(entries[i], prev);
+		if (p)
+			swap_entry_free(p, entries[i]);
+		prev = p;
+	}
+	if (p)
+		spin_unlock(&p->lock);
+}
+
+/*
+ * How many references to the entry are there, not counting continuations?
+ * Does not take the lock of the swap area, and returns 0 for an entry that
+ * is invalid or free.
+ */
+int __swp_swapcount(swp_entry_t entry)
+{
+	struct swap_info_struct *p;
+	unsigned long offset, type;
+
+	type = swp_type(entry);
+	if (type >= nr_swapfiles)
+		return 0;
+	p = swap_info[type];
+	offset = swp_offset(entry);
+	if (!(p->flags & SWP_USED) || offset >= p->max)
+		return 0;
+	return swap_count(READ_ONCE(p->swap_map[offset]));
+}
+
 /*
  * How many references to page are currently swapped out?
  * This does not give an exact answer when swap count is continued,
@@ -944,13 +1107,15 @@ int free_swap_and_cache(swp_entry_t entry)
 {
 	struct swap_info_struct *p;
 	struct page *page = NULL;
+	unsigned char count;
 
 	if (non_swap_entry(entry))
 		return 1;
 
 	p = swap_info_get(entry);
 	if (p) {
-		if (swap_entry_free(p, entry, 1) == SWAP_HAS_CACHE) {
+		count = __swap_entry_free(p, entry, 1);
+		if (count == SWAP_HAS_CACHE) {
 			page = find_get_page(swap_address_space(entry),
 						entry.val);
 			if (page && !trylock_page(page)) {
@@ -959,6 +1124,8 @@ int free_swap_and_cache(swp_entry_t entry)
 			}
 		}
 		spin_unlock(&p->lock);
+		if (!count)
+			free_swap_slot(entry);
 	}
 	if (page) {
 		/*
@@ -1869,6 +2036,12 @@ SYSCALL_DEFINE1(swapoff, const char __user *, specialfile)
 	spin_unlock(&p->lock);
 	spin_unlock(&swap_lock);
 
+	/*
+	 * Slots of p cached per cpu look in use to try_to_unuse(), return
+	 * them all and keep the caches empty until it is done.
+	 */
+	disable_swap_slots_cache_lock();
+
 	set_current_oom_origin();
 	err = try_to_unuse(p->type, false, 0); /* force unuse all pages */
 	clear_current_oom_origin();
@@ -1876,9 +2049,12 @@ SYSCALL_DEFINE1(swapoff, const char __user *, specialfile)
 	if (err) {
 		/* re-insert swap space back into swap_list */
 		reinsert_swap_info(p);
+		reenable_swap_slots_cache_unlock();
 		goto out_dput;
 	}
 
+	reenable_swap_slots_cache_unlock();
+
 	flush_work(&p->discard_work);
 
 	destroy_swap_extents(p);
@@ -2558,6 +2734,8 @@ out:
 		putname(name);
 	if (inode && S_ISREG(inode->i_mode))
 		mutex_unlock(&inode->i_mutex);
+	if (!error)
+		enable_swap_slots_cache();
 	return error;
 }
 
@@ -2837,7 +3015,7 @@ outer:
  * into, carry if so, or else fail until a new continuation page is allocated;
  * when the original swap_map count is decremented from 0 with continuation,
  * borrow from the continuation and report whether it still holds more.
- * Called while __swap_duplicate() or swap_entry_free() holds swap_lock.
+ * Called while __swap_duplicate() or __swap_entry_free() holds swap_lock.
  */
 static bool swap_count_continued(struct swap_info_struct *si,
 				 pgoff_t offset, unsigned char count)
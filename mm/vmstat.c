@@ -485,6 +485,10 @@ static int refresh_cpu_vm_stats(void)
 			}
 		}
 		cond_resched();
+
+		/* Keep the worker around until the pcp-lists have decayed */
+		if (decay_pcp_high(zone, this_cpu_ptr(&p->pcp)))
+			changes++;
 #ifdef CONFIG_NUMA
 		/*
 		 * Deal with draining the remote pageset of this
@@ -823,6 +827,8 @@ const char * const vmstat_text[] = {
 	"thp_split",
 	"thp_zero_page_alloc",
 	"thp_zero_page_alloc_failed",
+	"thp_file_alloc",
+	"thp_file_mapped",
 #endif
 #ifdef CONFIG_MEMORY_BALLOON
 	"balloon_inflate",
@@ -831,6 +837,10 @@ const char * const vmstat_text[] = {
 	"balloon_migrate",
 #endif
 #endif /* CONFIG_MEMORY_BALLOON */
+#ifdef CONFIG_ARCH_WANT_BATCHED_UNMAP_TLB_FLUSH
+	"unmap_tlb_flush_deferred",
+	"unmap_tlb_flush_batched",
+#endif
 #ifdef CONFIG_DEBUG_TLBFLUSH
 #ifdef CONFIG_SMP
 	"nr_tlb_remote_flush",
@@ -845,6 +855,9 @@ const char * const vmstat_text[] = {
 	"vmacache_find_hits",
 	"vmacache_full_flushes",
 #endif
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+	"speculative_pgfault",
+#endif
 #endif /* CONFIG_VM_EVENTS_COUNTERS */
 };
 #endif /* CONFIG_PROC_FS || CONFIG_SYSFS || CONFIG_NUMA */
@@ -1223,11 +1236,21 @@ static void zoneinfo_show_print(struct seq_file *m, pg_data_t *pgdat,
 			   "\n    cpu: %i"
 			   "\n              count: %i"
 			   "\n              high:  %i"
-			   "\n              batch: %i",
+			   "\n              high_min: %i"
+			   "\n              high_max: %i"
+			   "\n              batch: %i"
+			   "\n              alloc_hit:  %lu"
+			   "\n              alloc_miss: %lu"
+			   "\n              free_drain: %lu",
 			   i,
 			   pageset->pcp.count,
 			   pageset->pcp.high,
-			   pageset->pcp.batch);
+			   pageset->pcp.high_min,
+			   pageset->pcp.high_max,
+			   pageset->pcp.batch,
+			   pageset->pcp.alloc_hit,
+			   pageset->pcp.alloc_miss,
+			   pageset->pcp.free_drain);
 #ifdef CONFIG_SMP
 		seq_printf(m, "\n  vm stats threshold: %d",
 				pageset->stat_threshold);
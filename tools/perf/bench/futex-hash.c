@@ -27,6 +27,8 @@ static unsigned int nsecs    = 10;
 static unsigned int nfutexes = 1024;
 static bool fshared = false, done = false, silent = false;
 static int futex_flag = 0;
+/* 0: global hash, -1: private hash sized by the kernel, else slot count */
+static int hash_slots = 0;
 
 struct timeval start, end, runtime;
 static pthread_mutex_t thread_lock;
@@ -36,6 +38,7 @@ static pthread_cond_t thread_parent, thread_worker;
 
 struct worker {
 	int tid;
+	int node;
 	u_int32_t *futex;
 	pthread_t thread;
 	unsigned long ops;
@@ -47,6 +50,7 @@ static const struct option options[] = {
 	OPT_UINTEGER('f', "futexes", &nfutexes, "Specify amount of futexes per threads"),
 	OPT_BOOLEAN( 's', "silent",  &silent,   "Silent mode: do not display data/details"),
 	OPT_BOOLEAN( 'S', "shared",  &fshared,  "Use shared futexes instead of private ones"),
+	OPT_INTEGER( 'H', "hash-slots", &hash_slots, "Use a process-private futex hash with this many slots (-1: sized by the kernel)"),
 	OPT_END()
 };
 
@@ -58,9 +62,14 @@ static const char * const bench_futex_hash_usage[] = {
 static void *workerfn(void *arg)
 {
 	int ret;
-	unsigned int i;
+	unsigned int i, cpu, node;
 	struct worker *w = (struct worker *) arg;
 
+	/* threads are bound to a cpu, so the node does not change */
+	if (syscall(SYS_getcpu, &cpu, &node, NULL))
+		node = 0;
+	w->node = node;
+
 	pthread_mutex_lock(&thread_lock);
 	threads_starting--;
 	if (!threads_starting)
@@ -96,6 +105,41 @@ static void toggle_done(int sig __maybe_unused,
 	timersub(&end, &start, &runtime);
 }
 
+/*
+ * Per-node throughput: with a global hash all nodes share the same
+ * buckets, so threads on remote nodes pay for cross-node hb->lock and
+ * bucket cache line transfers.
+ */
+static void print_node_summary(struct worker *worker)
+{
+	unsigned int i;
+	int node, max_node = 0;
+
+	for (i = 0; i < nthreads; i++)
+		if (worker[i].node > max_node)
+			max_node = worker[i].node;
+
+	if (!max_node)
+		return;
+
+	printf("\n");
+	for (node = 0; node <= max_node; node++) {
+		unsigned long ops = 0;
+		unsigned int n = 0;
+
+		for (i = 0; i < nthreads; i++) {
+			if (worker[i].node != node)
+				continue;
+			ops += worker[i].ops / runtime.tv_sec;
+			n++;
+		}
+		if (!n)
+			continue;
+		printf("[node %2d] %3d threads: %ld operations/sec, %ld per thread\n",
+		       node, n, ops, ops / n);
+	}
+}
+
 static void print_summary(void)
 {
 	unsigned long avg = avg_stats(&throughput_stats);
@@ -138,8 +182,15 @@ int bench_futex_hash(int argc, const char **argv,
 	if (!fshared)
 		futex_flag = FUTEX_PRIVATE_FLAG;
 
-	printf("Run summary [PID %d]: %d threads, each operating on %d [%s] futexes for %d secs.\n\n",
-	       getpid(), nthreads, nfutexes, fshared ? "shared":"private", nsecs);
+	if (hash_slots &&
+	    prctl(PR_FUTEX_HASH, PR_FUTEX_HASH_SET_SLOTS,
+		  hash_slots < 0 ? PR_FUTEX_HASH_SLOTS_AUTO : (unsigned long)hash_slots,
+		  0, 0))
+		err(EXIT_FAILURE, "prctl(PR_FUTEX_HASH)");
+
+	printf("Run summary [PID %d]: %d threads, each operating on %d [%s] futexes for %d secs, %s hash.\n\n",
+	       getpid(), nthreads, nfutexes, fshared ? "shared":"private", nsecs,
+	       hash_slots ? "process-private" : "global");
 
 	init_stats(&throughput_stats);
 	pthread_mutex_init(&thread_lock, NULL);
@@ -206,6 +257,7 @@ int bench_futex_hash(int argc, const char **argv,
 		free(worker[i].futex);
 	}
 
+	print_node_summary(worker);
 	print_summary();
 
 	free(worker);
@@ -0,0 +1,248 @@
+/*
+ * futex-wait-multiple: Block a bunch of threads on a vector of futexes with
+ * FUTEX_WAIT_MULTIPLE and wake'em up, one at a time.
+ *
+ * This program measures the wait-any wakeup latency: the time between the
+ * FUTEX_WAKE call on one futex of the vector and the waiter returning to
+ * userspace. The woken futex is the last one of the vector, which is the
+ * worst case for the waiter side.
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/stat.h"
+#include "../util/parse-options.h"
+#include "../util/header.h"
+#include "bench.h"
+#include "futex.h"
+
+#include <err.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/time.h>
+#include <pthread.h>
+
+static u_int32_t *futexes;
+static struct futex_wait_block *wait_blocks;
+
+pthread_t *worker;
+static bool done = false, silent = false, fshared = false;
+static pthread_mutex_t thread_lock;
+static pthread_cond_t thread_parent, thread_worker;
+static struct stats latency_stats, waketime_stats;
+static unsigned int ncpus, threads_starting, nthreads = 64, nfutexes = 64;
+static volatile unsigned int nacked;
+static struct timespec wake_start;
+static int futex_flag = 0;
+
+static const struct option options[] = {
+	OPT_UINTEGER('t', "threads", &nthreads, "Specify amount of waiting threads (default 64)"),
+	OPT_UINTEGER('f', "futexes", &nfutexes, "Specify amount of futexes each thread waits on (default 64)"),
+	OPT_BOOLEAN( 's', "silent",  &silent,   "Silent mode: do not display data/details"),
+	OPT_BOOLEAN( 'S', "shared",  &fshared,  "Use shared futexes instead of private ones"),
+	OPT_END()
+};
+
+static const char * const bench_futex_wait_multiple_usage[] = {
+	"perf bench futex wait-multiple <options>",
+	NULL
+};
+
+static u64 timespec_diff_ns(struct timespec *start, struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) * 1000000000ULL +
+		end->tv_nsec - start->tv_nsec;
+}
+
+static void *workerfn(void *arg __maybe_unused)
+{
+	struct timespec now;
+	int ret;
+
+	pthread_mutex_lock(&thread_lock);
+	threads_starting--;
+	if (!threads_starting)
+		pthread_cond_signal(&thread_parent);
+	pthread_cond_wait(&thread_worker, &thread_lock);
+	pthread_mutex_unlock(&thread_lock);
+
+	while (1) {
+		ret = futex_wait_multiple(wait_blocks, nfutexes, NULL, 0);
+		if (ret >= 0 || errno != EINTR)
+			break;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	pthread_mutex_lock(&thread_lock);
+	if (ret >= 0)
+		update_stats(&latency_stats, timespec_diff_ns(&wake_start, &now));
+	nacked++;
+	pthread_mutex_unlock(&thread_lock);
+
+	pthread_exit(NULL);
+	return NULL;
+}
+
+static void print_summary(void)
+{
+	double latency_avg = avg_stats(&latency_stats);
+	double latency_stddev = stddev_stats(&latency_stats);
+	double waketime_avg = avg_stats(&waketime_stats);
+	double waketime_stddev = stddev_stats(&waketime_stats);
+
+	printf("Wait-any latency: %.3f us (+-%.2f%%), "
+	       "woke %d threads in %.4f ms (+-%.2f%%)\n",
+	       latency_avg / 1e3,
+	       rel_stddev_stats(latency_stddev, latency_avg),
+	       nthreads,
+	       waketime_avg / 1e6,
+	       rel_stddev_stats(waketime_stddev, waketime_avg));
+}
+
+static void block_threads(pthread_t *w,
+			  pthread_attr_t thread_attr)
+{
+	cpu_set_t cpu;
+	unsigned int i;
+
+	threads_starting = nthreads;
+
+	/* create and block all threads */
+	for (i = 0; i < nthreads; i++) {
+		CPU_ZERO(&cpu);
+		CPU_SET(i % ncpus, &cpu);
+
+		if (pthread_attr_setaffinity_np(&thread_attr, sizeof(cpu_set_t), &cpu))
+			err(EXIT_FAILURE, "pthread_attr_setaffinity_np");
+
+		if (pthread_create(&w[i], &thread_attr, workerfn, NULL))
+			err(EXIT_FAILURE, "pthread_create");
+	}
+}
+
+static void toggle_done(int sig __maybe_unused,
+			siginfo_t *info __maybe_unused,
+			void *uc __maybe_unused)
+{
+	done = true;
+}
+
+int bench_futex_wait_multiple(int argc, const char **argv,
+			      const char *prefix __maybe_unused)
+{
+	int ret = 0;
+	unsigned int i, j;
+	struct sigaction act;
+	pthread_attr_t thread_attr;
+	u_int32_t *target;
+
+	argc = parse_options(argc, argv, options, bench_futex_wait_multiple_usage, 0);
+	if (argc || !nfutexes) {
+		usage_with_options(bench_futex_wait_multiple_usage, options);
+		exit(EXIT_FAILURE);
+	}
+
+	ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+	sigfillset(&act.sa_mask);
+	act.sa_sigaction = toggle_done;
+	sigaction(SIGINT, &act, NULL);
+
+	if (!nthreads)
+		nthreads = ncpus;
+
+	worker = calloc(nthreads, sizeof(*worker));
+	futexes = calloc(nfutexes, sizeof(*futexes));
+	wait_blocks = calloc(nfutexes, sizeof(*wait_blocks));
+	if (!worker || !futexes || !wait_blocks)
+		err(EXIT_FAILURE, "calloc");
+
+	if (!fshared)
+		futex_flag = FUTEX_PRIVATE_FLAG;
+
+	for (i = 0; i < nfutexes; i++) {
+		wait_blocks[i].uaddr = (unsigned long)&futexes[i];
+		wait_blocks[i].val = 0;
+		wait_blocks[i].flags = futex_flag;
+	}
+	target = &futexes[nfutexes - 1];
+
+	/* a mismatching value must fail right away if the op is supported */
+	wait_blocks[0].val = 1;
+	if (futex_wait_multiple(wait_blocks, nfutexes, NULL, 0) < 0 &&
+	    errno == ENOSYS)
+		errx(EXIT_FAILURE, "FUTEX_WAIT_MULTIPLE is not supported");
+	wait_blocks[0].val = 0;
+
+	printf("Run summary [PID %d]: blocking on %d threads, each waiting on "
+	       "%d [%s] futexes, waking up 1 at a time.\n\n",
+	       getpid(), nthreads, nfutexes, fshared ? "shared":"private");
+
+	init_stats(&latency_stats);
+	init_stats(&waketime_stats);
+	pthread_attr_init(&thread_attr);
+	pthread_mutex_init(&thread_lock, NULL);
+	pthread_cond_init(&thread_parent, NULL);
+	pthread_cond_init(&thread_worker, NULL);
+
+	for (j = 0; j < bench_repeat && !done; j++) {
+		struct timespec start, end;
+
+		nacked = 0;
+
+		/* create, launch & block all threads */
+		block_threads(worker, thread_attr);
+
+		/* make sure all threads are already blocked */
+		pthread_mutex_lock(&thread_lock);
+		while (threads_starting)
+			pthread_cond_wait(&thread_parent, &thread_lock);
+		pthread_cond_broadcast(&thread_worker);
+		pthread_mutex_unlock(&thread_lock);
+
+		usleep(100000);
+
+		/* Ok, all threads are patiently blocked, start waking folks up */
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (i = 0; i < nthreads; i++) {
+			clock_gettime(CLOCK_MONOTONIC, &wake_start);
+			while (futex_wake(target, 1, futex_flag) < 1)
+				sched_yield();
+			/* wait for the waiter to report before the next wake */
+			while (nacked != i + 1)
+				sched_yield();
+		}
+		clock_gettime(CLOCK_MONOTONIC, &end);
+
+		update_stats(&waketime_stats, timespec_diff_ns(&start, &end));
+
+		if (!silent) {
+			printf("[Run %d]: Wokeup %d threads in %.4f ms, "
+			       "avg wait-any latency %.3f us\n",
+			       j + 1, nthreads,
+			       timespec_diff_ns(&start, &end) / 1e6,
+			       avg_stats(&latency_stats) / 1e3);
+		}
+
+		for (i = 0; i < nthreads; i++) {
+			ret = pthread_join(worker[i], NULL);
+			if (ret)
+				err(EXIT_FAILURE, "pthread_join");
+		}
+	}
+
+	/* cleanup & report results */
+	pthread_cond_destroy(&thread_parent);
+	pthread_cond_destroy(&thread_worker);
+	pthread_mutex_destroy(&thread_lock);
+	pthread_attr_destroy(&thread_attr);
+
+	print_summary();
+
+	free(wait_blocks);
+	free(futexes);
+	free(worker);
+	return ret;
+}
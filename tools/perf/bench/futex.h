@@ -10,6 +10,7 @@
 #include <unistd.h>
 #include <sys/syscall.h>
 #include <sys/types.h>
+#include <sys/prctl.h>
 #include <linux/futex.h>
 
 /**
@@ -68,6 +69,38 @@ futex_cmp_requeue(u_int32_t *uaddr, u_int32_t val, u_int32_t *uaddr2, int nr_wak
 		 val, opflags);
 }
 
+#ifndef PR_FUTEX_HASH
+#define PR_FUTEX_HASH			78
+# define PR_FUTEX_HASH_SET_SLOTS	1
+# define PR_FUTEX_HASH_GET_SLOTS	2
+# define PR_FUTEX_HASH_SLOTS_AUTO	(~0UL)
+#endif
+
+#ifndef FUTEX_WAIT_MULTIPLE
+#define FUTEX_WAIT_MULTIPLE	31
+
+struct futex_wait_block {
+	__u64 uaddr;
+	__u32 val;
+	__u32 flags;
+};
+#endif
+
+/**
+ * futex_wait_multiple() - block on several futexes, wake on any of them
+ * @wb:		array of wait blocks, one per futex
+ * @count:	number of entries in @wb
+ * @timeout:	absolute timeout
+ *
+ * Returns the index of the woken futex.
+ */
+static inline int
+futex_wait_multiple(struct futex_wait_block *wb, unsigned int count,
+		    struct timespec *timeout, int opflags)
+{
+	return futex(wb, FUTEX_WAIT_MULTIPLE, count, timeout, NULL, 0, opflags);
+}
+
 #ifndef HAVE_PTHREAD_ATTR_SETAFFINITY_NP
 #include <pthread.h>
 static inline int pthread_attr_setaffinity_np(pthread_attr_t *attr,
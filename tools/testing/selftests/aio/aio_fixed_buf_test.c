@@ -0,0 +1,237 @@
+/*
+ * aio_fixed_buf_test.c - registered buffer test
+ *
+ * Registers buffers with io_ring_register() and checks that
+ * IOCB_CMD_PREAD_FIXED and IOCB_CMD_PWRITE_FIXED move the right bytes
+ * through io_submit() and through the submission ring, that bad indexes
+ * and ranges are refused with EFAULT, that a second registration fails
+ * with EBUSY and that file backed memory cannot be registered.
+ */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "aio_ring.h"
+#include "../kselftest.h"
+
+#define BUF_SIZE	8192
+#define NR_BUFS		2
+#define IO_OFF		100
+#define IO_LEN		1000
+
+static char *bufs[NR_BUFS];
+static struct iovec iovs[NR_BUFS];
+static char pattern[BUF_SIZE];
+
+static void prep(struct iocb *iocb, unsigned opcode, int fd, unsigned index,
+		 void *buf, size_t len)
+{
+	memset(iocb, 0, sizeof(*iocb));
+	iocb->aio_lio_opcode = opcode;
+	iocb->aio_fildes = fd;
+	iocb->aio_buf_index = index;
+	iocb->aio_buf = (uintptr_t)buf;
+	iocb->aio_nbytes = len;
+}
+
+static long long submit_one(aio_context_t ctx, struct iocb *iocb)
+{
+	struct io_event ev;
+
+	if (sys_io_submit(ctx, 1, &iocb) != 1)
+		return -errno;
+	if (sys_io_getevents(ctx, 1, 1, &ev, NULL) != 1)
+		return -errno;
+	return ev.res;
+}
+
+static int test_submit(int fd)
+{
+	aio_context_t ctx = 0;
+	struct iocb iocb;
+	char check[IO_LEN];
+	long long res;
+	int ret = -1;
+
+	if (sys_io_setup(16, &ctx)) {
+		printf("aio: io_setup failed: %s\n", strerror(errno));
+		return -1;
+	}
+	if (sys_io_ring_register(ctx, IORING_REGISTER_BUFFERS, iovs,
+				 NR_BUFS)) {
+		printf("aio: buffer registration failed: %s\n",
+		       strerror(errno));
+		goto out;
+	}
+
+	memset(bufs[1], 0, BUF_SIZE);
+	prep(&iocb, IOCB_CMD_PREAD_FIXED, fd, 1, bufs[1] + IO_OFF, IO_LEN);
+	res = submit_one(ctx, &iocb);
+	if (res != IO_LEN || memcmp(bufs[1] + IO_OFF, pattern, IO_LEN)) {
+		printf("aio: fixed read returned %lld\n", res);
+		goto out;
+	}
+
+	memset(bufs[0], 0x5a, BUF_SIZE);
+	prep(&iocb, IOCB_CMD_PWRITE_FIXED, fd, 0, bufs[0] + IO_OFF, IO_LEN);
+	res = submit_one(ctx, &iocb);
+	if (res != IO_LEN || pread(fd, check, IO_LEN, 0) != IO_LEN ||
+	    memcmp(check, bufs[0] + IO_OFF, IO_LEN)) {
+		printf("aio: fixed write returned %lld\n", res);
+		goto out;
+	}
+	pwrite(fd, pattern, BUF_SIZE, 0);
+
+	prep(&iocb, IOCB_CMD_PREAD_FIXED, fd, NR_BUFS, bufs[1], IO_LEN);
+	res = submit_one(ctx, &iocb);
+	if (res != -EFAULT) {
+		printf("aio: bad index returned %lld, expected %d\n", res,
+		       -EFAULT);
+		goto out;
+	}
+
+	prep(&iocb, IOCB_CMD_PREAD_FIXED, fd, 1, bufs[1] + BUF_SIZE - 10,
+	     IO_LEN);
+	res = submit_one(ctx, &iocb);
+	if (res != -EFAULT) {
+		printf("aio: out of range buffer returned %lld, expected %d\n",
+		       res, -EFAULT);
+		goto out;
+	}
+
+	if (!sys_io_ring_register(ctx, IORING_REGISTER_BUFFERS, iovs,
+				  NR_BUFS) || errno != EBUSY) {
+		printf("aio: second registration did not fail with EBUSY\n");
+		goto out;
+	}
+
+	printf("aio: io_submit fixed buffers success.\n");
+	ret = 0;
+out:
+	sys_io_destroy(ctx);
+	return ret;
+}
+
+static int test_ring(int fd)
+{
+	struct aio_uring r;
+	struct io_event *ev;
+	int ret = -1;
+
+	if (aio_uring_setup(&r, 16, 0)) {
+		printf("aio: io_setup2 failed: %s\n", strerror(errno));
+		return -1;
+	}
+	if (sys_io_ring_register(r.ctx, IORING_REGISTER_BUFFERS, iovs,
+				 NR_BUFS)) {
+		printf("aio: buffer registration failed: %s\n",
+		       strerror(errno));
+		goto out;
+	}
+
+	memset(bufs[0], 0, BUF_SIZE);
+	prep(&r.iocbs[0], IOCB_CMD_PREAD_FIXED, fd, 0, bufs[0] + IO_OFF,
+	     IO_LEN);
+	aio_uring_queue(&r, 0);
+	if (sys_io_ring_enter(r.ctx, 1, 1,
+			      IORING_FLAG_SUBMIT | IORING_FLAG_GETEVENTS) != 1) {
+		printf("aio: io_ring_enter failed: %s\n", strerror(errno));
+		goto out;
+	}
+	ev = aio_uring_peek(&r);
+	if (!ev || ev->res != IO_LEN ||
+	    memcmp(bufs[0] + IO_OFF, pattern, IO_LEN)) {
+		printf("aio: ring fixed read returned %lld\n",
+		       ev ? (long long)ev->res : 0LL);
+		goto out;
+	}
+	aio_uring_advance(&r);
+
+	printf("aio: ring fixed buffers success.\n");
+	ret = 0;
+out:
+	sys_io_destroy(r.ctx);
+	return ret;
+}
+
+static int test_file_backed(int fd)
+{
+	aio_context_t ctx = 0;
+	struct iovec iov;
+	int ret;
+
+	iov.iov_len = BUF_SIZE;
+	iov.iov_base = mmap(NULL, BUF_SIZE, PROT_READ | PROT_WRITE,
+			    MAP_SHARED, fd, 0);
+	if (iov.iov_base == MAP_FAILED) {
+		perror("mmap");
+		return -1;
+	}
+	if (sys_io_setup(16, &ctx)) {
+		printf("aio: io_setup failed: %s\n", strerror(errno));
+		return -1;
+	}
+	ret = sys_io_ring_register(ctx, IORING_REGISTER_BUFFERS, &iov, 1);
+	sys_io_destroy(ctx);
+	munmap(iov.iov_base, BUF_SIZE);
+
+	if (ret != -1 || errno != EOPNOTSUPP) {
+		printf("aio: registering file backed memory returned %d\n",
+		       ret);
+		return -1;
+	}
+	printf("aio: file backed buffer refused.\n");
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	char path[] = "/tmp/aio_fixed_buf_testXXXXXX";
+	aio_context_t ctx = 0;
+	int fd, i, ret = 0;
+
+	if (sys_io_setup(1, &ctx)) {
+		printf("aio: io_setup failed: %s\n", strerror(errno));
+		return ksft_exit_fail();
+	}
+	if (sys_io_ring_register(ctx, IORING_REGISTER_BUFFERS, NULL, 0) &&
+	    errno == ENOSYS) {
+		printf("aio: io_ring_register unavailable, skipping.\n");
+		sys_io_destroy(ctx);
+		return ksft_exit_skip();
+	}
+	sys_io_destroy(ctx);
+
+	for (i = 0; i < NR_BUFS; i++) {
+		bufs[i] = mmap(NULL, BUF_SIZE, PROT_READ | PROT_WRITE,
+			       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (bufs[i] == MAP_FAILED) {
+			perror("mmap");
+			return ksft_exit_fail();
+		}
+		iovs[i].iov_base = bufs[i];
+		iovs[i].iov_len = BUF_SIZE;
+	}
+
+	fd = mkstemp(path);
+	if (fd < 0) {
+		perror("mkstemp");
+		return ksft_exit_fail();
+	}
+	unlink(path);
+	for (i = 0; i < BUF_SIZE; i++)
+		pattern[i] = i * 13;
+	if (pwrite(fd, pattern, BUF_SIZE, 0) != BUF_SIZE) {
+		perror("pwrite");
+		return ksft_exit_fail();
+	}
+
+	if (test_submit(fd) || test_ring(fd) || test_file_backed(fd))
+		ret = -1;
+	close(fd);
+
+	return ret ? ksft_exit_fail() : ksft_exit_pass();
+}
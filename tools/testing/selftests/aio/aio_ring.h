@@ -0,0 +1,145 @@
+#ifndef _AIO_RING_H
+#define _AIO_RING_H
+
+#define __EXPORTED_HEADERS__
+
+#include <linux/aio_abi.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <stdint.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+
+/* The rings of an IOCTX_FLAG_SCQRING context, as mapped by io_setup2(). */
+struct aio_uring {
+	aio_context_t		ctx;
+	struct aio_sq_ring	*sq;
+	struct iocb		*iocbs;
+	uint32_t		*cq_head;
+	uint32_t		*cq_tail;
+	struct io_event		*events;
+	uint32_t		cq_entries;
+};
+
+#ifdef __NR_io_setup2
+static inline int sys_io_setup2(unsigned nr_events, unsigned flags,
+				struct aio_ring_params *p, aio_context_t *ctxp)
+{
+	return syscall(__NR_io_setup2, nr_events, flags, p, ctxp);
+}
+
+static inline int sys_io_ring_enter(aio_context_t ctx, unsigned to_submit,
+				    unsigned min_complete, unsigned flags)
+{
+	return syscall(__NR_io_ring_enter, ctx, to_submit, min_complete,
+		       flags);
+}
+
+static inline int sys_io_ring_register(aio_context_t ctx, unsigned opcode,
+				       void *arg, unsigned nr_args)
+{
+	return syscall(__NR_io_ring_register, ctx, opcode, arg, nr_args);
+}
+#else
+static inline int sys_io_setup2(unsigned nr_events, unsigned flags,
+				struct aio_ring_params *p, aio_context_t *ctxp)
+{
+	errno = ENOSYS;
+	return -1;
+}
+
+static inline int sys_io_ring_enter(aio_context_t ctx, unsigned to_submit,
+				    unsigned min_complete, unsigned flags)
+{
+	errno = ENOSYS;
+	return -1;
+}
+
+static inline int sys_io_ring_register(aio_context_t ctx, unsigned opcode,
+				       void *arg, unsigned nr_args)
+{
+	errno = ENOSYS;
+	return -1;
+}
+#endif
+
+static inline int sys_io_setup(unsigned nr_events, aio_context_t *ctxp)
+{
+	return syscall(__NR_io_setup, nr_events, ctxp);
+}
+
+static inline int sys_io_destroy(aio_context_t ctx)
+{
+	return syscall(__NR_io_destroy, ctx);
+}
+
+static inline int sys_io_submit(aio_context_t ctx, long nr,
+				struct iocb **iocbs)
+{
+	return syscall(__NR_io_submit, ctx, nr, iocbs);
+}
+
+static inline int sys_io_getevents(aio_context_t ctx, long min_nr, long nr,
+				   struct io_event *events,
+				   struct timespec *timeout)
+{
+	return syscall(__NR_io_getevents, ctx, min_nr, nr, events, timeout);
+}
+
+static inline int aio_uring_setup(struct aio_uring *r, unsigned entries,
+				  unsigned flags)
+{
+	struct aio_ring_params p;
+	char *base;
+
+	r->ctx = 0;
+	if (sys_io_setup2(entries, flags | IOCTX_FLAG_SCQRING, &p, &r->ctx))
+		return -1;
+
+	base = (char *)r->ctx;
+	r->sq = (struct aio_sq_ring *)(base + p.sq_offset);
+	r->iocbs = (struct iocb *)((char *)r->sq + r->sq->iocbs_offset);
+	r->cq_head = (uint32_t *)(base + p.cq_head);
+	r->cq_tail = (uint32_t *)(base + p.cq_tail);
+	r->events = (struct io_event *)(base + p.cq_events);
+	r->cq_entries = p.cq_entries;
+	return 0;
+}
+
+/* Queues iocbs[idx] at the tail of the submission ring. */
+static inline void aio_uring_queue(struct aio_uring *r, unsigned idx)
+{
+	uint32_t tail = r->sq->tail;
+
+	r->sq->array[tail & (r->sq->nr - 1)] = idx;
+	__atomic_store_n(&r->sq->tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+/* Index in the iocb array of the iocb an event completes. */
+static inline unsigned aio_uring_index(struct aio_uring *r,
+				       struct io_event *ev)
+{
+	return (struct iocb *)(uintptr_t)ev->obj - r->iocbs;
+}
+
+/* Pops the next event off the completion ring, or returns NULL. */
+static inline struct io_event *aio_uring_peek(struct aio_uring *r)
+{
+	uint32_t head = *r->cq_head;
+
+	if (head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE))
+		return NULL;
+	return &r->events[head];
+}
+
+static inline void aio_uring_advance(struct aio_uring *r)
+{
+	uint32_t head = *r->cq_head + 1;
+
+	if (head == r->cq_entries)
+		head = 0;
+	__atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+}
+
+#endif /* _AIO_RING_H */
@@ -0,0 +1,264 @@
+/*
+ * aio_ring_bench.c - compare io_submit() with the aio submission ring
+ *
+ * Keeps "depth" random 4k O_DIRECT reads in flight against a block device
+ * (null_blk by default: modprobe null_blk) for a few seconds and reports
+ * IOPS and the number of system calls issued per I/O, for:
+ *
+ *   aio   - io_submit() + io_getevents(), as libaio does it
+ *   ring  - io_ring_enter() on an IOCTX_FLAG_SCQRING context
+ *   poll  - io_ring_enter() on an IOCTX_FLAG_SCQRING | IOCTX_FLAG_IOPOLL
+ *           context
+ *
+ * In poll mode, completions are reaped from the device itself if its queue
+ * has polling enabled (/sys/block/<dev>/queue/io_poll, and irqmode=2 for
+ * null_blk); writing 0 to io_poll_delay makes that hybrid polling, which
+ * sleeps for half the mean completion time before spinning.
+ *
+ * With -f, the buffers are registered with io_ring_register() and read
+ * with IOCB_CMD_PREAD_FIXED, so that the pages are not pinned per I/O.
+ *
+ * Usage: aio_ring_bench [-f] [-d depth] [-t seconds] [-m mode] [device]
+ */
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/time.h>
+#include <linux/fs.h>
+
+#include "aio_ring.h"
+
+#define BS		4096
+
+static unsigned depth = 32, seconds = 5;
+static int fixed;
+static struct iovec *iovs;
+static unsigned long long dev_blocks;
+static void **bufs;
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void prep_read(struct iocb *iocb, int fd, unsigned idx)
+{
+	memset(iocb, 0, sizeof(*iocb));
+	if (fixed) {
+		iocb->aio_lio_opcode = IOCB_CMD_PREAD_FIXED;
+		iocb->aio_buf_index = idx;
+	} else {
+		iocb->aio_lio_opcode = IOCB_CMD_PREAD;
+	}
+	iocb->aio_fildes = fd;
+	iocb->aio_buf = (uintptr_t)bufs[idx];
+	iocb->aio_nbytes = BS;
+	iocb->aio_offset = (random() % dev_blocks) * BS;
+	iocb->aio_data = idx;
+}
+
+static void report(const char *mode, unsigned long long ios,
+		   unsigned long long calls, double elapsed)
+{
+	printf("%-5s%s depth %3u: %10.0f IOPS, %.3f syscalls/IO\n", mode,
+	       fixed ? " fixed" : "", depth, ios / elapsed,
+	       (double)calls / ios);
+}
+
+static int register_buffers(aio_context_t ctx)
+{
+	if (fixed && sys_io_ring_register(ctx, IORING_REGISTER_BUFFERS, iovs,
+					  depth)) {
+		perror("io_ring_register");
+		return -1;
+	}
+	return 0;
+}
+
+static int run_aio(int fd)
+{
+	struct iocb *iocbs = calloc(depth, sizeof(*iocbs));
+	struct iocb **ptrs = calloc(depth, sizeof(*ptrs));
+	struct io_event *events = calloc(depth, sizeof(*events));
+	unsigned long long ios = 0, calls = 0;
+	aio_context_t ctx = 0;
+	double start, end;
+	int i, nr, ret;
+
+	if (!iocbs || !ptrs || !events || sys_io_setup(depth, &ctx)) {
+		perror("io_setup");
+		return -1;
+	}
+	if (register_buffers(ctx))
+		return -1;
+
+	for (i = 0; i < depth; i++) {
+		prep_read(&iocbs[i], fd, i);
+		ptrs[i] = &iocbs[i];
+	}
+	nr = depth;
+
+	start = now();
+	end = start + seconds;
+	do {
+		ret = sys_io_submit(ctx, nr, ptrs);
+		calls++;
+		if (ret != nr) {
+			perror("io_submit");
+			return -1;
+		}
+		nr = sys_io_getevents(ctx, 1, depth, events, NULL);
+		calls++;
+		if (nr < 0) {
+			perror("io_getevents");
+			return -1;
+		}
+		for (i = 0; i < nr; i++) {
+			struct iocb *iocb = &iocbs[events[i].data];
+
+			if (events[i].res != BS) {
+				fprintf(stderr, "read: %lld\n",
+					(long long)events[i].res);
+				return -1;
+			}
+			prep_read(iocb, fd, events[i].data);
+			ptrs[i] = iocb;
+		}
+		ios += nr;
+	} while (now() < end);
+
+	report("aio", ios, calls, now() - start);
+	sys_io_destroy(ctx);
+	return 0;
+}
+
+static int run_ring(int fd, unsigned flags, const char *mode)
+{
+	unsigned long long ios = 0, calls = 0;
+	struct aio_uring r;
+	struct io_event *ev;
+	double start, end;
+	unsigned i, nr;
+	int ret;
+
+	if (aio_uring_setup(&r, depth, flags)) {
+		perror("io_setup2");
+		return -1;
+	}
+	if (register_buffers(r.ctx))
+		return -1;
+
+	for (i = 0; i < depth; i++) {
+		prep_read(&r.iocbs[i], fd, i);
+		aio_uring_queue(&r, i);
+	}
+	nr = depth;
+
+	start = now();
+	end = start + seconds;
+	do {
+		ret = sys_io_ring_enter(r.ctx, nr, 1,
+				IORING_FLAG_SUBMIT | IORING_FLAG_GETEVENTS);
+		calls++;
+		if (ret != nr) {
+			perror("io_ring_enter");
+			return -1;
+		}
+		for (nr = 0; (ev = aio_uring_peek(&r)); nr++) {
+			i = aio_uring_index(&r, ev);
+			if (ev->res != BS) {
+				fprintf(stderr, "read: %lld\n",
+					(long long)ev->res);
+				return -1;
+			}
+			aio_uring_advance(&r);
+			prep_read(&r.iocbs[i], fd, i);
+			aio_uring_queue(&r, i);
+		}
+		ios += nr;
+	} while (now() < end);
+
+	report(mode, ios, calls, now() - start);
+	sys_io_destroy(r.ctx);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	const char *dev = "/dev/nullb0", *mode = NULL;
+	unsigned long long size;
+	int c, fd, ret = 0;
+	unsigned i;
+
+	while ((c = getopt(argc, argv, "fd:t:m:")) != -1) {
+		switch (c) {
+		case 'f':
+			fixed = 1;
+			break;
+		case 'd':
+			depth = atoi(optarg);
+			break;
+		case 't':
+			seconds = atoi(optarg);
+			break;
+		case 'm':
+			mode = optarg;
+			break;
+		default:
+			fprintf(stderr,
+				"Usage: %s [-f] [-d depth] [-t seconds] [-m aio|ring|poll] [device]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+	if (optind < argc)
+		dev = argv[optind];
+	if (!depth || depth > 4096) {
+		fprintf(stderr, "depth must be within 1..4096\n");
+		return 1;
+	}
+
+	fd = open(dev, O_RDONLY | O_DIRECT);
+	if (fd < 0 || ioctl(fd, BLKGETSIZE64, &size)) {
+		perror(dev);
+		return 1;
+	}
+	dev_blocks = size / BS;
+	if (!dev_blocks) {
+		fprintf(stderr, "%s: device too small\n", dev);
+		return 1;
+	}
+
+	bufs = calloc(depth, sizeof(*bufs));
+	iovs = calloc(depth, sizeof(*iovs));
+	if (!bufs || !iovs) {
+		perror("calloc");
+		return 1;
+	}
+	for (i = 0; i < depth; i++) {
+		if (posix_memalign(&bufs[i], BS, BS)) {
+			perror("posix_memalign");
+			return 1;
+		}
+		iovs[i].iov_base = bufs[i];
+		iovs[i].iov_len = BS;
+	}
+
+	if (!mode || !strcmp(mode, "aio"))
+		ret |= run_aio(fd);
+	if (!mode || !strcmp(mode, "ring"))
+		ret |= run_ring(fd, 0, "ring");
+	if (!mode || !strcmp(mode, "poll"))
+		ret |= run_ring(fd, IOCTX_FLAG_IOPOLL, "poll");
+
+	close(fd);
+	return ret ? 1 : 0;
+}
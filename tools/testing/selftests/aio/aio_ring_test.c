@@ -0,0 +1,174 @@
+/*
+ * aio_ring_test.c - io_setup2()/io_ring_enter() submission ring test
+ *
+ * Queues a buffered read, an fsync, a read from a bad file descriptor
+ * and an out of range index through the submission ring of an
+ * IOCTX_FLAG_SCQRING context, and checks the events reaped from the
+ * completion ring, with and without IOCTX_FLAG_IOPOLL.  Also checks that
+ * io_ring_enter() refuses contexts created by io_setup().
+ */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "aio_ring.h"
+#include "../kselftest.h"
+
+#define BUF_SIZE	4096
+
+enum { REQ_READ, REQ_FSYNC, REQ_BADF, NR_REQS };
+
+static char wbuf[BUF_SIZE], rbuf[BUF_SIZE];
+
+static void prep(struct iocb *iocb, unsigned opcode, int fd, void *buf,
+		 size_t len, unsigned data)
+{
+	memset(iocb, 0, sizeof(*iocb));
+	iocb->aio_lio_opcode = opcode;
+	iocb->aio_fildes = fd;
+	iocb->aio_buf = (uintptr_t)buf;
+	iocb->aio_nbytes = len;
+	iocb->aio_data = data;
+}
+
+static int test_ring(int fd, unsigned flags, const char *name)
+{
+	struct aio_uring r;
+	struct io_event *ev;
+	int seen[NR_REQS] = { 0 };
+	int ret, i;
+
+	if (aio_uring_setup(&r, 16, flags)) {
+		printf("aio: %s io_setup2 failed: %s\n", name, strerror(errno));
+		return -1;
+	}
+
+	memset(rbuf, 0, sizeof(rbuf));
+	prep(&r.iocbs[0], IOCB_CMD_PREAD, fd, rbuf, BUF_SIZE, REQ_READ);
+	prep(&r.iocbs[1], IOCB_CMD_FSYNC, fd, NULL, 0, REQ_FSYNC);
+	prep(&r.iocbs[2], IOCB_CMD_PREAD, -1, rbuf, BUF_SIZE, REQ_BADF);
+	aio_uring_queue(&r, 0);
+	aio_uring_queue(&r, 1);
+	aio_uring_queue(&r, r.sq->nr);	/* dropped */
+	aio_uring_queue(&r, 2);
+
+	ret = sys_io_ring_enter(r.ctx, 4, NR_REQS,
+				IORING_FLAG_SUBMIT | IORING_FLAG_GETEVENTS);
+	if (ret != NR_REQS) {
+		printf("aio: %s io_ring_enter returned %d (%s), expected %d\n",
+		       name, ret, strerror(errno), NR_REQS);
+		goto fail;
+	}
+	if (r.sq->head != 4 || r.sq->dropped != 1) {
+		printf("aio: %s sq head %u dropped %u, expected 4 and 1\n",
+		       name, r.sq->head, r.sq->dropped);
+		goto fail;
+	}
+
+	for (i = 0; i < NR_REQS; i++) {
+		ev = aio_uring_peek(&r);
+		if (!ev) {
+			printf("aio: %s only %d events in the ring\n", name, i);
+			goto fail;
+		}
+		if (ev->data >= NR_REQS || seen[ev->data]++) {
+			printf("aio: %s bad event data %llu\n", name,
+			       (unsigned long long)ev->data);
+			goto fail;
+		}
+		if (aio_uring_index(&r, ev) != ev->data) {
+			printf("aio: %s event obj does not match its iocb\n",
+			       name);
+			goto fail;
+		}
+		switch (ev->data) {
+		case REQ_READ:
+			if (ev->res != BUF_SIZE ||
+			    memcmp(rbuf, wbuf, BUF_SIZE)) {
+				printf("aio: %s buffered read failed: %lld\n",
+				       name, (long long)ev->res);
+				goto fail;
+			}
+			break;
+		case REQ_FSYNC:
+			if (ev->res) {
+				printf("aio: %s fsync failed: %lld\n", name,
+				       (long long)ev->res);
+				goto fail;
+			}
+			break;
+		case REQ_BADF:
+			if (ev->res != -EBADF) {
+				printf("aio: %s bad fd returned %lld, expected %d\n",
+				       name, (long long)ev->res, -EBADF);
+				goto fail;
+			}
+			break;
+		}
+		aio_uring_advance(&r);
+	}
+
+	sys_io_destroy(r.ctx);
+	printf("aio: %s ring success.\n", name);
+	return 0;
+fail:
+	sys_io_destroy(r.ctx);
+	return -1;
+}
+
+static int test_legacy_ctx(void)
+{
+	aio_context_t ctx = 0;
+	int ret;
+
+	if (sys_io_setup(16, &ctx)) {
+		printf("aio: io_setup failed: %s\n", strerror(errno));
+		return -1;
+	}
+	ret = sys_io_ring_enter(ctx, 0, 0, IORING_FLAG_GETEVENTS);
+	sys_io_destroy(ctx);
+	if (ret != -1 || errno != EINVAL) {
+		printf("aio: io_ring_enter on an io_setup context returned %d\n",
+		       ret);
+		return -1;
+	}
+	printf("aio: io_setup context refused.\n");
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	char path[] = "/tmp/aio_ring_testXXXXXX";
+	aio_context_t ctx = 0;
+	int fd, i, ret = 0;
+
+	if (sys_io_setup2(16, IOCTX_FLAG_SCQRING, NULL, &ctx)) {
+		printf("aio: io_setup2 unavailable (%s), skipping.\n",
+		       strerror(errno));
+		return ksft_exit_skip();
+	}
+	sys_io_destroy(ctx);
+
+	fd = mkstemp(path);
+	if (fd < 0) {
+		perror("mkstemp");
+		return ksft_exit_fail();
+	}
+	unlink(path);
+	for (i = 0; i < BUF_SIZE; i++)
+		wbuf[i] = i * 7;
+	if (pwrite(fd, wbuf, BUF_SIZE, 0) != BUF_SIZE) {
+		perror("pwrite");
+		return ksft_exit_fail();
+	}
+
+	if (test_ring(fd, 0, "sleeping") ||
+	    test_ring(fd, IOCTX_FLAG_IOPOLL, "polled") ||
+	    test_legacy_ctx())
+		ret = -1;
+	close(fd);
+
+	return ret ? ksft_exit_fail() : ksft_exit_pass();
+}
@@ -0,0 +1,217 @@
+/*
+ * epoll_ctl_batch_test.c - epoll_ctl_batch() functional test and benchmark
+ *
+ * Checks that every command of a batch reports its own result, then
+ * applies NR_MODS EPOLL_CTL_MOD operations on NR_FDS pipes, once with one
+ * epoll_ctl() call per modification and once with epoll_ctl_batch(), and
+ * prints the number of system calls and the time taken by each variant.
+ */
+#define _GNU_SOURCE
+#define __EXPORTED_HEADERS__
+
+#include <linux/eventpoll.h>
+#include <sys/syscall.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../kselftest.h"
+
+#define NR_FDS		400
+#define NR_MODS		10000
+#define BATCH_SIZE	1000
+
+static int pipes[NR_FDS][2];
+static struct epoll_ctl_cmd cmds[NR_MODS];
+
+#ifdef __NR_epoll_ctl_batch
+static int sys_epoll_ctl_batch(int epfd, int flags, int ncmds,
+			       struct epoll_ctl_cmd *cmds)
+{
+	return syscall(__NR_epoll_ctl_batch, epfd, flags, ncmds, cmds);
+}
+#else
+static int sys_epoll_ctl_batch(int epfd, int flags, int ncmds,
+			       struct epoll_ctl_cmd *cmds)
+{
+	errno = ENOSYS;
+	return -1;
+}
+#endif
+
+static int sys_epoll_create1(int flags)
+{
+	return syscall(__NR_epoll_create1, flags);
+}
+
+static int sys_epoll_ctl(int epfd, int op, int fd, struct epoll_event *ev)
+{
+	return syscall(__NR_epoll_ctl, epfd, op, fd, ev);
+}
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void fill_cmd(struct epoll_ctl_cmd *cmd, int op, int fd,
+		     uint32_t events)
+{
+	memset(cmd, 0, sizeof(*cmd));
+	cmd->op = op;
+	cmd->fd = fd;
+	cmd->events = events;
+	cmd->data = fd;
+	cmd->result = -1;
+}
+
+static int test_results(int epfd)
+{
+	struct epoll_ctl_cmd c[5];
+	int ret;
+
+	fill_cmd(&c[0], EPOLL_CTL_ADD, pipes[0][0], POLLIN);
+	fill_cmd(&c[1], EPOLL_CTL_ADD, pipes[0][0], POLLIN);
+	fill_cmd(&c[2], EPOLL_CTL_MOD, -1, POLLIN);
+	fill_cmd(&c[3], EPOLL_CTL_DEL, pipes[1][0], 0);
+	fill_cmd(&c[4], EPOLL_CTL_MOD, pipes[0][0], POLLIN | EPOLLET);
+
+	ret = sys_epoll_ctl_batch(epfd, 0, 5, c);
+	if (ret != 5) {
+		printf("epoll_ctl_batch: returned %d (%s), expected 5\n",
+		       ret, strerror(errno));
+		return -1;
+	}
+	if (c[0].result != 0 || c[1].result != -EEXIST ||
+	    c[2].result != -EBADF || c[3].result != -ENOENT ||
+	    c[4].result != 0) {
+		printf("epoll_ctl_batch: unexpected results %d %d %d %d %d\n",
+		       c[0].result, c[1].result, c[2].result, c[3].result,
+		       c[4].result);
+		return -1;
+	}
+
+	fill_cmd(&c[0], EPOLL_CTL_DEL, pipes[0][0], 0);
+	c[0].flags = 1;
+	if (sys_epoll_ctl_batch(epfd, 0, 1, c) != 1 || c[0].result != -EINVAL) {
+		printf("epoll_ctl_batch: non-zero command flags accepted\n");
+		return -1;
+	}
+	c[0].flags = 0;
+	if (sys_epoll_ctl_batch(epfd, 0, 1, c) != 1 || c[0].result != 0) {
+		printf("epoll_ctl_batch: EPOLL_CTL_DEL failed: %d\n",
+		       c[0].result);
+		return -1;
+	}
+	if (sys_epoll_ctl_batch(epfd, 1, 1, c) != -1 || errno != EINVAL) {
+		printf("epoll_ctl_batch: non-zero flags accepted\n");
+		return -1;
+	}
+	if (sys_epoll_ctl_batch(epfd, 0, 1, NULL) != -1 || errno != EFAULT) {
+		printf("epoll_ctl_batch: bad command array accepted\n");
+		return -1;
+	}
+	printf("epoll_ctl_batch: per-command results success.\n");
+	return 0;
+}
+
+static int bench_mods(int epfd)
+{
+	unsigned long long start, single_ns, batch_ns;
+	struct epoll_event ev;
+	int i, ret, calls;
+
+	for (i = 0; i < NR_FDS; i++) {
+		ev.events = POLLIN;
+		ev.data = i;
+		if (sys_epoll_ctl(epfd, EPOLL_CTL_ADD, pipes[i][0], &ev)) {
+			printf("epoll_ctl: EPOLL_CTL_ADD failed: %s\n",
+			       strerror(errno));
+			return -1;
+		}
+	}
+
+	start = now_ns();
+	for (i = 0; i < NR_MODS; i++) {
+		ev.events = (i & 1) ? POLLIN : POLLIN | EPOLLET;
+		ev.data = i;
+		if (sys_epoll_ctl(epfd, EPOLL_CTL_MOD,
+				  pipes[i % NR_FDS][0], &ev)) {
+			printf("epoll_ctl: EPOLL_CTL_MOD failed: %s\n",
+			       strerror(errno));
+			return -1;
+		}
+	}
+	single_ns = now_ns() - start;
+
+	for (i = 0; i < NR_MODS; i++)
+		fill_cmd(&cmds[i], EPOLL_CTL_MOD, pipes[i % NR_FDS][0],
+			 (i & 1) ? POLLIN | EPOLLET : POLLIN);
+
+	start = now_ns();
+	for (i = 0, calls = 0; i < NR_MODS; i += BATCH_SIZE, calls++) {
+		ret = sys_epoll_ctl_batch(epfd, 0, BATCH_SIZE, &cmds[i]);
+		if (ret != BATCH_SIZE) {
+			printf("epoll_ctl_batch: returned %d (%s)\n",
+			       ret, strerror(errno));
+			return -1;
+		}
+	}
+	batch_ns = now_ns() - start;
+
+	for (i = 0; i < NR_MODS; i++) {
+		if (cmds[i].result) {
+			printf("epoll_ctl_batch: command %d failed: %d\n",
+			       i, cmds[i].result);
+			return -1;
+		}
+	}
+
+	printf("epoll_ctl:       %d modifications, %d syscalls, %llu us\n",
+	       NR_MODS, NR_MODS, single_ns / 1000);
+	printf("epoll_ctl_batch: %d modifications, %d syscalls, %llu us\n",
+	       NR_MODS, calls, batch_ns / 1000);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	struct epoll_ctl_cmd cmd;
+	int epfd, i, ret = 0;
+
+	epfd = sys_epoll_create1(0);
+	if (epfd < 0) {
+		perror("epoll_create1");
+		return ksft_exit_fail();
+	}
+	for (i = 0; i < NR_FDS; i++) {
+		if (pipe2(pipes[i], O_CLOEXEC)) {
+			perror("pipe2");
+			return ksft_exit_fail();
+		}
+	}
+
+	if (sys_epoll_ctl_batch(epfd, 0, 0, &cmd) && errno == ENOSYS) {
+		printf("epoll_ctl_batch: not supported, skipping.\n");
+		return ksft_exit_skip();
+	}
+
+	if (test_results(epfd) || bench_mods(epfd))
+		ret = -1;
+
+	for (i = 0; i < NR_FDS; i++) {
+		close(pipes[i][0]);
+		close(pipes[i][1]);
+	}
+	close(epfd);
+
+	return ret ? ksft_exit_fail() : ksft_exit_pass();
+}
@@ -0,0 +1,193 @@
+/*
+ * epoll_userpoll_test.c - EPOLL_USERPOLL shared ready ring test
+ *
+ * Creates an epoll instance with a ring shared with userspace, registers
+ * edge-triggered pipes and checks that writes to them are reaped from the
+ * ring without calling epoll_wait(), that epoll_wait() returns as soon as
+ * the ring is non-empty, and that level-triggered registrations are
+ * refused.
+ */
+#define _GNU_SOURCE
+#define __EXPORTED_HEADERS__
+
+#include <linux/eventpoll.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "../kselftest.h"
+
+#define NR_ITEMS	64
+
+static int pipes[NR_ITEMS][2];
+
+static struct epoll_uheader *header;
+static struct epoll_uitem *items;
+static uint32_t *ring;
+
+#ifdef __NR_epoll_create2
+static int sys_epoll_create2(int flags, int size)
+{
+	return syscall(__NR_epoll_create2, flags, size);
+}
+#else
+static int sys_epoll_create2(int flags, int size)
+{
+	errno = ENOSYS;
+	return -1;
+}
+#endif
+
+static int sys_epoll_ctl(int epfd, int op, int fd, struct epoll_event *ev)
+{
+	return syscall(__NR_epoll_ctl, epfd, op, fd, ev);
+}
+
+static int sys_epoll_wait(int epfd, struct epoll_event *events,
+			  int maxevents, int timeout)
+{
+	return syscall(__NR_epoll_wait, epfd, events, maxevents, timeout);
+}
+
+/* Reaps the ring, marking every ready item in @seen. */
+static int reap(int *seen)
+{
+	uint32_t head, tail, idx, ready;
+	int nr = 0;
+
+	head = header->head;
+	tail = __atomic_load_n(&header->tail, __ATOMIC_ACQUIRE);
+	while (head != tail) {
+		idx = ring[head & header->ring_mask];
+		ready = __atomic_exchange_n(&items[idx].ready_events, 0,
+					    __ATOMIC_ACQ_REL);
+		if (ready) {
+			seen[items[idx].data]++;
+			nr++;
+		}
+		head++;
+	}
+	__atomic_store_n(&header->head, head, __ATOMIC_RELEASE);
+
+	return nr;
+}
+
+int main(int argc, char **argv)
+{
+	struct epoll_event ev;
+	int seen[NR_ITEMS] = { 0 };
+	int epfd, i, nr;
+	size_t length;
+	void *map;
+
+	epfd = sys_epoll_create2(EPOLL_USERPOLL, NR_ITEMS);
+	if (epfd < 0) {
+		printf("epoll_userpoll: EPOLL_USERPOLL not supported (%s), skipping.\n",
+		       strerror(errno));
+		return ksft_exit_skip();
+	}
+
+	map = mmap(NULL, sysconf(_SC_PAGESIZE), PROT_READ | PROT_WRITE,
+		   MAP_SHARED, epfd, 0);
+	if (map == MAP_FAILED) {
+		perror("mmap");
+		return ksft_exit_fail();
+	}
+	header = map;
+	if (header->magic != EPOLL_USERPOLL_HEADER_MAGIC ||
+	    header->max_items != NR_ITEMS) {
+		printf("epoll_userpoll: bad header\n");
+		return ksft_exit_fail();
+	}
+	length = header->header_length;
+	munmap(map, sysconf(_SC_PAGESIZE));
+	map = mmap(NULL, length, PROT_READ | PROT_WRITE,
+		   MAP_SHARED, epfd, 0);
+	if (map == MAP_FAILED) {
+		perror("mmap");
+		return ksft_exit_fail();
+	}
+	header = map;
+	items = map + header->items_offset;
+	ring = map + header->ring_offset;
+
+	for (i = 0; i < NR_ITEMS; i++) {
+		if (pipe(pipes[i])) {
+			perror("pipe");
+			return ksft_exit_fail();
+		}
+	}
+
+	ev.events = POLLIN;
+	ev.data = 0;
+	if (sys_epoll_ctl(epfd, EPOLL_CTL_ADD, pipes[0][0], &ev) != -1 ||
+	    errno != EINVAL) {
+		printf("epoll_userpoll: level-triggered item accepted\n");
+		return ksft_exit_fail();
+	}
+
+	for (i = 0; i < NR_ITEMS; i++) {
+		ev.events = POLLIN | EPOLLET;
+		ev.data = i;
+		if (sys_epoll_ctl(epfd, EPOLL_CTL_ADD, pipes[i][0], &ev)) {
+			perror("epoll_ctl");
+			return ksft_exit_fail();
+		}
+	}
+	ev.events = POLLIN | EPOLLET;
+	if (sys_epoll_ctl(epfd, EPOLL_CTL_ADD, pipes[0][1], &ev) != -1 ||
+	    errno != ENOSPC) {
+		printf("epoll_userpoll: item beyond the ring size accepted\n");
+		return ksft_exit_fail();
+	}
+
+	if (reap(seen)) {
+		printf("epoll_userpoll: events reaped before any write\n");
+		return ksft_exit_fail();
+	}
+
+	/* Write twice to every other pipe: one ring entry each. */
+	for (i = 0; i < NR_ITEMS; i += 2) {
+		if (write(pipes[i][1], "x", 1) != 1 ||
+		    write(pipes[i][1], "x", 1) != 1) {
+			perror("write");
+			return ksft_exit_fail();
+		}
+	}
+
+	/* epoll_wait() must not block while the ring is non-empty. */
+	nr = sys_epoll_wait(epfd, &ev, 1, -1);
+	if (nr != 0) {
+		printf("epoll_userpoll: epoll_wait returned %d, expected 0\n",
+		       nr);
+		return ksft_exit_fail();
+	}
+
+	nr = reap(seen);
+	if (nr != NR_ITEMS / 2) {
+		printf("epoll_userpoll: reaped %d events, expected %d\n",
+		       nr, NR_ITEMS / 2);
+		return ksft_exit_fail();
+	}
+	for (i = 0; i < NR_ITEMS; i++) {
+		if (seen[i] != !(i & 1)) {
+			printf("epoll_userpoll: item %d seen %d times\n",
+			       i, seen[i]);
+			return ksft_exit_fail();
+		}
+	}
+
+	if (sys_epoll_wait(epfd, &ev, 1, 0) != 0) {
+		printf("epoll_userpoll: events left after reaping the ring\n");
+		return ksft_exit_fail();
+	}
+
+	printf("epoll_userpoll: shared ready ring success.\n");
+	return ksft_exit_pass();
+}
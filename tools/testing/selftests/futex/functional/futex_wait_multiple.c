@@ -0,0 +1,129 @@
+/******************************************************************************
+ *
+ *   This program is free software;  you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ * DESCRIPTION
+ *      Test FUTEX_WAIT_MULTIPLE: a mismatching value returns EWOULDBLOCK,
+ *      a wakeup on any futex of the vector returns its index, and the
+ *      absolute timeout expires with ETIMEDOUT.
+ *
+ *****************************************************************************/
+
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "futextest.h"
+#include "logging.h"
+
+#define NR_FUTEXES	8
+#define WAKE_INDEX	5
+
+static futex_t futexes[NR_FUTEXES];
+static struct futex_wait_block wb[NR_FUTEXES];
+static int waiter_ret, waiter_errno;
+
+void usage(char *prog)
+{
+	printf("Usage: %s\n", prog);
+	printf("  -c	Use color\n");
+	printf("  -h	Display this help message\n");
+	printf("  -v L	Verbosity level: %d=QUIET %d=CRITICAL %d=INFO\n",
+	       VQUIET, VCRITICAL, VINFO);
+}
+
+static void *waiterfn(void *arg)
+{
+	waiter_ret = futex_wait_multiple(wb, NR_FUTEXES, NULL);
+	waiter_errno = errno;
+	return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+	struct timespec to;
+	pthread_t waiter;
+	int res, ret = RET_PASS;
+	int c, i;
+
+	while ((c = getopt(argc, argv, "chv:")) != -1) {
+		switch (c) {
+		case 'c':
+			log_color(1);
+			break;
+		case 'h':
+			usage(basename(argv[0]));
+			exit(0);
+		case 'v':
+			log_verbosity(atoi(optarg));
+			break;
+		default:
+			usage(basename(argv[0]));
+			exit(1);
+		}
+	}
+
+	printf("%s: Wait on any of %d futexes\n", basename(argv[0]),
+	       NR_FUTEXES);
+
+	for (i = 0; i < NR_FUTEXES; i++) {
+		wb[i].uaddr = (unsigned long)&futexes[i];
+		wb[i].val = 0;
+		wb[i].flags = FUTEX_PRIVATE_FLAG;
+	}
+
+	info("Calling futex_wait_multiple with a mismatching value\n");
+	wb[NR_FUTEXES - 1].val = 1;
+	res = futex_wait_multiple(wb, NR_FUTEXES, NULL);
+	if (res == -1 && errno == ENOSYS) {
+		error("FUTEX_WAIT_MULTIPLE not supported\n", errno);
+		ret = RET_ERROR;
+		goto out;
+	}
+	if (res != -1 || errno != EWOULDBLOCK) {
+		fail("futex_wait_multiple returned %d (%s), expected EWOULDBLOCK\n",
+		     res, strerror(errno));
+		ret = RET_FAIL;
+	}
+	wb[NR_FUTEXES - 1].val = 0;
+
+	info("Calling futex_wait_multiple with a 100ms timeout\n");
+	clock_gettime(CLOCK_MONOTONIC, &to);
+	to.tv_nsec += 100000000;
+	if (to.tv_nsec >= 1000000000) {
+		to.tv_sec++;
+		to.tv_nsec -= 1000000000;
+	}
+	res = futex_wait_multiple(wb, NR_FUTEXES, &to);
+	if (res != -1 || errno != ETIMEDOUT) {
+		fail("futex_wait_multiple returned %d (%s), expected ETIMEDOUT\n",
+		     res, strerror(errno));
+		ret = RET_FAIL;
+	}
+
+	info("Waking futex %d of the vector\n", WAKE_INDEX);
+	if (pthread_create(&waiter, NULL, waiterfn, NULL)) {
+		error("pthread_create failed\n", errno);
+		ret = RET_ERROR;
+		goto out;
+	}
+	/* Keep trying until the waiter is queued. */
+	while (futex_wake(&futexes[WAKE_INDEX], 1, FUTEX_PRIVATE_FLAG) < 1)
+		usleep(1000);
+	pthread_join(waiter, NULL);
+	if (waiter_ret != WAKE_INDEX) {
+		fail("futex_wait_multiple returned %d (%s), expected %d\n",
+		     waiter_ret, strerror(waiter_errno), WAKE_INDEX);
+		ret = RET_FAIL;
+	}
+
+out:
+	print_result(ret);
+	return ret;
+}
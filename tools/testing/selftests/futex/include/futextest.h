@@ -50,6 +50,14 @@ typedef volatile u_int32_t futex_t;
 #define FUTEX_CMP_REQUEUE_PI_PRIVATE	(FUTEX_CMP_REQUEUE_PI | \
 					 FUTEX_PRIVATE_FLAG)
 #endif
+#ifndef FUTEX_WAIT_MULTIPLE
+#define FUTEX_WAIT_MULTIPLE		31
+struct futex_wait_block {
+	__u64 uaddr;
+	__u32 val;
+	__u32 flags;
+};
+#endif
 
 /**
  * futex() - SYS_futex syscall wrapper
@@ -84,6 +92,21 @@ futex_wait(futex_t *uaddr, futex_t val, struct timespec *timeout, int opflags)
 	return futex(uaddr, FUTEX_WAIT, val, timeout, NULL, 0, opflags);
 }
 
+/**
+ * futex_wait_multiple() - block on several futexes, wake on any of them
+ * @wb:		array of wait blocks, each with its own address, value and flags
+ * @count:	number of entries in @wb
+ * @timeout:	absolute CLOCK_MONOTONIC timeout
+ *
+ * Return the index of the woken futex.
+ */
+static inline int
+futex_wait_multiple(struct futex_wait_block *wb, int count,
+		    struct timespec *timeout)
+{
+	return futex(wb, FUTEX_WAIT_MULTIPLE, count, timeout, NULL, 0, 0);
+}
+
 /**
  * futex_wake() - wake one or more tasks blocked on uaddr
  * @nr_wake:	wake up to this many tasks
@@ -0,0 +1,129 @@
+/*
+ * membarrier_bench.c - compare the latency of the membarrier commands
+ *
+ * Starts one busy thread per online CPU (minus the caller), so that the
+ * private expedited command actually has to interrupt sibling threads,
+ * then times MEMBARRIER_CMD_SHARED and MEMBARRIER_CMD_PRIVATE_EXPEDITED.
+ *
+ * Usage: membarrier_bench [-t threads] [-n loops]
+ */
+#define _GNU_SOURCE
+#define __EXPORTED_HEADERS__
+
+#include <linux/membarrier.h>
+#include <asm-generic/unistd.h>
+#include <sys/syscall.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../kselftest.h"
+
+static volatile int stop;
+
+static int sys_membarrier(int cmd, int flags)
+{
+	return syscall(__NR_membarrier, cmd, flags);
+}
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void *spin_thread(void *arg)
+{
+	while (!stop)
+		;
+	return NULL;
+}
+
+static int bench(const char *name, int cmd, unsigned int loops)
+{
+	unsigned long long start, end;
+	unsigned int i;
+
+	start = now_ns();
+	for (i = 0; i < loops; i++) {
+		if (sys_membarrier(cmd, 0)) {
+			printf("%s: membarrier failed: %s\n", name,
+			       strerror(errno));
+			return -1;
+		}
+	}
+	end = now_ns();
+
+	printf("%-28s %8u calls %12.3f us/call\n", name, loops,
+	       (double)(end - start) / loops / 1000.0);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	long nr_threads = sysconf(_SC_NPROCESSORS_ONLN) - 1;
+	unsigned int loops = 1000, shared_loops;
+	pthread_t *threads;
+	int ret, c, i;
+
+	while ((c = getopt(argc, argv, "t:n:")) != -1) {
+		switch (c) {
+		case 't':
+			nr_threads = atol(optarg);
+			break;
+		case 'n':
+			loops = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-t threads] [-n loops]\n",
+				argv[0]);
+			return ksft_exit_fail();
+		}
+	}
+	if (nr_threads < 0)
+		nr_threads = 0;
+	if (!loops)
+		loops = 1;
+
+	ret = sys_membarrier(MEMBARRIER_CMD_QUERY, 0);
+	if (ret < 0 || !(ret & MEMBARRIER_CMD_PRIVATE_EXPEDITED)) {
+		printf("membarrier: private expedited command not supported\n");
+		return ksft_exit_skip();
+	}
+	if (sys_membarrier(MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0)) {
+		printf("membarrier: registration failed: %s\n", strerror(errno));
+		return ksft_exit_fail();
+	}
+
+	threads = calloc(nr_threads, sizeof(*threads));
+	if (!threads)
+		return ksft_exit_fail();
+	for (i = 0; i < nr_threads; i++) {
+		if (pthread_create(&threads[i], NULL, spin_thread, NULL)) {
+			nr_threads = i;
+			break;
+		}
+	}
+	printf("membarrier: %ld spinning threads\n", nr_threads);
+
+	/* The shared command waits for a grace period, keep it short. */
+	shared_loops = loops / 100 ? loops / 100 : 1;
+	ret = bench("MEMBARRIER_CMD_SHARED", MEMBARRIER_CMD_SHARED,
+		    shared_loops);
+	if (!ret)
+		ret = bench("MEMBARRIER_CMD_PRIVATE_EXPEDITED",
+			    MEMBARRIER_CMD_PRIVATE_EXPEDITED, loops);
+
+	stop = 1;
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+
+	return ret ? ksft_exit_fail() : ksft_exit_pass();
+}
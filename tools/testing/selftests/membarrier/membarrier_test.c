@@ -57,6 +57,41 @@ static enum test_membarrier_status test_membarrier_success(void)
 	return TEST_MEMBARRIER_PASS;
 }
 
+static enum test_membarrier_status test_membarrier_private_expedited_fail(void)
+{
+	int cmd = MEMBARRIER_CMD_PRIVATE_EXPEDITED, flags = 0;
+
+	if (sys_membarrier(cmd, flags) != -1) {
+		printf("membarrier: Private expedited before registration should fail but passed.\n");
+		return TEST_MEMBARRIER_FAIL;
+	}
+	if (errno != EPERM) {
+		printf("membarrier: Private expedited before registration should return EPERM, got %s.\n",
+				strerror(errno));
+		return TEST_MEMBARRIER_FAIL;
+	}
+	return TEST_MEMBARRIER_PASS;
+}
+
+static enum test_membarrier_status test_membarrier_private_expedited_success(void)
+{
+	int flags = 0;
+
+	if (sys_membarrier(MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, flags) != 0) {
+		printf("membarrier: Registering private expedited failed. %s.\n",
+				strerror(errno));
+		return TEST_MEMBARRIER_FAIL;
+	}
+	if (sys_membarrier(MEMBARRIER_CMD_PRIVATE_EXPEDITED, flags) != 0) {
+		printf("membarrier: Executing MEMBARRIER_CMD_PRIVATE_EXPEDITED failed. %s.\n",
+				strerror(errno));
+		return TEST_MEMBARRIER_FAIL;
+	}
+
+	printf("membarrier: MEMBARRIER_CMD_PRIVATE_EXPEDITED success.\n");
+	return TEST_MEMBARRIER_PASS;
+}
+
 static enum test_membarrier_status test_membarrier(void)
 {
 	enum test_membarrier_status status;
@@ -68,6 +103,12 @@ static enum test_membarrier_status test_membarrier(void)
 	if (status)
 		return status;
 	status = test_membarrier_success();
+	if (status)
+		return status;
+	status = test_membarrier_private_expedited_fail();
+	if (status)
+		return status;
+	status = test_membarrier_private_expedited_success();
 	if (status)
 		return status;
 	return TEST_MEMBARRIER_PASS;
@@ -97,6 +138,10 @@ static enum test_membarrier_status test_membarrier_query(void)
 		printf("command MEMBARRIER_CMD_SHARED is not supported.\n");
 		return TEST_MEMBARRIER_FAIL;
 	}
+	if (!(ret & MEMBARRIER_CMD_PRIVATE_EXPEDITED)) {
+		printf("command MEMBARRIER_CMD_PRIVATE_EXPEDITED is not supported.\n");
+		return TEST_MEMBARRIER_FAIL;
+	}
 	printf("syscall available.\n");
 	return TEST_MEMBARRIER_PASS;
 }
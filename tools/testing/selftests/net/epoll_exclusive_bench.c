@@ -0,0 +1,234 @@
+/*
+ * epoll_exclusive_bench.c - EPOLLEXCLUSIVE accept benchmark
+ *
+ * Starts a number of worker threads, each with its own epoll instance
+ * watching the same non-blocking listening socket, then connects to it
+ * one connection at a time. Every worker accepts when woken up, so without
+ * EPOLLEXCLUSIVE all of them are woken up for every connection and all but
+ * one get EAGAIN from accept().
+ *
+ * Reports the accept latency (from connect() to accept() returning), the
+ * number of wakeups and wasted wakeups (accept() failing with EAGAIN) seen
+ * by the workers per connection, and the number of context switches per
+ * connection, without and with EPOLLEXCLUSIVE. The latter also accounts
+ * for workers woken up for nothing which find no ready event when
+ * epoll_wait() polls the socket again, and go back to sleep.
+ *
+ * Usage: epoll_exclusive_bench [-w workers] [-n connections]
+ */
+#define _GNU_SOURCE
+
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifndef EPOLLEXCLUSIVE
+#define EPOLLEXCLUSIVE (1u << 28)
+#endif
+
+static int nr_workers = 64;
+static int nr_conns = 2000;
+
+static int listen_fd;
+static volatile int stop;
+static volatile unsigned long long connect_ns;
+static unsigned long accepted, wakeups, wasted;
+static unsigned long long latency_ns;
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void *worker(void *arg)
+{
+	int epfd = *(int *)arg;
+	struct epoll_event ev;
+	unsigned long long lat;
+	int fd;
+
+	while (!stop) {
+		if (epoll_wait(epfd, &ev, 1, 100) < 1)
+			continue;
+
+		fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK);
+		lat = now_ns() - connect_ns;
+
+		pthread_mutex_lock(&stats_lock);
+		wakeups++;
+		if (fd >= 0) {
+			latency_ns += lat;
+			accepted++;
+		} else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			wasted++;
+		}
+		pthread_mutex_unlock(&stats_lock);
+
+		if (fd >= 0)
+			close(fd);
+	}
+
+	return NULL;
+}
+
+static long context_switches(void)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_nvcsw + ru.ru_nivcsw;
+}
+
+static unsigned long read_accepted(void)
+{
+	unsigned long ret;
+
+	pthread_mutex_lock(&stats_lock);
+	ret = accepted;
+	pthread_mutex_unlock(&stats_lock);
+
+	return ret;
+}
+
+static int run(struct sockaddr_in *addr, int exclusive)
+{
+	pthread_t threads[nr_workers];
+	int epfds[nr_workers];
+	struct epoll_event ev;
+	unsigned long long start;
+	long csw;
+	int i, fd;
+
+	stop = 0;
+	accepted = wakeups = wasted = 0;
+	latency_ns = 0;
+
+	for (i = 0; i < nr_workers; i++) {
+		epfds[i] = epoll_create1(EPOLL_CLOEXEC);
+		if (epfds[i] < 0) {
+			perror("epoll_create1");
+			return -1;
+		}
+		ev.events = EPOLLIN | (exclusive ? EPOLLEXCLUSIVE : 0);
+		ev.data.fd = listen_fd;
+		if (epoll_ctl(epfds[i], EPOLL_CTL_ADD, listen_fd, &ev)) {
+			if (exclusive && errno == EINVAL && i == 0) {
+				printf("EPOLLEXCLUSIVE not supported, skipping\n");
+				close(epfds[i]);
+				return 0;
+			}
+			perror("epoll_ctl");
+			return -1;
+		}
+		if (pthread_create(&threads[i], NULL, worker, &epfds[i])) {
+			perror("pthread_create");
+			return -1;
+		}
+	}
+
+	/* Let every worker block in epoll_wait() */
+	usleep(100000);
+
+	csw = context_switches();
+	for (i = 0; i < nr_conns; i++) {
+		fd = socket(AF_INET, SOCK_STREAM, 0);
+		if (fd < 0) {
+			perror("socket");
+			return -1;
+		}
+		connect_ns = now_ns();
+		if (connect(fd, (struct sockaddr *)addr, sizeof(*addr))) {
+			perror("connect");
+			return -1;
+		}
+		start = now_ns();
+		while (read_accepted() != i + 1) {
+			if (now_ns() - start > 1000000000ULL) {
+				fprintf(stderr, "connection %d not accepted\n", i);
+				return -1;
+			}
+			sched_yield();
+		}
+		close(fd);
+	}
+
+	/* Give late wakeups for the last connection a chance to be counted */
+	usleep(10000);
+	csw = context_switches() - csw;
+	stop = 1;
+	for (i = 0; i < nr_workers; i++) {
+		pthread_join(threads[i], NULL);
+		close(epfds[i]);
+	}
+
+	printf("%-15s %d workers, %d connections: accept latency %.2f us, "
+	       "%.2f wakeups/conn, %.2f wasted wakeups/conn, "
+	       "%.2f context switches/conn\n",
+	       exclusive ? "EPOLLEXCLUSIVE:" : "shared:", nr_workers, nr_conns,
+	       (double)latency_ns / accepted / 1000,
+	       (double)wakeups / nr_conns, (double)wasted / nr_conns,
+	       (double)csw / nr_conns);
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	struct sockaddr_in addr;
+	socklen_t len = sizeof(addr);
+	int c;
+
+	while ((c = getopt(argc, argv, "w:n:")) != -1) {
+		switch (c) {
+		case 'w':
+			nr_workers = atoi(optarg);
+			break;
+		case 'n':
+			nr_conns = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-w workers] [-n connections]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+	if (nr_workers <= 0 || nr_conns <= 0) {
+		fprintf(stderr, "invalid number of workers or connections\n");
+		return 1;
+	}
+
+	listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	if (listen_fd < 0) {
+		perror("socket");
+		return 1;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+	    getsockname(listen_fd, (struct sockaddr *)&addr, &len) ||
+	    listen(listen_fd, 1024)) {
+		perror("listen");
+		return 1;
+	}
+
+	if (run(&addr, 0) || run(&addr, 1))
+		return 1;
+
+	close(listen_fd);
+	return 0;
+}
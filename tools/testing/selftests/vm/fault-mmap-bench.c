@@ -0,0 +1,224 @@
+/*
+ * fault-mmap-bench.c - page faults against concurrent mmap()/munmap()
+ *
+ * Fault threads keep faulting in a private region of their own, throwing
+ * the pages away with MADV_DONTNEED after each pass, while churn threads
+ * map and unmap small areas of the same address space.  With mmap_sem
+ * taken on every fault the churn threads stall the faulting ones; with
+ * speculative page faults they should not.
+ *
+ * Reports pages faulted in per second, and how many page faults were
+ * handled speculatively according to the speculative_pgfault counter in
+ * /proc/vmstat, when the kernel has it.  File faults map pages around
+ * the faulting one, so there are fewer faults than pages.
+ *
+ * With -f the fault threads read a shared file mapping instead of writing
+ * to anonymous memory.
+ *
+ * Usage: fault-mmap-bench [-f] [-t fault threads] [-c churn threads]
+ *                         [-s seconds] [-m MB per fault thread]
+ */
+#define _GNU_SOURCE
+
+#include <err.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+
+static int nr_fault = 4, nr_churn = 1, seconds = 5, use_file;
+static size_t region_size = 64 << 20;
+static long page_size;
+static int file_fd = -1;
+static volatile int stop;
+
+struct fault_thread {
+	pthread_t thread;
+	unsigned long long faults;
+};
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static long long vmstat_spf(void)
+{
+	char name[64];
+	long long val;
+	FILE *f;
+
+	f = fopen("/proc/vmstat", "r");
+	if (!f)
+		return -1;
+	while (fscanf(f, "%63s %lld", name, &val) == 2) {
+		if (!strcmp(name, "speculative_pgfault")) {
+			fclose(f);
+			return val;
+		}
+	}
+	fclose(f);
+	return -1;
+}
+
+static void *fault_fn(void *arg)
+{
+	struct fault_thread *t = arg;
+	volatile char *p;
+	size_t off;
+	char *region;
+
+	if (use_file)
+		region = mmap(NULL, region_size, PROT_READ, MAP_SHARED,
+			      file_fd, 0);
+	else
+		region = mmap(NULL, region_size, PROT_READ | PROT_WRITE,
+			      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (region == MAP_FAILED)
+		err(1, "mmap");
+	/* Huge pages would hide the faults this is meant to count. */
+	if (!use_file)
+		madvise(region, region_size, MADV_NOHUGEPAGE);
+
+	p = region;
+	while (!stop) {
+		for (off = 0; off < region_size && !stop; off += page_size) {
+			if (use_file)
+				(void)p[off];
+			else
+				p[off] = 1;
+			t->faults++;
+		}
+		if (madvise(region, region_size, MADV_DONTNEED))
+			err(1, "madvise");
+	}
+
+	munmap(region, region_size);
+	return NULL;
+}
+
+static void *churn_fn(void *arg)
+{
+	unsigned long long *ops = arg;
+	char *p;
+
+	while (!stop) {
+		p = mmap(NULL, 16 * page_size, PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (p == MAP_FAILED)
+			err(1, "mmap");
+		p[0] = 1;
+		munmap(p, 16 * page_size);
+		(*ops)++;
+	}
+	return NULL;
+}
+
+static void setup_file(void)
+{
+	char path[] = "/tmp/fault-mmap-benchXXXXXX";
+	char *buf;
+	size_t off;
+
+	file_fd = mkstemp(path);
+	if (file_fd < 0)
+		err(1, "mkstemp");
+	unlink(path);
+
+	buf = calloc(1, page_size);
+	if (!buf)
+		err(1, "calloc");
+	for (off = 0; off < region_size; off += page_size) {
+		buf[0] = off / page_size;
+		if (pwrite(file_fd, buf, page_size, off) != page_size)
+			err(1, "pwrite");
+	}
+	free(buf);
+}
+
+int main(int argc, char **argv)
+{
+	struct fault_thread *faulters;
+	unsigned long long faults = 0, churn_ops = 0, *churn_counts;
+	pthread_t *churners;
+	long long spf_start, spf_end;
+	double start, elapsed;
+	int c, i;
+
+	while ((c = getopt(argc, argv, "ft:c:s:m:")) != -1) {
+		switch (c) {
+		case 'f':
+			use_file = 1;
+			break;
+		case 't':
+			nr_fault = atoi(optarg);
+			break;
+		case 'c':
+			nr_churn = atoi(optarg);
+			break;
+		case 's':
+			seconds = atoi(optarg);
+			break;
+		case 'm':
+			region_size = (size_t)atoi(optarg) << 20;
+			break;
+		default:
+			fprintf(stderr,
+				"Usage: %s [-f] [-t fault threads] [-c churn threads] [-s seconds] [-m MB]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+	if (nr_fault < 1 || nr_churn < 0 || !region_size)
+		errx(1, "need at least one fault thread and a region");
+
+	page_size = sysconf(_SC_PAGESIZE);
+	if (use_file)
+		setup_file();
+
+	faulters = calloc(nr_fault, sizeof(*faulters));
+	churners = calloc(nr_churn + 1, sizeof(*churners));
+	churn_counts = calloc(nr_churn + 1, sizeof(*churn_counts));
+	if (!faulters || !churners || !churn_counts)
+		err(1, "calloc");
+
+	spf_start = vmstat_spf();
+	start = now();
+	for (i = 0; i < nr_fault; i++)
+		if (pthread_create(&faulters[i].thread, NULL, fault_fn,
+				   &faulters[i]))
+			errx(1, "pthread_create");
+	for (i = 0; i < nr_churn; i++)
+		if (pthread_create(&churners[i], NULL, churn_fn,
+				   &churn_counts[i]))
+			errx(1, "pthread_create");
+
+	sleep(seconds);
+	stop = 1;
+
+	for (i = 0; i < nr_fault; i++) {
+		pthread_join(faulters[i].thread, NULL);
+		faults += faulters[i].faults;
+	}
+	for (i = 0; i < nr_churn; i++) {
+		pthread_join(churners[i], NULL);
+		churn_ops += churn_counts[i];
+	}
+	elapsed = now() - start;
+	spf_end = vmstat_spf();
+
+	printf("%s faults, %d fault threads, %d churn threads\n",
+	       use_file ? "file read" : "anon write", nr_fault, nr_churn);
+	printf("%12.0f pages faulted/sec\n", faults / elapsed);
+	printf("%12.0f mmap/munmap/sec\n", churn_ops / elapsed);
+	if (spf_start >= 0 && spf_end >= 0 && faults)
+		printf("%12lld speculative faults\n", spf_end - spf_start);
+	return 0;
+}
@@ -0,0 +1,195 @@
+/*
+ * filemap-huge-bench.c - random reads through a huge pmd mapped file
+ *
+ * Maps a file shared and read-only at a huge page aligned address, as a
+ * database would map an index file, and reads random words from all of
+ * it, once with MADV_NOHUGEPAGE, so that the page cache is mapped with
+ * small pages, and once with MADV_HUGEPAGE, so that the kernel can map
+ * each cold 2MB range of it with a single pmd.  The file
+ * is dropped from the page cache before each run, since only ranges none
+ * of which is cached yet are read into contiguous memory.
+ *
+ * Reports how long faulting the whole file in took, the random reads per
+ * second after that, and how many ranges were mapped by a huge pmd
+ * according to thp_file_mapped in /proc/vmstat, when the kernel has it.
+ * The file is created in the given directory, which should be on ext4.
+ *
+ * Usage: filemap-huge-bench [-f file MB] [-s seconds] [directory]
+ */
+#define _GNU_SOURCE
+
+#include <err.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+
+#define HPAGE_SIZE	(2UL << 20)
+#define CHUNK		(1 << 20)
+
+static int file_mb = 512, seconds = 5;
+static const char *dir = ".";
+static long page_size;
+static volatile int stop;
+static volatile unsigned long sink;
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static long long vmstat_thp_file_mapped(void)
+{
+	char name[64];
+	long long val;
+	FILE *f;
+
+	f = fopen("/proc/vmstat", "r");
+	if (!f)
+		return -1;
+	while (fscanf(f, "%63s %lld", name, &val) == 2) {
+		if (!strcmp(name, "thp_file_mapped")) {
+			fclose(f);
+			return val;
+		}
+	}
+	fclose(f);
+	return -1;
+}
+
+static int create_file(const char *path)
+{
+	char *buf;
+	int fd, i;
+
+	fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0)
+		err(1, "%s", path);
+	buf = malloc(CHUNK);
+	if (!buf)
+		err(1, "malloc");
+	for (i = 0; i < file_mb; i++) {
+		memset(buf, i + 1, CHUNK);
+		if (write(fd, buf, CHUNK) != CHUNK)
+			err(1, "%s", path);
+	}
+	fsync(fd);
+	free(buf);
+	close(fd);
+
+	/* Opened for writing, the shared mapping could be made writable. */
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		err(1, "%s", path);
+	return fd;
+}
+
+static void alarm_handler(int sig)
+{
+	stop = 1;
+}
+
+static void run(int fd, int advice, const char *name)
+{
+	size_t size = (size_t)file_mb << 20;
+	unsigned long long reads = 0, x = 88172645463325252ULL;
+	long long mapped = vmstat_thp_file_mapped();
+	double start, fault_time, elapsed;
+	unsigned long sum = 0;
+	char *map, *addr;
+	size_t off;
+
+	/* Start with none of the file cached. */
+	if (posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED))
+		warnx("POSIX_FADV_DONTNEED failed");
+
+	map = mmap(NULL, size + HPAGE_SIZE, PROT_NONE,
+		   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (map == MAP_FAILED)
+		err(1, "mmap");
+	addr = (char *)(((unsigned long)map + HPAGE_SIZE - 1) &
+			~(HPAGE_SIZE - 1));
+	if (mmap(addr, size, PROT_READ, MAP_SHARED | MAP_FIXED, fd, 0) !=
+	    addr)
+		err(1, "mmap");
+	if (madvise(addr, size, advice))
+		err(1, "madvise");
+
+	start = now();
+	for (off = 0; off < size; off += page_size)
+		sum += addr[off];
+	fault_time = now() - start;
+
+	stop = 0;
+	alarm(seconds);
+	start = now();
+	while (!stop) {
+		int i;
+
+		for (i = 0; i < 1024; i++) {
+			x ^= x << 13;
+			x ^= x >> 7;
+			x ^= x << 17;
+			sum += *(unsigned long *)(addr +
+				((x % size) & ~(sizeof(unsigned long) - 1)));
+		}
+		reads += 1024;
+	}
+	elapsed = now() - start;
+
+	printf("%-15s fault in %7.3f s, %8.2f M reads/sec",
+	       name, fault_time, reads / elapsed / 1e6);
+	if (mapped >= 0)
+		printf(", %lld huge pmds", vmstat_thp_file_mapped() - mapped);
+	printf("\n");
+	sink = sum;
+
+	munmap(map, size + HPAGE_SIZE);
+}
+
+int main(int argc, char **argv)
+{
+	char path[PATH_MAX];
+	int c, fd;
+
+	while ((c = getopt(argc, argv, "f:s:")) != -1) {
+		switch (c) {
+		case 'f':
+			file_mb = atoi(optarg);
+			break;
+		case 's':
+			seconds = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr,
+				"Usage: %s [-f file MB] [-s seconds] [directory]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+	if (optind < argc)
+		dir = argv[optind];
+	if (file_mb < 2 || seconds < 1)
+		errx(1, "need a file of at least 2 MB and a second to run");
+	file_mb &= ~1;
+	page_size = sysconf(_SC_PAGESIZE);
+	signal(SIGALRM, alarm_handler);
+
+	snprintf(path, sizeof(path), "%s/filemap-huge-bench.data", dir);
+	fd = create_file(path);
+
+	run(fd, MADV_NOHUGEPAGE, "MADV_NOHUGEPAGE");
+	run(fd, MADV_HUGEPAGE, "MADV_HUGEPAGE");
+
+	close(fd);
+	unlink(path);
+	return 0;
+}
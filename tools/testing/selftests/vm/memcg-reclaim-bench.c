@@ -0,0 +1,232 @@
+/*
+ * memcg-reclaim-bench.c - page cache reclaim in many memory cgroups at once
+ *
+ * Creates a number of memory cgroups under the v1 memory controller, each
+ * with a limit well below the size of a file that one reader process in
+ * it keeps reading through.  Every read past the limit makes the reader
+ * reclaim the page cache it charged earlier, so all groups keep isolating
+ * pages from, and adding pages to, their LRU lists at the same time.  With
+ * one LRU lock per zone they all contend on it; with one per memcg lruvec
+ * they should not.
+ *
+ * Reports the aggregate read bandwidth, which is mostly bounded by the
+ * cost of reclaim.  Needs root and the memory controller mounted at
+ * /sys/fs/cgroup/memory; the files are created in the given directory,
+ * which should not be on tmpfs.
+ *
+ * Usage: memcg-reclaim-bench [-g groups] [-l limit MB] [-f file MB]
+ *                            [-s seconds] [directory]
+ */
+#define _GNU_SOURCE
+
+#include <err.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#define MEMCG_ROOT	"/sys/fs/cgroup/memory"
+#define CHUNK		(1 << 20)
+
+static int nr_groups = 8, limit_mb = 32, file_mb = 128, seconds = 10;
+static const char *dir = ".";
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void write_file(const char *path, const char *val)
+{
+	int fd = open(path, O_WRONLY);
+
+	if (fd < 0)
+		err(1, "%s", path);
+	if (write(fd, val, strlen(val)) != strlen(val))
+		err(1, "%s", path);
+	close(fd);
+}
+
+static void group_path(char *buf, int group, const char *file)
+{
+	snprintf(buf, PATH_MAX, MEMCG_ROOT "/memcg-reclaim-bench.%d/%s",
+		 group, file);
+}
+
+static void data_path(char *buf, int group)
+{
+	snprintf(buf, PATH_MAX, "%s/memcg-reclaim-bench.%d", dir, group);
+}
+
+static void create_file(int group)
+{
+	char path[PATH_MAX], *buf;
+	int fd, i;
+
+	data_path(path, group);
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0)
+		err(1, "%s", path);
+	buf = malloc(CHUNK);
+	if (!buf)
+		err(1, "malloc");
+	memset(buf, group + 1, CHUNK);
+	for (i = 0; i < file_mb; i++)
+		if (write(fd, buf, CHUNK) != CHUNK)
+			err(1, "%s", path);
+	fsync(fd);
+	close(fd);
+	free(buf);
+}
+
+/*
+ * Runs in its own group, and reports the number of MB read through a pipe
+ * when told to stop.
+ */
+static void reader(int group, int out)
+{
+	char path[PATH_MAX], *buf;
+	unsigned long long mb = 0;
+	off_t off = 0;
+	sigset_t set;
+	int fd, sig;
+
+	data_path(path, group);
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		err(1, "%s", path);
+	buf = malloc(CHUNK);
+	if (!buf)
+		err(1, "malloc");
+
+	sigemptyset(&set);
+	sigaddset(&set, SIGUSR1);
+
+	for (;;) {
+		struct timespec zero = { 0, 0 };
+
+		if (pread(fd, buf, CHUNK, off) != CHUNK)
+			err(1, "pread");
+		mb++;
+		off += CHUNK;
+		if (off >= (off_t)file_mb * CHUNK)
+			off = 0;
+		sig = sigtimedwait(&set, NULL, &zero);
+		if (sig == SIGUSR1)
+			break;
+	}
+	if (write(out, &mb, sizeof(mb)) != sizeof(mb))
+		err(1, "write");
+	exit(0);
+}
+
+int main(int argc, char **argv)
+{
+	char path[PATH_MAX], val[32];
+	unsigned long long mb, total = 0;
+	int c, i, fds[2];
+	struct stat st;
+	sigset_t set;
+	double start, elapsed;
+	pid_t *pids;
+
+	while ((c = getopt(argc, argv, "g:l:f:s:")) != -1) {
+		switch (c) {
+		case 'g':
+			nr_groups = atoi(optarg);
+			break;
+		case 'l':
+			limit_mb = atoi(optarg);
+			break;
+		case 'f':
+			file_mb = atoi(optarg);
+			break;
+		case 's':
+			seconds = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr,
+				"Usage: %s [-g groups] [-l limit MB] [-f file MB] [-s seconds] [directory]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+	if (optind < argc)
+		dir = argv[optind];
+	if (nr_groups < 1 || limit_mb < 1 || file_mb <= limit_mb)
+		errx(1, "need a group and files larger than the limit");
+
+	if (geteuid() || stat(MEMCG_ROOT "/memory.limit_in_bytes", &st)) {
+		printf("memcg-reclaim-bench: needs root and " MEMCG_ROOT
+		       ", skipping\n");
+		return 0;
+	}
+
+	pids = calloc(nr_groups, sizeof(*pids));
+	if (!pids || pipe(fds))
+		err(1, "setup");
+
+	for (i = 0; i < nr_groups; i++) {
+		create_file(i);
+		group_path(path, i, "");
+		if (mkdir(path, 0755))
+			err(1, "%s", path);
+		group_path(path, i, "memory.limit_in_bytes");
+		snprintf(val, sizeof(val), "%lld", (long long)limit_mb << 20);
+		write_file(path, val);
+	}
+	/* Start with none of the files cached. */
+	sync();
+	write_file("/proc/sys/vm/drop_caches", "1");
+
+	/* Blocked until the readers wait for it. */
+	sigemptyset(&set);
+	sigaddset(&set, SIGUSR1);
+	sigprocmask(SIG_BLOCK, &set, NULL);
+
+	start = now();
+	for (i = 0; i < nr_groups; i++) {
+		pids[i] = fork();
+		if (pids[i] < 0)
+			err(1, "fork");
+		if (!pids[i]) {
+			group_path(path, i, "tasks");
+			write_file(path, "0");
+			reader(i, fds[1]);
+		}
+	}
+
+	sleep(seconds);
+	for (i = 0; i < nr_groups; i++)
+		kill(pids[i], SIGUSR1);
+	for (i = 0; i < nr_groups; i++) {
+		if (read(fds[0], &mb, sizeof(mb)) != sizeof(mb))
+			err(1, "read");
+		total += mb;
+	}
+	elapsed = now() - start;
+	for (i = 0; i < nr_groups; i++)
+		waitpid(pids[i], NULL, 0);
+
+	printf("%d groups, %d MB limit, %d MB files: %10.1f MB/s, %8.1f MB/s/group\n",
+	       nr_groups, limit_mb, file_mb, total / elapsed,
+	       total / elapsed / nr_groups);
+
+	for (i = 0; i < nr_groups; i++) {
+		group_path(path, i, "");
+		if (rmdir(path))
+			warn("%s", path);
+		data_path(path, i);
+		unlink(path);
+	}
+	return 0;
+}
@@ -0,0 +1,151 @@
+/*
+ * mprotect-scale.c - mprotect/madvise/fault scalability across threads
+ *
+ * Each thread owns an arena of its own, kept in a vma of its own by
+ * PROT_NONE guard areas in between, and loops the way a memory allocator
+ * recycling it would: fault its pages in, write protect it, make it
+ * writable again and throw the pages away with MADV_DONTNEED.
+ *
+ * With mprotect() taking mmap_sem for writing, threads working on
+ * unrelated arenas serialize against each other; with whole vmas only
+ * range locked they should scale with the number of threads.
+ *
+ * Runs with 1, 2, 4, ... up to the given number of threads and reports
+ * the loops and faults per second for each.
+ *
+ * Usage: mprotect-scale [-t max threads] [-s seconds] [-p pages per arena]
+ */
+#define _GNU_SOURCE
+
+#include <err.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+
+static int max_threads, seconds = 2, arena_pages = 64;
+static long page_size;
+static char *arenas;
+static volatile int stop;
+
+struct worker {
+	pthread_t thread;
+	char *arena;
+	unsigned long long loops;
+};
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void *worker_fn(void *arg)
+{
+	struct worker *w = arg;
+	size_t size = (size_t)arena_pages * page_size;
+	int i;
+
+	while (!stop) {
+		for (i = 0; i < arena_pages; i++)
+			w->arena[(size_t)i * page_size] = 1;
+		if (mprotect(w->arena, size, PROT_READ))
+			err(1, "mprotect");
+		if (mprotect(w->arena, size, PROT_READ | PROT_WRITE))
+			err(1, "mprotect");
+		if (madvise(w->arena, size, MADV_DONTNEED))
+			err(1, "madvise");
+		w->loops++;
+	}
+	return NULL;
+}
+
+static void run(int nr_threads)
+{
+	struct worker *workers = calloc(nr_threads, sizeof(*workers));
+	unsigned long long loops = 0;
+	double start, elapsed;
+	int i;
+
+	if (!workers)
+		err(1, "calloc");
+
+	stop = 0;
+	start = now();
+	for (i = 0; i < nr_threads; i++) {
+		/* Every other arena-sized slot is a guard. */
+		workers[i].arena = arenas +
+			(size_t)2 * i * arena_pages * page_size;
+		if (pthread_create(&workers[i].thread, NULL, worker_fn,
+				   &workers[i]))
+			errx(1, "pthread_create");
+	}
+	sleep(seconds);
+	stop = 1;
+	for (i = 0; i < nr_threads; i++) {
+		pthread_join(workers[i].thread, NULL);
+		loops += workers[i].loops;
+	}
+	elapsed = now() - start;
+
+	printf("%3d threads: %10.0f loops/sec %12.0f faults/sec %10.0f loops/sec/thread\n",
+	       nr_threads, loops / elapsed, loops * arena_pages / elapsed,
+	       loops / elapsed / nr_threads);
+	free(workers);
+}
+
+int main(int argc, char **argv)
+{
+	size_t size;
+	int c, i, n;
+
+	max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	while ((c = getopt(argc, argv, "t:s:p:")) != -1) {
+		switch (c) {
+		case 't':
+			max_threads = atoi(optarg);
+			break;
+		case 's':
+			seconds = atoi(optarg);
+			break;
+		case 'p':
+			arena_pages = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr,
+				"Usage: %s [-t max threads] [-s seconds] [-p pages per arena]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+	if (max_threads < 1 || arena_pages < 1)
+		errx(1, "need at least one thread and one page per arena");
+
+	page_size = sysconf(_SC_PAGESIZE);
+	size = (size_t)2 * max_threads * arena_pages * page_size;
+	arenas = mmap(NULL, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS,
+		      -1, 0);
+	if (arenas == MAP_FAILED)
+		err(1, "mmap");
+	for (i = 0; i < max_threads; i++) {
+		char *arena = arenas + (size_t)2 * i * arena_pages * page_size;
+
+		if (mprotect(arena, (size_t)arena_pages * page_size,
+			     PROT_READ | PROT_WRITE))
+			err(1, "mprotect");
+		/* Huge pages would hide the faults. */
+		madvise(arena, (size_t)arena_pages * page_size,
+			MADV_NOHUGEPAGE);
+	}
+
+	for (n = 1; n < max_threads; n *= 2)
+		run(n);
+	run(max_threads);
+
+	munmap(arenas, size);
+	return 0;
+}
@@ -0,0 +1,224 @@
+/*
+ * swapout-scale.c - swap-out throughput against the number of reclaimers
+ *
+ * Creates a memory cgroup under the v1 memory controller for each of a
+ * number of processes, with a limit well below the anonymous memory the
+ * process keeps writing to.  Every fault past the limit makes the process
+ * reclaim and swap out its own pages, so all of them allocate and free
+ * swap slots at the same time, on as many CPUs.  With every slot taken
+ * under the lock of the swap area they contend on it; with slots handed
+ * out from per cpu caches they should not.
+ *
+ * Runs with 1, 2, 4, ... up to the given number of processes, and reports
+ * the pages swapped out per second according to pswpout in /proc/vmstat.
+ * Needs root, the memory controller mounted at /sys/fs/cgroup/memory, and
+ * enough swap space for the processes, preferably on a fast device.
+ *
+ * Usage: swapout-scale [-p max processes] [-l limit MB] [-m MB per process]
+ *                      [-s seconds]
+ */
+#define _GNU_SOURCE
+
+#include <err.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#define MEMCG_ROOT	"/sys/fs/cgroup/memory"
+
+static int max_procs, limit_mb = 32, proc_mb = 128, seconds = 5;
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static long long vmstat(const char *item)
+{
+	char name[64];
+	long long val;
+	FILE *f;
+
+	f = fopen("/proc/vmstat", "r");
+	if (!f)
+		err(1, "/proc/vmstat");
+	while (fscanf(f, "%63s %lld", name, &val) == 2) {
+		if (!strcmp(name, item)) {
+			fclose(f);
+			return val;
+		}
+	}
+	fclose(f);
+	errx(1, "no %s in /proc/vmstat", item);
+}
+
+/* Free swap space in MB, from /proc/meminfo */
+static long swap_free_mb(void)
+{
+	char line[256];
+	long kb = 0;
+	FILE *f;
+
+	f = fopen("/proc/meminfo", "r");
+	if (!f)
+		err(1, "/proc/meminfo");
+	while (fgets(line, sizeof(line), f))
+		if (sscanf(line, "SwapFree: %ld kB", &kb) == 1)
+			break;
+	fclose(f);
+	return kb >> 10;
+}
+
+static void write_file(const char *path, const char *val)
+{
+	int fd = open(path, O_WRONLY);
+
+	if (fd < 0)
+		err(1, "%s", path);
+	if (write(fd, val, strlen(val)) != strlen(val))
+		err(1, "%s", path);
+	close(fd);
+}
+
+static void group_path(char *buf, int group, const char *file)
+{
+	snprintf(buf, PATH_MAX, MEMCG_ROOT "/swapout-scale.%d/%s",
+		 group, file);
+}
+
+/* Runs in its own group, writing to all of its memory until killed. */
+static void writer(int group)
+{
+	size_t size = (size_t)proc_mb << 20, off;
+	long page_size = sysconf(_SC_PAGESIZE);
+	char path[PATH_MAX];
+	unsigned long pass;
+	char *map;
+
+	group_path(path, group, "tasks");
+	write_file(path, "0");
+
+	map = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (map == MAP_FAILED)
+		err(1, "mmap");
+	/* Huge pages would be split for swap-out anyway. */
+	madvise(map, size, MADV_NOHUGEPAGE);
+
+	for (pass = 1; ; pass++)
+		for (off = 0; off < size; off += page_size)
+			*(unsigned long *)(map + off) = pass;
+}
+
+static void run(int nr_procs)
+{
+	pid_t *pids = calloc(nr_procs, sizeof(*pids));
+	long long pswpout;
+	double start, elapsed;
+	int i;
+
+	if (!pids)
+		err(1, "calloc");
+
+	for (i = 0; i < nr_procs; i++) {
+		pids[i] = fork();
+		if (pids[i] < 0)
+			err(1, "fork");
+		if (!pids[i])
+			writer(i);
+	}
+
+	/* Give the groups a second to fill up to their limits. */
+	sleep(1);
+	pswpout = vmstat("pswpout");
+	start = now();
+	sleep(seconds);
+	pswpout = vmstat("pswpout") - pswpout;
+	elapsed = now() - start;
+
+	for (i = 0; i < nr_procs; i++)
+		kill(pids[i], SIGKILL);
+	for (i = 0; i < nr_procs; i++)
+		waitpid(pids[i], NULL, 0);
+
+	printf("%3d processes: %10.0f pages/sec %8.1f MB/s %10.0f pages/sec/process\n",
+	       nr_procs, pswpout / elapsed,
+	       pswpout * sysconf(_SC_PAGESIZE) / elapsed / (1 << 20),
+	       pswpout / elapsed / nr_procs);
+	free(pids);
+}
+
+int main(int argc, char **argv)
+{
+	char path[PATH_MAX], val[32];
+	struct stat st;
+	int c, i, n;
+
+	max_procs = sysconf(_SC_NPROCESSORS_ONLN);
+	while ((c = getopt(argc, argv, "p:l:m:s:")) != -1) {
+		switch (c) {
+		case 'p':
+			max_procs = atoi(optarg);
+			break;
+		case 'l':
+			limit_mb = atoi(optarg);
+			break;
+		case 'm':
+			proc_mb = atoi(optarg);
+			break;
+		case 's':
+			seconds = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr,
+				"Usage: %s [-p max processes] [-l limit MB] [-m MB per process] [-s seconds]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+	if (max_procs < 1 || limit_mb < 1 || proc_mb <= limit_mb ||
+	    seconds < 1)
+		errx(1, "need a process with more memory than its limit");
+
+	if (geteuid() || stat(MEMCG_ROOT "/memory.limit_in_bytes", &st)) {
+		printf("swapout-scale: needs root and " MEMCG_ROOT
+		       ", skipping\n");
+		return 0;
+	}
+	if (swap_free_mb() < (long)max_procs * (proc_mb - limit_mb)) {
+		printf("swapout-scale: needs %d MB of free swap, skipping\n",
+		       max_procs * (proc_mb - limit_mb));
+		return 0;
+	}
+
+	for (i = 0; i < max_procs; i++) {
+		group_path(path, i, "");
+		if (mkdir(path, 0755))
+			err(1, "%s", path);
+		group_path(path, i, "memory.limit_in_bytes");
+		snprintf(val, sizeof(val), "%lld", (long long)limit_mb << 20);
+		write_file(path, val);
+	}
+
+	for (n = 1; n < max_procs; n *= 2)
+		run(n);
+	run(max_procs);
+
+	for (i = 0; i < max_procs; i++) {
+		group_path(path, i, "");
+		if (rmdir(path))
+			warn("%s", path);
+	}
+	return 0;
+}
@@ -0,0 +1,162 @@
+/*
+ * thp-collapse.c - collapse requests to khugepaged
+ *
+ * Faults in a range with small pages only, then asks khugepaged to collapse
+ * it with MADV_COLLAPSE, and waits for AnonHugePages in /proc/self/smaps to
+ * cover it.  Does the same for the whole process with PR_THP_COLLAPSE, and
+ * reports how long each took and what /proc/self/status says about it.
+ *
+ * Needs transparent hugepages enabled, "always" or "madvise".
+ *
+ * Usage: thp-collapse [-n huge pages] [-t timeout seconds]
+ */
+#define _GNU_SOURCE
+
+#include <err.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/time.h>
+
+#ifndef MADV_COLLAPSE
+#define MADV_COLLAPSE	25
+#endif
+#ifndef PR_THP_COLLAPSE
+#define PR_THP_COLLAPSE	79
+#endif
+
+#define HPAGE_SIZE	(2UL << 20)
+
+static int nr_hpages = 8, timeout = 10;
+static long page_size;
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/* AnonHugePages of the vma at addr, in kB */
+static unsigned long anon_huge_kb(char *addr)
+{
+	unsigned long start, end, kb = 0;
+	char line[256];
+	int found = 0;
+	FILE *f;
+
+	f = fopen("/proc/self/smaps", "r");
+	if (!f)
+		err(1, "/proc/self/smaps");
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "%lx-%lx ", &start, &end) == 2) {
+			found = start <= (unsigned long)addr &&
+				(unsigned long)addr < end;
+			continue;
+		}
+		if (found && sscanf(line, "AnonHugePages: %lu kB", &kb) == 1)
+			break;
+	}
+	fclose(f);
+	return kb;
+}
+
+static void show_status(void)
+{
+	char line[256];
+	FILE *f;
+
+	f = fopen("/proc/self/status", "r");
+	if (!f)
+		err(1, "/proc/self/status");
+	while (fgets(line, sizeof(line), f))
+		if (!strncmp(line, "THP_", 4))
+			printf("  %s", line);
+	fclose(f);
+}
+
+/* Map and fault in the range with small pages, huge page aligned. */
+static char *small_pages(void)
+{
+	size_t size = nr_hpages * HPAGE_SIZE;
+	char *map, *addr;
+	size_t i;
+
+	map = mmap(NULL, size + HPAGE_SIZE, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (map == MAP_FAILED)
+		err(1, "mmap");
+	addr = (char *)(((unsigned long)map + HPAGE_SIZE - 1) &
+			~(HPAGE_SIZE - 1));
+
+	if (madvise(addr, size, MADV_NOHUGEPAGE))
+		err(1, "MADV_NOHUGEPAGE");
+	for (i = 0; i < size; i += page_size)
+		addr[i] = 1;
+	if (madvise(addr, size, MADV_HUGEPAGE))
+		err(1, "MADV_HUGEPAGE");
+	return addr;
+}
+
+static int wait_collapsed(const char *what, char *addr)
+{
+	unsigned long want = nr_hpages * (HPAGE_SIZE >> 10), kb;
+	double start = now();
+
+	while ((kb = anon_huge_kb(addr)) < want && now() - start < timeout)
+		usleep(10000);
+
+	printf("%s: %lu of %lu kB collapsed in %.3f s\n", what, kb, want,
+	       now() - start);
+	show_status();
+	return kb < want;
+}
+
+int main(int argc, char **argv)
+{
+	int c, ret = 0;
+	char *addr;
+
+	while ((c = getopt(argc, argv, "n:t:")) != -1) {
+		switch (c) {
+		case 'n':
+			nr_hpages = atoi(optarg);
+			break;
+		case 't':
+			timeout = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr,
+				"Usage: %s [-n huge pages] [-t timeout seconds]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+	if (nr_hpages < 1)
+		errx(1, "need at least one huge page");
+	page_size = sysconf(_SC_PAGESIZE);
+
+	addr = small_pages();
+	if (anon_huge_kb(addr))
+		errx(1, "range already has huge pages");
+	if (madvise(addr, nr_hpages * HPAGE_SIZE, MADV_COLLAPSE)) {
+		if (errno == EINVAL) {
+			printf("thp-collapse: no MADV_COLLAPSE or THP disabled, skipping\n");
+			return 0;
+		}
+		err(1, "MADV_COLLAPSE");
+	}
+	ret |= wait_collapsed("MADV_COLLAPSE", addr);
+
+	addr = small_pages();
+	if (prctl(PR_THP_COLLAPSE, 0, 0, 0, 0))
+		err(1, "PR_THP_COLLAPSE");
+	ret |= wait_collapsed("PR_THP_COLLAPSE", addr);
+
+	return ret;
+}
@@ -0,0 +1,265 @@
+/*
+ * zram-bench.c - zram throughput and compression ratio
+ *
+ * For each compression algorithm and for 1, 2, 4, ... up to the given
+ * number of threads, adds a zram device with zram-control, and has every
+ * thread write its own part of it with O_DIRECT, so that all of them
+ * compress pages at the same time, on as many CPUs, and then read it back.
+ * The data is made of words picked at random from a small dictionary,
+ * which compresses a few times over with any of the algorithms.
+ *
+ * Reports the MB/s written and read, and the compression ratio according
+ * to mm_stat of the device.  Algorithms the kernel does not offer in
+ * comp_algorithm are skipped.  Needs root and the zram module loaded.
+ *
+ * Usage: zram-bench [-a algorithm,...] [-t max threads] [-m MB per thread]
+ */
+#define _GNU_SOURCE
+
+#include <err.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#define ZRAM_CONTROL	"/sys/class/zram-control"
+#define CHUNK		(256 << 10)
+
+static int max_threads, thread_mb = 64;
+static char default_algorithms[] = "lzo,lz4,deflate";
+static char *algorithms = default_algorithms;
+static char available[256];
+static char *data;
+static char dev_path[PATH_MAX];
+static int writing;
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void write_file(const char *path, const char *val)
+{
+	int fd = open(path, O_WRONLY);
+
+	if (fd < 0)
+		err(1, "%s", path);
+	if (write(fd, val, strlen(val)) != strlen(val))
+		err(1, "%s: %s", path, val);
+	close(fd);
+}
+
+static void read_file(const char *path, char *buf, size_t size)
+{
+	int fd = open(path, O_RDONLY);
+	ssize_t len;
+
+	if (fd < 0)
+		err(1, "%s", path);
+	len = read(fd, buf, size - 1);
+	if (len < 0)
+		err(1, "%s", path);
+	buf[len] = '\0';
+	close(fd);
+}
+
+static void zram_attr(char *buf, int id, const char *attr)
+{
+	snprintf(buf, PATH_MAX, "/sys/block/zram%d/%s", id, attr);
+}
+
+/* Words picked at random, so that pages are neither empty nor random. */
+static void fill_data(void)
+{
+	static const char * const words[] = {
+		"page ", "swap ", "memory ", "compress ", "stream ", "cpu ",
+		"zram ", "block ", "device ", "the ", "of ", "a ", "and ",
+		"0x7f3a9c ", "0000 ", "ffff ", "\n", "\t", "= ", "; ",
+	};
+	unsigned long long x = 88172645463325252ULL;
+	size_t size = (size_t)thread_mb << 20, off = 0;
+
+	data = aligned_alloc(4096, size);
+	if (!data)
+		err(1, "aligned_alloc");
+	while (off < size) {
+		const char *w;
+		size_t len;
+
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+		w = words[x % (sizeof(words) / sizeof(words[0]))];
+		len = strlen(w);
+		if (len > size - off)
+			len = size - off;
+		memcpy(data + off, w, len);
+		off += len;
+	}
+}
+
+/* Writes or reads back the part of the device that belongs to it. */
+static void *worker(void *arg)
+{
+	off_t base = (off_t)(long)arg * ((off_t)thread_mb << 20);
+	size_t size = (size_t)thread_mb << 20, off;
+	char *buf = NULL;
+	int fd;
+
+	fd = open(dev_path, O_RDWR | O_DIRECT);
+	if (fd < 0)
+		err(1, "%s", dev_path);
+	if (!writing && posix_memalign((void **)&buf, 4096, CHUNK))
+		errx(1, "posix_memalign");
+
+	for (off = 0; off < size; off += CHUNK) {
+		ssize_t ret;
+
+		if (writing)
+			ret = pwrite(fd, data + off, CHUNK, base + off);
+		else
+			ret = pread(fd, buf, CHUNK, base + off);
+		if (ret != CHUNK)
+			err(1, "%s", dev_path);
+	}
+
+	free(buf);
+	close(fd);
+	return NULL;
+}
+
+static double run_threads(int nr_threads)
+{
+	pthread_t *threads = calloc(nr_threads, sizeof(*threads));
+	double start;
+	long i;
+
+	if (!threads)
+		err(1, "calloc");
+
+	start = now();
+	for (i = 0; i < nr_threads; i++)
+		if (pthread_create(&threads[i], NULL, worker, (void *)i))
+			errx(1, "pthread_create");
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(threads[i], NULL);
+
+	free(threads);
+	return now() - start;
+}
+
+static void run(const char *algorithm, int nr_threads)
+{
+	unsigned long long orig, compr;
+	double mb = (double)nr_threads * thread_mb, wtime, rtime;
+	char path[PATH_MAX], val[256];
+	int id;
+
+	read_file(ZRAM_CONTROL "/hot_add", val, sizeof(val));
+	id = atoi(val);
+	snprintf(dev_path, sizeof(dev_path), "/dev/zram%d", id);
+
+	zram_attr(path, id, "comp_algorithm");
+	write_file(path, algorithm);
+	zram_attr(path, id, "disksize");
+	snprintf(val, sizeof(val), "%lldM", (long long)nr_threads * thread_mb);
+	write_file(path, val);
+
+	writing = 1;
+	wtime = run_threads(nr_threads);
+	writing = 0;
+	rtime = run_threads(nr_threads);
+
+	zram_attr(path, id, "mm_stat");
+	read_file(path, val, sizeof(val));
+	if (sscanf(val, "%llu %llu", &orig, &compr) != 2)
+		errx(1, "%s: %s", path, val);
+
+	printf("%-8s %3d threads: write %8.1f MB/s, read %8.1f MB/s, ratio %5.2f\n",
+	       algorithm, nr_threads, mb / wtime, mb / rtime,
+	       compr ? (double)orig / compr : 0);
+
+	zram_attr(path, id, "reset");
+	write_file(path, "1");
+	snprintf(val, sizeof(val), "%d", id);
+	write_file(ZRAM_CONTROL "/hot_remove", val);
+}
+
+/* Is the algorithm one of those listed in comp_algorithm? */
+static int algorithm_available(const char *algorithm)
+{
+	char *tok, *save, list[sizeof(available)];
+
+	strcpy(list, available);
+	for (tok = strtok_r(list, " []\n", &save); tok;
+	     tok = strtok_r(NULL, " []\n", &save))
+		if (!strcmp(tok, algorithm))
+			return 1;
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	char path[PATH_MAX], val[32], *algorithm, *save;
+	struct stat st;
+	int c, n, id;
+
+	max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	while ((c = getopt(argc, argv, "a:t:m:")) != -1) {
+		switch (c) {
+		case 'a':
+			algorithms = optarg;
+			break;
+		case 't':
+			max_threads = atoi(optarg);
+			break;
+		case 'm':
+			thread_mb = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr,
+				"Usage: %s [-a algorithm,...] [-t max threads] [-m MB per thread]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+	if (max_threads < 1 || thread_mb < 1)
+		errx(1, "need at least one thread and one MB");
+
+	if (geteuid() || stat(ZRAM_CONTROL "/hot_add", &st)) {
+		printf("zram-bench: needs root and " ZRAM_CONTROL ", skipping\n");
+		return 0;
+	}
+
+	/* Find out what the kernel offers from a device of our own. */
+	read_file(ZRAM_CONTROL "/hot_add", val, sizeof(val));
+	id = atoi(val);
+	zram_attr(path, id, "comp_algorithm");
+	read_file(path, available, sizeof(available));
+	snprintf(val, sizeof(val), "%d", id);
+	write_file(ZRAM_CONTROL "/hot_remove", val);
+
+	fill_data();
+
+	for (algorithm = strtok_r(algorithms, ",", &save); algorithm;
+	     algorithm = strtok_r(NULL, ",", &save)) {
+		if (!algorithm_available(algorithm)) {
+			printf("%-8s not available, skipping\n", algorithm);
+			continue;
+		}
+		for (n = 1; n < max_threads; n *= 2)
+			run(algorithm, n);
+		run(algorithm, max_threads);
+	}
+
+	free(data);
+	return 0;
+}